@@ -0,0 +1,314 @@
+#include "animation.h"
+#include "compact_octree.h"
+#include "bvh.h"
+#include "scene.h"
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+
+bool sortByFrame(const keyframe &a, const keyframe &b)
+{
+	return a.frame < b.frame;
+}
+
+void registerAnimatedObject(json &object, int first_shape, int first_plane)
+{
+	animated_object * newObject = new animated_object;
+	newObject->type = object["type"];
+
+	json &keyframes = object["keyframes"];
+
+	for (json::iterator it = keyframes.begin(); it != keyframes.end(); ++it)
+	{
+		json &key = *it;
+		keyframe newKey;
+
+		newKey.frame = key["frame"];
+		newKey.rotation = 0;
+		newKey.axisOfrotation = 2;
+		newKey.scale = glm::vec3(1, 1, 1);
+		newKey.translation = glm::vec3(0, 0, 0);
+
+		if (key.find("rotation") != key.end())
+		{
+			newKey.rotation = key["rotation"];
+		}
+		if (key.find("axisOfrotation") != key.end())
+		{
+			newKey.axisOfrotation = key["axisOfrotation"];
+		}
+		if (key.find("scale") != key.end())
+		{
+			std::vector<float> scale = key["scale"];
+			newKey.scale = glm::vec3(scale.at(0), scale.at(1), scale.at(2));
+		}
+		if (key.find("translation") != key.end())
+		{
+			std::vector<float> translation = key["translation"];
+			newKey.translation = glm::vec3(translation.at(0), translation.at(1), translation.at(2));
+		}
+		newObject->keyframes.push_back(newKey);
+	}
+	std::sort(newObject->keyframes.begin(), newObject->keyframes.end(), sortByFrame);
+
+	if (newObject->keyframes.size() == 0)
+	{
+		delete newObject;
+		return;
+	}
+
+	glm::vec3 sum(0, 0, 0);
+	int number = 0;
+
+	for (int i = first_shape; i < current_scene->listOfShapes.size(); i++)
+	{
+		shape * s = current_scene->listOfShapes.at(i);
+		newObject->shapes.push_back(s);
+
+		if (s->type == "triangle")
+		{
+			newObject->base_vertices.push_back(s->vertex0);
+			newObject->base_vertices.push_back(s->vertex1);
+			newObject->base_vertices.push_back(s->vertex2);
+			sum += glm::vec3(s->vertex0) + glm::vec3(s->vertex1) + glm::vec3(s->vertex2);
+			number += 3;
+		}
+		else if (s->type == "sphere")
+		{
+			newObject->base_positions.push_back(s->position);
+			newObject->base_radius.push_back(s->radius);
+			sum += s->position;
+			number += 1;
+		}
+		else // csg
+		{
+			newObject->base_positions.push_back(s->sub_shape1->position);
+			newObject->base_positions.push_back(s->sub_shape2->position);
+			newObject->base_radius.push_back(s->sub_shape1->radius);
+			newObject->base_radius.push_back(s->sub_shape2->radius);
+			sum += s->sub_shape1->position + s->sub_shape2->position;
+			number += 2;
+		}
+	}
+
+	for (int i = first_plane; i < current_scene->listOfPlanes.size(); i++)
+	{
+		shape * p = current_scene->listOfPlanes.at(i);
+		newObject->planes.push_back(p);
+		newObject->base_plane_positions.push_back(p->position);
+		newObject->base_plane_normals.push_back(p->normal);
+		sum += p->position;
+		number += 1;
+	}
+
+	// objects are rotated and scaled about their bary center, like the static "transformation"
+	newObject->pivot = number > 0 ? sum / (float)number : glm::vec3(0, 0, 0);
+
+	current_scene->listOfAnimatedObjects.push_back(newObject);
+}
+
+bool isAnimated()
+{
+	return current_scene->listOfAnimatedObjects.size() != 0;
+}
+
+void getFrameRange(int &first, int &last)
+{
+	first = 0;
+	last = 0;
+
+	for (int i = 0; i < current_scene->listOfAnimatedObjects.size(); i++)
+	{
+		std::vector<keyframe> &keys = current_scene->listOfAnimatedObjects.at(i)->keyframes;
+
+		if (i == 0 || keys.front().frame < first)
+		{
+			first = (int)keys.front().frame;
+		}
+		if (i == 0 || keys.back().frame > last)
+		{
+			last = (int)glm::ceil(keys.back().frame);
+		}
+	}
+}
+
+keyframe interpolate(const std::vector<keyframe> &keys, float frame)
+{
+	if (frame <= keys.front().frame)
+	{
+		return keys.front();
+	}
+	if (frame >= keys.back().frame)
+	{
+		return keys.back();
+	}
+
+	int i = 0;
+	while (keys.at(i + 1).frame < frame)
+	{
+		i++;
+	}
+
+	const keyframe &k0 = keys.at(i);
+	const keyframe &k1 = keys.at(i + 1);
+	float t = (frame - k0.frame) / (k1.frame - k0.frame);
+
+	keyframe result = k0;
+	result.frame = frame;
+	result.rotation = k0.rotation + (k1.rotation - k0.rotation) * t;
+	result.scale = k0.scale + (k1.scale - k0.scale) * t;
+	result.translation = k0.translation + (k1.translation - k0.translation) * t;
+	return result;
+}
+
+void setBounding(shape * s, float left, float right, float down, float up, float back, float front)
+{
+	s->bounding.clear();
+	s->bounding.push_back(left);
+	s->bounding.push_back(right);
+	s->bounding.push_back(down);
+	s->bounding.push_back(up);
+	s->bounding.push_back(back);
+	s->bounding.push_back(front);
+}
+
+void applyKeyframe(animated_object * object, const keyframe &key)
+{
+	glm::vec3 axis(0.0f, 0.0f, 0.0f);
+
+	if (key.axisOfrotation == 1)
+	{
+		axis.x = 1.0f;
+	}
+	else if (key.axisOfrotation == 2)
+	{
+		axis.y = 1.0f;
+	}
+	else
+	{
+		axis.z = 1.0f;
+	}
+
+	glm::mat4 model = glm::scale(glm::mat4(), key.scale) * glm::rotate(glm::mat4(), glm::radians(key.rotation), axis);
+	glm::vec4 pivot(object->pivot, 0.0f);
+	glm::vec4 translation(key.translation, 0.0f);
+
+	// spheres stay spheres, so they are scaled uniformly by the x component
+	float radius_scale = key.scale.x;
+
+	int vertex = 0;
+	int position = 0;
+
+	for (int i = 0; i < object->shapes.size(); i++)
+	{
+		shape * s = object->shapes.at(i);
+
+		if (s->type == "triangle")
+		{
+			s->vertex0 = model * (object->base_vertices.at(vertex) - pivot) + pivot + translation;
+			s->vertex1 = model * (object->base_vertices.at(vertex + 1) - pivot) + pivot + translation;
+			s->vertex2 = model * (object->base_vertices.at(vertex + 2) - pivot) + pivot + translation;
+			vertex += 3;
+
+			setBounding(s,
+				glm::min(glm::min(s->vertex0.x, s->vertex1.x), s->vertex2.x),
+				glm::max(glm::max(s->vertex0.x, s->vertex1.x), s->vertex2.x),
+				glm::min(glm::min(s->vertex0.y, s->vertex1.y), s->vertex2.y),
+				glm::max(glm::max(s->vertex0.y, s->vertex1.y), s->vertex2.y),
+				glm::min(glm::min(s->vertex0.z, s->vertex1.z), s->vertex2.z),
+				glm::max(glm::max(s->vertex0.z, s->vertex1.z), s->vertex2.z));
+		}
+		else if (s->type == "sphere")
+		{
+			s->position = glm::vec3(model * glm::vec4(object->base_positions.at(position) - object->pivot, 0.0f) + pivot + translation);
+			s->radius = object->base_radius.at(position) * radius_scale;
+			position += 1;
+
+			setBounding(s,
+				s->position.x - s->radius, s->position.x + s->radius,
+				s->position.y - s->radius, s->position.y + s->radius,
+				s->position.z - s->radius, s->position.z + s->radius);
+		}
+		else // csg
+		{
+			shape * sub_shape1 = s->sub_shape1;
+			shape * sub_shape2 = s->sub_shape2;
+
+			sub_shape1->position = glm::vec3(model * glm::vec4(object->base_positions.at(position) - object->pivot, 0.0f) + pivot + translation);
+			sub_shape2->position = glm::vec3(model * glm::vec4(object->base_positions.at(position + 1) - object->pivot, 0.0f) + pivot + translation);
+			sub_shape1->radius = object->base_radius.at(position) * radius_scale;
+			sub_shape2->radius = object->base_radius.at(position + 1) * radius_scale;
+			position += 2;
+
+			setBounding(s,
+				glm::min(sub_shape1->position.x - sub_shape1->radius, sub_shape2->position.x - sub_shape2->radius),
+				glm::max(sub_shape1->position.x + sub_shape1->radius, sub_shape2->position.x + sub_shape2->radius),
+				glm::min(sub_shape1->position.y - sub_shape1->radius, sub_shape2->position.y - sub_shape2->radius),
+				glm::max(sub_shape1->position.y + sub_shape1->radius, sub_shape2->position.y + sub_shape2->radius),
+				glm::min(sub_shape1->position.z - sub_shape1->radius, sub_shape2->position.z - sub_shape2->radius),
+				glm::max(sub_shape1->position.z + sub_shape1->radius, sub_shape2->position.z + sub_shape2->radius));
+		}
+	}
+
+	// planes are not in the octree, only their position and normal move
+	glm::mat3 normal_matrix = glm::transpose(glm::inverse(glm::mat3(model)));
+
+	for (int i = 0; i < object->planes.size(); i++)
+	{
+		shape * p = object->planes.at(i);
+		p->position = glm::vec3(model * glm::vec4(object->base_plane_positions.at(i) - object->pivot, 0.0f) + pivot + translation);
+		p->normal = normal_matrix * object->base_plane_normals.at(i);
+	}
+}
+
+void setAnimationFrame(float frame)
+{
+	for (int i = 0; i < current_scene->listOfAnimatedObjects.size(); i++)
+	{
+		animated_object * object = current_scene->listOfAnimatedObjects.at(i);
+		applyKeyframe(object, interpolate(object->keyframes, frame));
+	}
+
+	// the octree was built from the geometry as loaded, so the first frame always gets a fresh one
+	if (current_scene->cost_after_build < 0)
+	{
+		rebuildOcTree();
+		refitOcTree(current_scene->ocTree_root);
+		current_scene->cost_after_build = octreeCost(current_scene->ocTree_root);
+		buildCompactOctree();
+		buildBVH();
+		return;
+	}
+
+	// the shapes in every leaf are unchanged, so the boxes only have to follow them
+	updateAccelerationStructures();
+}
+
+void updateAccelerationStructures(bool shapes_changed)
+{
+	refitOcTree(current_scene->ocTree_root);
+	float cost = octreeCost(current_scene->ocTree_root);
+
+	if (cost > current_scene->rebuild_threshold * current_scene->cost_after_build)
+	{
+		std::cout << "Octree cost grew from " << current_scene->cost_after_build << " to " << cost << ", rebuilding." << std::endl;
+		rebuildOcTree();
+		refitOcTree(current_scene->ocTree_root);
+		current_scene->cost_after_build = octreeCost(current_scene->ocTree_root);
+	}
+	buildCompactOctree();
+
+	bvh_state &bvh = current_scene->bvh;
+	if (shapes_changed || !bvh.ready)
+	{
+		buildBVH();
+		return;
+	}
+
+	refitBVH();
+	float bvh_cost = bvhCost();
+	if (bvh_cost > current_scene->rebuild_threshold * bvh.cost_after_build)
+	{
+		std::cout << "BVH cost grew from " << bvh.cost_after_build << " to " << bvh_cost << ", rebuilding." << std::endl;
+		buildBVH();
+	}
+}
@@ -0,0 +1,43 @@
+#ifndef animation_h
+#define animation_h
+#include "raytracer.h"
+
+// one entry of an object's "keyframes" array in the scene file
+struct keyframe
+{
+	float frame;
+	float rotation;
+	int axisOfrotation;
+	glm::vec3 scale;
+	glm::vec3 translation;
+};
+
+// an object with keyframes, together with the geometry it had when it was loaded
+struct animated_object
+{
+	std::string type;
+	std::vector<keyframe> keyframes;
+	glm::vec3 pivot;
+
+	std::vector<shape *> shapes;
+	std::vector<glm::vec4> base_vertices; // three per triangle
+	std::vector<glm::vec3> base_positions; // one per sphere, two per csg object
+	std::vector<float> base_radius;
+
+	std::vector<shape *> planes;
+	std::vector<glm::vec3> base_plane_positions;
+	std::vector<glm::vec3> base_plane_normals;
+};
+
+void registerAnimatedObject(json &object, int first_shape, int first_plane);
+bool isAnimated();
+void getFrameRange(int &first, int &last);
+void setAnimationFrame(float frame);
+
+// The shapes have moved, or a few were put into or taken out of the leaves of the octree: its boxes
+// follow them and it is only built again once that has made it too slow. The flattened octree keeps
+// its boxes relative to their parents, so it is encoded again from the refitted one every time. The
+// BVH is refitted the same way while shapes only moved; when shapes_changed it is built again.
+void updateAccelerationStructures(bool shapes_changed = false);
+
+#endif
@@ -0,0 +1,389 @@
+#include "batch_shading.h"
+#include "statistics.h"
+#include "scene.h"
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SHADING_SSE
+#endif
+
+bool batched_shading = true;
+
+// Four lanes of floats: an SSE register, or without SSE2 an array the same operations loop over.
+// Masks are all ones in a lane that is set with SSE and 1.0f without.
+#ifdef SHADING_SSE
+typedef __m128 float4;
+
+inline float4 splat(float f) { return _mm_set1_ps(f); }
+inline float4 load4(const float *p) { return _mm_loadu_ps(p); }
+inline void store4(float *p, float4 a) { _mm_storeu_ps(p, a); }
+inline float4 add4(float4 a, float4 b) { return _mm_add_ps(a, b); }
+inline float4 sub4(float4 a, float4 b) { return _mm_sub_ps(a, b); }
+inline float4 mul4(float4 a, float4 b) { return _mm_mul_ps(a, b); }
+inline float4 div4(float4 a, float4 b) { return _mm_div_ps(a, b); }
+inline float4 sqrt4(float4 a) { return _mm_sqrt_ps(a); }
+inline float4 min4(float4 a, float4 b) { return _mm_min_ps(a, b); } // b where either is NaN
+inline float4 max4(float4 a, float4 b) { return _mm_max_ps(a, b); }
+inline float4 greater4(float4 a, float4 b) { return _mm_cmpgt_ps(a, b); }
+inline float4 greater_equal4(float4 a, float4 b) { return _mm_cmpge_ps(a, b); }
+inline float4 and4(float4 a, float4 b) { return _mm_and_ps(a, b); }
+inline float4 select4(float4 mask, float4 a, float4 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+
+// the nearest whole number, ties to even
+inline float4 round4(float4 a) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(a)); }
+
+// the exponent of positive normal floats, and their mantissa as a float in [1, 2)
+inline float4 exponent4(float4 a)
+{
+	return _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(a), 23), _mm_set1_epi32(127)));
+}
+
+inline float4 mantissa4(float4 a)
+{
+	return _mm_or_ps(_mm_and_ps(a, _mm_castsi128_ps(_mm_set1_epi32(0x007fffff))), _mm_set1_ps(1.0f));
+}
+
+// 2^n for whole n from -126 to 127
+inline float4 power_of_two4(float4 n)
+{
+	return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23));
+}
+#else
+struct float4
+{
+	float lane[4];
+};
+
+#define LANES(expression) float4 r; for (int i = 0; i < 4; i++) { r.lane[i] = expression; } return r;
+
+inline float4 splat(float f) { LANES(f) }
+inline float4 load4(const float *p) { LANES(p[i]) }
+inline void store4(float *p, float4 a) { memcpy(p, a.lane, sizeof(a.lane)); }
+inline float4 add4(float4 a, float4 b) { LANES(a.lane[i] + b.lane[i]) }
+inline float4 sub4(float4 a, float4 b) { LANES(a.lane[i] - b.lane[i]) }
+inline float4 mul4(float4 a, float4 b) { LANES(a.lane[i] * b.lane[i]) }
+inline float4 div4(float4 a, float4 b) { LANES(a.lane[i] / b.lane[i]) }
+inline float4 sqrt4(float4 a) { LANES(sqrtf(a.lane[i])) }
+inline float4 min4(float4 a, float4 b) { LANES(a.lane[i] < b.lane[i] ? a.lane[i] : b.lane[i]) }
+inline float4 max4(float4 a, float4 b) { LANES(a.lane[i] > b.lane[i] ? a.lane[i] : b.lane[i]) }
+inline float4 greater4(float4 a, float4 b) { LANES(a.lane[i] > b.lane[i] ? 1.0f : 0.0f) }
+inline float4 greater_equal4(float4 a, float4 b) { LANES(a.lane[i] >= b.lane[i] ? 1.0f : 0.0f) }
+inline float4 and4(float4 a, float4 b) { LANES(a.lane[i] != 0.0f && b.lane[i] != 0.0f ? 1.0f : 0.0f) }
+inline float4 select4(float4 mask, float4 a, float4 b) { LANES(mask.lane[i] != 0.0f ? a.lane[i] : b.lane[i]) }
+inline float4 round4(float4 a) { LANES(rintf(a.lane[i])) }
+
+inline int bits_of(float f)
+{
+	int i;
+	memcpy(&i, &f, sizeof(i));
+	return i;
+}
+
+inline float float_of(int i)
+{
+	float f;
+	memcpy(&f, &i, sizeof(f));
+	return f;
+}
+
+inline float4 exponent4(float4 a) { LANES((float)((bits_of(a.lane[i]) >> 23) - 127)) }
+inline float4 mantissa4(float4 a) { LANES(float_of((bits_of(a.lane[i]) & 0x007fffff) | 0x3f800000)) }
+inline float4 power_of_two4(float4 n) { LANES(float_of(((int)n.lane[i] + 127) << 23)) }
+
+#undef LANES
+#endif
+
+// log2 of positive normal floats. With the mantissa m in [sqrt(1/2), sqrt(2)) and t = (m - 1) / (m + 1),
+// log2(m) = 2 / ln(2) * (t + t^3 / 3 + t^5 / 5 + ...); |t| is at most 0.1716, so the terms from t^11 on
+// add less than 1e-9.
+inline float4 log2_4(float4 x)
+{
+	float4 exponent = exponent4(x);
+	float4 m = mantissa4(x);
+
+	float4 high = greater4(m, splat(1.41421356f));
+	m = select4(high, mul4(m, splat(0.5f)), m);
+	exponent = select4(high, add4(exponent, splat(1.0f)), exponent);
+
+	float4 t = div4(sub4(m, splat(1.0f)), add4(m, splat(1.0f)));
+	float4 t2 = mul4(t, t);
+	float4 series = add4(splat(0.57707802f), mul4(t2, add4(splat(0.41219858f), mul4(t2, splat(0.32059890f)))));
+	series = add4(splat(2.88539008f), mul4(t2, add4(splat(0.96179669f), mul4(t2, series))));
+	return add4(exponent, mul4(t, series));
+}
+
+// 2^y for y <= 127, flushed to 2^-126 below that. 2^f for the fraction f in [-1/2, 1/2] is the
+// Taylor series of e^(f ln 2) to f^6, which is off by less than 1.2e-7 of the result.
+inline float4 exp2_4(float4 y)
+{
+	y = min4(max4(y, splat(-126.0f)), splat(127.0f));
+	float4 n = round4(y);
+	float4 f = sub4(y, n);
+
+	float4 p = add4(splat(0.0096181291f), mul4(f, add4(splat(0.0013333558f), mul4(f, splat(0.00015403530f)))));
+	p = add4(splat(0.24022651f), mul4(f, add4(splat(0.055504109f), mul4(f, p))));
+	p = add4(splat(1.0f), mul4(f, add4(splat(0.69314718f), mul4(f, p))));
+	return mul4(p, power_of_two4(n));
+}
+
+// x^y for x in [0, 1] and y >= 0, as exp2(y * log2(x)). Measured against pow() in double for y up
+// to 1000, the absolute error is below 2e-7 and the relative error below 1.5e-5 where the result is
+// at least 1e-30; the relative error grows with -y * log2(x), as it comes from rounding that to a
+// float. x below 2^-126 counts as 0.
+inline float4 pow4(float4 x, float y)
+{
+	float4 result = exp2_4(mul4(splat(y), log2_4(max4(x, splat(FLT_MIN)))));
+	return select4(greater_equal4(x, splat(FLT_MIN)), result, splat(y == 0.0f ? 1.0f : 0.0f));
+}
+
+// four vectors, one per lane
+struct vec3x4
+{
+	float4 x, y, z;
+};
+
+inline vec3x4 vec3x4_of(float4 x, float4 y, float4 z)
+{
+	vec3x4 v = { x, y, z };
+	return v;
+}
+
+inline vec3x4 splat3(const glm::vec3 &v)
+{
+	return vec3x4_of(splat(v.x), splat(v.y), splat(v.z));
+}
+
+inline vec3x4 add3(const vec3x4 &a, const vec3x4 &b)
+{
+	return vec3x4_of(add4(a.x, b.x), add4(a.y, b.y), add4(a.z, b.z));
+}
+
+inline vec3x4 sub3(const vec3x4 &a, const vec3x4 &b)
+{
+	return vec3x4_of(sub4(a.x, b.x), sub4(a.y, b.y), sub4(a.z, b.z));
+}
+
+inline vec3x4 scale3(const vec3x4 &a, float4 s)
+{
+	return vec3x4_of(mul4(a.x, s), mul4(a.y, s), mul4(a.z, s));
+}
+
+inline float4 dot3(const vec3x4 &a, const vec3x4 &b)
+{
+	return add4(add4(mul4(a.x, b.x), mul4(a.y, b.y)), mul4(a.z, b.z));
+}
+
+// NaN for a zero vector, as glm::normalize gives
+inline vec3x4 normalize3(const vec3x4 &a)
+{
+	return scale3(a, div4(splat(1.0f), sqrt4(dot3(a, a))));
+}
+
+// what shade() keeps of four hits while it goes over the lights
+struct lanes_shading
+{
+	vec3x4 N, V;
+	vec3x4 u; // V projected into the tangent plane, for Oren-Nayar
+	float4 sin_r, cos_r; // of the angle between V and N
+	vec3x4 diffuse, specular; // the sums over the lights, before the material's colours
+};
+
+// The Oren-Nayar diffuse and Blinn-Phong specular of one light at four hits, as shadeLight() does.
+// lit masks the lanes the light reaches, L is the direction to it.
+template <bool ROUGH, bool SPECULAR>
+inline void shadeLanes(const Material &m, lanes_shading &lanes, const vec3x4 &L, float4 lit, const glm::vec3 &light_colour)
+{
+	float4 NdotL = dot3(L, lanes.N);
+	float4 diffuse = max4(NdotL, splat(0.0f));
+
+	if (ROUGH)
+	{
+		// sin(alpha) * tan(beta) with alpha the larger of the angles to L and V and beta the smaller;
+		// where the smaller is past 90 degrees NdotL is negative and the term is dropped anyway
+		float4 sin_i = sqrt4(max4(sub4(splat(1.0f), mul4(NdotL, NdotL)), splat(0.0f)));
+		float4 larger_cos = max4(max4(NdotL, lanes.cos_r), splat(1e-20f));
+		float4 sin_tan = div4(mul4(sin_i, lanes.sin_r), larger_cos);
+
+		vec3x4 v = normalize3(sub3(L, scale3(lanes.N, min4(max4(NdotL, splat(0.0f)), splat(1.0f)))));
+		float4 uv = max4(dot3(lanes.u, v), splat(0.0f)); // 0 where v is NaN
+
+		diffuse = mul4(diffuse, add4(splat(m.oren_nayar_A), mul4(mul4(splat(m.oren_nayar_B), uv), sin_tan)));
+	}
+
+	diffuse = select4(lit, diffuse, splat(0.0f));
+	lanes.diffuse = add3(lanes.diffuse, scale3(splat3(light_colour), diffuse));
+
+	if (SPECULAR)
+	{
+		vec3x4 H = normalize3(add3(L, lanes.V));
+		float4 specular = pow4(max4(dot3(lanes.N, H), splat(0.0f)), m.shininess);
+
+		specular = select4(and4(lit, greater_equal4(NdotL, splat(0.0f))), specular, splat(0.0f));
+		lanes.specular = add3(lanes.specular, scale3(splat3(light_colour), specular));
+	}
+}
+
+// the area light shadows of each lane, like area_light_shadowed is for shade()
+thread_local std::vector<char> area_lanes_shadowed[4];
+
+// shade() for up to four hits of batch from first on
+template <bool ROUGH, bool SPECULAR>
+void shadeFourHits(shading_batch &batch, int first, const std::vector<int> * spot_lights)
+{
+	const Scene &lights = *current_scene;
+	const Material &m = *batch.material;
+	int count = glm::min(batch.count - first, 4);
+
+	glm::vec3 position[4];
+	for (int lane = 0; lane < count; lane++)
+	{
+		position[lane] = glm::vec3(batch.position_x[first + lane], batch.position_y[first + lane], batch.position_z[first + lane]);
+	}
+
+	lanes_shading lanes;
+	vec3x4 P = vec3x4_of(load4(batch.position_x + first), load4(batch.position_y + first), load4(batch.position_z + first));
+	lanes.N = vec3x4_of(load4(batch.normal_x + first), load4(batch.normal_y + first), load4(batch.normal_z + first));
+	lanes.V = vec3x4_of(load4(batch.view_x + first), load4(batch.view_y + first), load4(batch.view_z + first));
+	lanes.diffuse = splat3(glm::vec3(0, 0, 0));
+	lanes.specular = splat3(glm::vec3(0, 0, 0));
+
+	if (ROUGH)
+	{
+		lanes.cos_r = dot3(lanes.V, lanes.N);
+		lanes.sin_r = sqrt4(max4(sub4(splat(1.0f), mul4(lanes.cos_r, lanes.cos_r)), splat(0.0f)));
+		lanes.u = normalize3(sub3(lanes.V, scale3(lanes.N, min4(max4(lanes.cos_r, splat(0.0f)), splat(1.0f)))));
+	}
+
+	alignas(16) float lit[4];
+
+	// point, with the samples of the area lights among them
+	int area = 0;
+	int area_first = 0;
+	int area_end = 0;
+
+	for (int i = 0; i < lights.light_point_position.size(); i++)
+	{
+		if (area < lights.light_area_first.size() && i == lights.light_area_first.at(area))
+		{
+			for (int lane = 0; lane < count; lane++)
+			{
+				areaLightShadows(position[lane], area, area_lanes_shadowed[lane]);
+			}
+			area_first = i;
+			area_end = i + area_lanes_shadowed[0].size();
+			area++;
+		}
+
+		bool any = false;
+		for (int lane = 0; lane < 4; lane++)
+		{
+			bool shadowed = lane >= count || (i < area_end ? area_lanes_shadowed[lane].at(i - area_first) != 0
+				: shadowTesting(position[lane], lights.light_point_position.at(i), 1, i));
+			lit[lane] = shadowed ? 0.0f : 1.0f;
+			any = any || !shadowed;
+		}
+
+		if (any)
+		{
+			vec3x4 L = normalize3(sub3(splat3(lights.light_point_position.at(i)), P));
+			shadeLanes<ROUGH, SPECULAR>(m, lanes, L, greater4(load4(lit), splat(0.0f)), lights.light_point_color.at(i));
+		}
+	}
+
+	// directional
+	for (int i = 0; i < lights.light_directional_direction.size(); i++)
+	{
+		bool any = false;
+		for (int lane = 0; lane < 4; lane++)
+		{
+			bool shadowed = lane >= count || shadowTesting(position[lane], position[lane] - lights.light_directional_direction.at(i), 2,
+				lights.light_point_position.size() + i);
+			lit[lane] = shadowed ? 0.0f : 1.0f;
+			any = any || !shadowed;
+		}
+
+		if (any)
+		{
+			vec3x4 L = splat3(-normalize(lights.light_directional_direction.at(i)));
+			shadeLanes<ROUGH, SPECULAR>(m, lanes, L, greater4(load4(lit), splat(0.0f)), lights.light_directional_color.at(i));
+		}
+	}
+
+	// spot
+	int spot_count = spot_lights != NULL ? spot_lights->size() : lights.light_spot_direction.size();
+	for (int k = 0; k < spot_count; k++)
+	{
+		int i = spot_lights != NULL ? spot_lights->at(k) : k;
+
+		bool any = false;
+		for (int lane = 0; lane < 4; lane++)
+		{
+			bool shadowed = true;
+			if (lane < count)
+			{
+				glm::vec3 from_light = position[lane] - lights.light_spot_position.at(i);
+				shadowed = dot(lights.light_spot_axis.at(i), from_light) < lights.light_spot_cos_cutoff.at(i) * length(from_light)
+					|| shadowTesting(position[lane], lights.light_spot_position.at(i), 3,
+						lights.light_point_position.size() + lights.light_directional_direction.size() + i);
+			}
+			lit[lane] = shadowed ? 0.0f : 1.0f;
+			any = any || !shadowed;
+		}
+
+		if (any)
+		{
+			vec3x4 L = splat3(-lights.light_spot_axis.at(i));
+			shadeLanes<ROUGH, SPECULAR>(m, lanes, L, greater4(load4(lit), splat(0.0f)), lights.light_spot_color.at(i));
+		}
+	}
+
+	glm::vec3 ambient = lights.light_ambient_color * m.ambient;
+	store4(batch.colour_r + first, add4(add4(splat(ambient.x), mul4(splat(m.diffuse.x), lanes.diffuse.x)), mul4(splat(m.specular.x), lanes.specular.x)));
+	store4(batch.colour_g + first, add4(add4(splat(ambient.y), mul4(splat(m.diffuse.y), lanes.diffuse.y)), mul4(splat(m.specular.y), lanes.specular.y)));
+	store4(batch.colour_b + first, add4(add4(splat(ambient.z), mul4(splat(m.diffuse.z), lanes.diffuse.z)), mul4(splat(m.specular.z), lanes.specular.z)));
+}
+
+template <bool ROUGH, bool SPECULAR>
+void shadeBatch(shading_batch &batch, const std::vector<int> * spot_lights)
+{
+	render_statistics &statistics = thread_statistics();
+	statistics.shading_batches++;
+	statistics.batched_hits += batch.count;
+
+	// the lanes past the last hit repeat the first, so that they compute something harmless
+	for (int i = batch.count; i < (batch.count + 3) / 4 * 4; i++)
+	{
+		batch.position_x[i] = batch.position_x[0];
+		batch.position_y[i] = batch.position_y[0];
+		batch.position_z[i] = batch.position_z[0];
+		batch.normal_x[i] = batch.normal_x[0];
+		batch.normal_y[i] = batch.normal_y[0];
+		batch.normal_z[i] = batch.normal_z[0];
+		batch.view_x[i] = batch.view_x[0];
+		batch.view_y[i] = batch.view_y[0];
+		batch.view_z[i] = batch.view_z[0];
+	}
+
+	for (int first = 0; first < batch.count; first += 4)
+	{
+		shadeFourHits<ROUGH, SPECULAR>(batch, first, spot_lights);
+	}
+}
+
+shade_batch_function batchShadingFor(int flags)
+{
+	switch (flags & (MATERIAL_ROUGH | MATERIAL_SPECULAR))
+	{
+	case 0:
+		return shadeBatch<false, false>;
+	case MATERIAL_SPECULAR:
+		return shadeBatch<false, true>;
+	case MATERIAL_ROUGH:
+		return shadeBatch<true, false>;
+	default:
+		return shadeBatch<true, true>;
+	}
+}
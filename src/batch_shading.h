@@ -0,0 +1,44 @@
+#ifndef batch_shading_h
+#define batch_shading_h
+#include "raytracer.h"
+
+// Batched shading. The primary hits of a light tile on materials that neither reflect nor
+// transmit are gathered by material, SHADING_BATCH at a time, into arrays of positions,
+// normals and view vectors, and Oren-Nayar and Blinn-Phong are evaluated for a light across
+// all of them at once with SSE (four lanes at a time, plain loops where SSE2 is missing).
+// The shadow rays are still traced one hit at a time.
+//
+// Oren-Nayar needs no approximation: sin(alpha) * tan(beta) is sin(theta_i) * sin(theta_r)
+// over the larger of cos(theta_i) and cos(theta_r), which only takes square roots and a
+// division. The specular pow() is exp2(shininess * log2(x)) with polynomials for both, off by
+// less than 2e-7 for shininess up to 1000 (see pow4() in batch_shading.cpp).
+// Rounding differs from the one hit at a time path, a batched image is within one level of
+// colour of it, which -verify checks.
+extern bool batched_shading; // false shades every hit on its own, -exact-shading
+
+const int SHADING_BATCH = 8;
+
+// hits on the same material, as a structure of arrays padded to whole SSE registers
+struct shading_batch
+{
+	const Material * material;
+	int count;
+	int sample[SHADING_BATCH]; // where the colour goes, for the caller
+	alignas(16) float position_x[SHADING_BATCH];
+	alignas(16) float position_y[SHADING_BATCH];
+	alignas(16) float position_z[SHADING_BATCH];
+	alignas(16) float normal_x[SHADING_BATCH];
+	alignas(16) float normal_y[SHADING_BATCH];
+	alignas(16) float normal_z[SHADING_BATCH];
+	alignas(16) float view_x[SHADING_BATCH];
+	alignas(16) float view_y[SHADING_BATCH];
+	alignas(16) float view_z[SHADING_BATCH];
+	alignas(16) float colour_r[SHADING_BATCH]; // what getColor() would have given each hit
+	alignas(16) float colour_g[SHADING_BATCH];
+	alignas(16) float colour_b[SHADING_BATCH];
+};
+
+// the batched variant of shade() for the flags of a compiled material
+shade_batch_function batchShadingFor(int flags);
+
+#endif
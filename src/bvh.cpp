@@ -0,0 +1,916 @@
+#include "bvh.h"
+#include "statistics.h"
+#include "trace.h"
+#include "scene.h"
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cstring>
+#include <map>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BVH_SSE
+#endif
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+static_assert(sizeof(bvh_node) == 128, "a bvh node should fill two cache lines");
+
+int acceleration_structure = ACCELERATION_BVH;
+
+// the boxes are padded a little, so that a hit computed on the very edge of a flat box still lies inside it
+const float bvh_padding = 0.0001f;
+
+const int bvh_bins = 16;
+
+// a node of the binary tree the four wide one is collapsed from
+struct bvh_build_node
+{
+	float box[6];
+	int left;
+	int right;
+	int first;
+	int count;
+};
+
+void emptyBox(float box[6])
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		box[axis * 2] = FLT_MAX;
+		box[axis * 2 + 1] = -FLT_MAX;
+	}
+}
+
+void growBox(float box[6], const float *other)
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		box[axis * 2] = glm::min(box[axis * 2], other[axis * 2]);
+		box[axis * 2 + 1] = glm::max(box[axis * 2 + 1], other[axis * 2 + 1]);
+	}
+}
+
+float boxArea(const float box[6])
+{
+	float x = box[1] - box[0];
+	float y = box[3] - box[2];
+	float z = box[5] - box[4];
+	return (x < 0 || y < 0 || z < 0) ? 0.0f : 2.0f * (x * y + y * z + z * x);
+}
+
+// splits order[first, first + count) into a subtree with binned SAH and returns the index of its root
+int buildBinary(std::vector<bvh_build_node> &nodes, std::vector<int> &order, const std::vector<float> &boxes,
+				const std::vector<glm::vec3> &centroids, const std::vector<char> &is_sphere, int first, int count)
+{
+	bvh_build_node node;
+	emptyBox(node.box);
+	node.left = -1;
+	node.right = -1;
+	node.first = first;
+	node.count = count;
+
+	glm::vec3 centroid_lo(FLT_MAX, FLT_MAX, FLT_MAX);
+	glm::vec3 centroid_hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	int spheres = 0;
+
+	for (int i = first; i < first + count; i++)
+	{
+		growBox(node.box, &boxes[order[i] * 6]);
+		centroid_lo = glm::min(centroid_lo, centroids[order[i]]);
+		centroid_hi = glm::max(centroid_hi, centroids[order[i]]);
+		spheres += is_sphere[order[i]];
+	}
+
+	int index = nodes.size();
+	nodes.push_back(node);
+
+	if (count <= 1)
+	{
+		return index;
+	}
+
+	glm::vec3 extent = centroid_hi - centroid_lo;
+	int axis = 0;
+	if (extent.y > extent[axis])
+	{
+		axis = 1;
+	}
+	if (extent.z > extent[axis])
+	{
+		axis = 2;
+	}
+
+	// every shape is centred on the same point, no split can separate them
+	if (extent[axis] <= 0)
+	{
+		return index;
+	}
+
+	int bin_count[bvh_bins];
+	float bin_box[bvh_bins][6];
+	for (int b = 0; b < bvh_bins; b++)
+	{
+		bin_count[b] = 0;
+		emptyBox(bin_box[b]);
+	}
+
+	float bin_scale = bvh_bins / extent[axis];
+	for (int i = first; i < first + count; i++)
+	{
+		int b = glm::min((int)((centroids[order[i]][axis] - centroid_lo[axis]) * bin_scale), bvh_bins - 1);
+		bin_count[b]++;
+		growBox(bin_box[b], &boxes[order[i] * 6]);
+	}
+
+	// sweep from the right to know the cost of everything past a split, then from the left
+	float right_area[bvh_bins];
+	int right_count[bvh_bins];
+	float box[6];
+	emptyBox(box);
+	int number = 0;
+	for (int b = bvh_bins - 1; b > 0; b--)
+	{
+		growBox(box, bin_box[b]);
+		number += bin_count[b];
+		right_area[b] = boxArea(box);
+		right_count[b] = number;
+	}
+
+	float best_cost = FLT_MAX;
+	int best_split = -1;
+	emptyBox(box);
+	number = 0;
+	for (int b = 1; b < bvh_bins; b++)
+	{
+		growBox(box, bin_box[b - 1]);
+		number += bin_count[b - 1];
+
+		if (number == 0 || right_count[b] == 0)
+		{
+			continue;
+		}
+
+		float cost = boxArea(box) * number + right_area[b] * right_count[b];
+		if (cost < best_cost)
+		{
+			best_cost = cost;
+			best_split = b;
+		}
+	}
+
+	// one box test more is worth it when it saves enough shape tests, a packet of spheres costs about one
+	float area = boxArea(node.box);
+	float split_cost = 1.0f + (area > 0 ? best_cost / area : count);
+	int leaf_cost = (count - spheres) + (spheres + 7) / 8;
+	bool small = count <= current_scene->bvh_max_leaf_size || (spheres == count && count <= current_scene->bvh_max_sphere_leaf_size);
+	if (small && split_cost >= leaf_cost)
+	{
+		return index;
+	}
+
+	int middle;
+	if (best_split < 0)
+	{
+		middle = first + count / 2;
+		std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + first + count,
+			[&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+	}
+	else
+	{
+		middle = std::partition(order.begin() + first, order.begin() + first + count,
+			[&](int a) { return glm::min((int)((centroids[a][axis] - centroid_lo[axis]) * bin_scale), bvh_bins - 1) < best_split; })
+			- order.begin();
+	}
+
+	int left = buildBinary(nodes, order, boxes, centroids, is_sphere, first, middle - first);
+	int right = buildBinary(nodes, order, boxes, centroids, is_sphere, middle, first + count - middle);
+	nodes[index].left = left;
+	nodes[index].right = right;
+	return index;
+}
+
+bool isBinaryLeaf(const bvh_build_node &node)
+{
+	return node.left < 0;
+}
+
+// turns the binary subtree at index into four wide nodes, pulling up grandchildren by largest area
+int collapseNode(const std::vector<bvh_build_node> &binary, int index, std::vector<bvh_node> &nodes)
+{
+	bvh_state &bvh = current_scene->bvh;
+	std::vector<int> children;
+	if (isBinaryLeaf(binary[index]))
+	{
+		children.push_back(index);
+	}
+	else
+	{
+		children.push_back(binary[index].left);
+		children.push_back(binary[index].right);
+	}
+
+	while (children.size() < 4)
+	{
+		int largest = -1;
+		for (int i = 0; i < children.size(); i++)
+		{
+			const bvh_build_node &child = binary[children[i]];
+			if (!isBinaryLeaf(child) && (largest < 0 || boxArea(child.box) > boxArea(binary[children[largest]].box)))
+			{
+				largest = i;
+			}
+		}
+		if (largest < 0)
+		{
+			break;
+		}
+
+		int opened = children[largest];
+		children.erase(children.begin() + largest);
+		children.push_back(binary[opened].left);
+		children.push_back(binary[opened].right);
+	}
+
+	bvh_node node;
+	memset(&node, 0, sizeof(node));
+	node.child_count = children.size();
+
+	for (int i = 0; i < children.size(); i++)
+	{
+		const float *box = binary[children[i]].box;
+		node.lower_x[i] = box[0] - bvh_padding;
+		node.upper_x[i] = box[1] + bvh_padding;
+		node.lower_y[i] = box[2] - bvh_padding;
+		node.upper_y[i] = box[3] + bvh_padding;
+		node.lower_z[i] = box[4] - bvh_padding;
+		node.upper_z[i] = box[5] + bvh_padding;
+	}
+
+	int out = nodes.size();
+	nodes.push_back(node);
+
+	for (int i = 0; i < children.size(); i++)
+	{
+		const bvh_build_node &child = binary[children[i]];
+		int reference;
+
+		if (isBinaryLeaf(child))
+		{
+			// the range of order, split into spheres and other shapes once the tree is complete
+			bvh_leaf leaf;
+			leaf.first_sphere = 0;
+			leaf.sphere_count = 0;
+			leaf.first_shape = child.first;
+			leaf.shape_count = child.count;
+			bvh.leaves.push_back(leaf);
+			reference = ~(int)(bvh.leaves.size() - 1);
+		}
+		else
+		{
+			reference = collapseNode(binary, children[i], nodes);
+		}
+		nodes[out].child[i] = reference;
+	}
+	return out;
+}
+
+void addSphere(std::vector<sphere_packet> &packets, shape * sphere)
+{
+	bvh_state &bvh = current_scene->bvh;
+	int lane = bvh.spheres.size() % 8;
+	if (lane == 0)
+	{
+		sphere_packet packet;
+		memset(&packet, 0, sizeof(packet));
+		packets.push_back(packet);
+	}
+
+	sphere_packet &packet = packets.back();
+	packet.center_x[lane] = sphere->position.x;
+	packet.center_y[lane] = sphere->position.y;
+	packet.center_z[lane] = sphere->position.z;
+	packet.radius_squared[lane] = sphere->radius * sphere->radius;
+	bvh.spheres.push_back(sphere);
+}
+
+// copies items into storage at a cache line boundary, for the aligned SIMD loads
+template <typename T>
+T * alignedCopy(std::vector<char> &storage, const std::vector<T> &items)
+{
+	storage.assign(items.size() * sizeof(T) + 63, 0);
+	T * aligned = (T *)(((size_t)&storage[0] + 63) & ~(size_t)63);
+	if (items.size() != 0)
+	{
+		memcpy(aligned, &items[0], items.size() * sizeof(T));
+	}
+	return aligned;
+}
+
+// builds the BVH over listOfShapes when it is the chosen acceleration structure, has to run again whenever shapes move;
+// when they all fit into one leaf it is left unbuilt and the rays go through the octree
+void buildBVH()
+{
+	bvh_state &bvh = current_scene->bvh;
+	trace_scope scope("build BVH");
+	bvh.ready = false;
+	bvh.leaves.clear();
+	bvh.shapes.clear();
+	bvh.spheres.clear();
+	bvh.node_count = 0;
+
+	if (acceleration_structure != ACCELERATION_BVH)
+	{
+		return;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	std::vector<float> boxes(current_scene->listOfShapes.size() * 6);
+	std::vector<glm::vec3> centroids(current_scene->listOfShapes.size());
+	std::vector<int> order(current_scene->listOfShapes.size());
+	std::vector<char> is_sphere(current_scene->listOfShapes.size());
+
+	for (int i = 0; i < current_scene->listOfShapes.size(); i++)
+	{
+		const std::vector<float> &bounding = current_scene->listOfShapes.at(i)->bounding;
+		for (int k = 0; k < 6; k++)
+		{
+			boxes[i * 6 + k] = bounding.at(k);
+		}
+		centroids[i] = glm::vec3(bounding.at(0) + bounding.at(1), bounding.at(2) + bounding.at(3), bounding.at(4) + bounding.at(5)) * 0.5f;
+		order[i] = i;
+		is_sphere[i] = current_scene->listOfShapes.at(i)->type == "sphere";
+	}
+
+	std::vector<bvh_node> nodes;
+	if (current_scene->listOfShapes.size() != 0)
+	{
+		std::vector<bvh_build_node> binary;
+		buildBinary(binary, order, boxes, centroids, is_sphere, 0, current_scene->listOfShapes.size());
+
+		// a single leaf tests every shape anyway, the octree does that without setting up a traversal per ray
+		if (isBinaryLeaf(binary[0]))
+		{
+			return;
+		}
+		collapseNode(binary, 0, nodes);
+	}
+
+	std::vector<sphere_packet> packets;
+	for (int i = 0; i < bvh.leaves.size(); i++)
+	{
+		bvh_leaf &leaf = bvh.leaves[i];
+		int first = leaf.first_shape;
+		int count = leaf.shape_count;
+
+		leaf.first_sphere = bvh.spheres.size();
+		leaf.first_shape = bvh.shapes.size();
+		leaf.shape_count = 0;
+
+		for (int k = first; k < first + count; k++)
+		{
+			shape * s = current_scene->listOfShapes.at(order[k]);
+			if (is_sphere[order[k]])
+			{
+				addSphere(packets, s);
+				leaf.sphere_count++;
+			}
+			else
+			{
+				bvh.shapes.push_back(s);
+				leaf.shape_count++;
+			}
+		}
+
+		// the next leaf starts on a packet of its own
+		while (bvh.spheres.size() % 8 != 0)
+		{
+			bvh.spheres.push_back(NULL);
+		}
+	}
+
+	bvh.nodes = alignedCopy(bvh.storage, nodes);
+	bvh.sphere_packets = alignedCopy(bvh.sphere_storage, packets);
+	bvh.node_count = nodes.size();
+	bvh.ready = true;
+	bvh.cost_after_build = bvhCost();
+
+	bvh.build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// the box around the shapes of a leaf, with its spheres copied into their packets again
+void refitLeaf(bvh_leaf &leaf, float box[6])
+{
+	bvh_state &bvh = current_scene->bvh;
+	emptyBox(box);
+
+	for (int i = leaf.first_sphere; i < leaf.first_sphere + leaf.sphere_count; i++)
+	{
+		shape * sphere = bvh.spheres[i];
+		sphere_packet &packet = bvh.sphere_packets[i / 8];
+		packet.center_x[i % 8] = sphere->position.x;
+		packet.center_y[i % 8] = sphere->position.y;
+		packet.center_z[i % 8] = sphere->position.z;
+		packet.radius_squared[i % 8] = sphere->radius * sphere->radius;
+		growBox(box, &sphere->bounding[0]);
+	}
+
+	for (int i = leaf.first_shape; i < leaf.first_shape + leaf.shape_count; i++)
+	{
+		growBox(box, &bvh.shapes[i]->bounding[0]);
+	}
+}
+
+// refits the children of the node at index bottom up and returns the box around them in box
+void refitNode(int index, float box[6])
+{
+	bvh_state &bvh = current_scene->bvh;
+	bvh_node &node = bvh.nodes[index];
+	emptyBox(box);
+
+	for (int i = 0; i < node.child_count; i++)
+	{
+		float child[6];
+		if (node.child[i] >= 0)
+		{
+			refitNode(node.child[i], child);
+		}
+		else
+		{
+			refitLeaf(bvh.leaves[~node.child[i]], child);
+		}
+		growBox(box, child);
+
+		node.lower_x[i] = child[0] - bvh_padding;
+		node.upper_x[i] = child[1] + bvh_padding;
+		node.lower_y[i] = child[2] - bvh_padding;
+		node.upper_y[i] = child[3] + bvh_padding;
+		node.lower_z[i] = child[4] - bvh_padding;
+		node.upper_z[i] = child[5] + bvh_padding;
+	}
+}
+
+void refitBVH()
+{
+	bvh_state &bvh = current_scene->bvh;
+	trace_scope scope("refit BVH");
+
+	if (bvh.ready && bvh.node_count != 0)
+	{
+		float box[6];
+		refitNode(0, box);
+	}
+}
+
+void replaceBVHShapes(const std::vector<shape *> &from, const std::vector<shape *> &to)
+{
+	bvh_state &bvh = current_scene->bvh;
+	if (!bvh.ready || from.size() == 0)
+	{
+		return;
+	}
+
+	std::map<shape *, shape *> replacement;
+	for (int i = 0; i < from.size(); i++)
+	{
+		replacement[from[i]] = to[i];
+	}
+
+	for (int i = 0; i < bvh.shapes.size(); i++)
+	{
+		std::map<shape *, shape *>::iterator it = replacement.find(bvh.shapes[i]);
+		if (it != replacement.end())
+		{
+			bvh.shapes[i] = it->second;
+		}
+	}
+	for (int i = 0; i < bvh.spheres.size(); i++)
+	{
+		std::map<shape *, shape *>::iterator it = replacement.find(bvh.spheres[i]);
+		if (bvh.spheres[i] != NULL && it != replacement.end())
+		{
+			bvh.spheres[i] = it->second;
+		}
+	}
+}
+
+float bvhCost()
+{
+	acceleration_report report;
+	reportBVH(report);
+	return report.cost;
+}
+
+size_t bvhBytes()
+{
+	const bvh_state &bvh = current_scene->bvh;
+	return bvh.storage.capacity() + bvh.sphere_storage.capacity() + bvh.leaves.capacity() * sizeof(bvh_leaf)
+		+ (bvh.shapes.capacity() + bvh.spheres.capacity()) * sizeof(shape *);
+}
+
+float childArea(const bvh_node &node, int i)
+{
+	float box[6] = { node.lower_x[i], node.upper_x[i], node.lower_y[i], node.upper_y[i], node.lower_z[i], node.upper_z[i] };
+	return boxArea(box);
+}
+
+// a visit tests the boxes of all four children at once and costs one, a packet of spheres costs one as well
+void reportBVHNode(int index, float area, float root_area, int depth, acceleration_report &report)
+{
+	const bvh_state &bvh = current_scene->bvh;
+	const bvh_node &node = bvh.nodes[index];
+	report.inner_nodes++;
+	report.depth = glm::max(report.depth, depth);
+	report.cost += area / root_area;
+
+	for (int i = 0; i < node.child_count; i++)
+	{
+		if (node.child[i] >= 0)
+		{
+			reportBVHNode(node.child[i], childArea(node, i), root_area, depth + 1, report);
+			continue;
+		}
+
+		const bvh_leaf &leaf = bvh.leaves[~node.child[i]];
+		int shapes = leaf.sphere_count + leaf.shape_count;
+
+		report.leaves++;
+		report.depth = glm::max(report.depth, depth + 1);
+		report.references += shapes;
+		report.histogram.at(occupancyBucket(shapes))++;
+		report.cost += childArea(node, i) / root_area * ((leaf.sphere_count + 7) / 8 + leaf.shape_count);
+	}
+}
+
+void reportBVH(acceleration_report &report)
+{
+	const bvh_state &bvh = current_scene->bvh;
+	report = acceleration_report();
+	report.name = "BVH";
+
+	if (!bvh.ready || bvh.node_count == 0)
+	{
+		return;
+	}
+
+	const bvh_node &root = bvh.nodes[0];
+	float box[6] = { FLT_MAX, -FLT_MAX, FLT_MAX, -FLT_MAX, FLT_MAX, -FLT_MAX };
+	for (int i = 0; i < root.child_count; i++)
+	{
+		box[0] = glm::min(box[0], root.lower_x[i]);
+		box[1] = glm::max(box[1], root.upper_x[i]);
+		box[2] = glm::min(box[2], root.lower_y[i]);
+		box[3] = glm::max(box[3], root.upper_y[i]);
+		box[4] = glm::min(box[4], root.lower_z[i]);
+		box[5] = glm::max(box[5], root.upper_z[i]);
+	}
+
+	float area = boxArea(box);
+	reportBVHNode(0, area, area > 0 ? area : 1.0f, 0, report);
+	report.shapes = report.references; // every shape is in exactly one leaf
+}
+
+// the ray with a direction that has no zero component, so that the slab test never multiplies 0 by infinity
+struct bvh_ray
+{
+	glm::vec3 origin;
+	glm::vec3 inverse_direction;
+};
+
+bvh_ray makeRay(const point3 &e, const point3 &s)
+{
+	bvh_ray ray;
+	ray.origin = e;
+	glm::vec3 d = s - e;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (d[axis] == 0.0f)
+		{
+			d[axis] = 1e-20f;
+		}
+		ray.inverse_direction[axis] = 1.0f / d[axis];
+	}
+	return ray;
+}
+
+// slab test of the ray against the children of node between 0 and tmax, returns a bit per child that is hit
+int intersectChildren(const bvh_node &node, const bvh_ray &ray, float tmax, float tnear[4])
+{
+#ifdef BVH_SSE
+	__m128 origin_x = _mm_set1_ps(ray.origin.x);
+	__m128 origin_y = _mm_set1_ps(ray.origin.y);
+	__m128 origin_z = _mm_set1_ps(ray.origin.z);
+	__m128 inverse_x = _mm_set1_ps(ray.inverse_direction.x);
+	__m128 inverse_y = _mm_set1_ps(ray.inverse_direction.y);
+	__m128 inverse_z = _mm_set1_ps(ray.inverse_direction.z);
+
+	__m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.lower_x), origin_x), inverse_x);
+	__m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.upper_x), origin_x), inverse_x);
+	__m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.lower_y), origin_y), inverse_y);
+	__m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.upper_y), origin_y), inverse_y);
+	__m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.lower_z), origin_z), inverse_z);
+	__m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.upper_z), origin_z), inverse_z);
+
+	__m128 entry = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)), _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_setzero_ps()));
+	__m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)), _mm_min_ps(_mm_max_ps(tz0, tz1), _mm_set1_ps(tmax)));
+
+	_mm_storeu_ps(tnear, entry);
+	return _mm_movemask_ps(_mm_cmple_ps(entry, exit)) & ((1 << node.child_count) - 1);
+#else
+	int mask = 0;
+	for (int i = 0; i < node.child_count; i++)
+	{
+		float tx0 = (node.lower_x[i] - ray.origin.x) * ray.inverse_direction.x;
+		float tx1 = (node.upper_x[i] - ray.origin.x) * ray.inverse_direction.x;
+		float ty0 = (node.lower_y[i] - ray.origin.y) * ray.inverse_direction.y;
+		float ty1 = (node.upper_y[i] - ray.origin.y) * ray.inverse_direction.y;
+		float tz0 = (node.lower_z[i] - ray.origin.z) * ray.inverse_direction.z;
+		float tz1 = (node.upper_z[i] - ray.origin.z) * ray.inverse_direction.z;
+
+		float entry = glm::max(glm::max(glm::min(tx0, tx1), glm::min(ty0, ty1)), glm::max(glm::min(tz0, tz1), 0.0f));
+		float exit = glm::min(glm::min(glm::max(tx0, tx1), glm::max(ty0, ty1)), glm::min(glm::max(tz0, tz1), tmax));
+
+		tnear[i] = entry;
+		if (entry <= exit)
+		{
+			mask |= 1 << i;
+		}
+	}
+	return mask;
+#endif
+}
+
+#if defined(BVH_SSE)
+// b * b - p the way the scalar code has it: glm::pow(float, int) squares in double, which matters
+// because the two terms nearly cancel for small spheres
+__m128 determine4(__m128 b, __m128 p)
+{
+	__m128d b_low = _mm_cvtps_pd(b);
+	__m128d b_high = _mm_cvtps_pd(_mm_movehl_ps(b, b));
+	__m128d low = _mm_sub_pd(_mm_mul_pd(b_low, b_low), _mm_cvtps_pd(p));
+	__m128d high = _mm_sub_pd(_mm_mul_pd(b_high, b_high), _mm_cvtps_pd(_mm_movehl_ps(p, p)));
+	return _mm_movelh_ps(_mm_cvtpd_ps(low), _mm_cvtpd_ps(high));
+}
+#endif
+
+// The nearer t of the ray e + t * d with every sphere of the packet, computed in the same order
+// as hitTestingShape and shadowTestingShape do, so that it comes out the same to the last bit.
+// Bit i of the result is set when the ray meets sphere i at all.
+int intersectSpheres(const sphere_packet &packet, const glm::vec3 &e, const glm::vec3 &d, float dd, float t[8])
+{
+#if defined(__AVX__)
+	__m256 oc_x = _mm256_sub_ps(_mm256_set1_ps(e.x), _mm256_load_ps(packet.center_x));
+	__m256 oc_y = _mm256_sub_ps(_mm256_set1_ps(e.y), _mm256_load_ps(packet.center_y));
+	__m256 oc_z = _mm256_sub_ps(_mm256_set1_ps(e.z), _mm256_load_ps(packet.center_z));
+
+	__m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(d.x), oc_x), _mm256_mul_ps(_mm256_set1_ps(d.y), oc_y)), _mm256_mul_ps(_mm256_set1_ps(d.z), oc_z));
+	__m256 c = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(oc_x, oc_x), _mm256_mul_ps(oc_y, oc_y)), _mm256_mul_ps(oc_z, oc_z));
+	__m256 p = _mm256_mul_ps(_mm256_set1_ps(dd), _mm256_sub_ps(c, _mm256_load_ps(packet.radius_squared)));
+
+	__m256d b_low = _mm256_cvtps_pd(_mm256_castps256_ps128(b));
+	__m256d b_high = _mm256_cvtps_pd(_mm256_extractf128_ps(b, 1));
+	__m256d low = _mm256_sub_pd(_mm256_mul_pd(b_low, b_low), _mm256_cvtps_pd(_mm256_castps256_ps128(p)));
+	__m256d high = _mm256_sub_pd(_mm256_mul_pd(b_high, b_high), _mm256_cvtps_pd(_mm256_extractf128_ps(p, 1)));
+	__m256 determine = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(low)), _mm256_cvtpd_ps(high), 1);
+
+	__m256 root = _mm256_sqrt_ps(_mm256_max_ps(determine, _mm256_setzero_ps()));
+	_mm256_storeu_ps(t, _mm256_div_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(), b), root), _mm256_set1_ps(dd)));
+	return _mm256_movemask_ps(_mm256_cmp_ps(determine, _mm256_setzero_ps(), _CMP_GE_OQ));
+#elif defined(BVH_SSE)
+	// two halves of four
+	int mask = 0;
+	for (int half = 0; half < 8; half += 4)
+	{
+		__m128 oc_x = _mm_sub_ps(_mm_set1_ps(e.x), _mm_load_ps(packet.center_x + half));
+		__m128 oc_y = _mm_sub_ps(_mm_set1_ps(e.y), _mm_load_ps(packet.center_y + half));
+		__m128 oc_z = _mm_sub_ps(_mm_set1_ps(e.z), _mm_load_ps(packet.center_z + half));
+
+		__m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(d.x), oc_x), _mm_mul_ps(_mm_set1_ps(d.y), oc_y)), _mm_mul_ps(_mm_set1_ps(d.z), oc_z));
+		__m128 c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(oc_x, oc_x), _mm_mul_ps(oc_y, oc_y)), _mm_mul_ps(oc_z, oc_z));
+		__m128 determine = determine4(b, _mm_mul_ps(_mm_set1_ps(dd), _mm_sub_ps(c, _mm_load_ps(packet.radius_squared + half))));
+
+		__m128 root = _mm_sqrt_ps(_mm_max_ps(determine, _mm_setzero_ps()));
+		_mm_storeu_ps(t + half, _mm_div_ps(_mm_sub_ps(_mm_sub_ps(_mm_setzero_ps(), b), root), _mm_set1_ps(dd)));
+		mask |= _mm_movemask_ps(_mm_cmpge_ps(determine, _mm_setzero_ps())) << half;
+	}
+	return mask;
+#else
+	int mask = 0;
+	for (int i = 0; i < 8; i++)
+	{
+		glm::vec3 oc = e - glm::vec3(packet.center_x[i], packet.center_y[i], packet.center_z[i]);
+		float b = dot(d, oc);
+		float determine = glm::pow(b, 2) - dd * (dot(oc, oc) - packet.radius_squared[i]);
+
+		if (determine >= 0)
+		{
+			t[i] = (-b - glm::sqrt(determine)) / dd;
+			mask |= 1 << i;
+		}
+	}
+	return mask;
+#endif
+}
+
+// the lanes of a leaf's packet that hold one of its spheres
+int laneMask(const bvh_leaf &leaf, int packet_start)
+{
+	int lanes = leaf.sphere_count - packet_start;
+	return lanes >= 8 ? 0xff : (1 << lanes) - 1;
+}
+
+struct bvh_stack_entry
+{
+	int reference;
+	float tnear;
+};
+
+thread_local std::vector<bvh_stack_entry> bvh_stack;
+
+void bvhClosestHit(const point3 &e, const point3 &s, float &finalT, bool &isHit, Material * &hit_material,
+				   glm::vec3 &intersection, glm::vec3 &N, glm::vec3 &center, int &type, float &radius, shape ** hit_shape)
+{
+	const bvh_state &bvh = current_scene->bvh;
+	if (bvh.node_count == 0)
+	{
+		return;
+	}
+
+	render_statistics &statistics = thread_statistics();
+	bvh_ray ray = makeRay(e, s);
+	glm::vec3 d = s - e;
+	float dd = dot(d, d);
+
+	std::vector<bvh_stack_entry> &stack = bvh_stack;
+	stack.clear();
+	bvh_stack_entry root = { 0, 0.0f };
+	stack.push_back(root);
+
+	while (stack.size() != 0)
+	{
+		bvh_stack_entry entry = stack.back();
+		stack.pop_back();
+
+		// a closer hit was found since this was pushed
+		if (entry.tnear > finalT)
+		{
+			continue;
+		}
+
+		if (entry.reference < 0)
+		{
+			const bvh_leaf &leaf = bvh.leaves[~entry.reference];
+			for (int p = 0; p < leaf.sphere_count; p += 8)
+			{
+				float t[8];
+				int mask = intersectSpheres(bvh.sphere_packets[(leaf.first_sphere + p) / 8], e, d, dd, t) & laneMask(leaf, p);
+				statistics.hit_shape_tests += glm::min(leaf.sphere_count - p, 8);
+
+				// the nearest sphere in front is taken over by hitTestingShape, like the loop over shapes would
+				int nearest = -1;
+				for (int lane = 0; lane < 8; lane++)
+				{
+					if ((mask & (1 << lane)) && t[lane] > 0.001 && t[lane] < finalT && (nearest < 0 || t[lane] < t[nearest]))
+					{
+						nearest = lane;
+					}
+				}
+				if (nearest >= 0)
+				{
+					shape * sphere = bvh.spheres[leaf.first_sphere + p + nearest];
+					float lastT = finalT;
+					hitTestingShape(sphere, e, s, finalT, isHit, hit_material, intersection, N, center, type, radius);
+
+					if (finalT != lastT && hit_shape != NULL)
+					{
+						*hit_shape = sphere;
+					}
+				}
+			}
+
+			for (int i = leaf.first_shape; i < leaf.first_shape + leaf.shape_count; i++)
+			{
+				statistics.hit_shape_tests++;
+				float lastT = finalT;
+				hitTestingShape(bvh.shapes[i], e, s, finalT, isHit, hit_material, intersection, N, center, type, radius);
+
+				if (finalT != lastT && hit_shape != NULL)
+				{
+					*hit_shape = bvh.shapes[i];
+				}
+			}
+			continue;
+		}
+
+		const bvh_node &node = bvh.nodes[entry.reference];
+		statistics.node_visits++;
+		statistics.box_tests += node.child_count;
+
+		float tnear[4];
+		int mask = intersectChildren(node, ray, finalT, tnear);
+
+		// the farthest child goes onto the stack first, so the nearest is taken next
+		bvh_stack_entry hits[4];
+		int number = 0;
+		for (int i = 0; i < node.child_count; i++)
+		{
+			if (mask & (1 << i))
+			{
+				bvh_stack_entry hit = { node.child[i], tnear[i] };
+				int k = number;
+				while (k > 0 && hits[k - 1].tnear < hit.tnear)
+				{
+					hits[k] = hits[k - 1];
+					k--;
+				}
+				hits[k] = hit;
+				number++;
+			}
+		}
+		for (int i = 0; i < number; i++)
+		{
+			stack.push_back(hits[i]);
+		}
+	}
+}
+
+shape * bvhAnyHit(const point3 &e, const point3 &s, int type, const shape * skip)
+{
+	const bvh_state &bvh = current_scene->bvh;
+	if (bvh.node_count == 0)
+	{
+		return NULL;
+	}
+
+	render_statistics &statistics = thread_statistics();
+	bvh_ray ray = makeRay(e, s);
+	glm::vec3 d = s - e;
+	float dd = dot(d, d);
+
+	// point and spot lights sit at t = 1, a directional light is infinitely far away
+	float tmax = type == 2 ? FLT_MAX : 1.0f;
+
+	std::vector<bvh_stack_entry> &stack = bvh_stack;
+	stack.clear();
+	bvh_stack_entry root = { 0, 0.0f };
+	stack.push_back(root);
+
+	while (stack.size() != 0)
+	{
+		bvh_stack_entry entry = stack.back();
+		stack.pop_back();
+
+		if (entry.reference < 0)
+		{
+			const bvh_leaf &leaf = bvh.leaves[~entry.reference];
+			for (int p = 0; p < leaf.sphere_count; p += 8)
+			{
+				float t[8];
+				int mask = intersectSpheres(bvh.sphere_packets[(leaf.first_sphere + p) / 8], e, d, dd, t) & laneMask(leaf, p);
+				statistics.shadow_shape_tests += glm::min(leaf.sphere_count - p, 8);
+
+				for (int lane = 0; lane < 8; lane++)
+				{
+					if ((mask & (1 << lane)) && t[lane] > 0.001 && (type == 2 || t[lane] < 1) && bvh.spheres[leaf.first_sphere + p + lane] != skip)
+					{
+						return bvh.spheres[leaf.first_sphere + p + lane];
+					}
+				}
+			}
+
+			for (int i = leaf.first_shape; i < leaf.first_shape + leaf.shape_count; i++)
+			{
+				if (bvh.shapes[i] == skip)
+				{
+					continue;
+				}
+
+				statistics.shadow_shape_tests++;
+				if (shadowTestingShape(bvh.shapes[i], e, s, type))
+				{
+					return bvh.shapes[i];
+				}
+			}
+			continue;
+		}
+
+		const bvh_node &node = bvh.nodes[entry.reference];
+		statistics.shadow_node_visits++;
+
+		float tnear[4];
+		int mask = intersectChildren(node, ray, tmax, tnear);
+		for (int i = 0; i < node.child_count; i++)
+		{
+			if (mask & (1 << i))
+			{
+				bvh_stack_entry hit = { node.child[i], tnear[i] };
+				stack.push_back(hit);
+			}
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,88 @@
+#ifndef bvh_h
+#define bvh_h
+#include "raytracer.h"
+
+#define ACCELERATION_OCTREE 0
+#define ACCELERATION_BVH 1
+
+// A bounding volume hierarchy with four children per node, built with the surface area
+// heuristic over listOfShapes (the planes are unbounded and stay outside of it). A node
+// keeps the boxes of its children side by side, one array per axis and side, so that one
+// SSE instruction works on all four of them. Traversal visits the children it hits nearest
+// first and skips every node that starts behind the closest hit found so far.
+struct bvh_node
+{
+	float lower_x[4];
+	float upper_x[4];
+	float lower_y[4];
+	float upper_y[4];
+	float lower_z[4];
+	float upper_z[4];
+	int child[4]; // an inner node, or ~leaf for a leaf
+	int child_count;
+	int padding[3];
+};
+
+// The spheres of a leaf, eight at a time, so that one instruction tests them all against a ray.
+// Unused lanes are masked off by the sphere count of the leaf.
+struct sphere_packet
+{
+	float center_x[8];
+	float center_y[8];
+	float center_z[8];
+	float radius_squared[8];
+};
+
+// the spheres of a leaf come first, in whole packets, then its other shapes
+struct bvh_leaf
+{
+	int first_sphere; // a multiple of 8, first_sphere / 8 is its first packet
+	int sphere_count;
+	int first_shape;
+	int shape_count;
+};
+
+extern int acceleration_structure;
+
+// what buildBVH() made of the shapes of a scene
+struct bvh_state
+{
+	bool ready;
+	std::vector<char> storage;
+	bvh_node * nodes; // cache line aligned, inside storage
+	int node_count;
+	std::vector<bvh_leaf> leaves;
+	std::vector<shape *> shapes;
+	std::vector<char> sphere_storage;
+	sphere_packet * sphere_packets; // cache line aligned, inside sphere_storage
+	std::vector<shape *> spheres; // lane by lane, NULL in unused lanes
+	float cost_after_build; // bvhCost() when it was last built
+	double build_ms; // how long that build took, print_statistics() reports it
+
+	bvh_state() : ready(false), nodes(NULL), node_count(0), sphere_packets(NULL), cost_after_build(0), build_ms(0) {}
+};
+
+void buildBVH();
+
+// Moves the boxes and sphere packets of the BVH to where its shapes are now, keeping which shapes
+// are in which leaf. The tree gets worse the further they move, which bvhCost() tells.
+void refitBVH();
+// Puts to[i] into the place of from[i] in the leaves, for shapes that were loaded again
+// somewhere else; a sphere has to stay a sphere. refitBVH() moves the boxes after them.
+void replaceBVHShapes(const std::vector<shape *> &from, const std::vector<shape *> &to);
+float bvhCost(); // the surface area heuristic cost of reportBVH()
+size_t bvhBytes();
+void reportBVH(acceleration_report &report);
+
+// boxes of six floats, left, right, down, up, back and front like Scene::bounding
+void emptyBox(float box[6]);
+void growBox(float box[6], const float *other);
+
+// the nearest hit along e + t * (s - e) closer than finalT, as hitTesting reports it
+void bvhClosestHit(const point3 &e, const point3 &s, float &finalT, bool &isHit, Material * &hit_material,
+	glm::vec3 &intersection, glm::vec3 &N, glm::vec3 &center, int &type, float &radius, shape ** hit_shape);
+
+// any shape but skip that blocks the shadow ray, as shadowTestingShape decides it
+shape * bvhAnyHit(const point3 &e, const point3 &s, int type, const shape * skip);
+
+#endif
@@ -0,0 +1,439 @@
+#include "checkpoint.h"
+#include "render.h"
+#include "statistics.h"
+#include "trace.h"
+#include "scene.h"
+#include "light_culling.h"
+#include "region.h"
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+// seconds between two writes of the journal
+double checkpoint_interval = 1.0;
+
+struct journal_header
+{
+	char magic[4];
+	int width, height;
+	int samples;
+	int tile_size;
+	unsigned long long scene_hash; // of the path of the scene file, whose size and modification time follow
+	long long scene_size;
+	long long scene_time;
+};
+
+// followed by width * height summed colours and then width * height sample counts
+struct journal_tile
+{
+	int x, y;
+	int width, height;
+};
+
+struct journal_record
+{
+	journal_tile tile;
+	std::vector<colour3> sums;
+	std::vector<unsigned int> counts;
+};
+
+// Render threads only queue their tiles, a thread of its own writes them out
+// every checkpoint_interval seconds, so the disk never holds up tracing.
+struct journal_writer
+{
+	FILE *file;
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<journal_record *> queue;
+	bool stop;
+};
+
+void write_record(FILE *file, const journal_record &record)
+{
+	fwrite(&record.tile, sizeof(record.tile), 1, file);
+	fwrite(&record.sums[0], sizeof(colour3), record.sums.size(), file);
+	fwrite(&record.counts[0], sizeof(unsigned int), record.counts.size(), file);
+}
+
+void journal_writer_loop(journal_writer *writer)
+{
+	trace_thread_name("journal");
+	std::unique_lock<std::mutex> lock(writer->mutex);
+
+	while (true)
+	{
+		if (!writer->stop)
+		{
+			writer->wake.wait_for(lock, std::chrono::duration<double>(checkpoint_interval));
+		}
+
+		std::deque<journal_record *> batch;
+		batch.swap(writer->queue);
+		bool stopping = writer->stop;
+		lock.unlock();
+
+		if (batch.size() != 0)
+		{
+			trace_scope scope("write journal");
+			for (int i = 0; i < batch.size(); i++)
+			{
+				write_record(writer->file, *batch.at(i));
+				delete batch.at(i);
+			}
+			fflush(writer->file);
+		}
+
+		lock.lock();
+		if (stopping && writer->queue.size() == 0)
+		{
+			return;
+		}
+	}
+}
+
+// reads the tiles of an earlier run, a record cut short by a crash is left out
+int load_journal(const std::string &path, const journal_header &expected, std::vector<colour3> &sums,
+	std::vector<unsigned int> &counts, std::vector<journal_tile> &tiles)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+	if (file == NULL)
+	{
+		return 0;
+	}
+
+	journal_header header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(&header, &expected, sizeof(header)) != 0)
+	{
+		std::cout << "Journal " << path << " belongs to a different render, starting over." << std::endl;
+		fclose(file);
+		return 0;
+	}
+
+	journal_record record;
+	while (fread(&record.tile, sizeof(record.tile), 1, file) == 1)
+	{
+		journal_tile &t = record.tile;
+		if (t.x < 0 || t.y < 0 || t.width <= 0 || t.height <= 0 || t.x + t.width > header.width || t.y + t.height > header.height)
+		{
+			break;
+		}
+
+		record.sums.resize(t.width * t.height);
+		record.counts.resize(t.width * t.height);
+		if (fread(&record.sums[0], sizeof(colour3), record.sums.size(), file) != record.sums.size() ||
+			fread(&record.counts[0], sizeof(unsigned int), record.counts.size(), file) != record.counts.size())
+		{
+			break;
+		}
+
+		for (int j = 0; j < t.height; j++)
+		{
+			for (int i = 0; i < t.width; i++)
+			{
+				sums.at((t.y + j) * header.width + t.x + i) = record.sums.at(j * t.width + i);
+				counts.at((t.y + j) * header.width + t.x + i) = record.counts.at(j * t.width + i);
+			}
+		}
+		tiles.push_back(t);
+	}
+	fclose(file);
+	return tiles.size();
+}
+
+// FNV-1a
+unsigned long long path_hash(const std::string &path)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	for (int i = 0; i < path.size(); i++)
+	{
+		hash = (hash ^ (unsigned char)path[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+journal_record * make_record(const journal_tile &t, int width, const std::vector<colour3> &sums, const std::vector<unsigned int> &counts)
+{
+	journal_record *record = new journal_record;
+	record->tile = t;
+
+	for (int j = 0; j < t.height; j++)
+	{
+		for (int i = 0; i < t.width; i++)
+		{
+			record->sums.push_back(sums.at((t.y + j) * width + t.x + i));
+			record->counts.push_back(counts.at((t.y + j) * width + t.x + i));
+		}
+	}
+	return record;
+}
+
+// what the render threads share
+struct checkpoint_render
+{
+	int width, height;
+	int samples;
+	std::vector<journal_tile> *tiles;
+	std::vector<colour3> *sums;
+	std::vector<unsigned int> *counts;
+	std::vector<pixel_cost> *costs;
+	journal_writer *writer;
+};
+
+// the samples the pixels of t are still missing, traced a light tile at a time
+void render_culled_tile(checkpoint_render *render, const journal_tile &t)
+{
+	int width = render->width;
+	std::vector<colour3> &sums = *render->sums;
+	std::vector<unsigned int> &counts = *render->counts;
+	std::vector<tile_sample> tile;
+
+	for (int tile_y = t.y; tile_y < t.y + t.height; tile_y += LIGHT_TILE_SIZE)
+	{
+		for (int tile_x = t.x; tile_x < t.x + t.width; tile_x += LIGHT_TILE_SIZE)
+		{
+			int end_x = glm::min(tile_x + LIGHT_TILE_SIZE, t.x + t.width);
+			int end_y = glm::min(tile_y + LIGHT_TILE_SIZE, t.y + t.height);
+
+			tile.clear();
+			for (int y = tile_y; y < end_y; y++)
+			{
+				for (int x = tile_x; x < end_x; x++)
+				{
+					for (int sample = counts.at(y * width + x); sample < render->samples; sample++)
+					{
+						glm::vec2 offset = sample_offset(x, y, sample);
+						tile_sample s;
+						s.e = point3(0.0f, 0.0f, 0.0f);
+						s.s = image_plane_point(x + offset.x, y + offset.y, width, render->height);
+						tile.push_back(s);
+					}
+				}
+			}
+
+			trace_tile(tile);
+
+			int next = 0;
+			for (int y = tile_y; y < end_y; y++)
+			{
+				for (int x = tile_x; x < end_x; x++)
+				{
+					for (int sample = counts.at(y * width + x); sample < render->samples; sample++)
+					{
+						sums.at(y * width + x) += tile.at(next++).colour;
+					}
+					counts.at(y * width + x) = glm::max(counts.at(y * width + x), (unsigned int)render->samples);
+				}
+			}
+		}
+	}
+}
+
+void render_checkpoint_tile(void *job, int index)
+{
+	checkpoint_render *render = (checkpoint_render *)job;
+	int width = render->width;
+	std::vector<colour3> &sums = *render->sums;
+	std::vector<unsigned int> &counts = *render->counts;
+	render_statistics &statistics = thread_statistics();
+
+	trace_scope scope("render tile");
+	const journal_tile &t = render->tiles->at(index);
+
+	// the cost maps time every pixel on its own, without them the samples are traced a light tile at a time
+	if (render->costs == NULL)
+	{
+		render_culled_tile(render, t);
+	}
+	else
+	{
+		for (int y = t.y; y < t.y + t.height; y++)
+		{
+			for (int x = t.x; x < t.x + t.width; x++)
+			{
+				render_statistics before = statistics;
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+				for (int sample = counts.at(y * width + x); sample < render->samples; sample++)
+				{
+					glm::vec2 offset = sample_offset(x, y, sample);
+					point3 e(0.0f, 0.0f, 0.0f);
+					point3 s = image_plane_point(x + offset.x, y + offset.y, width, render->height);
+					colour3 colour(0, 0, 0);
+
+					if (!trace(e, s, colour))
+					{
+						colour = current_scene->background_colour;
+					}
+					sums.at(y * width + x) += colour;
+					counts.at(y * width + x) = sample + 1;
+				}
+
+				pixel_cost &cost = render->costs->at(y * width + x);
+				cost.nanoseconds = std::chrono::duration<float, std::nano>(std::chrono::steady_clock::now() - start).count();
+				cost.rays = (statistics.rays - before.rays) + (statistics.shadow_rays - before.shadow_rays);
+				cost.node_visits = (statistics.node_visits - before.node_visits) + (statistics.shadow_node_visits - before.shadow_node_visits);
+				cost.primitive_tests = (statistics.hit_shape_tests - before.hit_shape_tests) + (statistics.shadow_shape_tests - before.shadow_shape_tests);
+			}
+		}
+	}
+
+	if (render->writer->file == NULL)
+	{
+		return;
+	}
+
+	journal_record *record = make_record(t, width, sums, counts);
+	{
+		std::lock_guard<std::mutex> lock(render->writer->mutex);
+		render->writer->queue.push_back(record);
+	}
+}
+
+// The journal is written afresh, so whatever was cut short last time does not stay in it. The tiles
+// resumed from it go to a new file first, which only replaces the journal once it is complete. The
+// journal is then open for the tiles still to come, or NULL when any of that failed.
+FILE * start_journal(const std::string &journal_path, const journal_header &header, int width,
+	const std::vector<journal_tile> &done, const std::vector<colour3> &sums, const std::vector<unsigned int> &counts)
+{
+	std::string fresh_path = journal_path + ".tmp";
+	FILE *file = fopen(fresh_path.c_str(), "wb");
+	if (file == NULL)
+	{
+		std::cout << "Unable to write journal " << fresh_path << std::endl;
+		return NULL;
+	}
+
+	fwrite(&header, sizeof(header), 1, file);
+	for (int i = 0; i < done.size(); i++)
+	{
+		journal_record *record = make_record(done.at(i), width, sums, counts);
+		write_record(file, *record);
+		delete record;
+	}
+
+	bool written = fflush(file) == 0 && !ferror(file);
+	fclose(file);
+
+	// rename() does not replace an existing file on Windows
+	if (!written || (rename(fresh_path.c_str(), journal_path.c_str()) != 0 &&
+		(remove(journal_path.c_str()) != 0 || rename(fresh_path.c_str(), journal_path.c_str()) != 0)))
+	{
+		std::cout << "Unable to replace journal " << journal_path << " with " << fresh_path << std::endl;
+		remove(fresh_path.c_str());
+		return NULL;
+	}
+
+	file = fopen(journal_path.c_str(), "ab");
+	if (file == NULL)
+	{
+		std::cout << "Unable to write journal " << journal_path << std::endl;
+	}
+	return file;
+}
+
+void render_with_checkpoints(int width, int height, int samples, const std::string &journal_path, bool resume,
+	std::vector<colour3> &pixels, std::vector<pixel_cost> *costs)
+{
+	journal_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "RTJ2", 4);
+	header.width = width;
+	header.height = height;
+	header.samples = samples;
+	header.tile_size = RENDER_TILE_SIZE;
+
+	// a journal of another scene, or of this one before it was edited, must not be resumed
+	header.scene_hash = path_hash(current_scene->scene_file);
+	file_stamp(current_scene->scene_file, header.scene_size, header.scene_time);
+
+	std::vector<colour3> sums(width * height, colour3(0, 0, 0));
+	std::vector<unsigned int> counts(width * height, 0);
+
+	if (costs != NULL)
+	{
+		pixel_cost nothing = { 0, 0, 0, 0 };
+		costs->assign(width * height, nothing);
+	}
+
+	std::vector<journal_tile> done;
+	if (resume && load_journal(journal_path, header, sums, counts, done) > 0)
+	{
+		std::cout << "Resuming with " << done.size() << " tiles from " << journal_path << std::endl;
+	}
+
+	std::vector<bool> finished(((width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE) * ((height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE), false);
+	int tiles_x = (width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+	for (int i = 0; i < done.size(); i++)
+	{
+		finished.at((done.at(i).y / RENDER_TILE_SIZE) * tiles_x + done.at(i).x / RENDER_TILE_SIZE) = true;
+	}
+
+	// a journal that cannot be written only costs the checkpoints, the image is rendered all the same
+	journal_writer writer;
+	writer.stop = false;
+	writer.file = start_journal(journal_path, header, width, done, sums, counts);
+	if (writer.file == NULL)
+	{
+		std::cout << "Rendering without checkpoints" << std::endl;
+	}
+
+	pixel_rect frame = { 0, 0, width, height };
+	std::vector<pixel_rect> frame_tiles;
+	split_into_tiles(frame, frame_tiles);
+
+	std::vector<journal_tile> tiles;
+	for (int i = 0; i < frame_tiles.size(); i++)
+	{
+		const pixel_rect &r = frame_tiles.at(i);
+		if (finished.at((r.y / RENDER_TILE_SIZE) * tiles_x + r.x / RENDER_TILE_SIZE))
+		{
+			continue;
+		}
+
+		journal_tile t;
+		t.x = r.x;
+		t.y = r.y;
+		t.width = r.width;
+		t.height = r.height;
+		tiles.push_back(t);
+	}
+
+	if (writer.file != NULL)
+	{
+		writer.thread = std::thread(journal_writer_loop, &writer);
+	}
+
+	checkpoint_render render;
+	render.width = width;
+	render.height = height;
+	render.samples = samples;
+	render.tiles = &tiles;
+	render.sums = &sums;
+	render.counts = &counts;
+	render.costs = costs;
+	render.writer = &writer;
+
+	render_tiles(current_scene, tiles.size(), render_checkpoint_tile, &render);
+
+	if (writer.file != NULL)
+	{
+		{
+			std::lock_guard<std::mutex> lock(writer.mutex);
+			writer.stop = true;
+		}
+		writer.wake.notify_one();
+		writer.thread.join();
+		fclose(writer.file);
+	}
+
+	pixels.resize(width * height);
+	for (int i = 0; i < width * height; i++)
+	{
+		pixels.at(i) = counts.at(i) > 0 ? sums.at(i) / (float)counts.at(i) : current_scene->background_colour;
+	}
+}
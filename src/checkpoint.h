@@ -0,0 +1,20 @@
+#ifndef checkpoint_h
+#define checkpoint_h
+#include "raytracer.h"
+#include "cost.h"
+
+// Renders an image tile by tile on all cores, taking samples per pixel, and appends
+// every finished tile (the summed colour and the sample count of each pixel) to the
+// journal at journal_path. With resume set, the tiles already in the journal are
+// taken from it instead of being rendered again, as long as it was written for the
+// same scene file, unchanged since, at the same size and samples. When the journal
+// cannot be written the image is rendered all the same, without checkpoints.
+//
+// With costs, what every pixel took to render is kept there as well; tiles taken
+// from the journal cost nothing.
+void render_with_checkpoints(int width, int height, int samples, const std::string &journal_path, bool resume,
+	std::vector<colour3> &pixels, std::vector<pixel_cost> *costs = NULL);
+
+extern double checkpoint_interval;
+
+#endif
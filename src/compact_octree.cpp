@@ -0,0 +1,330 @@
+#include "compact_octree.h"
+#include "statistics.h"
+#include "trace.h"
+#include "scene.h"
+#include <cmath>
+#include <cstring>
+
+static_assert(sizeof(compact_node) == 64, "a compact node should fill one cache line");
+
+// Scale of the 8 bit grid over a box: a power of two, so that decoding lo + q * scale
+// only rounds once, and big enough that 255 steps reach past hi.
+float gridScale(float lo, float hi)
+{
+	int exponent;
+	frexpf((hi - lo) / 255.0f, &exponent);
+	float scale = ldexpf(1.0f, exponent);
+
+	if (lo + 255.0f * scale < hi)
+	{
+		scale *= 2.0f;
+	}
+	return scale;
+}
+
+void quantize(float lo, float scale, float child_lo, float child_hi, unsigned char &q_lo, unsigned char &q_hi)
+{
+	int a = glm::clamp((int)floorf((child_lo - lo) / scale), 0, 255);
+	int b = glm::clamp((int)ceilf((child_hi - lo) / scale), 0, 255);
+
+	// the divisions round, the decoded box has to stay outside the real one
+	while (a > 0 && lo + a * scale > child_lo)
+	{
+		a--;
+	}
+	while (b < 255 && lo + b * scale < child_hi)
+	{
+		b++;
+	}
+	q_lo = (unsigned char)a;
+	q_hi = (unsigned char)b;
+}
+
+void addCompactLeaf(std::vector<compact_leaf> &leaves, Node * node)
+{
+	compact_octree_state &compact = current_scene->compact;
+	compact_leaf leaf;
+	leaf.first_shape = compact.shapes.size();
+	leaf.shape_count = node->shapes_contained.size();
+	compact.shapes.insert(compact.shapes.end(), node->shapes_contained.begin(), node->shapes_contained.end());
+	leaves.push_back(leaf);
+}
+
+// fills nodes[index] from node, whose decoded box is lo..hi
+void fillCompactNode(std::vector<compact_node> &nodes, int index, Node * node, const float lo[3], const float hi[3])
+{
+	compact_octree_state &compact = current_scene->compact;
+	float scale[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		scale[axis] = gridScale(lo[axis], hi[axis]);
+	}
+
+	compact_node n;
+	memset(&n, 0, sizeof(n));
+	n.child_count = node->children.size();
+
+	std::vector<Node *> inner;
+	n.first_leaf = compact.leaves.size();
+
+	for (int i = 0; i < node->children.size(); i++)
+	{
+		Node * child = node->children.at(i);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			quantize(lo[axis], scale[axis], child->bounding.at(axis * 2), child->bounding.at(axis * 2 + 1), n.lower[axis][i], n.upper[axis][i]);
+		}
+
+		if (child->children.size() == 0)
+		{
+			n.leaf_mask |= 1 << i;
+			addCompactLeaf(compact.leaves, child);
+		}
+		else
+		{
+			inner.push_back(child);
+		}
+	}
+
+	// the inner children get a block of their own, their children come after it
+	n.first_child = nodes.size();
+	nodes.resize(nodes.size() + inner.size());
+	nodes.at(index) = n;
+
+	int k = 0;
+	for (int i = 0; i < node->children.size(); i++)
+	{
+		if (n.leaf_mask & (1 << i))
+		{
+			continue;
+		}
+
+		float child_lo[3], child_hi[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			child_lo[axis] = lo[axis] + n.lower[axis][i] * scale[axis];
+			child_hi[axis] = lo[axis] + n.upper[axis][i] * scale[axis];
+		}
+		fillCompactNode(nodes, n.first_child + k, inner.at(k), child_lo, child_hi);
+		k++;
+	}
+}
+
+size_t pointerOctreeBytes(Node * node)
+{
+	size_t bytes = sizeof(Node) + node->bounding.capacity() * sizeof(float)
+		+ node->children.capacity() * sizeof(Node *) + node->shapes_contained.capacity() * sizeof(shape *);
+
+	for (int i = 0; i < node->children.size(); i++)
+	{
+		bytes += pointerOctreeBytes(node->children.at(i));
+	}
+	return bytes;
+}
+
+// flattens ocTree_root, has to run again whenever the octree is built, refitted or its leaves change
+void buildCompactOctree()
+{
+	compact_octree_state &compact = current_scene->compact;
+	trace_scope scope("build compact octree");
+	std::vector<compact_node> nodes(1);
+	compact.leaves.clear();
+	compact.shapes.clear();
+
+	float lo[3], hi[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		compact.root_bounding[axis * 2] = current_scene->ocTree_root->bounding.at(axis * 2);
+		compact.root_bounding[axis * 2 + 1] = current_scene->ocTree_root->bounding.at(axis * 2 + 1);
+		lo[axis] = compact.root_bounding[axis * 2];
+		hi[axis] = compact.root_bounding[axis * 2 + 1];
+	}
+
+	if (current_scene->ocTree_root->children.size() == 0)
+	{
+		// a root that is a leaf becomes the only child of a node around it
+		Node wrapper;
+		wrapper.bounding = current_scene->ocTree_root->bounding;
+		wrapper.children.push_back(current_scene->ocTree_root);
+		fillCompactNode(nodes, 0, &wrapper, lo, hi);
+	}
+	else
+	{
+		fillCompactNode(nodes, 0, current_scene->ocTree_root, lo, hi);
+	}
+
+	compact.storage.assign(nodes.size() * sizeof(compact_node) + 63, 0);
+	compact.nodes = (compact_node *)(((size_t)&compact.storage[0] + 63) & ~(size_t)63);
+	memcpy(compact.nodes, &nodes[0], nodes.size() * sizeof(compact_node));
+	compact.node_count = nodes.size();
+	compact.ready = true;
+
+	compact.encoded_bytes = nodes.size() * sizeof(compact_node) + compact.leaves.size() * sizeof(compact_leaf) + compact.shapes.size() * sizeof(shape *);
+}
+
+size_t compactOctreeBytes()
+{
+	const compact_octree_state &compact = current_scene->compact;
+	return compact.storage.capacity() + compact.leaves.capacity() * sizeof(compact_leaf) + compact.shapes.capacity() * sizeof(shape *);
+}
+
+// the same slab test as ray_box_intersection, on a decoded box
+bool compactBoxHit(const glm::vec3 &e, const glm::vec3 &s, const float box[6])
+{
+	float txmin, txmax;
+	float tymin, tymax;
+	float tzmin, tzmax;
+
+	bool isIntersected = true;
+
+	if ((s - e).x >= 0)
+	{
+		txmin = (box[0] - e.x) / (s - e).x;
+		txmax = (box[1] - e.x) / (s - e).x;
+	}
+	else
+	{
+		txmin = (box[1] - e.x) / (s - e).x;
+		txmax = (box[0] - e.x) / (s - e).x;
+	}
+
+	if ((s - e).y >= 0)
+	{
+		tymin = (box[2] - e.y) / (s - e).y;
+		tymax = (box[3] - e.y) / (s - e).y;
+	}
+	else
+	{
+		tymin = (box[3] - e.y) / (s - e).y;
+		tymax = (box[2] - e.y) / (s - e).y;
+	}
+
+	if (txmin > tymax || tymin > txmax)
+	{
+		isIntersected = false;
+	}
+
+	if (tymin > txmin)
+	{
+		txmin = tymin;
+	}
+
+	if (tymax < txmax)
+	{
+		txmax = tymax;
+	}
+
+	if ((s - e).z >= 0)
+	{
+		tzmin = (box[4] - e.z) / (s - e).z;
+		tzmax = (box[5] - e.z) / (s - e).z;
+	}
+	else
+	{
+		tzmin = (box[5] - e.z) / (s - e).z;
+		tzmax = (box[4] - e.z) / (s - e).z;
+	}
+
+	if (txmin > tzmax || tzmin > txmax)
+	{
+		isIntersected = false;
+	}
+
+	return isIntersected;
+}
+
+void addCompactLeafShapes(const compact_leaf &leaf, std::vector<shape *> &objects_to_for_hit_testing)
+{
+	const compact_octree_state &compact = current_scene->compact;
+	for (int i = 0; i < leaf.shape_count; i++)
+	{
+		shape * candidate = compact.shapes[leaf.first_shape + i];
+
+		bool ifExsit = false;
+		for (int j = 0; j < objects_to_for_hit_testing.size(); j++)
+		{
+			if (objects_to_for_hit_testing[j] == candidate)
+			{
+				ifExsit = true;
+				break;
+			}
+		}
+		if (!ifExsit)
+		{
+			objects_to_for_hit_testing.push_back(candidate);
+		}
+	}
+}
+
+void compactVisit(const glm::vec3 &e, const glm::vec3 &s, int index, const float lo[3], const float hi[3], std::vector<shape *> &objects_to_for_hit_testing)
+{
+	const compact_octree_state &compact = current_scene->compact;
+	const compact_node &node = compact.nodes[index];
+
+	render_statistics &statistics = thread_statistics();
+	statistics.node_visits++;
+	statistics.box_tests += node.child_count;
+
+	float scale[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		scale[axis] = gridScale(lo[axis], hi[axis]);
+	}
+
+	int inner = 0;
+	int leaves = 0;
+
+	for (int i = 0; i < node.child_count; i++)
+	{
+		float box[6];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			box[axis * 2] = lo[axis] + node.lower[axis][i] * scale[axis];
+			box[axis * 2 + 1] = lo[axis] + node.upper[axis][i] * scale[axis];
+		}
+
+		bool leaf = (node.leaf_mask & (1 << i)) != 0;
+
+		if (compactBoxHit(e, s, box))
+		{
+			if (leaf)
+			{
+				addCompactLeafShapes(compact.leaves[node.first_leaf + leaves], objects_to_for_hit_testing);
+			}
+			else
+			{
+				float child_lo[3] = { box[0], box[2], box[4] };
+				float child_hi[3] = { box[1], box[3], box[5] };
+				compactVisit(e, s, node.first_child + inner, child_lo, child_hi, objects_to_for_hit_testing);
+			}
+		}
+
+		if (leaf)
+		{
+			leaves++;
+		}
+		else
+		{
+			inner++;
+		}
+	}
+}
+
+// collects the candidate shapes along the ray like ray_box_intersection, the planes are added once at the end
+void compactRayBoxIntersection(const glm::vec3 &e, const glm::vec3 &s, std::vector<shape *> &objects_to_for_hit_testing)
+{
+	const compact_octree_state &compact = current_scene->compact;
+	thread_statistics().box_tests++;
+
+	if (compactBoxHit(e, s, compact.root_bounding))
+	{
+		float lo[3] = { compact.root_bounding[0], compact.root_bounding[2], compact.root_bounding[4] };
+		float hi[3] = { compact.root_bounding[1], compact.root_bounding[3], compact.root_bounding[5] };
+		compactVisit(e, s, 0, lo, hi, objects_to_for_hit_testing);
+	}
+
+	for (int i = 0; i < current_scene->listOfPlanes.size(); i++)
+	{
+		objects_to_for_hit_testing.push_back(current_scene->listOfPlanes.at(i));
+	}
+}
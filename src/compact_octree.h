@@ -0,0 +1,48 @@
+#ifndef compact_octree_h
+#define compact_octree_h
+#include "raytracer.h"
+
+// The octree flattened into one array of 64 byte nodes. A node keeps the boxes of its
+// children quantized to 8 bits inside its own box, rounded outwards, and the indices of
+// its first inner child and first leaf; inner children and leaves are stored next to
+// their siblings. Traversal decodes the boxes on the way down. A decoded box always
+// contains the real one, so a ray finds the same shapes as with the Node tree, plus
+// at most a few from neighbouring leaves, and hitTesting keeps the nearest.
+struct compact_node
+{
+	unsigned char lower[3][8]; // per axis, per child
+	unsigned char upper[3][8];
+	unsigned int first_child;
+	unsigned int first_leaf;
+	unsigned char child_count;
+	unsigned char leaf_mask; // bit i is set when child i is a leaf
+	unsigned char padding[6];
+};
+
+struct compact_leaf
+{
+	unsigned int first_shape;
+	unsigned int shape_count;
+};
+
+// what buildCompactOctree() made of the octree of a scene
+struct compact_octree_state
+{
+	bool ready;
+	std::vector<char> storage;
+	compact_node * nodes; // cache line aligned, inside storage
+	int node_count;
+	std::vector<compact_leaf> leaves;
+	std::vector<shape *> shapes;
+	float root_bounding[6];
+	size_t encoded_bytes; // of the nodes, leaves and shape references when it was last built, print_statistics() reports it
+
+	compact_octree_state() : ready(false), nodes(NULL), node_count(0), encoded_bytes(0) {}
+};
+
+void buildCompactOctree();
+size_t pointerOctreeBytes(Node * node); // of the Node tree below node
+size_t compactOctreeBytes();
+void compactRayBoxIntersection(const glm::vec3 &e, const glm::vec3 &s, std::vector<shape *> &objects_to_for_hit_testing);
+
+#endif
@@ -0,0 +1,67 @@
+#include "cost.h"
+#include "render.h"
+#include <algorithm>
+
+colour3 heat_colour(float t)
+{
+	const colour3 ramp[] = {
+		colour3(0, 0, 0),
+		colour3(0, 0, 1),
+		colour3(1, 0, 0),
+		colour3(1, 1, 0),
+		colour3(1, 1, 1)
+	};
+
+	float position = glm::clamp(t, 0.0f, 1.0f) * 4.0f;
+	int i = glm::min((int)position, 3);
+	return glm::mix(ramp[i], ramp[i + 1], position - i);
+}
+
+void write_cost_image(const std::string &fn, const char *what, int width, int height, const std::vector<float> &values)
+{
+	std::vector<float> sorted = values;
+	size_t n = (size_t)(sorted.size() * 0.99);
+	n = glm::min(n, sorted.size() - 1);
+	std::nth_element(sorted.begin(), sorted.begin() + n, sorted.end());
+	float scale = sorted.at(n);
+
+	float total = 0;
+	float highest = 0;
+	std::vector<colour3> pixels(values.size());
+
+	for (int i = 0; i < values.size(); i++)
+	{
+		pixels.at(i) = heat_colour(scale > 0 ? values.at(i) / scale : 0.0f);
+		total += values.at(i);
+		highest = glm::max(highest, values.at(i));
+	}
+
+	if (write_ppm(fn, width, height, pixels))
+	{
+		std::cout << "	" << what << " per pixel: " << total / values.size() << " average, " << highest << " highest, white at "
+			<< scale << ", in " << fn << std::endl;
+	}
+}
+
+void write_cost_images(const std::string &prefix, int width, int height, const std::vector<pixel_cost> &costs)
+{
+	if (costs.size() == 0)
+	{
+		return;
+	}
+
+	std::vector<float> nanoseconds, rays, node_visits, primitive_tests;
+	for (int i = 0; i < costs.size(); i++)
+	{
+		nanoseconds.push_back(costs.at(i).nanoseconds);
+		rays.push_back(costs.at(i).rays);
+		node_visits.push_back(costs.at(i).node_visits);
+		primitive_tests.push_back(costs.at(i).primitive_tests);
+	}
+
+	std::cout << "Cost:" << std::endl;
+	write_cost_image(prefix + "_time.ppm", "nanoseconds", width, height, nanoseconds);
+	write_cost_image(prefix + "_rays.ppm", "rays", width, height, rays);
+	write_cost_image(prefix + "_nodes.ppm", "node visits", width, height, node_visits);
+	write_cost_image(prefix + "_tests.ppm", "primitive tests", width, height, primitive_tests);
+}
@@ -0,0 +1,20 @@
+#ifndef cost_h
+#define cost_h
+#include "raytracer.h"
+
+// What the samples of one pixel cost, counting every ray they led to: reflections,
+// refractions and shadow rays as well as the primary ones.
+struct pixel_cost
+{
+	float nanoseconds;
+	unsigned int rays;
+	unsigned int node_visits;
+	unsigned int primitive_tests;
+};
+
+// Writes <prefix>_time.ppm, _rays.ppm, _nodes.ppm and _tests.ppm, each cost from black through
+// blue, red and yellow to white. White is the 99th percentile of the image, so that a few
+// outliers do not leave the rest dark; the scales are printed.
+void write_cost_images(const std::string &prefix, int width, int height, const std::vector<pixel_cost> &costs);
+
+#endif
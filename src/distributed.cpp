@@ -0,0 +1,487 @@
+#include "distributed.h"
+#include "raytracer.h"
+#include "render.h"
+#include "region.h"
+#include <chrono>
+#include <deque>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#endif
+
+// both ends run on the same machine, so the messages are sent as they are in memory
+struct tile_job
+{
+	int x, y;
+	int width, height; // a width of 0 tells the worker to quit
+	int image_width, image_height;
+	int samples;
+};
+
+// followed by width * height colours, bottom row first
+struct tile_result
+{
+	int x, y;
+	int width, height;
+};
+
+// tiles sent to a worker before it has answered, so it does not sit idle while the next one travels
+const int TILES_IN_FLIGHT = 2;
+
+// A worker that has been on one tile for longer than this many times the slowest tile so far,
+// and at least TILE_TIMEOUT_SECONDS, is taken to hang: its tiles are handed on, and it is killed
+// if it is one of the coordinator's own processes. Until some tile has come back there is
+// nothing to tell how long a tile takes, so nobody is timed out before then.
+const double TILE_TIMEOUT_FACTOR = 10;
+const double TILE_TIMEOUT_SECONDS = 30;
+
+#ifdef _WIN32
+
+void run_coordinator(const char *scene_name, int workers, int width, int height, int samples, const std::string &output)
+{
+	std::cout << "Distributed rendering needs Unix domain sockets and is not available on Windows." << std::endl;
+}
+
+void run_worker(const char *scene_name, const std::string &socket_path)
+{
+	std::cout << "Distributed rendering needs Unix domain sockets and is not available on Windows." << std::endl;
+}
+
+#else
+
+struct worker_connection
+{
+	int fd;
+	int pid;
+	bool alive;
+	std::deque<tile_job> in_flight;
+	std::chrono::steady_clock::time_point front_started; // when the worker could start on in_flight.front()
+
+	int tiles;
+	long long pixels;
+	std::chrono::steady_clock::time_point connected;
+	std::chrono::steady_clock::time_point last_result;
+};
+
+bool write_all(int fd, const void *data, size_t size)
+{
+	const char *p = (const char *)data;
+
+	while (size > 0)
+	{
+		ssize_t n = write(fd, p, size);
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n <= 0)
+		{
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool read_all(int fd, void *data, size_t size)
+{
+	char *p = (char *)data;
+
+	while (size > 0)
+	{
+		ssize_t n = read(fd, p, size);
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n <= 0)
+		{
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+sockaddr_un socket_address(const std::string &path)
+{
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+	return address;
+}
+
+void run_worker(const char *scene_name, const std::string &socket_path)
+{
+	choose_scene(scene_name);
+	getBoundingAndShapeList();
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un address = socket_address(socket_path);
+
+	if (fd < 0 || connect(fd, (sockaddr *)&address, sizeof(address)) != 0)
+	{
+		std::cout << "Worker " << getpid() << " could not connect to " << socket_path << std::endl;
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return;
+	}
+
+	int pid = getpid();
+	write_all(fd, &pid, sizeof(pid));
+
+	tile_job job;
+	std::vector<colour3> pixels;
+
+	while (read_all(fd, &job, sizeof(job)) && job.width != 0)
+	{
+		render_tile(job.x, job.y, job.width, job.height, job.image_width, job.image_height, job.samples, pixels);
+
+		tile_result result;
+		result.x = job.x;
+		result.y = job.y;
+		result.width = job.width;
+		result.height = job.height;
+
+		if (!write_all(fd, &result, sizeof(result)) || !write_all(fd, &pixels[0], pixels.size() * sizeof(colour3)))
+		{
+			break;
+		}
+	}
+	close(fd);
+}
+
+// puts the tiles the worker still owed back in front of the queue
+void fail_worker(worker_connection &worker, std::deque<tile_job> &jobs)
+{
+	std::cout << "Worker " << worker.pid << " failed, handing its " << worker.in_flight.size() << " tiles to the others." << std::endl;
+
+	while (worker.in_flight.size() != 0)
+	{
+		jobs.push_front(worker.in_flight.back());
+		worker.in_flight.pop_back();
+	}
+	close(worker.fd);
+	worker.alive = false;
+}
+
+void assign_jobs(worker_connection &worker, std::deque<tile_job> &jobs)
+{
+	while (worker.alive && worker.in_flight.size() < TILES_IN_FLIGHT && jobs.size() != 0)
+	{
+		tile_job job = jobs.front();
+		jobs.pop_front();
+		if (worker.in_flight.size() == 0)
+		{
+			worker.front_started = std::chrono::steady_clock::now();
+		}
+		worker.in_flight.push_back(job);
+
+		if (!write_all(worker.fd, &job, sizeof(job)))
+		{
+			fail_worker(worker, jobs);
+		}
+	}
+}
+
+// reads one finished tile into the image, false if the worker is gone or sent something other
+// than the tile it was given first; slowest_tile gets the seconds the worker took over it if that is more
+bool receive_tile(worker_connection &worker, int width, std::vector<colour3> &image, double &slowest_tile)
+{
+	tile_result result;
+	if (!read_all(worker.fd, &result, sizeof(result)) || worker.in_flight.size() == 0)
+	{
+		return false;
+	}
+
+	const tile_job &job = worker.in_flight.front();
+	if (result.x != job.x || result.y != job.y || result.width != job.width || result.height != job.height)
+	{
+		std::cout << "Worker " << worker.pid << " sent a tile at " << result.x << "," << result.y << " it was not given." << std::endl;
+		return false;
+	}
+
+	std::vector<colour3> pixels(result.width * result.height);
+	if (!read_all(worker.fd, &pixels[0], pixels.size() * sizeof(colour3)))
+	{
+		return false;
+	}
+
+	// a worker answers its tiles in the order they were sent, and starts on the next one now
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	slowest_tile = glm::max(slowest_tile, std::chrono::duration<double>(now - worker.front_started).count());
+	worker.in_flight.pop_front();
+	worker.front_started = now;
+
+	for (int j = 0; j < result.height; j++)
+	{
+		for (int i = 0; i < result.width; i++)
+		{
+			image.at((result.y + j) * width + result.x + i) = pixels.at(j * result.width + i);
+		}
+	}
+
+	worker.tiles++;
+	worker.pixels += pixels.size();
+	worker.last_result = now;
+	return true;
+}
+
+void run_coordinator(const char *scene_name, int workers, int width, int height, int samples, const std::string &output)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// a worker that dies mid-write must not take the coordinator with it
+	signal(SIGPIPE, SIG_IGN);
+
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/raytracer_%d.sock", (int)getpid());
+	unlink(path);
+
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un address = socket_address(path);
+
+	if (listen_fd < 0 || bind(listen_fd, (sockaddr *)&address, sizeof(address)) != 0 || listen(listen_fd, 64) != 0)
+	{
+		std::cout << "Unable to open socket " << path << std::endl;
+		return;
+	}
+
+	pixel_rect frame = { 0, 0, width, height };
+	std::vector<pixel_rect> tiles;
+	split_into_tiles(frame, tiles);
+
+	std::deque<tile_job> jobs;
+	for (int i = 0; i < tiles.size(); i++)
+	{
+		tile_job job;
+		job.x = tiles.at(i).x;
+		job.y = tiles.at(i).y;
+		job.width = tiles.at(i).width;
+		job.height = tiles.at(i).height;
+		job.image_width = width;
+		job.image_height = height;
+		job.samples = samples;
+		jobs.push_back(job);
+	}
+	int tiles_left = jobs.size();
+
+	std::cout << "Rendering " << tiles_left << " tiles with " << workers << " workers and " << samples << " samples per pixel on "
+		<< path << std::endl;
+	std::cout.flush();
+
+	std::vector<int> children;
+	for (int i = 0; i < workers; i++)
+	{
+		int pid = fork();
+		if (pid == 0)
+		{
+			close(listen_fd);
+			run_worker(scene_name, path);
+			_exit(0);
+		}
+		if (pid > 0)
+		{
+			children.push_back(pid);
+		}
+	}
+
+	std::vector<colour3> image(width * height, colour3(0, 0, 0));
+	std::vector<worker_connection> connections;
+	int running_children = children.size();
+	double slowest_tile = 0;
+
+	while (tiles_left > 0)
+	{
+		int connected = 0;
+		for (int i = 0; i < connections.size(); i++)
+		{
+			connected += connections.at(i).alive ? 1 : 0;
+		}
+
+		// with nobody left to send tiles to, the rest is rendered here
+		if (connected == 0 && running_children == 0)
+		{
+			std::cout << "No workers left, rendering the remaining " << jobs.size() << " tiles here." << std::endl;
+			choose_scene(scene_name);
+			getBoundingAndShapeList();
+
+			std::vector<colour3> pixels;
+			while (jobs.size() != 0)
+			{
+				tile_job job = jobs.front();
+				jobs.pop_front();
+				render_tile(job.x, job.y, job.width, job.height, width, height, samples, pixels);
+
+				for (int j = 0; j < job.height; j++)
+				{
+					for (int i = 0; i < job.width; i++)
+					{
+						image.at((job.y + j) * width + job.x + i) = pixels.at(j * job.width + i);
+					}
+				}
+				tiles_left--;
+			}
+			break;
+		}
+
+		std::vector<pollfd> fds;
+		std::vector<int> owners;
+
+		pollfd listening;
+		listening.fd = listen_fd;
+		listening.events = POLLIN;
+		listening.revents = 0;
+		fds.push_back(listening);
+		owners.push_back(-1);
+
+		for (int i = 0; i < connections.size(); i++)
+		{
+			if (connections.at(i).alive)
+			{
+				pollfd p;
+				p.fd = connections.at(i).fd;
+				p.events = POLLIN;
+				p.revents = 0;
+				fds.push_back(p);
+				owners.push_back(i);
+			}
+		}
+
+		poll(&fds[0], fds.size(), 100);
+
+		for (int f = 0; f < fds.size(); f++)
+		{
+			if (fds.at(f).revents == 0)
+			{
+				continue;
+			}
+
+			if (owners.at(f) < 0)
+			{
+				worker_connection worker;
+				worker.fd = accept(listen_fd, NULL, NULL);
+				worker.pid = -1;
+				worker.alive = worker.fd >= 0 && read_all(worker.fd, &worker.pid, sizeof(worker.pid));
+				worker.tiles = 0;
+				worker.pixels = 0;
+				worker.connected = std::chrono::steady_clock::now();
+				worker.last_result = worker.connected;
+				worker.front_started = worker.connected;
+
+				if (worker.alive)
+				{
+					connections.push_back(worker);
+				}
+				else if (worker.fd >= 0)
+				{
+					close(worker.fd);
+				}
+				continue;
+			}
+
+			worker_connection &worker = connections.at(owners.at(f));
+
+			if (receive_tile(worker, width, image, slowest_tile))
+			{
+				tiles_left--;
+			}
+			else
+			{
+				fail_worker(worker, jobs);
+			}
+		}
+
+		// a worker that hangs keeps its socket open, only the time it takes gives it away
+		double timeout = glm::max(TILE_TIMEOUT_SECONDS, TILE_TIMEOUT_FACTOR * slowest_tile);
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+		for (int i = 0; i < connections.size() && slowest_tile > 0; i++)
+		{
+			worker_connection &worker = connections.at(i);
+			if (worker.alive && worker.in_flight.size() != 0
+				&& std::chrono::duration<double>(now - worker.front_started).count() > timeout)
+			{
+				std::cout << "Worker " << worker.pid << " has been on a tile for more than " << timeout << " s." << std::endl;
+
+				// the pid is only what the worker said it was, a process of somebody else's is left alone
+				if (std::find(children.begin(), children.end(), worker.pid) != children.end())
+				{
+					kill(worker.pid, SIGKILL);
+				}
+				fail_worker(worker, jobs);
+			}
+		}
+
+		// refills every worker, including ones that just connected or lost a neighbour's tiles
+		for (int i = 0; i < connections.size(); i++)
+		{
+			assign_jobs(connections.at(i), jobs);
+		}
+
+		for (int i = 0; i < children.size(); i++)
+		{
+			if (children.at(i) > 0 && waitpid(children.at(i), NULL, WNOHANG) == children.at(i))
+			{
+				children.at(i) = -1;
+				running_children--;
+			}
+		}
+	}
+
+	for (int i = 0; i < connections.size(); i++)
+	{
+		worker_connection &worker = connections.at(i);
+		if (worker.alive)
+		{
+			tile_job quit;
+			memset(&quit, 0, sizeof(quit));
+			write_all(worker.fd, &quit, sizeof(quit));
+			close(worker.fd);
+		}
+	}
+	for (int i = 0; i < children.size(); i++)
+	{
+		if (children.at(i) > 0)
+		{
+			waitpid(children.at(i), NULL, 0);
+		}
+	}
+	close(listen_fd);
+	unlink(path);
+
+	double total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Rendered in " << total_ms << " ms" << std::endl;
+
+	for (int i = 0; i < connections.size(); i++)
+	{
+		worker_connection &worker = connections.at(i);
+		double seconds = std::chrono::duration<double>(worker.last_result - worker.connected).count();
+
+		std::cout << "\tworker " << worker.pid << ": " << worker.tiles << " tiles, " << worker.pixels << " pixels";
+		if (seconds > 0)
+		{
+			std::cout << ", " << worker.pixels / seconds << " pixels/s";
+		}
+		std::cout << (worker.alive ? "" : " (failed)") << std::endl;
+	}
+
+	write_ppm(output + ".ppm", width, height, image);
+}
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef distributed_h
+#define distributed_h
+#include <string>
+
+// Renders one still with local worker processes. The coordinator hands out tiles over a
+// Unix domain socket, a couple at a time, so faster workers simply get more of them;
+// tiles of a worker that dies, or takes far longer over a tile than any tile has taken
+// so far, are handed to the others.
+void run_coordinator(const char *scene_name, int workers, int width, int height, int samples, const std::string &output);
+
+// Loads the scene and renders the tiles the coordinator at socket_path sends until told to stop.
+void run_worker(const char *scene_name, const std::string &socket_path);
+
+#endif
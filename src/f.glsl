@@ -1,10 +1,11 @@
 #version 150
 
-in vec3 colour;
+in vec2 texCoord;
+uniform sampler2D image;
 out vec4 out_colour;
 
 void main() 
 { 
-  out_colour.rgb = colour;
+  out_colour.rgb = texture(image, texCoord).rgb;
   out_colour.a = 1;
 }
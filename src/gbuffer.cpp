@@ -0,0 +1,49 @@
+#include "gbuffer.h"
+#include "scene.h"
+
+std::vector<gbuffer_sample> gbuffer;
+int gbuffer_width = 0;
+int gbuffer_height = 0;
+
+// set once a whole pass has filled the buffer
+bool gbuffer_valid = false;
+
+void resize_gbuffer(int width, int height)
+{
+	if (width != gbuffer_width || height != gbuffer_height)
+	{
+		gbuffer.resize(width * height);
+		gbuffer_width = width;
+		gbuffer_height = height;
+	}
+	gbuffer_valid = false;
+}
+
+gbuffer_sample * gbuffer_at(int x, int y)
+{
+	return &gbuffer.at(y * gbuffer_width + x);
+}
+
+// shades the stored hit of pixel (x, y) with the current lights and materials,
+// e and s are the primary ray in case the pixel has to be traced again
+bool relight(int x, int y, point3 &e, point3 &s, colour3 &colour)
+{
+	gbuffer_sample * sample = gbuffer_at(x, y);
+
+	if (!sample->hit)
+	{
+		return false;
+	}
+
+	const Material * m = current_scene->listOfMaterials.at(sample->material);
+
+	// the material may have been edited to reflect or transmit since the first pass
+	if (sample->needs_trace || (m->flags & (MATERIAL_REFLECTIVE | MATERIAL_TRANSMISSIVE)))
+	{
+		return trace(e, s, colour, sample);
+	}
+
+	colour = colour3(0, 0, 0);
+	getColor(colour, *m, sample->position, sample->normal, sample->view);
+	return true;
+}
@@ -0,0 +1,27 @@
+#ifndef gbuffer_h
+#define gbuffer_h
+#include "raytracer.h"
+
+// What the first pass found under one pixel. Relighting only redoes the shading
+// and the shadow rays from here, the primary ray is not traced again.
+struct gbuffer_sample
+{
+	bool hit;
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec3 view;
+	shape * primitive;
+	int material; // index into listOfMaterials
+	bool needs_trace; // reflective or transmissive, the secondary rays depend on the lights as well
+};
+
+extern std::vector<gbuffer_sample> gbuffer;
+extern int gbuffer_width, gbuffer_height;
+extern bool gbuffer_valid;
+
+void resize_gbuffer(int width, int height);
+gbuffer_sample * gbuffer_at(int x, int y);
+
+bool relight(int x, int y, point3 &e, point3 &s, colour3 &colour);
+
+#endif
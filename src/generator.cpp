@@ -0,0 +1,378 @@
+#include "generator.h"
+#include <random>
+#include <cmath>
+#include <cstdlib>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// the part of the default camera's view the objects are spread over
+const glm::vec3 region_lo(-3.0f, -2.0f, -12.0f);
+const glm::vec3 region_hi(3.0f, 2.0f, -5.0f);
+
+// standard deviation of the objects around their cluster centre
+const float cluster_spread = 0.3f;
+
+void default_scene_parameters(scene_parameters &parameters)
+{
+	parameters.spheres = 100;
+	parameters.meshes = 0;
+	parameters.triangles = 100;
+	parameters.csg = 0;
+	parameters.planes = 1;
+	parameters.point_lights = 1;
+	parameters.directional_lights = 1;
+	parameters.spot_lights = 0;
+	parameters.distribution = DISTRIBUTION_UNIFORM;
+	parameters.clusters = 8;
+	parameters.thin = 0;
+	parameters.size = 0.05f;
+	parameters.seed = 1;
+}
+
+bool set_scene_parameter(scene_parameters &parameters, const std::string &name, const std::string &value)
+{
+	int number = atoi(value.c_str());
+
+	if (name == "spheres")
+	{
+		parameters.spheres = number;
+	}
+	else if (name == "meshes")
+	{
+		parameters.meshes = number;
+	}
+	else if (name == "triangles")
+	{
+		parameters.triangles = number;
+	}
+	else if (name == "csg")
+	{
+		parameters.csg = number;
+	}
+	else if (name == "planes")
+	{
+		parameters.planes = number;
+	}
+	else if (name == "point_lights")
+	{
+		parameters.point_lights = number;
+	}
+	else if (name == "directional_lights")
+	{
+		parameters.directional_lights = number;
+	}
+	else if (name == "spot_lights")
+	{
+		parameters.spot_lights = number;
+	}
+	else if (name == "distribution" && value == "uniform")
+	{
+		parameters.distribution = DISTRIBUTION_UNIFORM;
+	}
+	else if (name == "distribution" && value == "clustered")
+	{
+		parameters.distribution = DISTRIBUTION_CLUSTERED;
+	}
+	else if (name == "clusters")
+	{
+		parameters.clusters = glm::max(number, 1);
+	}
+	else if (name == "thin")
+	{
+		parameters.thin = number;
+	}
+	else if (name == "size")
+	{
+		parameters.size = (float)atof(value.c_str());
+	}
+	else if (name == "seed")
+	{
+		parameters.seed = number;
+	}
+	else
+	{
+		std::cout << "Unknown scene parameter " << name << "=" << value << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool parse_scene_parameters(scene_parameters &parameters, const std::string &list)
+{
+	size_t start = 0;
+
+	while (start < list.size())
+	{
+		size_t end = list.find(',', start);
+		if (end == std::string::npos)
+		{
+			end = list.size();
+		}
+
+		std::string item = list.substr(start, end - start);
+		size_t equals = item.find('=');
+
+		if (equals == std::string::npos)
+		{
+			std::cout << "Scene parameters are given as name=value, not " << item << std::endl;
+			return false;
+		}
+		if (!set_scene_parameter(parameters, item.substr(0, equals), item.substr(equals + 1)))
+		{
+			return false;
+		}
+		start = end + 1;
+	}
+	return true;
+}
+
+// in [lo, hi), from the raw bits of the engine so that every standard library gives the same scene
+float random_uniform(std::mt19937 &random, float lo, float hi)
+{
+	return lo + (hi - lo) * ((random() >> 8) * (1.0f / 16777216.0f));
+}
+
+float random_normal(std::mt19937 &random)
+{
+	float u = 1.0f - random_uniform(random, 0.0f, 1.0f);
+	float v = random_uniform(random, 0.0f, 1.0f);
+	return sqrtf(-2.0f * logf(u)) * cosf(2.0f * (float)M_PI * v);
+}
+
+glm::vec3 random_direction(std::mt19937 &random)
+{
+	glm::vec3 d(random_normal(random), random_normal(random), random_normal(random));
+	return glm::length(d) > 0.0f ? glm::normalize(d) : glm::vec3(0, 1, 0);
+}
+
+glm::vec3 random_position(std::mt19937 &random, const scene_parameters &parameters, const std::vector<glm::vec3> &centres)
+{
+	if (parameters.distribution == DISTRIBUTION_CLUSTERED)
+	{
+		const glm::vec3 &centre = centres.at(random() % centres.size());
+		return centre + cluster_spread * glm::vec3(random_normal(random), random_normal(random), random_normal(random));
+	}
+
+	return glm::vec3(random_uniform(random, region_lo.x, region_hi.x),
+		random_uniform(random, region_lo.y, region_hi.y),
+		random_uniform(random, region_lo.z, region_hi.z));
+}
+
+json vec3_json(const glm::vec3 &v)
+{
+	return json::array({ v.x, v.y, v.z });
+}
+
+json random_material(std::mt19937 &random)
+{
+	glm::vec3 diffuse(random_uniform(random, 0.2f, 1.0f), random_uniform(random, 0.2f, 1.0f), random_uniform(random, 0.2f, 1.0f));
+
+	json material;
+	material["ambient"] = vec3_json(0.2f * diffuse);
+	material["diffuse"] = vec3_json(diffuse);
+
+	if (random_uniform(random, 0.0f, 1.0f) < 0.5f)
+	{
+		material["specular"] = vec3_json(glm::vec3(0.4f, 0.4f, 0.4f));
+		material["shininess"] = 32;
+	}
+	return material;
+}
+
+json triangle_json(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c)
+{
+	return json::array({ vec3_json(a), vec3_json(b), vec3_json(c) });
+}
+
+// a bumpy square patch of small triangles in a random orientation
+json patch_mesh(std::mt19937 &random, const glm::vec3 &centre, int triangles, float size)
+{
+	glm::vec3 normal = random_direction(random);
+	glm::vec3 u = glm::normalize(glm::cross(normal, glm::abs(normal.y) < 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0)));
+	glm::vec3 v = glm::cross(normal, u);
+
+	int side = glm::max((int)ceil(sqrt(triangles / 2.0)), 1);
+	float step = 2.0f * size;
+
+	std::vector<glm::vec3> vertices;
+	for (int j = 0; j <= side; j++)
+	{
+		for (int i = 0; i <= side; i++)
+		{
+			float bump = random_uniform(random, -0.3f, 0.3f) * step;
+			vertices.push_back(centre + (i - side * 0.5f) * step * u + (j - side * 0.5f) * step * v + bump * normal);
+		}
+	}
+
+	json list = json::array();
+	for (int j = 0; j < side && list.size() < triangles; j++)
+	{
+		for (int i = 0; i < side && list.size() < triangles; i++)
+		{
+			const glm::vec3 &a = vertices.at(j * (side + 1) + i);
+			const glm::vec3 &b = vertices.at(j * (side + 1) + i + 1);
+			const glm::vec3 &c = vertices.at((j + 1) * (side + 1) + i);
+			const glm::vec3 &d = vertices.at((j + 1) * (side + 1) + i + 1);
+
+			list.push_back(triangle_json(a, b, d));
+			if (list.size() < triangles)
+			{
+				list.push_back(triangle_json(a, d, c));
+			}
+		}
+	}
+	return list;
+}
+
+// slivers forty times longer than the spheres are wide, the worst case for a spatial subdivision
+json thin_mesh(std::mt19937 &random, const glm::vec3 &centre, int triangles, float size)
+{
+	json list = json::array();
+
+	for (int i = 0; i < triangles; i++)
+	{
+		glm::vec3 a = centre + glm::vec3(random_normal(random), random_normal(random), random_normal(random));
+		glm::vec3 direction = random_direction(random);
+		glm::vec3 across = glm::normalize(glm::cross(direction, random_direction(random)));
+
+		float length = 40.0f * size;
+		glm::vec3 b = a + length * direction;
+		glm::vec3 c = a + 0.5f * length * direction + 0.2f * size * across;
+		list.push_back(triangle_json(a, b, c));
+	}
+	return list;
+}
+
+json generate_scene(const scene_parameters &parameters)
+{
+	std::mt19937 random(parameters.seed);
+
+	std::vector<glm::vec3> centres;
+	for (int i = 0; i < parameters.clusters; i++)
+	{
+		centres.push_back(glm::vec3(random_uniform(random, region_lo.x, region_hi.x),
+			random_uniform(random, region_lo.y, region_hi.y),
+			random_uniform(random, region_lo.z, region_hi.z)));
+	}
+
+	json scene;
+	scene["camera"]["field"] = 60;
+	scene["camera"]["background"] = vec3_json(glm::vec3(0.0f, 0.0f, 0.1f));
+
+	json objects = json::array();
+
+	for (int i = 0; i < parameters.spheres; i++)
+	{
+		json object;
+		object["type"] = "sphere";
+		object["radius"] = parameters.size * random_uniform(random, 0.5f, 1.5f);
+		object["position"] = vec3_json(random_position(random, parameters, centres));
+		object["material"] = random_material(random);
+		objects.push_back(object);
+	}
+
+	for (int i = 0; i < parameters.meshes; i++)
+	{
+		glm::vec3 centre = random_position(random, parameters, centres);
+
+		json object;
+		object["type"] = "mesh";
+		object["triangles"] = parameters.thin ? thin_mesh(random, centre, parameters.triangles, parameters.size)
+			: patch_mesh(random, centre, parameters.triangles, parameters.size);
+		object["material"] = random_material(random);
+		objects.push_back(object);
+	}
+
+	const char *operations[] = { "union", "intersection", "difference" };
+
+	for (int i = 0; i < parameters.csg; i++)
+	{
+		glm::vec3 centre = random_position(random, parameters, centres);
+		glm::vec3 offset = 0.6f * parameters.size * random_direction(random);
+
+		json first;
+		first["type"] = "sub_sphere";
+		first["radius"] = parameters.size;
+		first["position"] = vec3_json(centre - offset);
+		first["material"] = random_material(random);
+
+		json second = first;
+		second["position"] = vec3_json(centre + offset);
+		second["material"] = random_material(random);
+
+		json object;
+		object["type"] = operations[i % 3];
+		object["objects"] = json::array({ first, second });
+		objects.push_back(object);
+	}
+
+	for (int i = 0; i < parameters.planes; i++)
+	{
+		// a floor under everything, then walls around the region facing its centre
+		glm::vec3 normal(0, 1, 0);
+		glm::vec3 position(0, region_lo.y - 0.5f, 0);
+
+		if (i > 0)
+		{
+			glm::vec3 centre = 0.5f * (region_lo + region_hi);
+			normal = random_direction(random);
+			position = centre - 12.0f * normal;
+		}
+
+		json object;
+		object["type"] = "plane";
+		object["position"] = vec3_json(position);
+		object["normal"] = vec3_json(normal);
+		object["material"] = random_material(random);
+		objects.push_back(object);
+	}
+	scene["objects"] = objects;
+
+	// all lights together give about as much light as one
+	int number_of_lights = parameters.point_lights + parameters.directional_lights + parameters.spot_lights;
+	glm::vec3 colour(0.9f / glm::max(number_of_lights, 1));
+
+	json lights = json::array();
+
+	json ambient;
+	ambient["type"] = "ambient";
+	ambient["color"] = vec3_json(glm::vec3(0.1f, 0.1f, 0.1f));
+	lights.push_back(ambient);
+
+	for (int i = 0; i < parameters.point_lights; i++)
+	{
+		json light;
+		light["type"] = "point";
+		light["color"] = vec3_json(colour);
+		light["position"] = vec3_json(glm::vec3(random_uniform(random, -4.0f, 4.0f), random_uniform(random, 3.0f, 6.0f), random_uniform(random, -10.0f, -2.0f)));
+		lights.push_back(light);
+	}
+
+	for (int i = 0; i < parameters.directional_lights; i++)
+	{
+		json light;
+		light["type"] = "directional";
+		light["color"] = vec3_json(colour);
+		light["direction"] = vec3_json(glm::vec3(random_uniform(random, -0.5f, 0.5f), -1.0f, random_uniform(random, -0.5f, 0.5f)));
+		lights.push_back(light);
+	}
+
+	for (int i = 0; i < parameters.spot_lights; i++)
+	{
+		glm::vec3 position(random_uniform(random, -4.0f, 4.0f), random_uniform(random, 3.0f, 6.0f), random_uniform(random, -10.0f, -2.0f));
+		glm::vec3 target = random_position(random, parameters, centres);
+
+		json light;
+		light["type"] = "spot";
+		light["color"] = vec3_json(colour);
+		light["position"] = vec3_json(position);
+		light["direction"] = vec3_json(target - position);
+		light["cutoff"] = random_uniform(random, 10.0f, 30.0f);
+		lights.push_back(light);
+	}
+	scene["lights"] = lights;
+
+	return scene;
+}
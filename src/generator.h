@@ -0,0 +1,36 @@
+#ifndef generator_h
+#define generator_h
+#include "raytracer.h"
+
+#define DISTRIBUTION_UNIFORM 0
+#define DISTRIBUTION_CLUSTERED 1
+
+// What a generated scene is made of. The objects are spread over the view of the
+// default camera, between z = -5 and z = -12, either uniformly or around a number
+// of cluster centres; the same parameters and seed always give the same scene.
+struct scene_parameters
+{
+	int spheres;
+	int meshes;
+	int triangles; // per mesh
+	int csg; // unions, intersections and differences in turn
+	int planes;
+	int point_lights;
+	int directional_lights;
+	int spot_lights;
+	int distribution;
+	int clusters;
+	int thin; // long thin triangles instead of small patches
+	float size; // radius of the spheres, and the scale of everything else
+	int seed;
+};
+
+void default_scene_parameters(scene_parameters &parameters);
+
+// name=value,name=value,... with the names of the fields above, false on anything unknown
+bool parse_scene_parameters(scene_parameters &parameters, const std::string &list);
+bool set_scene_parameter(scene_parameters &parameters, const std::string &name, const std::string &value);
+
+json generate_scene(const scene_parameters &parameters);
+
+#endif
@@ -0,0 +1,209 @@
+#include "light_culling.h"
+#include "views.h"
+#include "render.h"
+#include "statistics.h"
+#include "scene.h"
+#include "batch_shading.h"
+#include <cfloat>
+
+bool light_culling = true;
+
+thread_local std::vector<int> tile_spot_lights;
+thread_local std::vector<shading_batch> tile_batches; // one per material of a tile
+
+void addToBatch(shading_batch &batch, int sample, const primary_hit &hit)
+{
+	int i = batch.count++;
+	batch.sample[i] = sample;
+	batch.position_x[i] = hit.intersection.x;
+	batch.position_y[i] = hit.intersection.y;
+	batch.position_z[i] = hit.intersection.z;
+	batch.normal_x[i] = hit.N.x;
+	batch.normal_y[i] = hit.N.y;
+	batch.normal_z[i] = hit.N.z;
+	batch.view_x[i] = hit.V.x;
+	batch.view_y[i] = hit.V.y;
+	batch.view_z[i] = hit.V.z;
+}
+
+// shades the hits gathered in batch into their samples and empties it
+void shadeGathered(shading_batch &batch, std::vector<tile_sample> &samples, const std::vector<int> * spots)
+{
+	batch.material->shade_batch(batch, spots);
+
+	for (int i = 0; i < batch.count; i++)
+	{
+		samples.at(batch.sample[i]).colour = colour3(batch.colour_r[i], batch.colour_g[i], batch.colour_b[i]);
+	}
+	batch.count = 0;
+}
+
+void spot_lights_reaching(const glm::vec3 &lower, const glm::vec3 &upper, std::vector<int> &spots)
+{
+	const Scene &lights = *current_scene;
+	glm::vec3 center = (lower + upper) * 0.5f;
+	float radius = glm::length(upper - lower) * 0.5f;
+
+	spots.clear();
+	for (int i = 0; i < lights.light_spot_position.size(); i++)
+	{
+		// In the plane through the axis and the centre, the signed distance from the centre to the
+		// edge of the cone, negative inside. It changes no faster than the point moves, so when it is
+		// more than the radius no point of the sphere is inside the cone.
+		glm::vec3 to_center = center - lights.light_spot_position.at(i);
+		float along = dot(to_center, lights.light_spot_axis.at(i));
+		float across = sqrt(glm::max(dot(to_center, to_center) - along * along, 0.0f));
+		float cos_cutoff = lights.light_spot_cos_cutoff.at(i);
+		float sin_cutoff = sqrt(glm::max(1.0f - cos_cutoff * cos_cutoff, 0.0f));
+		float outside = cos_cutoff * across - sin_cutoff * along;
+
+		// the margin covers the rounding of the test in shade()
+		if (outside <= radius + 0.0001f * (1.0f + glm::length(to_center)))
+		{
+			spots.push_back(i);
+		}
+	}
+}
+
+void trace_tile(std::vector<tile_sample> &samples)
+{
+	glm::vec3 lower(FLT_MAX, FLT_MAX, FLT_MAX);
+	glm::vec3 upper(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	int hits = 0;
+
+	for (int i = 0; i < samples.size(); i++)
+	{
+		tile_sample &sample = samples.at(i);
+		if (findPrimaryHit(sample.e, sample.s, sample.hit))
+		{
+			lower = glm::min(lower, sample.hit.intersection);
+			upper = glm::max(upper, sample.hit.intersection);
+			hits++;
+		}
+	}
+
+	const std::vector<int> * spots = NULL;
+	int spot_count = current_scene->light_spot_position.size();
+	if (light_culling && spot_count != 0 && hits != 0)
+	{
+		spot_lights_reaching(lower, upper, tile_spot_lights);
+		spots = &tile_spot_lights;
+
+		render_statistics &statistics = thread_statistics();
+		statistics.spot_lights_kept += (unsigned long long)hits * tile_spot_lights.size();
+		statistics.spot_lights_culled += (unsigned long long)hits * (spot_count - tile_spot_lights.size());
+	}
+
+	std::vector<shading_batch> &batches = tile_batches;
+	batches.clear();
+
+	for (int i = 0; i < samples.size(); i++)
+	{
+		tile_sample &sample = samples.at(i);
+		sample.colour = colour3(0, 0, 0);
+
+		if (!sample.hit.hit)
+		{
+			sample.colour = current_scene->background_colour;
+		}
+		else if (batched_shading && (sample.hit.material->flags & (MATERIAL_REFLECTIVE | MATERIAL_TRANSMISSIVE)) == 0)
+		{
+			// without mirror or refraction rays shadePrimaryHit() is just getColor(), which the batch does
+			int b = 0;
+			while (b < batches.size() && batches.at(b).material != sample.hit.material)
+			{
+				b++;
+			}
+			if (b == batches.size())
+			{
+				batches.push_back(shading_batch());
+				batches.back().material = sample.hit.material;
+				batches.back().count = 0;
+			}
+
+			addToBatch(batches.at(b), i, sample.hit);
+			if (batches.at(b).count == SHADING_BATCH)
+			{
+				shadeGathered(batches.at(b), samples, spots);
+			}
+		}
+		else
+		{
+			shadePrimaryHit(sample.e, sample.hit, sample.colour, spots);
+		}
+	}
+
+	for (int b = 0; b < batches.size(); b++)
+	{
+		if (batches.at(b).count != 0)
+		{
+			shadeGathered(batches.at(b), samples, spots);
+		}
+	}
+}
+
+void render_rect_culled(const view_camera * view, const pixel_rect &rect, int image_width, int image_height, int samples,
+	const std::vector<char> * wanted, colour3 *pixels, int stride)
+{
+	std::vector<tile_sample> tile;
+
+	for (int tile_y = rect.y; tile_y < rect.y + rect.height; tile_y += LIGHT_TILE_SIZE)
+	{
+		for (int tile_x = rect.x; tile_x < rect.x + rect.width; tile_x += LIGHT_TILE_SIZE)
+		{
+			int end_x = glm::min(tile_x + LIGHT_TILE_SIZE, rect.x + rect.width);
+			int end_y = glm::min(tile_y + LIGHT_TILE_SIZE, rect.y + rect.height);
+
+			tile.clear();
+			for (int y = tile_y; y < end_y; y++)
+			{
+				for (int x = tile_x; x < end_x; x++)
+				{
+					if (wanted != NULL && !wanted->at(y * image_width + x))
+					{
+						continue;
+					}
+
+					for (int sample = 0; sample < samples; sample++)
+					{
+						glm::vec2 offset = sample_offset(x, y, sample);
+						tile_sample t;
+						if (view == NULL)
+						{
+							t.e = point3(0.0f, 0.0f, 0.0f);
+							t.s = image_plane_point(x + offset.x, y + offset.y, image_width, image_height);
+						}
+						else
+						{
+							point3 p = image_plane_point(x + offset.x, y + offset.y, image_width, image_height, view->field);
+							t.e = view->position;
+							t.s = view->position + p.x * view->right + p.y * view->up + p.z * view->back;
+						}
+						tile.push_back(t);
+					}
+				}
+			}
+
+			trace_tile(tile);
+
+			int next = 0;
+			for (int y = tile_y; y < end_y; y++)
+			{
+				for (int x = tile_x; x < end_x; x++)
+				{
+					if (wanted != NULL && !wanted->at(y * image_width + x))
+					{
+						continue;
+					}
+
+					colour3 sum(0, 0, 0);
+					for (int sample = 0; sample < samples; sample++)
+					{
+						sum += tile.at(next++).colour;
+					}
+					pixels[(y - rect.y) * stride + x - rect.x] = sum / (float)samples;
+				}
+			}
+		}
+	}
+}
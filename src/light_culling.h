@@ -0,0 +1,43 @@
+#ifndef light_culling_h
+#define light_culling_h
+#include "raytracer.h"
+
+// Tiled light culling. The primary rays of a tile are traced before any of them is shaded,
+// and the box around their first hits is tested against the cone of every spot light, with
+// a sphere around the box so that the test stays cheap and never drops a light that reaches
+// any of the hits. The hits are then shaded with just the spot lights that passed. Reflected
+// and refracted rays leave the tile and still see all lights.
+//
+// Point and directional lights have no falloff here, they reach every point and are in
+// every list by definition, so only spot lights are culled.
+extern bool light_culling; // false shades every spot light at every hit, -no-light-culling
+
+// the tiles render_rect() and the other tile renderers cull for
+const int LIGHT_TILE_SIZE = 16;
+
+// One primary ray of a tile. trace_tile() fills in hit and colour.
+struct tile_sample
+{
+	point3 e, s;
+	primary_hit hit;
+	colour3 colour; // the background where nothing was hit
+};
+
+// the spot lights of the current scene whose cones reach into the box lower..upper
+void spot_lights_reaching(const glm::vec3 &lower, const glm::vec3 &upper, std::vector<int> &spots);
+
+// traces every sample of a tile, as trace() would, with the spot lights culled for the tile and
+// the hits that only need getColor() shaded in batches (see batch_shading.h)
+void trace_tile(std::vector<tile_sample> &samples);
+
+struct view_camera;
+struct pixel_rect;
+
+// Renders rect of an image_width x image_height frame into pixels, laid out as render_rect()
+// does, a light tile at a time with the samples of sample_offset(). view is the camera, NULL for
+// the one at the origin; without wanted every pixel is rendered, otherwise only those it marks,
+// indexed by y * image_width + x.
+void render_rect_culled(const view_camera * view, const pixel_rect &rect, int image_width, int image_height, int samples,
+	const std::vector<char> * wanted, colour3 *pixels, int stride);
+
+#endif
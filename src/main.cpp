@@ -2,6 +2,7 @@
 // Modified to isolate the main program and use GLM
 
  #include "common.h"
+#include "offline.h"
 
 #include <iostream>
 
@@ -107,6 +108,10 @@ timer(int unused)
 int
 main( int argc, char **argv )
 {
+   if ( run_offline( argc, argv ) ) {
+      return 0;
+   }
+
    glutInit( &argc, argv );
    glutInitDisplayMode( GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH );
    glutInitWindowSize( 640, 640 );
@@ -0,0 +1,599 @@
+#include "offline.h"
+#include "raytracer.h"
+#include "animation.h"
+#include "render.h"
+#include "statistics.h"
+#include "distributed.h"
+#include "checkpoint.h"
+#include "outofcore.h"
+#include "bvh.h"
+#include "generator.h"
+#include "sweep.h"
+#include "verify.h"
+#include "trace.h"
+#include "tuning.h"
+#include "region.h"
+#include "service.h"
+#include "views.h"
+#include "scene.h"
+#include "light_culling.h"
+#include "batch_shading.h"
+#include <fstream>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+struct offline_options
+{
+	const char *scene_name;
+	bool frames;
+	int first_frame;
+	int last_frame;
+	bool keyframe_range; // -frames without numbers, first_frame and last_frame come from the keyframes
+	int width;
+	int height;
+	std::string output;
+	int workers;
+	std::string worker_socket;
+	int samples;
+	bool resume;
+	std::string paged_geometry;
+	std::string generate;
+	std::string sweep;
+	std::string vary;
+	double vary_from;
+	double vary_to;
+	int vary_steps;
+	bool verify;
+	int max_ulp;
+	double min_psnr;
+	bool update_golden;
+	bool cost;
+	bool report;
+	int tune_probe;
+	std::vector<pixel_rect> regions;
+	std::string dirty_image;
+	bool crop;
+	bool views;
+	bool sheet;
+	std::string serve;
+	size_t cache_budget;
+};
+
+double milliseconds_since(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void render_frames(offline_options &options)
+{
+	if (!isAnimated())
+	{
+		std::cout << "Scene has no keyframes, rendering it as a single still." << std::endl;
+	}
+
+	if (options.keyframe_range)
+	{
+		getFrameRange(options.first_frame, options.last_frame);
+		if (isAnimated())
+		{
+			std::cout << "Rendering the keyframes, frames " << options.first_frame << " to " << options.last_frame << std::endl;
+		}
+	}
+
+	for (int frame = options.first_frame; frame <= options.last_frame; frame++)
+	{
+		trace_scope scope("frame");
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (isAnimated())
+		{
+			setAnimationFrame(frame);
+		}
+		double update_ms = milliseconds_since(start);
+
+		reset_statistics();
+		start = std::chrono::steady_clock::now();
+		char fn[64];
+		snprintf(fn, sizeof(fn), "_%04d", frame);
+		std::string journal = options.output + fn + ".journal";
+
+		std::vector<colour3> pixels;
+		std::vector<pixel_cost> costs;
+		if (out_of_core)
+		{
+			render_out_of_core(options.width, options.height, pixels);
+		}
+		else
+		{
+			render_with_checkpoints(options.width, options.height, options.samples, journal, options.resume, pixels,
+				options.cost ? &costs : NULL);
+		}
+		double render_ms = milliseconds_since(start);
+
+		// the journal is only needed until the image is safely written
+		if (write_ppm(options.output + fn + ".ppm", options.width, options.height, pixels))
+		{
+			remove(journal.c_str());
+		}
+
+		std::cout << "Frame " << frame << ": octree update " << update_ms << " ms, render " << render_ms << " ms" << std::endl;
+		print_statistics();
+		write_cost_images(options.output + fn, options.width, options.height, costs);
+	}
+}
+
+// one "x,y,width,height" per line
+bool read_rects(const std::string &fn, std::vector<pixel_rect> &rects)
+{
+	std::ifstream in(fn.c_str());
+	if (!in.is_open())
+	{
+		std::cout << "Unable to open " << fn << std::endl;
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(in, line))
+	{
+		pixel_rect rect;
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+		{
+			continue;
+		}
+		if (!parse_rect(line.c_str(), rect))
+		{
+			std::cout << "Ignoring " << line << " in " << fn << ", expected x,y,width,height" << std::endl;
+			continue;
+		}
+		rects.push_back(rect);
+	}
+	return true;
+}
+
+// only the pixels inside the rects are traced, into a black frame or into the image they were marked dirty in
+void render_regions(offline_options &options)
+{
+	int width = options.width;
+	int height = options.height;
+	std::vector<colour3> image;
+
+	if (!options.dirty_image.empty())
+	{
+		std::vector<unsigned char> rgb;
+		if (!read_ppm(options.dirty_image, width, height, rgb))
+		{
+			std::cout << "Unable to read image " << options.dirty_image << std::endl;
+			return;
+		}
+		ppm_pixels(width, height, rgb, image);
+	}
+	else
+	{
+		image.assign(width * height, colour3(0, 0, 0));
+	}
+
+	reset_statistics();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int count = render_rects(options.regions, width, height, options.samples, image);
+	std::cout << "Rendered " << count << " of " << width * height << " pixels in " << options.regions.size() << " rects in "
+		<< milliseconds_since(start) << " ms" << std::endl;
+	print_statistics();
+
+	if (!options.crop)
+	{
+		write_ppm(options.output + ".ppm", width, height, image);
+		return;
+	}
+
+	// the box around all of the rects, clipped to the frame
+	int left = width, bottom = height, right = 0, top = 0;
+	for (int i = 0; i < options.regions.size(); i++)
+	{
+		const pixel_rect &rect = options.regions.at(i);
+		left = glm::min(left, glm::max(rect.x, 0));
+		bottom = glm::min(bottom, glm::max(rect.y, 0));
+		right = glm::max(right, glm::min(rect.x + rect.width, width));
+		top = glm::max(top, glm::min(rect.y + rect.height, height));
+	}
+	if (right <= left || top <= bottom)
+	{
+		std::cout << "The rects are all outside the " << width << "x" << height << " frame." << std::endl;
+		return;
+	}
+
+	std::vector<colour3> cropped;
+	for (int y = bottom; y < top; y++)
+	{
+		cropped.insert(cropped.end(), image.begin() + y * width + left, image.begin() + y * width + right);
+	}
+	write_ppm(options.output + ".ppm", right - left, top - bottom, cropped);
+}
+
+// every camera of the scene in one go, each into <output>_<camera>.ppm or all of them into one sheet
+void render_all_views(offline_options &options)
+{
+	std::vector<view_camera> views;
+	load_views(views);
+
+	reset_statistics();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<std::vector<colour3> > images;
+	render_views(views, options.width, options.height, options.samples, images);
+	std::cout << "Rendered " << views.size() << " views in " << milliseconds_since(start) << " ms" << std::endl;
+	print_statistics();
+
+	if (options.sheet)
+	{
+		int width, height;
+		std::vector<colour3> sheet;
+		contact_sheet(images, options.width, options.height, width, height, sheet);
+		write_ppm(options.output + ".ppm", width, height, sheet);
+		return;
+	}
+
+	for (int i = 0; i < views.size(); i++)
+	{
+		write_ppm(options.output + "_" + views.at(i).name + ".ppm", options.width, options.height, images.at(i));
+	}
+}
+
+// the scene goes where choose_scene() looks for it, so it can be rendered by its name afterwards
+void generate_scene_file(offline_options &options)
+{
+	scene_parameters parameters;
+	default_scene_parameters(parameters);
+	if (!parse_scene_parameters(parameters, options.generate))
+	{
+		return;
+	}
+
+	std::string name = options.output.empty() ? "generated" : options.output;
+	std::ofstream out("scenes/" + name + ".json");
+	out << generate_scene(parameters).dump(1, '\t') << std::endl;
+
+	if (!out)
+	{
+		std::cout << "Unable to write scenes/" << name << ".json" << std::endl;
+		return;
+	}
+	std::cout << "Scene written to scenes/" << name << ".json" << std::endl;
+}
+
+void sweep_scenes(offline_options &options)
+{
+	scene_parameters parameters;
+	default_scene_parameters(parameters);
+	if (!parse_scene_parameters(parameters, options.sweep))
+	{
+		return;
+	}
+
+	if (options.vary.empty())
+	{
+		options.vary = "spheres";
+		options.vary_from = parameters.spheres;
+		options.vary_to = parameters.spheres;
+	}
+
+	run_sweep(parameters, options.vary, options.vary_from, options.vary_to, options.vary_steps,
+		options.width, options.height, options.output.empty() ? "sweep" : options.output);
+}
+
+// a whole number and nothing else, so that -frames can tell its range from the next option
+bool is_integer(const char *text)
+{
+	char *end;
+	strtol(text, &end, 10);
+	return end != text && *end == '\0';
+}
+
+bool run_offline(int argc, char **argv)
+{
+	offline_options options;
+	options.scene_name = NULL;
+	options.frames = false;
+	options.first_frame = 0;
+	options.last_frame = 0;
+	options.keyframe_range = false;
+	options.width = 640;
+	options.height = 640;
+	options.workers = -1;
+	options.samples = 1;
+	options.resume = false;
+	options.vary_from = 0;
+	options.vary_to = 0;
+	options.vary_steps = 1;
+	options.verify = false;
+	options.max_ulp = 0;
+	options.min_psnr = 0;
+	options.update_golden = false;
+	options.cost = false;
+	options.report = false;
+	options.tune_probe = 0;
+	options.crop = false;
+	options.views = false;
+	options.sheet = false;
+	options.cache_budget = (size_t)1024 << 20;
+
+	int i = 1;
+	if (argc > 1 && argv[1][0] != '-')
+	{
+		options.scene_name = argv[1];
+		i = 2;
+	}
+
+	for (; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-frames") == 0 && i + 2 < argc && is_integer(argv[i + 1]) && is_integer(argv[i + 2]))
+		{
+			options.frames = true;
+			options.first_frame = atoi(argv[i + 1]);
+			options.last_frame = atoi(argv[i + 2]);
+			i += 2;
+		}
+		else if (strcmp(argv[i], "-frames") == 0)
+		{
+			options.frames = true;
+			options.keyframe_range = true;
+		}
+		else if (strcmp(argv[i], "-size") == 0 && i + 2 < argc)
+		{
+			options.width = atoi(argv[i + 1]);
+			options.height = atoi(argv[i + 2]);
+			i += 2;
+		}
+		else if (strcmp(argv[i], "-samples") == 0 && i + 1 < argc)
+		{
+			options.samples = glm::max(atoi(argv[i + 1]), 1);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-resume") == 0)
+		{
+			options.resume = true;
+		}
+		else if (strcmp(argv[i], "-outofcore") == 0 && i + 1 < argc)
+		{
+			options.paged_geometry = argv[i + 1];
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-budget") == 0 && i + 1 < argc)
+		{
+			out_of_core_budget = (size_t)(atof(argv[i + 1]) * 1024 * 1024);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-accel") == 0 && i + 1 < argc)
+		{
+			acceleration_structure = strcmp(argv[i + 1], "octree") == 0 ? ACCELERATION_OCTREE : ACCELERATION_BVH;
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-distribute") == 0 && i + 1 < argc)
+		{
+			options.workers = atoi(argv[i + 1]);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-worker") == 0 && i + 1 < argc)
+		{
+			options.worker_socket = argv[i + 1];
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-views") == 0)
+		{
+			options.views = true;
+		}
+		else if (strcmp(argv[i], "-sheet") == 0)
+		{
+			options.views = true;
+			options.sheet = true;
+		}
+		else if (strcmp(argv[i], "-serve") == 0 && i + 1 < argc)
+		{
+			options.serve = argv[i + 1];
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-cache") == 0 && i + 1 < argc)
+		{
+			options.cache_budget = (size_t)(atof(argv[i + 1]) * 1024 * 1024);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-verify") == 0)
+		{
+			options.verify = true;
+		}
+		else if (strcmp(argv[i], "-ulp") == 0 && i + 1 < argc)
+		{
+			options.max_ulp = glm::max(atoi(argv[i + 1]), 0);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-psnr") == 0 && i + 1 < argc)
+		{
+			options.min_psnr = atof(argv[i + 1]);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-update-golden") == 0)
+		{
+			options.verify = true;
+			options.update_golden = true;
+		}
+		else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc)
+		{
+			start_tracing(argv[i + 1]);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-area-probes") == 0 && i + 1 < argc)
+		{
+			area_light_probes = glm::max(atoi(argv[i + 1]), 0);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-no-light-culling") == 0)
+		{
+			light_culling = false;
+		}
+		else if (strcmp(argv[i], "-exact-shading") == 0)
+		{
+			batched_shading = false;
+		}
+		else if (strcmp(argv[i], "-report") == 0)
+		{
+			options.report = true;
+		}
+		else if (strcmp(argv[i], "-tune") == 0)
+		{
+			options.tune_probe = 64;
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+			{
+				options.tune_probe = glm::max(atoi(argv[i + 1]), 1);
+				i += 1;
+			}
+		}
+		else if (strcmp(argv[i], "-cost") == 0)
+		{
+			options.cost = true;
+		}
+		else if (strcmp(argv[i], "-region") == 0 && i + 1 < argc)
+		{
+			pixel_rect rect;
+			if (parse_rect(argv[i + 1], rect))
+			{
+				options.regions.push_back(rect);
+			}
+			else
+			{
+				std::cout << "Ignoring -region " << argv[i + 1] << ", expected x,y,width,height" << std::endl;
+			}
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-regions") == 0 && i + 1 < argc)
+		{
+			read_rects(argv[i + 1], options.regions);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-dirty") == 0 && i + 1 < argc)
+		{
+			options.dirty_image = argv[i + 1];
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-crop") == 0)
+		{
+			options.crop = true;
+		}
+		else if (strcmp(argv[i], "-generate") == 0 && i + 1 < argc)
+		{
+			options.generate = argv[i + 1];
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-sweep") == 0 && i + 1 < argc)
+		{
+			options.sweep = argv[i + 1];
+			i += 1;
+		}
+		else if (strcmp(argv[i], "-vary") == 0 && i + 4 < argc)
+		{
+			options.vary = argv[i + 1];
+			options.vary_from = atof(argv[i + 2]);
+			options.vary_to = atof(argv[i + 3]);
+			options.vary_steps = atoi(argv[i + 4]);
+			i += 4;
+		}
+		else if (strcmp(argv[i], "-output") == 0 && i + 1 < argc)
+		{
+			options.output = argv[i + 1];
+			i += 1;
+		}
+		else
+		{
+			std::cout << "Ignoring unknown option " << argv[i] << std::endl;
+		}
+	}
+
+	if (!options.serve.empty())
+	{
+		run_service(options.serve, options.cache_budget);
+		return true;
+	}
+
+	if (!options.worker_socket.empty())
+	{
+		run_worker(options.scene_name, options.worker_socket);
+		return true;
+	}
+
+	if (!options.generate.empty())
+	{
+		generate_scene_file(options);
+		return true;
+	}
+
+	if (!options.sweep.empty() || !options.vary.empty())
+	{
+		sweep_scenes(options);
+		return true;
+	}
+
+	if (!options.frames && options.workers < 0 && !options.verify && !options.report && options.tune_probe == 0
+		&& options.regions.size() == 0 && !options.views)
+	{
+		return false;
+	}
+
+	if (options.output.empty())
+	{
+		options.output = options.scene_name != NULL ? options.scene_name : "c";
+	}
+
+	// the workers load the scene themselves
+	if (options.workers >= 0)
+	{
+		run_coordinator(options.scene_name, options.workers, options.width, options.height, options.samples, options.output);
+		return true;
+	}
+
+	// the triangles go straight from the scene file into the pages, the rest of the scene is loaded from there;
+	// when the scene cannot be paged it is loaded as usual
+	if (!options.paged_geometry.empty() && options.tune_probe == 0 && !options.report && !options.verify && !options.views
+		&& options.regions.size() == 0 && open_out_of_core(options.scene_name, options.paged_geometry))
+	{
+		render_frames(options);
+		return true;
+	}
+
+	choose_scene(options.scene_name);
+	getBoundingAndShapeList();
+
+	if (options.tune_probe > 0)
+	{
+		tune_acceleration(current_scene->scene_file, options.tune_probe, options.width, options.height);
+		return true;
+	}
+
+	if (options.report)
+	{
+		print_acceleration_reports();
+		return true;
+	}
+
+	if (options.verify)
+	{
+		if (!verify_render(options.scene_name != NULL ? options.scene_name : "c", options.width, options.height, options.samples,
+			options.max_ulp, options.min_psnr, options.output, options.update_golden))
+		{
+			exit(EXIT_FAILURE);
+		}
+		return true;
+	}
+
+	if (options.views)
+	{
+		render_all_views(options);
+		return true;
+	}
+
+	if (options.regions.size() != 0)
+	{
+		render_regions(options);
+		return true;
+	}
+
+	render_frames(options);
+	return true;
+}
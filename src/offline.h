@@ -0,0 +1,53 @@
+#ifndef offline_h
+#define offline_h
+#include <chrono>
+
+// Runs one of the headless modes if the command line asks for one, returning false
+// when the program should go on to open the viewer instead.
+//
+//   q1 <scene> -frames [<first> <last>] [-size <width> <height>] [-output <prefix>] [-samples <n>] [-resume]
+//       renders an animated scene frame by frame into <prefix>_<frame>.ppm, keeping the finished
+//       tiles of a frame in <prefix>_<frame>.journal until it is written; -resume picks them up again.
+//       Without <first> <last> it renders from the first keyframe of any object to the last, a scene without keyframes as a single still.
+//       With -outofcore <file> [-budget <MB>] the triangles are paged from <file> instead of kept in memory;
+//           <file> is written while the scene is parsed and reused while the scene file stays the same (see outofcore.h).
+//       -accel octree finds the hits with the octree instead of the BVH
+//       -area-probes <n> tests an n x n grid of the samples of an area light before the rest (3 is a good start);
+//           by default, and with 0, every sample is tested
+//       -no-light-culling shades every spot light at every hit rather than those that reach its tile (see light_culling.h)
+//       -exact-shading shades every hit on its own instead of in batches with approximated pow() (see batch_shading.h)
+//       -cost also writes the time, rays, node visits and primitive tests of every pixel as heatmaps (see cost.h)
+//   q1 <scene> -region <x>,<y>,<width>,<height> [-region ...] [-regions <file>] [-size <width> <height>] [-samples <n>]
+//           [-dirty <image.ppm>] [-crop] [-output <name>]
+//       renders only the pixels inside the rects (bottom row first, with the camera of the whole frame) into
+//       <name>.ppm, the rest black; -regions reads one rect per line. -dirty starts from that image, at its size,
+//       and renders its marked rects again; -crop writes only the box around the rects (see region.h)
+//   q1 <scene> -views [-sheet] [-size <width> <height>] [-samples <n>] [-output <prefix>]
+//       renders every camera of the scene's "cameras" (see views.h) in one pass into <prefix>_<camera>.ppm,
+//       or with -sheet all of them side by side into <prefix>.ppm
+//   q1 <scene> -distribute <workers> [-size <width> <height>] [-samples <n>] [-output <name>]
+//       renders a still into <name>.ppm with that many local worker processes
+//   q1 <scene> -worker <socket>
+//       joins the coordinator listening on <socket> as one more worker
+//   q1 <scene> -verify [-size <width> <height>] [-samples <n>] [-ulp <n>] [-psnr <dB>] [-update-golden] [-output <prefix>]
+//       compares the optimised paths with the reference path and with scenes/golden/<scene>.ppm (see verify.h),
+//       exiting with a failure when they differ
+//   q1 <scene> -report
+//       prints depth, node and leaf counts, leaf occupancy, duplicates and SAH cost of the octree and the BVH
+//   q1 <scene> -tune [<probe size>] [-size <width> <height>] [-accel octree]
+//       tries build settings for the acceleration structure on a probe image and keeps the fastest (see tuning.h)
+//   q1 -serve <socket> [-cache <MB>]
+//       stays up and renders the jobs sent to the Unix domain socket, or to stdin with -, keeping up
+//       to <MB> of loaded and built scenes for the next jobs (see service.h)
+//   q1 -generate <name>=<value>,... [-output <name>]
+//       writes a generated scene (see scene_parameters) to scenes/<name>.json
+//   q1 -sweep <name>=<value>,... -vary <name> <from> <to> <steps> [-size <width> <height>] [-output <name>]
+//       generates and renders a scene for every step and writes what each one cost to <name>.csv
+//
+// -trace <file> works with all of them and with the viewer: a timeline of the scene loading,
+// the acceleration builds, the tiles and the image writes is written to <file> at exit (see trace.h).
+bool run_offline(int argc, char **argv);
+
+double milliseconds_since(std::chrono::steady_clock::time_point start);
+
+#endif
@@ -0,0 +1,1627 @@
+#include "outofcore.h"
+#include "render.h"
+#include "scene.h"
+#include "bvh.h"
+#include "trace.h"
+#include "statistics.h"
+#include "region.h"
+#include <cstdio>
+#include <cstring>
+#include <cfloat>
+#include <fstream>
+#include <algorithm>
+#include <unordered_map>
+#include <iterator>
+#include <chrono>
+#include <glm/gtc/matrix_transform.hpp>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+bool out_of_core = false;
+
+// bytes of triangle shapes that may be resident at once
+size_t out_of_core_budget = 256 << 20;
+
+// The triangles are sorted into the cells of a PAGE_GRID^3 grid over their centres, and the
+// cells, in Morton order, into pages of up to PAGE_TRIANGLES. A cell is never split, so a
+// cell with more triangles than that is a page of its own.
+const int PAGE_GRID_BITS = 6;
+const int PAGE_GRID = 1 << PAGE_GRID_BITS;
+const int PAGE_TRIANGLES = 1024;
+
+// triangles in a leaf of the box hierarchy of a resident page
+const int PAGE_LEAF_TRIANGLES = 4;
+
+// triangles held back per page while the pages are written, so that they go out in runs
+const int PAGE_WRITE_BUFFER = 32;
+
+// triangles read at a time from the spill file
+const int SPILL_BLOCK = 4096;
+
+struct paged_file_header
+{
+	char magic[4];
+	int pages;
+	long long triangles;
+	long long scene_size; // of the scene file the pages were written from, to tell when it has changed
+	long long scene_time;
+	long long scene_bytes; // the scene as json, with the meshes emptied, follows the header
+	float bounding[6]; // around all of the triangles
+};
+
+// the page table follows the scene, the first triangle follows the page table
+struct page_entry
+{
+	long long first;
+	long long count;
+	float bounding[6];
+};
+
+// object is the index of the mesh in the "objects" of the scene, the triangle has its material
+struct paged_triangle
+{
+	float vertex0[3];
+	float vertex1[3];
+	float vertex2[3];
+	int object;
+};
+
+// A box around some items. An inner node has count 0 and its children at first and first + 1,
+// a leaf has the items from first to first + count.
+struct box_node
+{
+	float bounding[6];
+	int first;
+	int count;
+};
+
+struct triangle_page
+{
+	long long first;
+	long long count;
+	float bounding[6];
+	bool resident;
+	std::vector<shape> shapes; // in the order of the leaves of nodes
+	std::vector<box_node> nodes;
+	long long last_demanded;
+};
+
+std::vector<triangle_page> pages; // in the order of the leaves of page_tree
+std::vector<box_node> page_tree;
+std::vector<Material *> page_materials; // by object
+
+FILE *paged_file = NULL;
+const char *mapped_triangles = NULL; // NULL where the file cannot be mapped, pages are read instead
+size_t mapped_size = 0;
+long long triangles_offset = 0;
+size_t resident_bytes = 0;
+
+// pages the rays of this thread wanted but found missing since the last clear, and all
+// the pages they reached, resident or not, each with where the ray enters it
+thread_local std::vector<int> missing_pages;
+thread_local std::vector<float> missing_t;
+thread_local std::vector<int> reached_pages;
+thread_local std::vector<float> reached_t;
+
+struct out_of_core_statistics
+{
+	long long passes;
+	long long deferred;
+	long long page_ins;
+	long long evictions;
+	long long batches;
+	long long over_budget;
+	size_t peak_resident_bytes;
+};
+out_of_core_statistics paging;
+
+// what a page takes once it is resident, known before it is loaded
+size_t page_bytes(const triangle_page &page)
+{
+	return page.count * sizeof(shape) + (2 * page.count / PAGE_LEAF_TRIANGLES + 1) * sizeof(box_node);
+}
+
+bool seekTo(FILE *file, long long offset)
+{
+#ifdef _WIN32
+	return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, offset, SEEK_SET) == 0;
+#endif
+}
+
+void triangleBox(const paged_triangle &t, float *box)
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		box[2 * axis] = glm::min(glm::min(t.vertex0[axis], t.vertex1[axis]), t.vertex2[axis]);
+		box[2 * axis + 1] = glm::max(glm::max(t.vertex0[axis], t.vertex1[axis]), t.vertex2[axis]);
+	}
+}
+
+struct by_centre
+{
+	const std::vector<float> *boxes;
+	int axis;
+
+	bool operator()(int a, int b) const
+	{
+		const float *box_a = &boxes->at(a * 6);
+		const float *box_b = &boxes->at(b * 6);
+		return box_a[2 * axis] + box_a[2 * axis + 1] < box_b[2 * axis] + box_b[2 * axis + 1];
+	}
+};
+
+// Fills nodes[index] with the items order[begin..end), whose boxes are six floats each in
+// boxes, splitting them at the median of their centres along the widest axis.
+void buildBoxNodes(std::vector<box_node> &nodes, int index, std::vector<int> &order, int begin, int end,
+	const std::vector<float> &boxes, int leaf_size)
+{
+	float bounding[6];
+	float centres[6];
+	emptyBox(bounding);
+	emptyBox(centres);
+
+	for (int i = begin; i < end; i++)
+	{
+		const float *box = &boxes.at(order.at(i) * 6);
+		growBox(bounding, box);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float centre = (box[2 * axis] + box[2 * axis + 1]) * 0.5f;
+			centres[2 * axis] = glm::min(centres[2 * axis], centre);
+			centres[2 * axis + 1] = glm::max(centres[2 * axis + 1], centre);
+		}
+	}
+	memcpy(nodes.at(index).bounding, bounding, sizeof(bounding));
+
+	if (end - begin <= leaf_size)
+	{
+		nodes.at(index).first = begin;
+		nodes.at(index).count = end - begin;
+		return;
+	}
+
+	by_centre order_by;
+	order_by.boxes = &boxes;
+	order_by.axis = 0;
+	for (int axis = 1; axis < 3; axis++)
+	{
+		if (centres[2 * axis + 1] - centres[2 * axis] > centres[2 * order_by.axis + 1] - centres[2 * order_by.axis])
+		{
+			order_by.axis = axis;
+		}
+	}
+
+	int middle = (begin + end) / 2;
+	std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, order_by);
+
+	int first = nodes.size();
+	nodes.resize(first + 2);
+	nodes.at(index).first = first;
+	nodes.at(index).count = 0;
+	buildBoxNodes(nodes, first, order, begin, middle, boxes, leaf_size);
+	buildBoxNodes(nodes, first + 1, order, middle, end, boxes, leaf_size);
+}
+
+// whether e + t * (s - e), for some t >= 0, is inside box, t_near the first such t; inverse is 1 / (s - e)
+bool rayHitsBox(const point3 &e, const glm::vec3 &inverse, const float *box, float &t_near)
+{
+	t_near = 0.0f;
+	float t_far = FLT_MAX;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float t0 = (box[2 * axis] - e[axis]) * inverse[axis];
+		float t1 = (box[2 * axis + 1] - e[axis]) * inverse[axis];
+		t_near = glm::max(t_near, glm::min(t0, t1));
+		t_far = glm::min(t_far, glm::max(t0, t1));
+	}
+	return t_near <= t_far;
+}
+
+// Reads the scene file like choose_scene() would, except that the triangles of the meshes
+// are written to spill as they are parsed and the meshes keep an empty "triangles".
+struct mesh_streamer
+{
+	nlohmann::detail::json_sax_dom_parser<json> dom;
+	FILE *spill;
+	int depth; // objects and arrays open around the next value
+	int objects_depth; // of the "objects" array of the scene while it is open, otherwise 0
+	int object; // the entry of "objects" being read
+	bool objects_next; // the key of the scene's "objects" came last
+	bool triangles_next; // the key of an object's "triangles" came last
+	int triangles_depth; // arrays open inside the "triangles" being spilled, 0 when not spilling
+	float values[9];
+	int value_count;
+	long long triangles;
+	std::vector<glm::vec3> sums; // of the vertices of each object, in the order loadObject() adds them
+	std::vector<int> vertices;
+
+	mesh_streamer(json &scene, FILE *spill_file)
+		: dom(scene), spill(spill_file), depth(0), objects_depth(0), object(-1), objects_next(false),
+		triangles_next(false), triangles_depth(0), value_count(0), triangles(0)
+	{
+	}
+
+	bool spilling() const
+	{
+		return triangles_depth > 0;
+	}
+
+	// anything but an array after a key ends what the key announced
+	void value()
+	{
+		objects_next = false;
+		triangles_next = false;
+	}
+
+	bool number(float n)
+	{
+		if (triangles_depth == 3 && value_count < 9)
+		{
+			values[value_count++] = n;
+		}
+		return true;
+	}
+
+	void addTriangle()
+	{
+		paged_triangle t;
+		memcpy(t.vertex0, values, sizeof(t.vertex0));
+		memcpy(t.vertex1, values + 3, sizeof(t.vertex1));
+		memcpy(t.vertex2, values + 6, sizeof(t.vertex2));
+		t.object = object;
+		fwrite(&t, sizeof(t), 1, spill);
+
+		if (object >= sums.size())
+		{
+			sums.resize(object + 1, glm::vec3(0.0f));
+			vertices.resize(object + 1, 0);
+		}
+		sums.at(object).x += t.vertex0[0] + t.vertex1[0] + t.vertex2[0];
+		sums.at(object).y += t.vertex0[1] + t.vertex1[1] + t.vertex2[1];
+		sums.at(object).z += t.vertex0[2] + t.vertex1[2] + t.vertex2[2];
+		vertices.at(object) += 3;
+		triangles++;
+	}
+
+	bool null()
+	{
+		if (spilling()) return true;
+		value();
+		return dom.null();
+	}
+
+	bool boolean(bool val)
+	{
+		if (spilling()) return true;
+		value();
+		return dom.boolean(val);
+	}
+
+	bool number_integer(json::number_integer_t val)
+	{
+		if (spilling()) return number((float)val);
+		value();
+		return dom.number_integer(val);
+	}
+
+	bool number_unsigned(json::number_unsigned_t val)
+	{
+		if (spilling()) return number((float)val);
+		value();
+		return dom.number_unsigned(val);
+	}
+
+	bool number_float(json::number_float_t val, const json::string_t &s)
+	{
+		if (spilling()) return number((float)val);
+		value();
+		return dom.number_float(val, s);
+	}
+
+	bool string(json::string_t &val)
+	{
+		if (spilling()) return true;
+		value();
+		return dom.string(val);
+	}
+
+	bool start_object(std::size_t elements)
+	{
+		if (spilling()) return true;
+		value();
+		depth++;
+		if (objects_depth != 0 && depth == objects_depth + 1)
+		{
+			object++;
+		}
+		return dom.start_object(elements);
+	}
+
+	bool key(json::string_t &val)
+	{
+		if (spilling()) return true;
+		objects_next = depth == 1 && val == "objects";
+		triangles_next = objects_depth != 0 && depth == objects_depth + 1 && val == "triangles";
+		return dom.key(val);
+	}
+
+	bool end_object()
+	{
+		if (spilling()) return true;
+		depth--;
+		return dom.end_object();
+	}
+
+	bool start_array(std::size_t elements)
+	{
+		if (spilling())
+		{
+			triangles_depth++;
+			if (triangles_depth == 2)
+			{
+				value_count = 0;
+			}
+			return true;
+		}
+		if (triangles_next)
+		{
+			triangles_next = false;
+			triangles_depth = 1;
+			return dom.start_array(0) && dom.end_array();
+		}
+
+		depth++;
+		if (objects_next)
+		{
+			objects_depth = depth;
+			objects_next = false;
+		}
+		return dom.start_array(elements);
+	}
+
+	bool end_array()
+	{
+		if (spilling())
+		{
+			if (triangles_depth == 2 && value_count == 9)
+			{
+				addTriangle();
+			}
+			triangles_depth--;
+			return true;
+		}
+		if (depth == objects_depth)
+		{
+			objects_depth = 0;
+		}
+		depth--;
+		return dom.end_array();
+	}
+
+	bool parse_error(std::size_t position, const std::string &last_token, const nlohmann::detail::exception &ex)
+	{
+		return dom.parse_error(position, last_token, ex);
+	}
+};
+
+// what loadObject() does to the vertices of a mesh with a "transformation"
+struct mesh_transform
+{
+	bool transformed;
+	glm::mat4 matrix;
+	glm::vec4 centre;
+	glm::vec4 translation;
+};
+
+void transformVertex(const mesh_transform &transform, float *vertex)
+{
+	glm::vec4 v(vertex[0], vertex[1], vertex[2], 0.0f);
+	v = v - transform.centre;
+	v = transform.matrix * v;
+	v = v + transform.centre + transform.translation;
+
+	vertex[0] = v.x;
+	vertex[1] = v.y;
+	vertex[2] = v.z;
+}
+
+void meshTransforms(json &objects, const mesh_streamer &streamer, std::vector<mesh_transform> &transforms)
+{
+	transforms.assign(objects.size(), mesh_transform());
+
+	for (int i = 0; i < objects.size(); i++)
+	{
+		json &object = objects[i];
+		mesh_transform &transform = transforms.at(i);
+		transform.transformed = object.find("transformation") != object.end() && i < streamer.vertices.size() &&
+			streamer.vertices.at(i) > 0;
+
+		if (!transform.transformed)
+		{
+			continue;
+		}
+
+		json &transformation = object["transformation"];
+		float rotation = transformation["rotation"];
+		int axisOfrotation = transformation["axisOfrotation"];
+		std::vector<float> scale = transformation["scale"];
+		std::vector<float> translation = transformation["translation"];
+
+		glm::vec3 axis(0.0f, 0.0f, 0.0f);
+		if (axisOfrotation == 1)
+		{
+			axis.x = 1.0f;
+		}
+		else if (axisOfrotation == 2)
+		{
+			axis.y = 1.0f;
+		}
+		else
+		{
+			axis.z = 1.0f;
+		}
+
+		int number = streamer.vertices.at(i);
+		transform.centre = glm::vec4(streamer.sums.at(i).x / number, streamer.sums.at(i).y / number, streamer.sums.at(i).z / number, 0.0f);
+		transform.matrix = glm::scale(glm::mat4(), glm::vec3(scale.at(0), scale.at(1), scale.at(2))) * glm::rotate(glm::mat4(), glm::radians(rotation), axis);
+		transform.translation = glm::vec4(translation.at(0), translation.at(1), translation.at(2), 0.0);
+	}
+}
+
+// reads the spilled triangles from the start, a block at a time, with their transformations applied
+struct spill_reader
+{
+	FILE *file;
+	const std::vector<mesh_transform> *transforms;
+	std::vector<paged_triangle> block;
+	size_t next;
+	size_t size;
+
+	spill_reader(FILE *spill, const std::vector<mesh_transform> &mesh_transforms)
+		: file(spill), transforms(&mesh_transforms), block(SPILL_BLOCK), next(0), size(0)
+	{
+		rewind(file);
+	}
+
+	bool read(paged_triangle &t)
+	{
+		if (next == size)
+		{
+			size = fread(&block[0], sizeof(paged_triangle), block.size(), file);
+			next = 0;
+			if (size == 0)
+			{
+				return false;
+			}
+		}
+
+		t = block.at(next++);
+		const mesh_transform &transform = transforms->at(t.object);
+		if (transform.transformed)
+		{
+			transformVertex(transform, t.vertex0);
+			transformVertex(transform, t.vertex1);
+			transformVertex(transform, t.vertex2);
+		}
+		return true;
+	}
+};
+
+unsigned int spreadBits(unsigned int v)
+{
+	unsigned int spread = 0;
+	for (int bit = 0; bit < PAGE_GRID_BITS; bit++)
+	{
+		spread |= ((v >> bit) & 1) << (3 * bit);
+	}
+	return spread;
+}
+
+// the cell of the triangle's centre, numbered along a Morton curve
+int cellOf(const paged_triangle &t, const float *centres)
+{
+	float box[6];
+	triangleBox(t, box);
+
+	unsigned int code = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float centre = (box[2 * axis] + box[2 * axis + 1]) * 0.5f;
+		float extent = centres[2 * axis + 1] - centres[2 * axis];
+		int cell = extent > 0 ? (int)((centre - centres[2 * axis]) / extent * PAGE_GRID) : 0;
+		code |= spreadBits(glm::clamp(cell, 0, PAGE_GRID - 1)) << axis;
+	}
+	return code;
+}
+
+// Groups the cells into pages top down, like an octree over the Morton order: a block of cells
+// whose triangles fit into a page is put into one, and only blocks next to each other under the
+// same parent share a page. So a page never straddles two large blocks, and its box stays small.
+struct page_packer
+{
+	const std::vector<long long> *cell_counts;
+	const std::vector<float> *cell_boxes;
+	std::vector<long long> before; // triangles in the cells before each cell
+	std::vector<page_entry> *entries;
+	std::vector<int> *page_of_cell;
+	bool open; // whether the last page takes more blocks
+
+	void pack(int begin, int size)
+	{
+		long long count = before.at(begin + size) - before.at(begin);
+		if (count == 0)
+		{
+			return;
+		}
+
+		if (count > PAGE_TRIANGLES && size > 1)
+		{
+			open = false;
+			for (int child = 0; child < 8; child++)
+			{
+				pack(begin + child * size / 8, size / 8);
+			}
+			open = false;
+			return;
+		}
+
+		if (!open || entries->back().count + count > PAGE_TRIANGLES)
+		{
+			page_entry entry;
+			entry.first = before.at(begin);
+			entry.count = 0;
+			emptyBox(entry.bounding);
+			entries->push_back(entry);
+			open = true;
+		}
+		for (int cell = begin; cell < begin + size; cell++)
+		{
+			if (cell_counts->at(cell) != 0)
+			{
+				growBox(entries->back().bounding, &cell_boxes->at(cell * 6));
+				page_of_cell->at(cell) = entries->size() - 1;
+			}
+		}
+		entries->back().count += count;
+	}
+};
+
+bool flushPage(FILE *file, const std::vector<page_entry> &entries, int page, std::vector<long long> &written,
+	std::vector<std::vector<paged_triangle> > &buffers)
+{
+	std::vector<paged_triangle> &buffer = buffers.at(page);
+	if (buffer.size() == 0)
+	{
+		return true;
+	}
+
+	bool ok = seekTo(file, triangles_offset + (entries.at(page).first + written.at(page)) * (long long)sizeof(paged_triangle)) &&
+		fwrite(&buffer[0], sizeof(paged_triangle), buffer.size(), file) == buffer.size();
+	written.at(page) += buffer.size();
+	buffer.clear();
+	return ok;
+}
+
+// Parses the scene file into a page file at path, streaming the triangles of its meshes
+// through a spill file next to it; the scene itself only ever holds them one at a time.
+bool bake_out_of_core(const std::string &scene_file, const std::string &path)
+{
+	trace_scope scope("bake pages");
+
+	std::ifstream in(scene_file.c_str(), std::ios::binary);
+	if (!in.is_open())
+	{
+		std::cout << "Unable to open scene file " << scene_file << std::endl;
+		return false;
+	}
+
+	std::string spill_path = path + ".tmp";
+	FILE *spill = fopen(spill_path.c_str(), "wb+");
+	if (spill == NULL)
+	{
+		std::cout << "Unable to write " << spill_path << std::endl;
+		return false;
+	}
+
+	json scene;
+	mesh_streamer streamer(scene, spill);
+	json::sax_parse(in, &streamer);
+	in.close();
+	fflush(spill);
+
+	json &objects = scene["objects"];
+	for (int i = 0; i < objects.size(); i++)
+	{
+		if (objects[i].find("keyframes") != objects[i].end())
+		{
+			std::cout << "Animated scenes cannot be rendered out of core, keeping the triangles in memory." << std::endl;
+			fclose(spill);
+			remove(spill_path.c_str());
+			return false;
+		}
+	}
+
+	std::vector<mesh_transform> transforms;
+	meshTransforms(objects, streamer, transforms);
+
+	// first the box around the centres of the triangles, for the grid
+	float centres[6];
+	float bounding[6];
+	emptyBox(centres);
+	emptyBox(bounding);
+
+	paged_triangle t;
+	spill_reader first_pass(spill, transforms);
+	while (first_pass.read(t))
+	{
+		float box[6];
+		triangleBox(t, box);
+		growBox(bounding, box);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float centre = (box[2 * axis] + box[2 * axis + 1]) * 0.5f;
+			centres[2 * axis] = glm::min(centres[2 * axis], centre);
+			centres[2 * axis + 1] = glm::max(centres[2 * axis + 1], centre);
+		}
+	}
+
+	// then how many triangles each cell gets, and the box around them
+	int cells = PAGE_GRID * PAGE_GRID * PAGE_GRID;
+	std::vector<long long> cell_counts(cells, 0);
+	std::vector<float> cell_boxes(cells * 6);
+	for (int cell = 0; cell < cells; cell++)
+	{
+		emptyBox(&cell_boxes.at(cell * 6));
+	}
+
+	spill_reader second_pass(spill, transforms);
+	while (second_pass.read(t))
+	{
+		float box[6];
+		triangleBox(t, box);
+
+		int cell = cellOf(t, centres);
+		cell_counts.at(cell)++;
+		growBox(&cell_boxes.at(cell * 6), box);
+	}
+
+	std::vector<page_entry> entries;
+	std::vector<int> page_of_cell(cells, -1);
+
+	page_packer packer;
+	packer.cell_counts = &cell_counts;
+	packer.cell_boxes = &cell_boxes;
+	packer.before.assign(cells + 1, 0);
+	for (int cell = 0; cell < cells; cell++)
+	{
+		packer.before.at(cell + 1) = packer.before.at(cell) + cell_counts.at(cell);
+	}
+	packer.entries = &entries;
+	packer.page_of_cell = &page_of_cell;
+	packer.open = false;
+	packer.pack(0, cells);
+
+	FILE *file = fopen(path.c_str(), "wb+");
+	if (file == NULL)
+	{
+		std::cout << "Unable to write " << path << std::endl;
+		fclose(spill);
+		remove(spill_path.c_str());
+		return false;
+	}
+
+	std::string text = scene.dump();
+
+	paged_file_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "RTG3", 4);
+	header.pages = entries.size();
+	header.triangles = streamer.triangles;
+	file_stamp(scene_file, header.scene_size, header.scene_time);
+	header.scene_bytes = text.size();
+	memcpy(header.bounding, bounding, sizeof(bounding));
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(text.data(), 1, text.size(), file);
+	if (entries.size() != 0)
+	{
+		fwrite(&entries[0], sizeof(page_entry), entries.size(), file);
+	}
+
+	// the triangles start on a cache line, each page's in one run
+	triangles_offset = sizeof(header) + text.size() + entries.size() * sizeof(page_entry);
+	triangles_offset = (triangles_offset + 63) / 64 * 64;
+
+	std::vector<long long> written(entries.size(), 0);
+	std::vector<std::vector<paged_triangle> > buffers(entries.size());
+	bool ok = true;
+
+	spill_reader third_pass(spill, transforms);
+	while (third_pass.read(t))
+	{
+		int page = page_of_cell.at(cellOf(t, centres));
+		buffers.at(page).push_back(t);
+		if (buffers.at(page).size() == PAGE_WRITE_BUFFER)
+		{
+			ok = flushPage(file, entries, page, written, buffers) && ok;
+		}
+	}
+	for (int page = 0; page < entries.size(); page++)
+	{
+		ok = flushPage(file, entries, page, written, buffers) && ok;
+	}
+
+	ok = fflush(file) == 0 && ok;
+	ok = ferror(file) == 0 && ok;
+	fclose(file);
+	fclose(spill);
+	remove(spill_path.c_str());
+
+	if (!ok)
+	{
+		std::cout << "Unable to write " << path << std::endl;
+		remove(path.c_str());
+		return false;
+	}
+
+	std::cout << "Wrote " << streamer.triangles << " triangles into " << entries.size() << " pages in " << path
+		<< " (" << (streamer.triangles * sizeof(paged_triangle)) / 1024 << " KB)" << std::endl;
+	return true;
+}
+
+// whether path holds pages written from the scene file as it is now
+bool pagesAreCurrent(const std::string &scene_file, const std::string &path)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	paged_file_header header;
+	bool read = fread(&header, sizeof(header), 1, file) == 1;
+	fclose(file);
+
+	if (!read || memcmp(header.magic, "RTG3", 4) != 0)
+	{
+		return false;
+	}
+
+	// without the scene file the pages are all there is
+	long long size, time;
+	file_stamp(scene_file, size, time);
+	return size == 0 || (size == header.scene_size && time == header.scene_time);
+}
+
+bool loadPages(const std::string &scene_file, const std::string &path)
+{
+	trace_scope scope("open pages");
+
+	FILE *file = fopen(path.c_str(), "rb");
+	if (file == NULL)
+	{
+		std::cout << "Unable to open " << path << std::endl;
+		return false;
+	}
+
+	paged_file_header header;
+	std::string text;
+	std::vector<page_entry> entries;
+
+	bool ok = fread(&header, sizeof(header), 1, file) == 1;
+	if (ok)
+	{
+		text.resize(header.scene_bytes);
+		entries.resize(header.pages);
+		ok = fread(&text[0], 1, text.size(), file) == text.size() &&
+			(entries.size() == 0 || fread(&entries[0], sizeof(page_entry), entries.size(), file) == entries.size());
+	}
+	if (!ok)
+	{
+		std::cout << "Unable to read " << path << std::endl;
+		fclose(file);
+		return false;
+	}
+
+	use_scene(json::parse(text), scene_file);
+	loadShapes();
+
+	// the scene's box has to hold the paged triangles too, planes and spheres are built over it
+	if (header.triangles > 0)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			current_scene->bounding.at(2 * axis) = glm::min(current_scene->bounding.at(2 * axis), header.bounding[2 * axis]);
+			current_scene->bounding.at(2 * axis + 1) = glm::max(current_scene->bounding.at(2 * axis + 1), header.bounding[2 * axis + 1]);
+		}
+	}
+	buildAccelerationStructures();
+
+	page_materials.assign(current_scene->listOfObjects.size(), NULL);
+	for (int i = 0; i < current_scene->listOfObjects.size(); i++)
+	{
+		if (current_scene->listOfObjects.at(i).materials.size() != 0)
+		{
+			page_materials.at(i) = current_scene->listOfObjects.at(i).materials.at(0);
+		}
+	}
+
+	// a box hierarchy with a page in every leaf, the pages reordered to match it
+	std::vector<float> boxes(entries.size() * 6);
+	std::vector<int> order(entries.size());
+	for (int i = 0; i < entries.size(); i++)
+	{
+		memcpy(&boxes.at(i * 6), entries.at(i).bounding, sizeof(entries.at(i).bounding));
+		order.at(i) = i;
+	}
+
+	page_tree.clear();
+	if (entries.size() != 0)
+	{
+		page_tree.resize(1);
+		buildBoxNodes(page_tree, 0, order, 0, entries.size(), boxes, 1);
+	}
+
+	// occluders cached from pages of an earlier file are gone
+	invalidateOccluderCache();
+	pages.assign(entries.size(), triangle_page());
+	for (int i = 0; i < entries.size(); i++)
+	{
+		const page_entry &entry = entries.at(order.at(i));
+		triangle_page &page = pages.at(i);
+		page.first = entry.first;
+		page.count = entry.count;
+		memcpy(page.bounding, entry.bounding, sizeof(entry.bounding));
+		page.resident = false;
+		page.last_demanded = -1;
+	}
+
+	triangles_offset = sizeof(header) + text.size() + entries.size() * sizeof(page_entry);
+	triangles_offset = (triangles_offset + 63) / 64 * 64;
+	paged_file = file;
+	mapped_triangles = NULL;
+	resident_bytes = 0;
+
+#ifndef _WIN32
+	mapped_size = triangles_offset + header.triangles * sizeof(paged_triangle);
+	void *mapping = mmap(NULL, mapped_size, PROT_READ, MAP_SHARED, fileno(file), 0);
+	if (mapping != MAP_FAILED)
+	{
+		mapped_triangles = (const char *)mapping + triangles_offset;
+	}
+#endif
+
+	out_of_core = true;
+	memset(&paging, 0, sizeof(paging));
+	std::cout << "Paging " << header.triangles << " triangles in " << pages.size() << " pages from " << path << std::endl;
+	return true;
+}
+
+bool open_out_of_core(const char *scene_name, const std::string &path)
+{
+	std::string scene_file = PATH + std::string(scene_name != NULL ? scene_name : "c") + ".json";
+
+	if (!pagesAreCurrent(scene_file, path) && !bake_out_of_core(scene_file, path))
+	{
+		return false;
+	}
+	return loadPages(scene_file, path);
+}
+
+void evictPage(int index)
+{
+	triangle_page &page = pages.at(index);
+	resident_bytes -= page_bytes(page);
+	std::vector<shape>().swap(page.shapes);
+	std::vector<box_node>().swap(page.nodes);
+	page.resident = false;
+	paging.evictions++;
+
+	// cached occluders may point into the page
+	invalidateOccluderCache();
+
+#ifndef _WIN32
+	// the mapped bytes of the page are not needed either until it comes back
+	if (mapped_triangles != NULL)
+	{
+		long page_size = sysconf(_SC_PAGESIZE);
+		size_t begin = triangles_offset + page.first * sizeof(paged_triangle);
+		size_t end = begin + page.count * sizeof(paged_triangle);
+		begin = (begin + page_size - 1) / page_size * page_size;
+		end = end / page_size * page_size;
+		if (end > begin)
+		{
+			madvise((char *)mapped_triangles - triangles_offset + begin, end - begin, MADV_DONTNEED);
+		}
+	}
+#endif
+}
+
+void loadPage(int index)
+{
+	trace_scope scope("page in");
+
+	triangle_page &page = pages.at(index);
+	std::vector<paged_triangle> read_triangles;
+	const paged_triangle *triangles = NULL;
+
+	if (mapped_triangles != NULL)
+	{
+		triangles = (const paged_triangle *)mapped_triangles + page.first;
+	}
+	else
+	{
+		read_triangles.resize(page.count);
+		seekTo(paged_file, triangles_offset + page.first * (long long)sizeof(paged_triangle));
+		fread(&read_triangles[0], sizeof(paged_triangle), page.count, paged_file);
+		triangles = &read_triangles[0];
+	}
+
+	std::vector<float> boxes(page.count * 6);
+	std::vector<int> order(page.count);
+	for (int i = 0; i < page.count; i++)
+	{
+		triangleBox(triangles[i], &boxes.at(i * 6));
+		order.at(i) = i;
+	}
+	page.nodes.assign(1, box_node());
+	buildBoxNodes(page.nodes, 0, order, 0, page.count, boxes, PAGE_LEAF_TRIANGLES);
+
+	page.shapes.resize(page.count);
+	for (int i = 0; i < page.count; i++)
+	{
+		const paged_triangle &t = triangles[order.at(i)];
+		shape &s = page.shapes.at(i);
+		s.type = "triangle";
+		s.vertex0 = glm::vec4(t.vertex0[0], t.vertex0[1], t.vertex0[2], 0.0f);
+		s.vertex1 = glm::vec4(t.vertex1[0], t.vertex1[1], t.vertex1[2], 0.0f);
+		s.vertex2 = glm::vec4(t.vertex2[0], t.vertex2[1], t.vertex2[2], 0.0f);
+		s.mat = page_materials.at(t.object);
+		s.sub_shape1 = NULL;
+		s.sub_shape2 = NULL;
+	}
+
+	page.resident = true;
+	resident_bytes += page_bytes(page);
+	paging.page_ins++;
+	paging.peak_resident_bytes = glm::max(paging.peak_resident_bytes, resident_bytes);
+}
+
+
+// makes room for the page and loads it, never evicting a page wanted in the same pass;
+// when nothing else can go, force loads it over the budget instead of giving up
+bool pageIn(int index, long long pass, bool force)
+{
+	triangle_page &page = pages.at(index);
+	page.last_demanded = pass;
+
+	if (page.resident)
+	{
+		return true;
+	}
+
+	while (resident_bytes + page_bytes(page) > out_of_core_budget)
+	{
+		int victim = -1;
+		for (int i = 0; i < pages.size(); i++)
+		{
+			if (pages.at(i).resident && pages.at(i).last_demanded < pass &&
+				(victim < 0 || pages.at(i).last_demanded < pages.at(victim).last_demanded))
+			{
+				victim = i;
+			}
+		}
+		if (victim < 0)
+		{
+			if (!force)
+			{
+				return false;
+			}
+			break; // a single ray needs more than the budget, go over it rather than never finish
+		}
+		evictPage(victim);
+	}
+
+	loadPage(index);
+	return true;
+}
+
+struct box_entry
+{
+	int node;
+	float t_near;
+};
+
+// Walks the boxes of nodes that the ray passes through, the nearest first, and hands every leaf
+// to walk.leaf(first, count, t_near). A box that starts further along the ray than walk.limit() is
+// skipped; the walk ends as soon as a leaf returns true.
+template <class walker>
+bool walkBoxes(const std::vector<box_node> &nodes, const point3 &e, const glm::vec3 &inverse, walker &walk)
+{
+	box_entry stack[64];
+	int size = 0;
+	float t_near;
+
+	if (nodes.size() == 0 || !rayHitsBox(e, inverse, nodes[0].bounding, t_near))
+	{
+		return false;
+	}
+	stack[size].node = 0;
+	stack[size++].t_near = t_near;
+
+	while (size > 0)
+	{
+		box_entry entry = stack[--size];
+		if (entry.t_near > walk.limit())
+		{
+			continue;
+		}
+
+		const box_node &node = nodes[entry.node];
+		if (node.count != 0)
+		{
+			if (walk.leaf(node.first, node.count, entry.t_near))
+			{
+				return true;
+			}
+			continue;
+		}
+
+		float t0, t1;
+		bool hit0 = rayHitsBox(e, inverse, nodes[node.first].bounding, t0);
+		bool hit1 = rayHitsBox(e, inverse, nodes[node.first + 1].bounding, t1);
+
+		// the nearer child goes on top
+		if (hit0 && (!hit1 || t0 >= t1))
+		{
+			stack[size].node = node.first;
+			stack[size++].t_near = t0;
+		}
+		if (hit1)
+		{
+			stack[size].node = node.first + 1;
+			stack[size++].t_near = t1;
+		}
+		if (hit0 && hit1 && t0 < t1)
+		{
+			stack[size].node = node.first;
+			stack[size++].t_near = t0;
+		}
+	}
+	return false;
+}
+
+// hands the triangles of one resident page to visit.test()
+template <class visitor>
+struct shape_walk
+{
+	triangle_page *page;
+	visitor *visit;
+
+	float limit()
+	{
+		return visit->limit();
+	}
+
+	bool leaf(int first, int count, float t_near)
+	{
+		for (int i = first; i < first + count; i++)
+		{
+			if (visit->test(&page->shapes[i]))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+// goes into the pages along the ray that are resident and notes down the others
+template <class visitor>
+struct page_walk
+{
+	const point3 *e;
+	glm::vec3 inverse;
+	visitor *visit;
+
+	float limit()
+	{
+		return visit->limit();
+	}
+
+	bool leaf(int first, int count, float t_near)
+	{
+		for (int index = first; index < first + count; index++)
+		{
+			triangle_page &page = pages[index];
+			reached_pages.push_back(index);
+			reached_t.push_back(t_near);
+			if (!page.resident)
+			{
+				missing_pages.push_back(index);
+				missing_t.push_back(t_near);
+				continue;
+			}
+
+			shape_walk<visitor> walk;
+			walk.page = &page;
+			walk.visit = visit;
+			if (walkBoxes(page.nodes, *e, inverse, walk))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+// the paged triangles along e + t * (s - e), nearest first, until visit.test() returns true
+template <class visitor>
+bool walkPages(const point3 &e, const point3 &s, visitor &visit)
+{
+	page_walk<visitor> walk;
+	walk.e = &e;
+	walk.inverse = 1.0f / (s - e);
+	walk.visit = &visit;
+	return walkBoxes(page_tree, e, walk.inverse, walk);
+}
+
+struct collect_visitor
+{
+	std::vector<shape *> *shapes;
+
+	float limit()
+	{
+		return FLT_MAX;
+	}
+
+	bool test(shape *s)
+	{
+		shapes->push_back(s);
+		return false;
+	}
+};
+
+struct closest_visitor
+{
+	const point3 *e, *s;
+	float *finalT;
+	bool *isHit;
+	Material **hit_material;
+	glm::vec3 *intersection, *N, *center;
+	int *type;
+	float *radius;
+	shape **hit_shape;
+	render_statistics *statistics;
+
+	float limit()
+	{
+		return *finalT;
+	}
+
+	bool test(shape *object)
+	{
+		statistics->hit_shape_tests++;
+		float lastT = *finalT;
+		hitTestingShape(object, *e, *s, *finalT, *isHit, *hit_material, *intersection, *N, *center, *type, *radius);
+
+		if (*finalT != lastT && hit_shape != NULL)
+		{
+			*hit_shape = object;
+		}
+		return false;
+	}
+};
+
+struct shadow_visitor
+{
+	const point3 *e, *s;
+	int type;
+	shape *occluder;
+
+	// point and spot lights are at s, only a directional light is blocked by whatever lies beyond
+	float limit()
+	{
+		return type == 1 || type == 3 ? 1.0f : FLT_MAX;
+	}
+
+	bool test(shape *object)
+	{
+		if (shadowTestingShape(object, *e, *s, type))
+		{
+			occluder = object;
+			return true;
+		}
+		return false;
+	}
+};
+
+// drops the pages noted from the given entries on that the ray only enters after t
+void forgetPagesPast(std::vector<int> &noted, std::vector<float> &noted_t, size_t from, float t)
+{
+	size_t kept = from;
+	for (size_t i = from; i < noted.size(); i++)
+	{
+		if (noted_t[i] <= t)
+		{
+			noted[kept] = noted[i];
+			noted_t[kept++] = noted_t[i];
+		}
+	}
+	noted.resize(kept);
+	noted_t.resize(kept);
+}
+
+void addPagedShapes(const point3 &e, const point3 &s, std::vector<shape *> &objects_to_for_hit_testing)
+{
+	collect_visitor visit;
+	visit.shapes = &objects_to_for_hit_testing;
+	walkPages(e, s, visit);
+}
+
+void pagedClosestHit(const point3 &e, const point3 &s, float &finalT, bool &isHit, Material * &hit_material,
+	glm::vec3 &intersection, glm::vec3 &N, glm::vec3 &center, int &type, float &radius, shape ** hit_shape)
+{
+	closest_visitor visit;
+	visit.e = &e;
+	visit.s = &s;
+	visit.finalT = &finalT;
+	visit.isHit = &isHit;
+	visit.hit_material = &hit_material;
+	visit.intersection = &intersection;
+	visit.N = &N;
+	visit.center = &center;
+	visit.type = &type;
+	visit.radius = &radius;
+	visit.hit_shape = hit_shape;
+	visit.statistics = &thread_statistics();
+
+	size_t reached_from = reached_pages.size();
+	size_t missing_from = missing_pages.size();
+	walkPages(e, s, visit);
+
+	// a page the ray only enters behind the nearest hit cannot hold a nearer one, resident or not
+	if (isHit)
+	{
+		forgetPagesPast(reached_pages, reached_t, reached_from, finalT);
+		forgetPagesPast(missing_pages, missing_t, missing_from, finalT);
+	}
+}
+
+shape * shadowTestingPaged(const point3 &e, const point3 &s, int type)
+{
+	shadow_visitor visit;
+	visit.e = &e;
+	visit.s = &s;
+	visit.type = type;
+	visit.occluder = NULL;
+	walkPages(e, s, visit);
+	return visit.occluder;
+}
+
+// a pixel that could not be finished, with the pages its rays reached, sorted
+typedef std::pair<int, std::vector<int> > deferred_pixel;
+
+// pending pixels below this are traced on the calling thread, starting threads would take longer
+const int PAGING_THREAD_PIXELS = 256;
+
+// traces one pixel, false if some page it needed was not resident
+bool tracePixel(int x, int y, int width, int height, colour3 &colour)
+{
+	missing_pages.clear();
+	missing_t.clear();
+	reached_pages.clear();
+	reached_t.clear();
+
+	point3 e(0.0f, 0.0f, 0.0f);
+	point3 s = image_plane_point(x, y, width, height);
+	colour = colour3(0, 0, 0);
+
+	if (!trace(e, s, colour))
+	{
+		colour = current_scene->background_colour;
+	}
+	return missing_pages.size() == 0;
+}
+
+// pending pixels handed out to the threads at a time
+const int PAGING_CHUNK_PIXELS = 64;
+
+struct paging_pass
+{
+	int width, height;
+	const std::vector<int> *pending;
+	std::vector<colour3> *pixels;
+	std::vector<std::vector<deferred_pixel> > deferred; // per chunk
+};
+
+void tracePendingChunk(void *job, int chunk)
+{
+	paging_pass *pass = (paging_pass *)job;
+	int begin = chunk * PAGING_CHUNK_PIXELS;
+	int end = glm::min(begin + PAGING_CHUNK_PIXELS, (int)pass->pending->size());
+
+	for (int i = begin; i < end; i++)
+	{
+		int pixel = pass->pending->at(i);
+		colour3 colour;
+
+		if (tracePixel(pixel % pass->width, pixel / pass->width, pass->width, pass->height, colour))
+		{
+			pass->pixels->at(pixel) = colour;
+		}
+		else
+		{
+			std::vector<int> reached = reached_pages;
+			std::sort(reached.begin(), reached.end());
+			reached.erase(std::unique(reached.begin(), reached.end()), reached.end());
+			pass->deferred.at(chunk).push_back(deferred_pixel(pixel, reached));
+		}
+	}
+}
+
+// traces the pending pixels with the pages resident now, deferred gets those that needed others
+void tracePending(int width, int height, const std::vector<int> &pending, std::vector<colour3> &pixels,
+	std::vector<deferred_pixel> &deferred)
+{
+	paging_pass pass;
+	pass.width = width;
+	pass.height = height;
+	pass.pending = &pending;
+	pass.pixels = &pixels;
+
+	int chunks = (pending.size() + PAGING_CHUNK_PIXELS - 1) / PAGING_CHUNK_PIXELS;
+	pass.deferred.resize(chunks);
+
+	if (pending.size() < PAGING_THREAD_PIXELS)
+	{
+		for (int chunk = 0; chunk < chunks; chunk++)
+		{
+			tracePendingChunk(&pass, chunk);
+		}
+	}
+	else
+	{
+		render_tiles(current_scene, chunks, tracePendingChunk, &pass);
+	}
+
+	deferred.clear();
+	for (int chunk = 0; chunk < chunks; chunk++)
+	{
+		deferred.insert(deferred.end(), pass.deferred.at(chunk).begin(), pass.deferred.at(chunk).end());
+	}
+}
+
+bool byDemand(const std::pair<int, int> &a, const std::pair<int, int> &b)
+{
+	return a.second > b.second;
+}
+
+// the pages of a batch, all resident at once while its pixels are traced
+struct page_batch
+{
+	std::vector<int> pixels;
+	std::vector<int> pages; // sorted
+	size_t bytes;
+	size_t largest; // the most any one of its pixels needs
+	size_t largest_pages;
+};
+
+size_t pagesBytes(const std::vector<int> &needed)
+{
+	size_t bytes = 0;
+	for (int i = 0; i < needed.size(); i++)
+	{
+		bytes += page_bytes(pages.at(needed.at(i)));
+	}
+	return bytes;
+}
+
+// pixels in blocks of 8 x 8, which mostly reach the same pages
+struct by_block
+{
+	int width;
+
+	bool operator()(const deferred_pixel &a, const deferred_pixel &b) const
+	{
+		int ax = a.first % width, ay = a.first / width;
+		int bx = b.first % width, by = b.first / width;
+		if (ay / 8 != by / 8)
+		{
+			return ay / 8 < by / 8;
+		}
+		if (ax / 8 != bx / 8)
+		{
+			return ax / 8 < bx / 8;
+		}
+		return a.first < b.first;
+	}
+};
+
+// pages in the pages of the batch, traces its pixels and notes those that reached yet others
+void traceBatch(int width, int height, page_batch &batch, long long &pass_number, std::vector<colour3> &pixels,
+	std::vector<deferred_pixel> &deferred)
+{
+	pass_number++;
+	paging.batches++;
+
+	// only a pixel that alone needs more than the budget is ever in a batch that does
+	bool fits = batch.bytes <= out_of_core_budget;
+	if (!fits && paging.over_budget++ == 0)
+	{
+		std::cout << "A pixel needs " << batch.largest_pages << " pages, " << batch.largest / 1024 << " KB, more than the budget of "
+			<< out_of_core_budget / 1024 << " KB; such pixels are rendered over the budget." << std::endl;
+	}
+
+	// the pages of the batch that are resident already must not make room for the others
+	for (int i = 0; i < batch.pages.size(); i++)
+	{
+		pages.at(batch.pages.at(i)).last_demanded = pass_number;
+	}
+	for (int i = 0; i < batch.pages.size(); i++)
+	{
+		pageIn(batch.pages.at(i), pass_number, !fits);
+	}
+
+	std::vector<deferred_pixel> again;
+	tracePending(width, height, batch.pixels, pixels, again);
+
+	for (int i = 0; i < again.size(); i++)
+	{
+		std::vector<int> all;
+		std::set_union(batch.pages.begin(), batch.pages.end(), again.at(i).second.begin(), again.at(i).second.end(), std::back_inserter(all));
+		deferred.push_back(deferred_pixel(again.at(i).first, all));
+	}
+
+	batch.pixels.clear();
+	batch.pages.clear();
+	batch.bytes = 0;
+	batch.largest = 0;
+	batch.largest_pages = 0;
+}
+
+// The pixels the passes hardly got any further with are taken block by block and gathered
+// into batches for as long as the pages their rays reached fit into the budget together;
+// then those pages are made resident and the batch is traced. Neighbouring pixels mostly
+// reach the same pages, so the next batch keeps most of them and only the difference is
+// paged. A pixel whose rays then reach further pages goes into the next round with all of
+// them. Only a pixel whose pages alone are more than the budget is loaded over it, and
+// that is reported.
+void finishInBatches(int width, int height, std::vector<deferred_pixel> &deferred, long long &pass_number,
+	std::vector<colour3> &pixels)
+{
+	by_block order;
+	order.width = width;
+
+	page_batch batch;
+	batch.bytes = 0;
+	batch.largest = 0;
+	batch.largest_pages = 0;
+
+	while (deferred.size() != 0)
+	{
+		std::vector<deferred_pixel> round;
+		round.swap(deferred);
+		std::sort(round.begin(), round.end(), order);
+
+		for (int i = 0; i < round.size(); i++)
+		{
+			const std::vector<int> &needed = round.at(i).second;
+			std::vector<int> merged;
+			std::set_union(batch.pages.begin(), batch.pages.end(), needed.begin(), needed.end(), std::back_inserter(merged));
+			size_t merged_bytes = pagesBytes(merged);
+			size_t needed_bytes = pagesBytes(needed);
+			size_t largest = std::max(batch.largest, needed_bytes);
+
+			// pixels over the budget share their load for as long as it grows by no more than the budget
+			size_t limit = largest > out_of_core_budget ? largest + out_of_core_budget : out_of_core_budget;
+			if (merged_bytes > limit && batch.pixels.size() != 0)
+			{
+				traceBatch(width, height, batch, pass_number, pixels, deferred);
+				merged = needed;
+				merged_bytes = needed_bytes;
+				largest = needed_bytes;
+			}
+
+			batch.pixels.push_back(round.at(i).first);
+			batch.pages.swap(merged);
+			batch.bytes = merged_bytes;
+			batch.largest = largest;
+			if (needed_bytes == largest)
+			{
+				batch.largest_pages = needed.size();
+			}
+		}
+
+		if (batch.pixels.size() != 0)
+		{
+			traceBatch(width, height, batch, pass_number, pixels, deferred);
+		}
+	}
+}
+
+void render_out_of_core(int width, int height, std::vector<colour3> &pixels)
+{
+	pixels.assign(width * height, current_scene->background_colour);
+
+	std::vector<int> pending;
+	for (int i = 0; i < width * height; i++)
+	{
+		pending.push_back(i);
+	}
+
+	// when every page fits there is nothing to find out first, a first pass would only be deferred
+	size_t all_bytes = 0;
+	for (int i = 0; i < pages.size(); i++)
+	{
+		all_bytes += page_bytes(pages.at(i));
+	}
+	if (all_bytes <= out_of_core_budget)
+	{
+		for (int i = 0; i < pages.size(); i++)
+		{
+			pageIn(i, 0, false);
+		}
+	}
+
+	for (long long pass_number = 1; pending.size() != 0; pass_number++)
+	{
+		paging.passes++;
+
+		std::vector<deferred_pixel> deferred;
+		tracePending(width, height, pending, pixels, deferred);
+		paging.deferred += deferred.size();
+
+		// a pass that finishes less than one pixel in a hundred is not worth repeating
+		bool progress = (pending.size() - deferred.size()) * 100 >= pending.size();
+		pending.clear();
+
+		if (deferred.size() == 0)
+		{
+			break;
+		}
+
+		if (!progress && pass_number > 1)
+		{
+			finishInBatches(width, height, deferred, pass_number, pixels);
+			break;
+		}
+
+		// the pages most deferred rays reached come in first, as many as the budget allows
+		std::unordered_map<int, int> demand;
+		for (int i = 0; i < deferred.size(); i++)
+		{
+			pending.push_back(deferred.at(i).first);
+			for (int j = 0; j < deferred.at(i).second.size(); j++)
+			{
+				demand[deferred.at(i).second.at(j)]++;
+			}
+		}
+
+		std::vector<std::pair<int, int> > wanted(demand.begin(), demand.end());
+		std::sort(wanted.begin(), wanted.end(), byDemand);
+
+		for (int i = 0; i < wanted.size(); i++)
+		{
+			pageIn(wanted.at(i).first, pass_number, false);
+		}
+	}
+
+	std::cout << "Out of core: " << paging.passes << " passes, " << paging.batches << " batches, " << paging.deferred
+		<< " deferred rays, " << paging.page_ins << " page ins, " << paging.evictions << " evictions, peak resident "
+		<< paging.peak_resident_bytes / 1024 << " KB of " << out_of_core_budget / 1024 << " KB budget";
+	if (paging.over_budget > 0)
+	{
+		std::cout << ", " << paging.over_budget << " batches needed more than the budget";
+	}
+	std::cout << std::endl;
+}
@@ -0,0 +1,35 @@
+#ifndef outofcore_h
+#define outofcore_h
+#include "raytracer.h"
+
+// Out-of-core triangles: the triangles of the meshes are streamed into a page file while
+// the scene file is parsed, so they are never all in memory at once. They are sorted into
+// pages by where they are, one grid cell after another along a Morton curve, each triangle
+// into exactly one page; the page file also keeps the rest of the scene, so a later run
+// with an unchanged scene file reads it without parsing the meshes again. A page's
+// triangles only become shapes, with a small box hierarchy over them, while it is resident.
+// Residency only changes between the passes of render_out_of_core, a ray that reaches a
+// page that is not resident is deferred to a later pass together with the other rays that
+// need it.
+extern bool out_of_core;
+extern size_t out_of_core_budget;
+
+// Loads the scene from the page file at path, writing it from the scene file first when
+// it is missing or older than the scene. False, with nothing loaded, when the scene cannot
+// be paged (keyframes move triangles, which paging cannot do) or the file cannot be written.
+bool open_out_of_core(const char *scene_name, const std::string &path);
+
+// the triangles of resident pages along the ray; pages it reaches that are not resident are noted as missing
+void addPagedShapes(const point3 &e, const point3 &s, std::vector<shape *> &objects_to_for_hit_testing);
+
+// the nearest paged triangle closer than finalT, as hitTestingShape reports it, walking the pages and
+// their boxes nearest first and skipping those past the closest hit so far
+void pagedClosestHit(const point3 &e, const point3 &s, float &finalT, bool &isHit, Material * &hit_material,
+	glm::vec3 &intersection, glm::vec3 &N, glm::vec3 &center, int &type, float &radius, shape ** hit_shape);
+
+// the first resident paged triangle found between e and the light, NULL if there is none
+shape * shadowTestingPaged(const point3 &e, const point3 &s, int type);
+
+void render_out_of_core(int width, int height, std::vector<colour3> &pixels);
+
+#endif
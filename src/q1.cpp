@@ -1,10 +1,19 @@
 #include "common.h"
 #include "raytracer.h"
+#include "render.h"
+#include "statistics.h"
+#include "gbuffer.h"
+#include "tiles.h"
+#include "trace.h"
+#include "reload.h"
+#include "scene.h"
 #include <iostream>
 #include <cmath>
 #include <glm/glm.hpp>
 #include <fstream>
 #include <string>
+#include <chrono>
+#include <cstring>
 #include <glm/gtx/string_cast.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -12,33 +21,22 @@
 #define M_PI 3.14159265358979323846
 
 const char *WINDOW_TITLE = "Ray Tracing";
-const double FRAME_RATE_MS = 1;
+const double FRAME_RATE_MS = 16;
 
-float xs[1<<16]; // big enough for a row of pixels
-colour3 colours[1<<16];
-GLuint Y, Window, Projection;
+GLuint texture, pixel_buffer;
 int vp_width, vp_height;
-float drawing_y = 0;
 point3 origin(0.0f, 0.0f, 0.0f);
-float d = 1;
+
+// when set, the render shades the g-buffer of the last full render instead of tracing
+bool relighting = false;
+std::chrono::steady_clock::time_point render_start;
+int passes_shown = 0; // of the coarse to fine passes, the ones whose time was printed
 
 //----------------------------------------------------------------------------
 
 point3 s(float x, float y)
 {
-	float aspect_ratio = (float)vp_width / vp_height;
-	float h = d * (float)tan((M_PI * fov) / 180.0 / 2.0);
-	float w = h * aspect_ratio;
-   
-	float top = h;
-	float bottom = -h;
-	float left = -w;
-	float right = w;
-   
-	float u = left + (right - left) * (x + 0.5f) / vp_width;
-	float v = bottom + (top - bottom) * (y + 0.5f) / vp_height;
-   
-	return point3(u, v, -d);
+	return image_plane_point(x, y, vp_width, vp_height);
 }
 
 //----------------------------------------------------------------------------
@@ -48,125 +46,173 @@ void init(char *fn) {
 	choose_scene(fn);
    
 	getBoundingAndShapeList();
+	watch_scene_file();
+
+	// the render threads have to be joined before exit() destroys them
+	atexit(stop_tile_render);
+
 	// Create a vertex array object
 	GLuint vao;
 	glGenVertexArrays( 1, &vao );
 	glBindVertexArray( vao );
 
-	// Create and initialize a buffer object
+	// one quad over the whole window, the image is a texture on it
+	GLfloat quad[] = { -1, -1, 1, -1, -1, 1, 1, 1 };
+
 	GLuint buffer;
 	glGenBuffers( 1, &buffer );
 	glBindBuffer( GL_ARRAY_BUFFER, buffer );
-	glBufferData( GL_ARRAY_BUFFER, sizeof(colours) + sizeof(xs), NULL, GL_STATIC_DRAW );
+	glBufferData( GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW );
 
 	// Load shaders and use the resulting shader program
 	GLuint program = InitShader( "v.glsl", "f.glsl" );
 	glUseProgram( program );
 
 	// set up vertex arrays
-	GLuint vColour = glGetAttribLocation( program, "vColour" );
-	glEnableVertexAttribArray( vColour );
-	glVertexAttribPointer( vColour, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0) );
+	GLuint vPosition = glGetAttribLocation( program, "vPosition" );
+	glEnableVertexAttribArray( vPosition );
+	glVertexAttribPointer( vPosition, 2, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0) );
 
-	GLuint xPos = glGetAttribLocation( program, "xPos" );
-	glEnableVertexAttribArray( xPos );
-	glVertexAttribPointer( xPos, 1, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(sizeof(colours)) );
+	glGenTextures( 1, &texture );
+	glBindTexture( GL_TEXTURE_2D, texture );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+	glUniform1i( glGetUniformLocation(program, "image"), 0 );
 
-	Y = glGetUniformLocation(program, "Y");
-	Window = glGetUniformLocation(program, "Window");
-	Projection = glGetUniformLocation(program, "Projection");
+	// finished tiles go to the texture through this buffer
+	glGenBuffers( 1, &pixel_buffer );
 
 	// glClearColor( background_colour[0], background_colour[1], background_colour[2], 1 );
 	glClearColor( 0.7, 0.7, 0.8, 1 );
-    
-	// ???
-	for (int x = 0; x < sizeof(xs)/sizeof(float); x++) 
+}
+
+//----------------------------------------------------------------------------
+
+void upload_tiles(const std::vector<tile> &tiles)
+{
+	trace_scope scope("upload tiles");
+
+	GLsizeiptr size = 0;
+	for (int i = 0; i < tiles.size(); i++)
 	{
-		xs[x] = x;
+		size += tiles.at(i).width * tiles.at(i).height * 4;
 	}
-	for (int x = 0; x < sizeof(colours)/sizeof(colour3); x++) 
+
+	// a fresh buffer every time, so the driver does not wait for the previous upload
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, pixel_buffer );
+	glBufferData( GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW );
+	unsigned char *data = (unsigned char *)glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT );
+
+	std::vector<GLsizeiptr> offsets;
+	GLsizeiptr offset = 0;
+
+	// the render threads took the copies, the framebuffer may already hold the next pass
+	for (int i = 0; i < tiles.size(); i++)
+	{
+		const std::vector<unsigned char> &rgba = tiles.at(i).rgba;
+		offsets.push_back(offset);
+		memcpy(data + offset, rgba.data(), rgba.size());
+		offset += rgba.size();
+	}
+	glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+
+	for (int i = 0; i < tiles.size(); i++)
 	{
-		colours[x] = colour3 (0, 0, 0);
+		const tile &t = tiles.at(i);
+		glTexSubImage2D( GL_TEXTURE_2D, 0, t.x, t.y, t.width, t.height, GL_RGBA, GL_UNSIGNED_BYTE, BUFFER_OFFSET(offsets.at(i)) );
 	}
-	glBufferSubData( GL_ARRAY_BUFFER, sizeof(colours), sizeof(xs), xs);
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
 }
 
 //----------------------------------------------------------------------------
 
 void display( void ) {
-	// draw one scanline at a time, to each buffer; only clear when we draw the first scanline
-	// (when fract(drawing_y) == 0.0, draw one buffer, when it is 0.5 draw the other)
-	void srand(unsigned int seed);
+	// the render threads trace the tiles, here they are only shown
+	bool finished = tile_render_running() && tile_render_finished();
 
-	for (int x = 0; x < sizeof(colours) / sizeof(colour3); x++)
+	std::vector<tile> tiles;
+	take_finished_tiles(tiles);
+	if (tiles.size() != 0)
 	{
-		colours[x] = colour3(0, 0, 0);
+		upload_tiles(tiles);
 	}
 
-	if (drawing_y <= 0.5) {
-		glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+	glClear( GL_COLOR_BUFFER_BIT );
+	glDrawArrays( GL_TRIANGLE_STRIP, 0, 4 );
+	glutSwapBuffers();
 
-		glFlush();
-		glFinish();
-		glutSwapBuffers();
+	// the time to the first image is what a preview is for
+	int passes = tile_render_passes_done();
+	if (tile_render_running() && passes > passes_shown && passes < tile_render_pass_count())
+	{
+		passes_shown = passes;
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - render_start).count();
+		std::cout << "preview pass " << passes << " of " << tile_render_pass_count() << ": " << ms << " ms" << std::endl;
+	}
 
-		drawing_y += 0.5;
-	} 
-	else if (drawing_y >= 1.0 && drawing_y <= vp_height + 0.5) 
+	if (finished)
 	{
-		int y = int(drawing_y) - 1;
+		finish_tile_render();
+
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - render_start).count();
+		std::cout << (relighting ? "relight: " : "render: ") << ms << " ms" << std::endl;
+		print_statistics();
+		gbuffer_valid = true;
+	}
+}
 
-		// only recalculate if this is a new scanline
-		if (drawing_y == int(drawing_y)) 
+//----------------------------------------------------------------------------
+
+void start_render()
+{
+	render_start = std::chrono::steady_clock::now();
+	passes_shown = 0;
+	start_tile_render(vp_width, vp_height, relighting);
+}
+
+//----------------------------------------------------------------------------
+
+// takes over the edits to the scene file and traces again only the tiles they can show in
+void reload()
+{
+	// a render that did not finish leaves no g-buffer to go by
+	bool finished = gbuffer_valid;
+	stop_tile_render();
+
+	scene_changes changes;
+	if (!reload_scene(changes))
+	{
+		if (!finished)
 		{
-			// this would be better with a single-pixel quad and a texture
-			for (int x = 0; x < vp_width; x++)
-			{
-				bool antialiasing = false;
-
-				if (!antialiasing)
-				{
-					if (!trace(origin, s(x, y), colours[x]))
-					{
-						colours[x] = background_colour;
-					}
-				}
-				else
-				{
-					colour3 color_One(0, 0, 0);
-					colour3 color_Two(0, 0, 0);
-					colour3 color_Three(0, 0, 0);
-					colour3 color_Four(0, 0, 0);
-					if (!trace(origin, s(x + 0.25f, y + 0.25f), color_One))
-					{
-						color_One = background_colour;
-					}
-					if (!trace(origin, s(x + 0.25f, y + 0.75f), color_Two))
-					{
-						color_Two = background_colour;
-					}
-					if (!trace(origin, s(x + 0.75f, y + 0.25f), color_Three))
-					{
-						color_Three = background_colour;
-					}
-					if (!trace(origin, s(x + 0.75f, y + 0.75f), color_Four))
-					{
-						color_Four = background_colour;
-					}
-					colours[x] = (color_One + color_Two + color_Three + color_Four) / 4.0f;
-				}
-			}
-			glBufferSubData( GL_ARRAY_BUFFER, 0, vp_width * sizeof(colour3), colours);
+			start_render();
 		}
-		glUniform1f( Y, y );
-		glDrawArrays( GL_POINTS, 0, vp_width );
-		
-		glFlush();
-		glFinish();
-		glutSwapBuffers();
-		
-		drawing_y += 0.5;
+		return;
+	}
+
+	if (!finished || changes.all || changes.camera)
+	{
+		relighting = false;
+		start_render();
+		return;
 	}
+
+	if (!changes.lights && !changes.planes && changes.materials.size() == 0 && changes.boxes.size() == 0)
+	{
+		std::cout << "Nothing that shows has changed." << std::endl;
+		return;
+	}
+
+	std::vector<char> changed;
+	changed_pixels(changes, changed);
+
+	// with the same geometry the g-buffer still holds, only the shading has to be done again
+	relighting = !changes.planes && changes.boxes.size() == 0;
+	render_start = std::chrono::steady_clock::now();
+	passes_shown = 0;
+	int tiles = start_tile_render(vp_width, vp_height, relighting, &changed);
+	std::cout << (relighting ? "Shading " : "Tracing ") << tiles << " tiles again." << std::endl;
 }
 
 //----------------------------------------------------------------------------
@@ -178,7 +224,19 @@ void keyboard( unsigned char key, int x, int y ) {
 		exit( EXIT_SUCCESS );
 		break;
 	case ' ':
-		drawing_y = 1;
+		relighting = false;
+		start_render();
+		break;
+	case 'r': case 'R':
+		// the scene file is watched where there is inotify, elsewhere this loads the edits
+		reload();
+		break;
+	case 'p': case 'P':
+		// any change restarts at the coarsest pass, this turns the passes off for timing full renders
+		coarse_to_fine = !coarse_to_fine;
+		std::cout << "Coarse to fine preview " << (coarse_to_fine ? "on" : "off") << std::endl;
+		relighting = false;
+		start_render();
 		break;
 	}
 }
@@ -193,7 +251,7 @@ void mouse( int button, int state, int x, int y ) {
 			colour3 c;
 			point3 uvw = s(x, y);
 			std::vector<shape *> objects_to_for_hit_testing;
-			ray_box_intersection(origin, uvw, ocTree_root, objects_to_for_hit_testing, true);
+			ray_box_intersection(origin, uvw, current_scene->ocTree_root, objects_to_for_hit_testing, true);
 			break;
 		}
 	}
@@ -202,6 +260,10 @@ void mouse( int button, int state, int x, int y ) {
 //----------------------------------------------------------------------------
 
 void update( void ) {
+	if (scene_file_changed())
+	{
+		reload();
+	}
 }
 
 //----------------------------------------------------------------------------
@@ -211,6 +273,13 @@ void reshape( int width, int height )
 	glViewport( 0, 0, width, height );
 	vp_width = width;
 	vp_height = height;
-	glUniform2f( Window, width, height );
-	drawing_y = 0;
+
+	stop_tile_render();
+
+	// the old image is gone, start from black until the tiles come in
+	std::vector<unsigned char> black(width * height * 4, 0);
+	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, black.size() != 0 ? &black[0] : NULL );
+
+	relighting = false;
+	start_render();
 }
@@ -1,15 +1,25 @@
 #include "raytracer.h"
+#include "animation.h"
+#include "statistics.h"
+#include "gbuffer.h"
+#include "outofcore.h"
+#include "compact_octree.h"
+#include "bvh.h"
+#include "trace.h"
+#include "tuning.h"
+#include "scene.h"
+#include "batch_shading.h"
 #include <stdio.h>
 #include <stdlib.h>
-#include <GL/glew.h>
+#include <atomic>
+#include <algorithm>
+#include <set>
 #include <glm/gtc/matrix_transform.hpp>
 
 using json = nlohmann::json;
 float refractionOfAir = 1.0002926f;
 const char *PATH = "scenes/";
 
-json scene;
-
 int point = 1;
 int direction = 2;
 int spot = 3;
@@ -17,29 +27,9 @@ int sphere = 4;
 int triangle = 5;
 int plane = 6;
 
-double fov = 60;
-colour3 background_colour(0, 0, 0);
-Node * ocTree_root;
-
-glm::vec3 light_ambient_color;
-
-std::vector<glm::vec3> light_directional_color;
-std::vector<glm::vec3> light_directional_direction;
-
-std::vector<glm::vec3> light_point_color;
-std::vector<glm::vec3> light_point_position;
-
-std::vector<glm::vec3> light_spot_color;
-std::vector<glm::vec3> light_spot_position;
-std::vector<glm::vec3> light_spot_direction;
-std::vector<float> light_spot_cutoff;
-
-std::vector<float> bounding;
-
-std::vector<shape *> listOfShapes;
-std::vector<shape *> listOfPlanes;
-
-glm::vec3 eye(0.0f, 0.0f, 0.0f);
+// an n x n grid of the point lights of an area light first (-area-probes n), 0 tests every one of them;
+// off by default, since an occluder between the probes changes the shadow
+int area_light_probes = 0;
 
 json find(json &j, const std::string key, const std::string value) {
 	json::iterator it;
@@ -59,6 +49,8 @@ glm::vec3 vector_to_vec3(const std::vector<float> &v) {
 
 void choose_scene(char const *fn) 
 {
+	trace_scope scope("parse scene");
+
 	if (fn == NULL) {
 		std::cout << "Using default input file " << PATH << "c.json\n";
 		fn = "c";
@@ -71,23 +63,68 @@ void choose_scene(char const *fn)
 		exit(EXIT_FAILURE);
 	}
 	
-	in >> scene;
-	
-	json camera = scene["camera"];
+	json loaded;
+	in >> loaded;
+	use_scene(std::move(loaded), fname);
+}
+
+// takes over a scene that was read or generated, file is where reload_scene() finds it again
+void use_scene(json loaded, const std::string &file)
+{
+	current_scene->scene = std::move(loaded);
+	current_scene->scene_file = file;
+	load_acceleration_settings(file);
+
+	loadCamera(current_scene->scene["camera"]);
+
+	if (current_scene->scene.find("animation") != current_scene->scene.end())
+	{
+		json &animation = current_scene->scene["animation"];
 
+		if (animation.find("rebuildThreshold") != animation.end())
+		{
+			current_scene->rebuild_threshold = animation["rebuildThreshold"];
+			std::cout << "Setting acceleration structure rebuild threshold to " << current_scene->rebuild_threshold << std::endl;
+		}
+	}
+
+	loadLights(current_scene->scene["lights"]);
+}
+
+void loadCamera(json &camera)
+{
 	// these are optional parameters (otherwise they default to the values initialized earlier)
 	if (camera.find("field") != camera.end()) {
-		fov = camera["field"];
-		std::cout << "Setting fov to " << fov << " degrees.\n";
+		current_scene->fov = camera["field"];
+		std::cout << "Setting fov to " << current_scene->fov << " degrees.\n";
 	}
 
 	if (camera.find("background") != camera.end()) {
-		background_colour = vector_to_vec3(camera["background"]);
-		std::cout << "Setting background colour to " << glm::to_string(background_colour) << std::endl;
+		current_scene->background_colour = vector_to_vec3(camera["background"]);
+		std::cout << "Setting background colour to " << glm::to_string(current_scene->background_colour) << std::endl;
 	}
+}
 
-	json lights = scene["lights"];
+void clearLights()
+{
+	current_scene->light_ambient_color = glm::vec3(0, 0, 0);
+	current_scene->light_directional_color.clear();
+	current_scene->light_directional_direction.clear();
+	current_scene->light_point_color.clear();
+	current_scene->light_point_position.clear();
+	current_scene->light_spot_color.clear();
+	current_scene->light_spot_position.clear();
+	current_scene->light_spot_direction.clear();
+	current_scene->light_spot_cutoff.clear();
+	current_scene->light_spot_axis.clear();
+	current_scene->light_spot_cos_cutoff.clear();
+	current_scene->light_area_first.clear();
+	current_scene->light_area_columns.clear();
+	current_scene->light_area_rows.clear();
+}
 
+void loadLights(json &lights)
+{
 	for (json::iterator it = lights.begin(); it != lights.end(); ++it)
 	{
 		json &light = *it;
@@ -95,37 +132,39 @@ void choose_scene(char const *fn)
 		if (light["type"] == "ambient")
 		{
 			std::vector<float> color = light["color"];
-			light_ambient_color = (vector_to_vec3(color));
+			current_scene->light_ambient_color = (vector_to_vec3(color));
 		}
 		else if (light["type"] == "directional")
 		{
 			std::vector<float> color = light["color"];
-			light_directional_color.push_back(vector_to_vec3(color));
+			current_scene->light_directional_color.push_back(vector_to_vec3(color));
 
 			std::vector<float> direction = light["direction"];
-			light_directional_direction.push_back(vector_to_vec3(direction));
+			current_scene->light_directional_direction.push_back(vector_to_vec3(direction));
 		}
 		else if (light["type"] == "point")
 		{
 			std::vector<float> color = light["color"];
-			light_point_color.push_back(vector_to_vec3(color));
+			current_scene->light_point_color.push_back(vector_to_vec3(color));
 
 			std::vector<float> position = light["position"];
-			light_point_position.push_back(vector_to_vec3(position));
+			current_scene->light_point_position.push_back(vector_to_vec3(position));
 		}
 		else if (light["type"] == "spot")
 		{
 			std::vector<float> color = light["color"];
-			light_spot_color.push_back(vector_to_vec3(color));
+			current_scene->light_spot_color.push_back(vector_to_vec3(color));
 
 			std::vector<float> position = light["position"];
-			light_spot_position.push_back(vector_to_vec3(position));
+			current_scene->light_spot_position.push_back(vector_to_vec3(position));
 
 			std::vector<float> direction = light["direction"];
-			light_spot_direction.push_back(vector_to_vec3(direction));
+			current_scene->light_spot_direction.push_back(vector_to_vec3(direction));
 
 			float cutoff = light["cutoff"];
-			light_spot_cutoff.push_back(cutoff);
+			current_scene->light_spot_cutoff.push_back(cutoff);
+			current_scene->light_spot_axis.push_back(glm::normalize(vector_to_vec3(direction)));
+			current_scene->light_spot_cos_cutoff.push_back(cos(glm::radians(glm::min(cutoff, 180.0f))));
 		}
 		else if (light["type"] == "area")
 		{
@@ -138,14 +177,25 @@ void choose_scene(char const *fn)
 			float num_in_x = (end.at(0) - start.at(0)) / 0.1f;
 			float num_in_z = (start.at(2) - end.at(2)) / 0.1f;
 			std::cout << num_in_x << " " << num_in_z << std::endl;
+			int first = current_scene->light_point_position.size();
+			int columns = 0;
 			for (float x = start.at(0); x <= end.at(0); x += 0.1f)
 			{
+				columns++;
 				for (float z = start.at(2); z >= end.at(2); z -= 0.1f)
 				{
-					light_point_color.push_back( vector_color / (num_in_x * num_in_z) );
-					light_point_position.push_back( glm::vec3(x, start.at(1), z) );
+					current_scene->light_point_color.push_back( vector_color / (num_in_x * num_in_z) );
+					current_scene->light_point_position.push_back( glm::vec3(x, start.at(1), z) );
 				}
 			}
+
+			int count = current_scene->light_point_position.size() - first;
+			if (count != 0)
+			{
+				current_scene->light_area_first.push_back(first);
+				current_scene->light_area_columns.push_back(columns);
+				current_scene->light_area_rows.push_back(count / columns);
+			}
 		}
 	}
 }
@@ -178,932 +228,1144 @@ glm::vec3 refract(const glm::vec3 &I, const glm::vec3 &N, const float &ior)
 	}
 }
 
-bool trace(point3 &e, point3 &s, colour3 &colour)
+bool findPrimaryHit(point3 &e, point3 &s, primary_hit &hit)
 {
-	bool isHit = false;
-
-	glm::vec3 material_ambient = glm::vec3(0, 0, 0);
-	glm::vec3 material_diffuse = glm::vec3(0, 0, 0);
-	glm::vec3 material_specular = glm::vec3(0, 0, 0);
-	float material_shininess = 0;
-	float material_roughness = 0;
-	glm::vec3 material_reflective = glm::vec3(0, 0, 0);
-	glm::vec3 material_transmissive = glm::vec3(0, 0, 0);
-	float material_refraction = refractionOfAir;
-	glm::vec3 intersection = glm::vec3(0, 0, 0);
-	glm::vec3 N = glm::vec3(0, 0, 0);
-	glm::vec3 V = normalize(e - s);
-	glm::vec3 c = glm::vec3(0, 0, 0);
-	int type = -1;
-	float radius = 0;
-
-	std::vector<shape *> objects_to_for_hit_testing_one;
-	ray_box_intersection(e, s, ocTree_root, objects_to_for_hit_testing_one, false);
-
-	isHit = hitTesting(e, s,
-					   material_ambient, material_diffuse, material_specular,
-					   material_shininess, material_reflective, material_transmissive, material_refraction, material_roughness,
-					   intersection, N, c, type, radius, objects_to_for_hit_testing_one);
+	hit.material = NULL;
+	hit.intersection = glm::vec3(0, 0, 0);
+	hit.N = glm::vec3(0, 0, 0);
+	hit.V = normalize(e - s);
+	hit.center = glm::vec3(0, 0, 0);
+	hit.type = -1;
+	hit.radius = 0;
+	hit.primitive = NULL;
+	hit.hit = closestHit(e, s, hit.material, hit.intersection, hit.N, hit.center, hit.type, hit.radius, &hit.primitive);
 
 	// eye is not at the origin.
-	if (isHit && (eye.x != 0.0f || eye.y != 0.0f || eye.z != 0.0f))
+	const glm::vec3 &eye = current_scene->eye;
+	if (hit.hit && (eye.x != 0.0f || eye.y != 0.0f || eye.z != 0.0f))
 	{
 		glm::vec3 move_of_eye = eye - glm::vec3(0, 0, 0);
-		glm::vec3 move_of_s =	distance(intersection, s) / distance(intersection, e) * move_of_eye;
+		glm::vec3 move_of_s =	distance(hit.intersection, s) / distance(hit.intersection, e) * move_of_eye;
 		s = s + move_of_s;
 		e = eye;
-		V = normalize(e - s);
+		hit.V = normalize(e - s);
 	}
-	//
-	if (isHit)
+	return hit.hit;
+}
+
+void shadePrimaryHit(const point3 &e, const primary_hit &hit, colour3 &colour, const std::vector<int> * spot_lights)
+{
+	Material * hit_material = hit.material;
+	glm::vec3 intersection = hit.intersection;
+	glm::vec3 N = hit.N;
+	glm::vec3 V = hit.V;
+	glm::vec3 c = hit.center;
+	int type = hit.type;
+	float radius = hit.radius;
+
+	glm::vec3 material_reflective = hit_material->reflective;
+	glm::vec3 material_transmissive = hit_material->transmissive;
+	float material_refraction = hit_material->refraction;
+
+	// Schlick's approximation
+	if (hit_material->flags & MATERIAL_TRANSMISSIVE)
 	{
-		// Schlick's approximation
-		if ( material_transmissive.x != 0.0f || material_transmissive.y != 0.0f || material_transmissive.z != 0.0f )
-		{
-			float R0 = pow((refractionOfAir - material_refraction) / (refractionOfAir + material_refraction), 2);
-			float R_theta = R0 + (1 - R0) * pow((1 - dot(N, V)), 5);
-			material_reflective.x = R_theta;
-			material_reflective.y = R_theta;
-			material_reflective.z = R_theta;
-			material_transmissive.x = 1.0 - R_theta;
-			material_transmissive.y = 1.0 - R_theta;
-			material_transmissive.z = 1.0 - R_theta;
-		}
+		float R0 = pow((refractionOfAir - material_refraction) / (refractionOfAir + material_refraction), 2);
+		float R_theta = R0 + (1 - R0) * pow((1 - dot(N, V)), 5);
+		material_reflective.x = R_theta;
+		material_reflective.y = R_theta;
+		material_reflective.z = R_theta;
+		material_transmissive.x = 1.0 - R_theta;
+		material_transmissive.y = 1.0 - R_theta;
+		material_transmissive.z = 1.0 - R_theta;
+	}
+
+	// mirror reflection, only traced for materials that reflect anything
+	glm::vec3 colourForMirror = glm::vec3(0, 0, 0);
+	bool isReflective = material_reflective.x != 0.0f || material_reflective.y != 0.0f || material_reflective.z != 0.0f;
 
-		// mirror reflection
-		glm::vec3 colourForMirror = glm::vec3(0, 0, 0);
+	if (isReflective)
+	{
 		glm::vec3 RforMirror = normalize(2 * glm::max(dot(N, V), 0.0f) * N - V);
 
-		glm::vec3 material_ambient_ForHitPoint = glm::vec3(0, 0, 0);
-		glm::vec3 material_diffuse_ForHitPoint = glm::vec3(0, 0, 0);
-		glm::vec3 material_specular_ForHitPoint = glm::vec3(0, 0, 0);
-		float material_shininess_ForHitPoint = 0;
-		float material_roughness_ForHitPoint = 0;
-		glm::vec3 material_reflective_ForHitPoint = glm::vec3(0, 0, 0);
-		glm::vec3 material_transmissive_ForHitPoint = glm::vec3(0, 0, 0);
-		float material_refraction_ForHitPoint = refractionOfAir;
+		Material * material_ForHitPoint = NULL;
 		glm::vec3 intersection_ForHitPoint = glm::vec3(0, 0, 0);
 		glm::vec3 N_ForHitPoint = glm::vec3(0, 0, 0);
 		glm::vec3 c_ForHitPoint = glm::vec3(0, 0, 0);
 		int type_ForHitPoint = -1;
 		float radius_ForHitPoint = -1;
 
-		std::vector<shape *> objects_to_for_hit_testing_two;
-		ray_box_intersection(intersection, RforMirror + intersection, ocTree_root, objects_to_for_hit_testing_two, false);
+		isReflective = closestHit(intersection, RforMirror + intersection, material_ForHitPoint,
+			intersection_ForHitPoint, N_ForHitPoint, c_ForHitPoint, type_ForHitPoint, radius_ForHitPoint);
 
-		if (hitTesting(intersection, RforMirror + intersection,
-			material_ambient_ForHitPoint, material_diffuse_ForHitPoint, material_specular_ForHitPoint,
-			material_shininess_ForHitPoint, material_reflective_ForHitPoint, material_transmissive_ForHitPoint, material_refraction_ForHitPoint, material_roughness_ForHitPoint,
-			intersection_ForHitPoint, N_ForHitPoint, c_ForHitPoint, type_ForHitPoint, radius_ForHitPoint, objects_to_for_hit_testing_two)
-			&&
-			(material_reflective.x != 0.0f || material_reflective.y != 0.0f || material_reflective.z != 0.0f))
+		if (isReflective)
 		{
 			mirrorReflection(intersection, RforMirror + intersection, colourForMirror, 3,
-				material_ambient, material_diffuse, material_specular,
-				material_shininess, material_reflective, material_transmissive, material_refraction, material_roughness,
-				N, e);
+				*hit_material, material_reflective, N, e);
 			colour = colourForMirror + colour;
 		}
-		else
-		{
-			getColor(colour,
-				material_ambient, material_diffuse, material_specular,
-				material_shininess, material_reflective, material_transmissive, material_refraction, material_roughness,
-				intersection, N, V);
-		}
+	}
+
+	if (!isReflective)
+	{
+		getColor(colour, *hit_material, intersection, N, V, spot_lights);
+	}
 
-		// transpency
-		glm::vec3 I2 = glm::vec3(0, 0, 0);
+	// transpency
+	glm::vec3 I2 = glm::vec3(0, 0, 0);
 
-		if (material_transmissive.x != 0.0f || material_transmissive.y != 0.0f || material_transmissive.z != 0.0f)
+	if (hit_material->flags & MATERIAL_TRANSMISSIVE)
+	{
+		if (type == 4)//sphere
 		{
-			if (type == 4)//sphere
-			{
-				glm::vec3 Vr = normalize(refract(normalize(intersection - e), N, material_refraction));
-				float determineForSecondSurface = glm::pow(dot(Vr, (intersection - c)), 2) - dot(Vr, Vr) * (dot((intersection - c), (intersection - c)) - radius * radius);
+			glm::vec3 Vr = normalize(refract(normalize(intersection - e), N, material_refraction));
+			float determineForSecondSurface = glm::pow(dot(Vr, (intersection - c)), 2) - dot(Vr, Vr) * (dot((intersection - c), (intersection - c)) - radius * radius);
 
-				if (determineForSecondSurface >= 0) // there is intersetion 
-				{
-					float rooted_determineForSecondSurface = glm::sqrt(determineForSecondSurface);
-					float tForSecondSurface = (-1 * dot(Vr, (intersection - c)) + rooted_determineForSecondSurface) / dot(Vr, Vr);
-
-					glm::vec3 positionOfSecondIntersection = intersection + tForSecondSurface * Vr;
-
-					glm::vec3 VrForSecondSurface = normalize(refract(Vr, normalize(positionOfSecondIntersection - c), material_refraction));
-
-					glm::vec3 material_ambient_ForSecondSurface = glm::vec3(0, 0, 0);
-					glm::vec3 material_diffuse_ForSecondSurface = glm::vec3(0, 0, 0);
-					glm::vec3 material_specular_ForSecondSurface = glm::vec3(0, 0, 0);
-					float material_shininess_ForSecondSurface = 0;
-					float material_roughness_ForSecondSurface = 0;
-					glm::vec3 material_reflective_ForSecondSurface = glm::vec3(0, 0, 0);
-					glm::vec3 material_transmissive_ForSecondSurface = glm::vec3(0, 0, 0);
-					float material_refraction_ForSecondSurface = refractionOfAir;
-					glm::vec3 intersection_ForSecondSurface = glm::vec3(0, 0, 0);
-					glm::vec3 N_ForSecondSurface = glm::vec3(0, 0, 0);
-					glm::vec3 c_ForSecondSurface = glm::vec3(0, 0, 0);
-					int type_ForSecondSurface = -1;
-					float radius_ForSecondSurface = -1;
-
-					std::vector<shape *> objects_to_for_hit_testing_three;
-					ray_box_intersection(positionOfSecondIntersection, VrForSecondSurface + positionOfSecondIntersection, ocTree_root, objects_to_for_hit_testing_three, false);
-
-					bool isHitOther = hitTesting(positionOfSecondIntersection, VrForSecondSurface + positionOfSecondIntersection,
-						material_ambient_ForSecondSurface, material_diffuse_ForSecondSurface, material_specular_ForSecondSurface,
-						material_shininess_ForSecondSurface, material_reflective_ForSecondSurface, material_transmissive_ForSecondSurface, material_refraction_ForSecondSurface, material_roughness_ForSecondSurface,
-						intersection_ForSecondSurface, N_ForSecondSurface, c_ForSecondSurface, type_ForSecondSurface, radius_ForSecondSurface, objects_to_for_hit_testing_three);
-
-					if (!isHitOther)
-					{
-						I2 = background_colour;
-					}
-					else
-					{
-						getColor(I2,
-							material_ambient_ForSecondSurface, material_diffuse_ForSecondSurface, material_specular_ForSecondSurface,
-							material_shininess_ForSecondSurface, material_reflective_ForSecondSurface, material_transmissive_ForSecondSurface, material_refraction_ForSecondSurface, material_roughness_ForSecondSurface,
-							intersection_ForSecondSurface, N_ForSecondSurface, -1.0f * VrForSecondSurface);
-					}
-					colour = (glm::vec3(1.0f, 1.0f, 1.0f) - material_transmissive) * colour + material_transmissive * I2;
-				}
-			}
-			else
+			if (determineForSecondSurface >= 0) // there is intersetion 
 			{
-				glm::vec3 Vr = normalize(refract(normalize(intersection - e), N, material_refraction));
-
-				glm::vec3 material_ambient_ForSecondSurface = glm::vec3(0, 0, 0);
-				glm::vec3 material_diffuse_ForSecondSurface = glm::vec3(0, 0, 0);
-				glm::vec3 material_specular_ForSecondSurface = glm::vec3(0, 0, 0);
-				float material_shininess_ForSecondSurface = 0;
-				float material_roughness_ForSecondSurface = 0;
-				glm::vec3 material_reflective_ForSecondSurface = glm::vec3(0, 0, 0);
-				glm::vec3 material_transmissive_ForSecondSurface = glm::vec3(0, 0, 0);
-				float material_refraction_ForSecondSurface = refractionOfAir;
+				float rooted_determineForSecondSurface = glm::sqrt(determineForSecondSurface);
+				float tForSecondSurface = (-1 * dot(Vr, (intersection - c)) + rooted_determineForSecondSurface) / dot(Vr, Vr);
+
+				glm::vec3 positionOfSecondIntersection = intersection + tForSecondSurface * Vr;
+
+				glm::vec3 VrForSecondSurface = normalize(refract(Vr, normalize(positionOfSecondIntersection - c), material_refraction));
+
+				Material * material_ForSecondSurface = NULL;
 				glm::vec3 intersection_ForSecondSurface = glm::vec3(0, 0, 0);
 				glm::vec3 N_ForSecondSurface = glm::vec3(0, 0, 0);
 				glm::vec3 c_ForSecondSurface = glm::vec3(0, 0, 0);
 				int type_ForSecondSurface = -1;
 				float radius_ForSecondSurface = -1;
 
-				std::vector<shape *> objects_to_for_hit_testing_four;
-				ray_box_intersection(intersection, Vr + intersection, ocTree_root, objects_to_for_hit_testing_four, false);
-
-				bool isHitOther = hitTesting(intersection, Vr + intersection,
-											material_ambient_ForSecondSurface, material_diffuse_ForSecondSurface, material_specular_ForSecondSurface,
-											material_shininess_ForSecondSurface, material_reflective_ForSecondSurface, material_transmissive_ForSecondSurface, material_refraction_ForSecondSurface, material_roughness_ForSecondSurface,
-											intersection_ForSecondSurface, N_ForSecondSurface, c_ForSecondSurface, type_ForSecondSurface, radius_ForSecondSurface, objects_to_for_hit_testing_four);
+				bool isHitOther = closestHit(positionOfSecondIntersection, VrForSecondSurface + positionOfSecondIntersection, material_ForSecondSurface,
+					intersection_ForSecondSurface, N_ForSecondSurface, c_ForSecondSurface, type_ForSecondSurface, radius_ForSecondSurface);
 
 				if (!isHitOther)
 				{
-					I2 = background_colour;
+					I2 = current_scene->background_colour;
 				}
 				else
 				{
-					getColor(I2,
-						material_ambient_ForSecondSurface, material_diffuse_ForSecondSurface, material_specular_ForSecondSurface,
-						material_shininess_ForSecondSurface, material_reflective_ForSecondSurface, material_transmissive_ForSecondSurface, material_refraction_ForSecondSurface, material_roughness_ForSecondSurface,
-						intersection_ForSecondSurface, N_ForSecondSurface, -1.0f * Vr);
+					getColor(I2, *material_ForSecondSurface, intersection_ForSecondSurface, N_ForSecondSurface, -1.0f * VrForSecondSurface);
 				}
 				colour = (glm::vec3(1.0f, 1.0f, 1.0f) - material_transmissive) * colour + material_transmissive * I2;
 			}
 		}
+		else
+		{
+			glm::vec3 Vr = normalize(refract(normalize(intersection - e), N, material_refraction));
+
+			Material * material_ForSecondSurface = NULL;
+			glm::vec3 intersection_ForSecondSurface = glm::vec3(0, 0, 0);
+			glm::vec3 N_ForSecondSurface = glm::vec3(0, 0, 0);
+			glm::vec3 c_ForSecondSurface = glm::vec3(0, 0, 0);
+			int type_ForSecondSurface = -1;
+			float radius_ForSecondSurface = -1;
+
+			bool isHitOther = closestHit(intersection, Vr + intersection, material_ForSecondSurface,
+										intersection_ForSecondSurface, N_ForSecondSurface, c_ForSecondSurface, type_ForSecondSurface, radius_ForSecondSurface);
+
+			if (!isHitOther)
+			{
+				I2 = current_scene->background_colour;
+			}
+			else
+			{
+				getColor(I2, *material_ForSecondSurface, intersection_ForSecondSurface, N_ForSecondSurface, -1.0f * Vr);
+			}
+			colour = (glm::vec3(1.0f, 1.0f, 1.0f) - material_transmissive) * colour + material_transmissive * I2;
+		}
 	}
-	return isHit;
 }
 
-bool shadowTesting(const point3 &e, const point3 &s, int type)
+bool trace(point3 &e, point3 &s, colour3 &colour, gbuffer_sample * sample)
 {
-	for (int i = 0; i < listOfShapes.size(); i++)
+	primary_hit hit;
+	bool isHit = findPrimaryHit(e, s, hit);
+
+	if (sample != NULL)
 	{
-		if (listOfShapes.at(i)->type == "sphere")
+		sample->hit = isHit;
+		if (isHit)
 		{
-			glm::vec3 c = listOfShapes.at(i)->position;
-			float radius = listOfShapes.at(i)->radius;
+			sample->position = hit.intersection;
+			sample->normal = hit.N;
+			sample->view = hit.V;
+			sample->primitive = hit.primitive;
+			sample->material = hit.material->id;
+			sample->needs_trace = (hit.material->flags & (MATERIAL_REFLECTIVE | MATERIAL_TRANSMISSIVE)) != 0;
+		}
+	}
+
+	if (isHit)
+	{
+		shadePrimaryHit(e, hit, colour);
+	}
+	return isHit;
+}
+
+// does this one shape block the ray from e towards s
+bool shadowTestingShape(shape * object, const point3 &e, const point3 &s, int type)
+{
+	if (object->type == "sphere")
+	{
+		glm::vec3 c = object->position;
+		float radius = object->radius;
 
-			glm::vec3 d = (s - e);
+		glm::vec3 d = (s - e);
 
-			float determine = glm::pow(dot(d, (e - c)), 2) - dot(d, d) * (dot((e - c), (e - c)) - radius * radius);
+		float determine = glm::pow(dot(d, (e - c)), 2) - dot(d, d) * (dot((e - c), (e - c)) - radius * radius);
 
-			if (determine >= 0) // there is intersetion 
-			{
-				float rooted_determine = glm::sqrt(determine);
-				float t = (-1 * dot(d, (e - c)) - rooted_determine) / dot(d, d);
+		if (determine >= 0) // there is intersetion 
+		{
+			float rooted_determine = glm::sqrt(determine);
+			float t = (-1 * dot(d, (e - c)) - rooted_determine) / dot(d, d);
 
-				if (type == 1 || type == 3)	// point or spot
+			if (type == 1 || type == 3)	// point or spot
+			{
+				if ( t > 0.001 && t < 1 )
 				{
-					if ( t > 0.001 && t < 1 )
-					{
-						return true;
-					}
+					return true;
 				}
-				else if (type == 2)	// direction
+			}
+			else if (type == 2)	// direction
+			{
+				if (t > 0.001)
 				{
-					if (t > 0.001)
-					{
-						return true;
-					}
+					return true;
 				}
 			}
-		}// if
-		else if (listOfShapes.at(i)->type == "triangle")
-		{
-			glm::vec3 vertex0_vector = listOfShapes.at(i)->vertex0;
-			glm::vec3 vertex1_vector = listOfShapes.at(i)->vertex1;
-			glm::vec3 vertex2_vector = listOfShapes.at(i)->vertex2;
+		}
+	}// if
+	else if (object->type == "triangle")
+	{
+		glm::vec3 vertex0_vector = object->vertex0;
+		glm::vec3 vertex1_vector = object->vertex1;
+		glm::vec3 vertex2_vector = object->vertex2;
 
-			glm::vec3 n = normalize(cross(vertex1_vector - vertex0_vector, vertex2_vector - vertex1_vector));
-			glm::vec3 d = s - e;
+		glm::vec3 n = normalize(cross(vertex1_vector - vertex0_vector, vertex2_vector - vertex1_vector));
+		glm::vec3 d = s - e;
 
-			float denominator = dot(n, d);
+		float denominator = dot(n, d);
 
-			if (denominator != 0)
-			{
-				float t = dot(n, (vertex0_vector - e)) / denominator;
+		if (denominator != 0)
+		{
+			float t = dot(n, (vertex0_vector - e)) / denominator;
 
-				if (type == 1 || type == 3)	// point or spot
+			if (type == 1 || type == 3)	// point or spot
+			{
+				if (t > 0.001 && t < 1)
 				{
-					if (t > 0.001 && t < 1)
-					{
-						glm::vec3 intersection = e + t * d;
+					glm::vec3 intersection = e + t * d;
 
-						glm::vec3 b_a = vertex1_vector - vertex0_vector;
-						glm::vec3 x_a = intersection - vertex0_vector;
+					glm::vec3 b_a = vertex1_vector - vertex0_vector;
+					glm::vec3 x_a = intersection - vertex0_vector;
 
-						glm::vec3 c_b = vertex2_vector - vertex1_vector;
-						glm::vec3 x_b = intersection - vertex1_vector;
+					glm::vec3 c_b = vertex2_vector - vertex1_vector;
+					glm::vec3 x_b = intersection - vertex1_vector;
 
-						glm::vec3 a_c = vertex0_vector - vertex2_vector;
-						glm::vec3 x_c = intersection - vertex2_vector;
+					glm::vec3 a_c = vertex0_vector - vertex2_vector;
+					glm::vec3 x_c = intersection - vertex2_vector;
 
-						bool sign1 = dot(cross(b_a, x_a), n) > 0;
-						bool sign2 = dot(cross(c_b, x_b), n) > 0;
-						bool sign3 = dot(cross(a_c, x_c), n) > 0;
+					bool sign1 = dot(cross(b_a, x_a), n) > 0;
+					bool sign2 = dot(cross(c_b, x_b), n) > 0;
+					bool sign3 = dot(cross(a_c, x_c), n) > 0;
 
-						if (sign1 && sign2 && sign3) // intersect with this triangle
-						{
-							return true;
-						}
+					if (sign1 && sign2 && sign3) // intersect with this triangle
+					{
+						return true;
 					}
 				}
-				else if (type == 2)	// direction
+			}
+			else if (type == 2)	// direction
+			{
+				if (t > 0.001)
 				{
-					if (t > 0.001)
-					{
-						glm::vec3 intersection = e + t * d;
+					glm::vec3 intersection = e + t * d;
 
-						glm::vec3 b_a = vertex1_vector - vertex0_vector;
-						glm::vec3 x_a = intersection - vertex0_vector;
+					glm::vec3 b_a = vertex1_vector - vertex0_vector;
+					glm::vec3 x_a = intersection - vertex0_vector;
 
-						glm::vec3 c_b = vertex2_vector - vertex1_vector;
-						glm::vec3 x_b = intersection - vertex1_vector;
+					glm::vec3 c_b = vertex2_vector - vertex1_vector;
+					glm::vec3 x_b = intersection - vertex1_vector;
 
-						glm::vec3 a_c = vertex0_vector - vertex2_vector;
-						glm::vec3 x_c = intersection - vertex2_vector;
+					glm::vec3 a_c = vertex0_vector - vertex2_vector;
+					glm::vec3 x_c = intersection - vertex2_vector;
 
-						bool sign1 = dot(cross(b_a, x_a), n) > 0;
-						bool sign2 = dot(cross(c_b, x_b), n) > 0;
-						bool sign3 = dot(cross(a_c, x_c), n) > 0;
+					bool sign1 = dot(cross(b_a, x_a), n) > 0;
+					bool sign2 = dot(cross(c_b, x_b), n) > 0;
+					bool sign3 = dot(cross(a_c, x_c), n) > 0;
 
-						if (sign1 && sign2 && sign3) // intersect with this triangle
-						{
-							return true;
-						}
+					if (sign1 && sign2 && sign3) // intersect with this triangle
+					{
+						return true;
 					}
 				}
 			}
-		}//else if
-		else if (listOfShapes.at(i)->type == "plane")
-		{
-			glm::vec3 a = listOfShapes.at(i)->position;
-			glm::vec3 n = normalize(listOfShapes.at(i)->normal);
-			glm::vec3 d = s - e;
+		}
+	}//else if
+	else if (object->type == "plane")
+	{
+		glm::vec3 a = object->position;
+		glm::vec3 n = normalize(object->normal);
+		glm::vec3 d = s - e;
 
-			float denominator = dot(n, d);
+		float denominator = dot(n, d);
 
-			if (denominator != 0)
+		if (denominator != 0)
+		{
+			float t = dot(n, (a - e)) / denominator;
+			if (type == 1 || type == 3)	// point or spot
 			{
-				float t = dot(n, (a - e)) / denominator;
-				if (type == 1 || type == 3)	// point or spot
+				if ( t > 0.001 && t < 1 )
 				{
-					if ( t > 0.001 && t < 1 )
-					{
-						return true;
-					}
+					return true;
 				}
-				else if (type == 2)
+			}
+			else if (type == 2)
+			{
+				if (t > 0.01)
 				{
-					if (t > 0.01)
-					{
-						return true;
-					}
+					return true;
 				}
 			}
-		}//else if
-		else if (listOfShapes.at(i)->type == "intersection")
-		{
-			shape * sub_shape1 = listOfShapes.at(i)->sub_shape1;
-			shape * sub_shape2 = listOfShapes.at(i)->sub_shape2;
+		}
+	}//else if
+	else if (object->type == "intersection")
+	{
+		shape * sub_shape1 = object->sub_shape1;
+		shape * sub_shape2 = object->sub_shape2;
 
-			// hit testing with first sphere
-			bool hit_with_first = false;
+		// hit testing with first sphere
+		bool hit_with_first = false;
 
-			float radius_for_first = sub_shape1->radius;
-			glm::vec3 c_for_first = sub_shape1->position;
-			glm::vec3 d = s - e;
-			float t_For_first = 0;
-			float t_For_first2 = 0;
-			float determine = glm::pow(dot(d, (e - c_for_first)), 2) - dot(d, d) * (dot((e - c_for_first), (e - c_for_first)) - radius_for_first * radius_for_first);
+		float radius_for_first = sub_shape1->radius;
+		glm::vec3 c_for_first = sub_shape1->position;
+		glm::vec3 d = s - e;
+		float t_For_first = 0;
+		float t_For_first2 = 0;
+		float determine = glm::pow(dot(d, (e - c_for_first)), 2) - dot(d, d) * (dot((e - c_for_first), (e - c_for_first)) - radius_for_first * radius_for_first);
 
-			if (determine >= 0) // there is intersetion 
-			{
-				float rooted_determine = glm::sqrt(determine);
-				t_For_first = (-1 * dot(d, (e - c_for_first)) - rooted_determine) / dot(d, d);
-				t_For_first2 = (-1 * dot(d, (e - c_for_first)) + rooted_determine) / dot(d, d);
+		if (determine >= 0) // there is intersetion 
+		{
+			float rooted_determine = glm::sqrt(determine);
+			t_For_first = (-1 * dot(d, (e - c_for_first)) - rooted_determine) / dot(d, d);
+			t_For_first2 = (-1 * dot(d, (e - c_for_first)) + rooted_determine) / dot(d, d);
 
-				if (t_For_first > 0.001 || t_For_first2 > 0.001)
-				{
-					hit_with_first = true;
-				}
+			if (t_For_first > 0.001 || t_For_first2 > 0.001)
+			{
+				hit_with_first = true;
 			}
-			// hit testing with second sphere
-			bool hit_with_second = false;
+		}
+		// hit testing with second sphere
+		bool hit_with_second = false;
 
-			float radius_for_second = sub_shape2->radius;
-			glm::vec3 c_for_second = sub_shape2->position;
-			d = s - e;
-			float t_For_second = 0;
-			float t_For_second2 = 0;
+		float radius_for_second = sub_shape2->radius;
+		glm::vec3 c_for_second = sub_shape2->position;
+		d = s - e;
+		float t_For_second = 0;
+		float t_For_second2 = 0;
 
-			float determine_for_second = glm::pow(dot(d, (e - c_for_second)), 2) - dot(d, d) * (dot((e - c_for_second), (e - c_for_second)) - radius_for_second * radius_for_second);
-			if (determine_for_second >= 0) // there is intersetion 
-			{
-				float rooted_determine = glm::sqrt(determine_for_second);
-				t_For_second = (-1 * dot(d, (e - c_for_second)) - rooted_determine) / dot(d, d);
-				t_For_second2 = (-1 * dot(d, (e - c_for_second)) + rooted_determine) / dot(d, d);
+		float determine_for_second = glm::pow(dot(d, (e - c_for_second)), 2) - dot(d, d) * (dot((e - c_for_second), (e - c_for_second)) - radius_for_second * radius_for_second);
+		if (determine_for_second >= 0) // there is intersetion 
+		{
+			float rooted_determine = glm::sqrt(determine_for_second);
+			t_For_second = (-1 * dot(d, (e - c_for_second)) - rooted_determine) / dot(d, d);
+			t_For_second2 = (-1 * dot(d, (e - c_for_second)) + rooted_determine) / dot(d, d);
 
-				if (t_For_second > 0.001 || t_For_second2 > 0.001)
-				{
-					hit_with_second = true;
-				}
-			}
-			if (hit_with_first && hit_with_second)
+			if (t_For_second > 0.001 || t_For_second2 > 0.001)
 			{
-				return true;
+				hit_with_second = true;
 			}
 		}
-		else if (listOfShapes.at(i)->type == "union")
+		if (hit_with_first && hit_with_second)
 		{
-			shape * sub_shape1 = listOfShapes.at(i)->sub_shape1;
-			shape * sub_shape2 = listOfShapes.at(i)->sub_shape2;
+			return true;
+		}
+	}
+	else if (object->type == "union")
+	{
+		shape * sub_shape1 = object->sub_shape1;
+		shape * sub_shape2 = object->sub_shape2;
 
-			// hit testing with first sphere
-			bool hit_with_first = false;
+		// hit testing with first sphere
+		bool hit_with_first = false;
 
-			float radius_for_first = sub_shape1->radius;
-			glm::vec3 c_for_first = sub_shape1->position;
-			glm::vec3 d = s - e;
-			float t_For_first = 0;
+		float radius_for_first = sub_shape1->radius;
+		glm::vec3 c_for_first = sub_shape1->position;
+		glm::vec3 d = s - e;
+		float t_For_first = 0;
 
-			float determine = glm::pow(dot(d, (e - c_for_first)), 2) - dot(d, d) * (dot((e - c_for_first), (e - c_for_first)) - radius_for_first * radius_for_first);
+		float determine = glm::pow(dot(d, (e - c_for_first)), 2) - dot(d, d) * (dot((e - c_for_first), (e - c_for_first)) - radius_for_first * radius_for_first);
 
-			if (determine >= 0) // there is intersetion 
-			{
-				float rooted_determine = glm::sqrt(determine);
-				t_For_first = (-1 * dot(d, (e - c_for_first)) - rooted_determine) / dot(d, d);
+		if (determine >= 0) // there is intersetion 
+		{
+			float rooted_determine = glm::sqrt(determine);
+			t_For_first = (-1 * dot(d, (e - c_for_first)) - rooted_determine) / dot(d, d);
 
-				if (type == 1 || type == 3)	// point or spot
+			if (type == 1 || type == 3)	// point or spot
+			{
+				if (t_For_first > 0.001 && t_For_first < 1)
 				{
-					if (t_For_first > 0.001 && t_For_first < 1)
-					{
-						hit_with_first = true;
-					}
+					hit_with_first = true;
 				}
-				else if (type == 2)	// direction
+			}
+			else if (type == 2)	// direction
+			{
+				if (t_For_first > 0.001)
 				{
-					if (t_For_first > 0.001)
-					{
-						hit_with_first = true;
-					}
+					hit_with_first = true;
 				}
 			}
-			// hit testing with second sphere
-			bool hit_with_second = false;
+		}
+		// hit testing with second sphere
+		bool hit_with_second = false;
 
-			float radius_for_second = sub_shape2->radius;
-			glm::vec3 c_for_second = sub_shape2->position;
-			d = s - e;
-			float t_For_second = 0;
+		float radius_for_second = sub_shape2->radius;
+		glm::vec3 c_for_second = sub_shape2->position;
+		d = s - e;
+		float t_For_second = 0;
 
-			float determine_for_second = glm::pow(dot(d, (e - c_for_second)), 2) - dot(d, d) * (dot((e - c_for_second), (e - c_for_second)) - radius_for_second * radius_for_second);
-			if (determine_for_second >= 0) // there is intersetion 
-			{
-				float rooted_determine = glm::sqrt(determine_for_second);
-				t_For_second = (-1 * dot(d, (e - c_for_second)) - rooted_determine) / dot(d, d);
+		float determine_for_second = glm::pow(dot(d, (e - c_for_second)), 2) - dot(d, d) * (dot((e - c_for_second), (e - c_for_second)) - radius_for_second * radius_for_second);
+		if (determine_for_second >= 0) // there is intersetion 
+		{
+			float rooted_determine = glm::sqrt(determine_for_second);
+			t_For_second = (-1 * dot(d, (e - c_for_second)) - rooted_determine) / dot(d, d);
 
-				if (type == 1 || type == 3)	// point or spot
-				{
-					if (t_For_second > 0.001 && t_For_second < 1)
-					{
-						hit_with_second = true;
-					}
-				}
-				else if (type == 2)	// direction
+			if (type == 1 || type == 3)	// point or spot
+			{
+				if (t_For_second > 0.001 && t_For_second < 1)
 				{
-					if (t_For_second > 0.001)
-					{
-						hit_with_second = true;
-					}
+					hit_with_second = true;
 				}
 			}
-			if ( hit_with_first || hit_with_second)
+			else if (type == 2)	// direction
 			{
-				return true;
+				if (t_For_second > 0.001)
+				{
+					hit_with_second = true;
+				}
 			}
 		}
-		else if (listOfShapes.at(i)->type == "difference")
+		if ( hit_with_first || hit_with_second)
 		{
-			shape * sub_shape1 = listOfShapes.at(i)->sub_shape1;
-			shape * sub_shape2 = listOfShapes.at(i)->sub_shape2;
+			return true;
+		}
+	}
+	else if (object->type == "difference")
+	{
+		shape * sub_shape1 = object->sub_shape1;
+		shape * sub_shape2 = object->sub_shape2;
 
-			// hit testing with first sphere
-			bool hit_with_first = false;
+		// hit testing with first sphere
+		bool hit_with_first = false;
 
-			float radius_for_first = sub_shape1->radius;
-			glm::vec3 c_for_first = sub_shape1->position;
-			glm::vec3 d = s - e;
-			float t_For_first = 0;
+		float radius_for_first = sub_shape1->radius;
+		glm::vec3 c_for_first = sub_shape1->position;
+		glm::vec3 d = s - e;
+		float t_For_first = 0;
 
-			float determine = glm::pow(dot(d, (e - c_for_first)), 2) - dot(d, d) * (dot((e - c_for_first), (e - c_for_first)) - radius_for_first * radius_for_first);
+		float determine = glm::pow(dot(d, (e - c_for_first)), 2) - dot(d, d) * (dot((e - c_for_first), (e - c_for_first)) - radius_for_first * radius_for_first);
 
-			if (determine >= 0) // there is intersetion 
-			{
-				float rooted_determine = glm::sqrt(determine);
-				t_For_first = (-1 * dot(d, (e - c_for_first)) - rooted_determine) / dot(d, d);
+		if (determine >= 0) // there is intersetion 
+		{
+			float rooted_determine = glm::sqrt(determine);
+			t_For_first = (-1 * dot(d, (e - c_for_first)) - rooted_determine) / dot(d, d);
 
-				if (type == 1 || type == 3)	// point or spot
+			if (type == 1 || type == 3)	// point or spot
+			{
+				if (t_For_first > 0.001 && t_For_first < 1)
 				{
-					if (t_For_first > 0.001 && t_For_first < 1)
-					{
-						hit_with_first = true;
-					}
+					hit_with_first = true;
 				}
-				else if (type == 2)	// direction
+			}
+			else if (type == 2)	// direction
+			{
+				if (t_For_first > 0.001)
 				{
-					if (t_For_first > 0.001)
-					{
-						hit_with_first = true;
-					}
+					hit_with_first = true;
 				}
 			}
-			// hit testing with second sphere
-			bool hit_with_second = false;
+		}
+		// hit testing with second sphere
+		bool hit_with_second = false;
 
-			float radius_for_second = sub_shape2->radius;
-			glm::vec3 c_for_second = sub_shape2->position;
-			d = s - e;
-			float t_For_second = 0;
+		float radius_for_second = sub_shape2->radius;
+		glm::vec3 c_for_second = sub_shape2->position;
+		d = s - e;
+		float t_For_second = 0;
 
-			float determine_for_second = glm::pow(dot(d, (e - c_for_second)), 2) - dot(d, d) * (dot((e - c_for_second), (e - c_for_second)) - radius_for_second * radius_for_second);
-			if (determine_for_second >= 0) // there is intersetion 
-			{
-				float rooted_determine = glm::sqrt(determine_for_second);
-				t_For_second = (-1 * dot(d, (e - c_for_second)) - rooted_determine) / dot(d, d);
+		float determine_for_second = glm::pow(dot(d, (e - c_for_second)), 2) - dot(d, d) * (dot((e - c_for_second), (e - c_for_second)) - radius_for_second * radius_for_second);
+		if (determine_for_second >= 0) // there is intersetion 
+		{
+			float rooted_determine = glm::sqrt(determine_for_second);
+			t_For_second = (-1 * dot(d, (e - c_for_second)) - rooted_determine) / dot(d, d);
 
-				if (type == 1 || type == 3)	// point or spot
+			if (type == 1 || type == 3)	// point or spot
+			{
+				if (t_For_second > 0.001 && t_For_second < 1)
 				{
-					if (t_For_second > 0.001 && t_For_second < 1)
-					{
-						hit_with_second = true;
-					}
+					hit_with_second = true;
 				}
-				else if (type == 2)	// direction
+			}
+			else if (type == 2)	// direction
+			{
+				if (t_For_second > 0.001)
 				{
-					if (t_For_second > 0.001)
-					{
-						hit_with_second = true;
-					}
+					hit_with_second = true;
 				}
 			}
+		}
 
-			if (hit_with_first && !hit_with_second)
-			{
-				return true;
-			}
+		if (hit_with_first && !hit_with_second)
+		{
+			return true;
 		}
-	}//for
+	}
 	return false;
 }
 
-bool hitTesting(const point3 &e, const point3 &s, 
-				glm::vec3 &material_ambient, glm::vec3 &material_diffuse, glm::vec3 &material_specular,
-				float &material_shininess, glm::vec3 &material_reflective, glm::vec3 &material_transmissive, float &material_refraction, float &material_roughness,
-				glm::vec3 &intersection, glm::vec3 &N, glm::vec3 &center, int &type, float &radiusParamter, std::vector<shape *> objects_to_for_hit_testing)
+// the last occluder found for every light, per thread
+thread_local std::vector<shape *> occluder_cache;
+thread_local int occluder_cache_generation = -1;
+thread_local const Scene * occluder_cache_scene = NULL;
+std::atomic<int> current_occluder_cache_generation(0);
+
+void invalidateOccluderCache()
 {
-	bool isHit = false;
-	float finalT = 10000.0f;
+	current_occluder_cache_generation++;
+}
 
-	for (int i = 0; i < objects_to_for_hit_testing.size(); i++)
+// Neighbouring shading points are usually shadowed by the same object, so the occluder that blocked
+// the previous shadow ray towards this light is tested first and the BVH, or the full scan without one,
+// only runs on a miss.
+// light indexes the point lights first, then the directional lights, then the spot lights.
+bool shadowTesting(const point3 &e, const point3 &s, int type, int light)
+{
+	render_statistics &statistics = thread_statistics();
+	statistics.shadow_rays++;
+
+	if (occluder_cache_generation != current_occluder_cache_generation || occluder_cache_scene != current_scene)
 	{
-		if (objects_to_for_hit_testing.at(i)->type == "sphere")
-		{
-			float radius = objects_to_for_hit_testing.at(i)->radius;
-			glm::vec3 c = objects_to_for_hit_testing.at(i)->position;
-			glm::vec3 d = s - e;
+		occluder_cache.clear();
+		occluder_cache_generation = current_occluder_cache_generation;
+		occluder_cache_scene = current_scene;
+	}
+	if (light >= occluder_cache.size())
+	{
+		occluder_cache.resize(light + 1, NULL);
+	}
 
-			float determine = glm::pow(dot(d, (e - c)), 2) - dot(d, d) * (dot((e - c), (e - c)) - radius * radius);
+	shape * last_occluder = occluder_cache.at(light);
 
-			if (determine >= 0) // there is intersetion 
-			{
-				float rooted_determine = glm::sqrt(determine);
-				float t = (-1 * dot(d, (e - c)) - rooted_determine) / dot(d, d);
+	if (last_occluder != NULL)
+	{
+		statistics.occluder_cache_tests++;
+		statistics.shadow_shape_tests++;
 
-				if (t > 0.001 && t < finalT)
-				{
-					finalT = t;
-					intersection = e + t * d;
-					material_ambient = objects_to_for_hit_testing.at(i)->material_ambient;
-					material_diffuse = objects_to_for_hit_testing.at(i)->material_diffuse;
-					material_specular = objects_to_for_hit_testing.at(i)->material_specular;
-					material_roughness = objects_to_for_hit_testing.at(i)->material_roughness;
-					material_shininess = objects_to_for_hit_testing.at(i)->material_shininess;
-					material_reflective = objects_to_for_hit_testing.at(i)->material_reflective;
-					material_transmissive = objects_to_for_hit_testing.at(i)->material_transmissive;
-					material_refraction = objects_to_for_hit_testing.at(i)->material_refraction;
-					center = c;
-					type = 4;
-					N = normalize(e + t * d - c);
-					radiusParamter = radius;
-					isHit = true;
-				}
-			}
-		}// if
-		else if (objects_to_for_hit_testing.at(i)->type == "triangle")
+		if (shadowTestingShape(last_occluder, e, s, type))
 		{
-			glm::vec3 vertex0_vector = objects_to_for_hit_testing.at(i)->vertex0;
-			glm::vec3 vertex1_vector = objects_to_for_hit_testing.at(i)->vertex1;
-			glm::vec3 vertex2_vector = objects_to_for_hit_testing.at(i)->vertex2;
+			statistics.occluder_cache_hits++;
+			statistics.shadow_rays_occluded++;
+			return true;
+		}
+	}
 
-			glm::vec3 n = normalize(cross(vertex1_vector - vertex0_vector, vertex2_vector - vertex1_vector));
-			glm::vec3 d = s - e;
+	if (current_scene->bvh.ready)
+	{
+		shape * occluder = bvhAnyHit(e, s, type, last_occluder);
+		if (occluder != NULL)
+		{
+			occluder_cache.at(light) = occluder;
+			statistics.shadow_rays_occluded++;
+			return true;
+		}
+	}
+	else
+	{
+		for (int i = 0; i < current_scene->listOfShapes.size(); i++)
+		{
+			if (current_scene->listOfShapes.at(i) == last_occluder)
+			{
+				continue;
+			}
 
-			float denominator = dot(n, d);
+			statistics.shadow_shape_tests++;
 
-			if (denominator != 0)
+			if (shadowTestingShape(current_scene->listOfShapes.at(i), e, s, type))
 			{
-				float t = dot(n, (vertex0_vector - e)) / denominator;
-
-				if (t > 0.001 && t < finalT)
-				{
-					glm::vec3 intersectionForPlane = e + t * d;
+				occluder_cache.at(light) = current_scene->listOfShapes.at(i);
+				statistics.shadow_rays_occluded++;
+				return true;
+			}
+		}
+	}
 
-					glm::vec3 b_a = vertex1_vector - vertex0_vector;
-					glm::vec3 x_a = intersectionForPlane - vertex0_vector;
+	// paged triangles are not in the shape list, only the resident pages along the ray are tested;
+	// an occluder from a page stays cached until pages are evicted
+	if (out_of_core)
+	{
+		shape * occluder = shadowTestingPaged(e, s, type);
+		if (occluder != NULL)
+		{
+			occluder_cache.at(light) = occluder;
+			statistics.shadow_rays_occluded++;
+			return true;
+		}
+	}
+	return false;
+}
 
-					glm::vec3 c_b = vertex2_vector - vertex1_vector;
-					glm::vec3 x_b = intersectionForPlane - vertex1_vector;
+// Most shading points see all of an area light or none of it. An area_light_probes x area_light_probes
+// grid of its samples, from corner to corner, is tested first; only when they disagree, in its penumbra,
+// are the rest tested as well. shadowed gets 1 for every sample of the light that is blocked.
+void areaLightShadows(const glm::vec3 &intersection, int area, std::vector<char> &shadowed)
+{
+	int first = current_scene->light_area_first.at(area);
+	int columns = current_scene->light_area_columns.at(area);
+	int rows = current_scene->light_area_rows.at(area);
+	int probes = area_light_probes;
 
-					glm::vec3 a_c = vertex0_vector - vertex2_vector;
-					glm::vec3 x_c = intersectionForPlane - vertex2_vector;
+	shadowed.assign(columns * rows, -1);
 
-					bool sign1 = dot(cross(b_a, x_a), n) > 0;
-					bool sign2 = dot(cross(c_b, x_b), n) > 0;
-					bool sign3 = dot(cross(a_c, x_c), n) > 0;
+	if (probes >= 2 && probes * probes < columns * rows)
+	{
+		render_statistics &statistics = thread_statistics();
+		statistics.area_light_tests++;
 
-					if (sign1 && sign2 && sign3) // intersect with this triangle
-					{
-						finalT = t;
-						intersection = intersectionForPlane;
-
-						material_ambient = objects_to_for_hit_testing.at(i)->material_ambient;
-						material_diffuse = objects_to_for_hit_testing.at(i)->material_diffuse;
-						material_specular = objects_to_for_hit_testing.at(i)->material_specular;
-						material_shininess = objects_to_for_hit_testing.at(i)->material_shininess;
-						material_roughness = objects_to_for_hit_testing.at(i)->material_roughness;
-						material_reflective = objects_to_for_hit_testing.at(i)->material_reflective;
-						material_transmissive = objects_to_for_hit_testing.at(i)->material_transmissive;
-						material_refraction = objects_to_for_hit_testing.at(i)->material_refraction;
-
-						N = normalize(n);
-						center = glm::vec3(0,0,0);
-						type = 5;
-						isHit = true;
-					}
+		bool agree = true;
+		for (int a = 0; a < probes; a++)
+		{
+			for (int b = 0; b < probes; b++)
+			{
+				int sample = (a * (columns - 1) / (probes - 1)) * rows + b * (rows - 1) / (probes - 1);
+				if (shadowed.at(sample) < 0)
+				{
+					shadowed.at(sample) = shadowTesting(intersection, current_scene->light_point_position.at(first + sample), 1, first + sample);
 				}
+				agree = agree && shadowed.at(sample) == shadowed.at(0);
 			}
-		}//else if
-		else if (objects_to_for_hit_testing.at(i)->type == "plane")
+		}
+
+		if (agree)
 		{
-			glm::vec3 a = objects_to_for_hit_testing.at(i)->position;
-			glm::vec3 n = normalize(objects_to_for_hit_testing.at(i)->normal);
-			glm::vec3 d = s - e;
+			shadowed.assign(columns * rows, shadowed.at(0));
+			return;
+		}
+		statistics.area_light_penumbrae++;
+	}
 
-			float denominator = dot(n, d);
+	for (int sample = 0; sample < columns * rows; sample++)
+	{
+		if (shadowed.at(sample) < 0)
+		{
+			shadowed.at(sample) = shadowTesting(intersection, current_scene->light_point_position.at(first + sample), 1, first + sample);
+		}
+	}
+}
+
+// whether any part of the segment from a to b is inside the box
+bool segmentHitsBox(const glm::vec3 &a, const glm::vec3 &b, const std::vector<float> &box)
+{
+	float t_near = 0.0f;
+	float t_far = 1.0f;
 
-			if (denominator != 0)
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float lo = box.at(2 * axis);
+		float hi = box.at(2 * axis + 1);
+		float d = b[axis] - a[axis];
+
+		if (d == 0.0f)
+		{
+			if (a[axis] < lo || a[axis] > hi)
 			{
-				float t = dot(n, (a - e)) / denominator;
+				return false;
+			}
+			continue;
+		}
 
-				if ( t > 0.001 && t < finalT )
-				{
-					finalT = t;
-					intersection = e + t * d;;
+		float t0 = (lo - a[axis]) / d;
+		float t1 = (hi - a[axis]) / d;
+		t_near = glm::max(t_near, glm::min(t0, t1));
+		t_far = glm::min(t_far, glm::max(t0, t1));
 
-					material_ambient = objects_to_for_hit_testing.at(i)->material_ambient;
-					material_diffuse = objects_to_for_hit_testing.at(i)->material_diffuse;
-					material_specular = objects_to_for_hit_testing.at(i)->material_specular;
-					material_shininess = objects_to_for_hit_testing.at(i)->material_shininess;
-					material_roughness = objects_to_for_hit_testing.at(i)->material_roughness;
-					material_reflective = objects_to_for_hit_testing.at(i)->material_reflective;
-					material_transmissive = objects_to_for_hit_testing.at(i)->material_transmissive;
-					material_refraction = objects_to_for_hit_testing.at(i)->material_refraction;
+		if (t_near > t_far)
+		{
+			return false;
+		}
+	}
+	return true;
+}
 
-					N = normalize(n);
-					center = glm::vec3(0, 0, 0);
-					type = 6;
-					isHit = true;
-				}
-			}
-		}//else if
-		else if (objects_to_for_hit_testing.at(i)->type == "intersection")
+// whether a shape inside the box could be in the way of a shadow ray from point to any of the lights
+bool boxBlocksLight(const std::vector<float> &box, const glm::vec3 &point)
+{
+	for (int i = 0; i < current_scene->light_point_position.size(); i++)
+	{
+		if (segmentHitsBox(point, current_scene->light_point_position.at(i), box))
 		{
-			shape * sub_shape1 = objects_to_for_hit_testing.at(i)->sub_shape1;
-			shape * sub_shape2 = objects_to_for_hit_testing.at(i)->sub_shape2;
+			return true;
+		}
+	}
+	for (int i = 0; i < current_scene->light_directional_direction.size(); i++)
+	{
+		if (segmentHitsBox(point, point - 10000.0f * glm::normalize(current_scene->light_directional_direction.at(i)), box))
+		{
+			return true;
+		}
+	}
+	for (int i = 0; i < current_scene->light_spot_position.size(); i++)
+	{
+		if (segmentHitsBox(point, current_scene->light_spot_position.at(i), box))
+		{
+			return true;
+		}
+	}
+	return false;
+}
 
-			// hit testing with first sphere
-			bool hit_with_first = false;
+thread_local std::vector<char> area_light_shadowed;
 
-			float radius_for_first = sub_shape1->radius;
-			glm::vec3 c_for_first = sub_shape1->position;
-			glm::vec3 d = s - e;
-			float t_For_first = 0;
+// Tests one shape against the ray e + t * (s - e) and takes it over as the hit if it is closer than finalT.
+void hitTestingShape(shape * object, const point3 &e, const point3 &s, float &finalT, bool &isHit, Material * &hit_material,
+				glm::vec3 &intersection, glm::vec3 &N, glm::vec3 &center, int &type, float &radiusParamter)
+{
+	if (object->type == "sphere")
+	{
+		float radius = object->radius;
+		glm::vec3 c = object->position;
+		glm::vec3 d = s - e;
 
-			float determine = glm::pow(dot(d, (e - c_for_first)), 2) - dot(d, d) * (dot((e - c_for_first), (e - c_for_first)) - radius_for_first * radius_for_first);
+		float determine = glm::pow(dot(d, (e - c)), 2) - dot(d, d) * (dot((e - c), (e - c)) - radius * radius);
 
-			if (determine >= 0) // there is intersetion 
-			{
-				float rooted_determine = glm::sqrt(determine);
-				t_For_first = (-1 * dot(d, (e - c_for_first)) - rooted_determine) / dot(d, d);
+		if (determine >= 0) // there is intersetion 
+		{
+			float rooted_determine = glm::sqrt(determine);
+			float t = (-1 * dot(d, (e - c)) - rooted_determine) / dot(d, d);
 
-				if (t_For_first > 0.001 && t_For_first < finalT)
-				{
-					hit_with_first = true;
-				}
+			if (t > 0.001 && t < finalT)
+			{
+				finalT = t;
+				intersection = e + t * d;
+				hit_material = object->mat;
+				center = c;
+				type = 4;
+				N = normalize(e + t * d - c);
+				radiusParamter = radius;
+				isHit = true;
 			}
+		}
+	}// if
+	else if (object->type == "triangle")
+	{
+		glm::vec3 vertex0_vector = object->vertex0;
+		glm::vec3 vertex1_vector = object->vertex1;
+		glm::vec3 vertex2_vector = object->vertex2;
+
+		glm::vec3 n = normalize(cross(vertex1_vector - vertex0_vector, vertex2_vector - vertex1_vector));
+		glm::vec3 d = s - e;
 
-			// hit testing with second sphere
-			bool hit_with_second = false;
+		float denominator = dot(n, d);
 
-			float radius_for_second = sub_shape2->radius;
-			glm::vec3 c_for_second = sub_shape2->position;
-			d = s - e;
-			float t_For_second = 0;
+		if (denominator != 0)
+		{
+			float t = dot(n, (vertex0_vector - e)) / denominator;
 
-			float determine_for_second = glm::pow(dot(d, (e - c_for_second)), 2) - dot(d, d) * (dot((e - c_for_second), (e - c_for_second)) - radius_for_second * radius_for_second);
-			if (determine_for_second >= 0) // there is intersetion 
+			if (t > 0.001 && t < finalT)
 			{
-				float rooted_determine = glm::sqrt(determine_for_second);
-				t_For_second = (-1 * dot(d, (e - c_for_second)) - rooted_determine) / dot(d, d);
+				glm::vec3 intersectionForPlane = e + t * d;
 
-				if (t_For_second > 0.001 && t_For_second < finalT)
+				glm::vec3 b_a = vertex1_vector - vertex0_vector;
+				glm::vec3 x_a = intersectionForPlane - vertex0_vector;
+
+				glm::vec3 c_b = vertex2_vector - vertex1_vector;
+				glm::vec3 x_b = intersectionForPlane - vertex1_vector;
+
+				glm::vec3 a_c = vertex0_vector - vertex2_vector;
+				glm::vec3 x_c = intersectionForPlane - vertex2_vector;
+
+				bool sign1 = dot(cross(b_a, x_a), n) > 0;
+				bool sign2 = dot(cross(c_b, x_b), n) > 0;
+				bool sign3 = dot(cross(a_c, x_c), n) > 0;
+
+				if (sign1 && sign2 && sign3) // intersect with this triangle
 				{
-					hit_with_second = true;
+					finalT = t;
+					intersection = intersectionForPlane;
+					hit_material = object->mat;
+					N = normalize(n);
+					center = glm::vec3(0,0,0);
+					type = 5;
+					isHit = true;
 				}
 			}
+		}
+	}//else if
+	else if (object->type == "plane")
+	{
+		glm::vec3 a = object->position;
+		glm::vec3 n = normalize(object->normal);
+		glm::vec3 d = s - e;
+
+		float denominator = dot(n, d);
+
+		if (denominator != 0)
+		{
+			float t = dot(n, (a - e)) / denominator;
 
-			if ( hit_with_first && hit_with_second )
+			if ( t > 0.001 && t < finalT )
 			{
-				finalT = glm::min(t_For_first, t_For_second);
-				intersection = e + finalT * d;
-				material_ambient = (sub_shape1->material_ambient + sub_shape2->material_ambient) / 2.0f;
-				material_diffuse = (sub_shape1->material_diffuse + sub_shape2->material_diffuse) / 2.0f;
-				material_specular = (sub_shape1->material_specular + sub_shape2->material_specular) / 2.0f;
-				material_roughness = (sub_shape1->material_roughness + sub_shape2->material_roughness) / 2.0f;
-				material_shininess = (sub_shape1->material_shininess + sub_shape2->material_shininess) / 2.0f;
-				material_reflective = (sub_shape1->material_reflective + sub_shape2->material_reflective) / 2.0f;
-				material_transmissive = (sub_shape1->material_transmissive + sub_shape2->material_transmissive) / 2.0f;
-				material_refraction = (sub_shape1->material_refraction + sub_shape2->material_refraction) / 2.0f;
-				type = 4;
-				center = c_for_first;
-				N = normalize(e + t_For_first * d - c_for_first);
-				radiusParamter = radius_for_first;
-			
+				finalT = t;
+				intersection = e + t * d;;
+				hit_material = object->mat;
+				N = normalize(n);
+				center = glm::vec3(0, 0, 0);
+				type = 6;
 				isHit = true;
 			}
 		}
-		else if (objects_to_for_hit_testing.at(i)->type == "union")
-		{
-			shape * sub_shape1 = objects_to_for_hit_testing.at(i)->sub_shape1;
-			shape * sub_shape2 = objects_to_for_hit_testing.at(i)->sub_shape2;
+	}//else if
+	else if (object->type == "intersection")
+	{
+		shape * sub_shape1 = object->sub_shape1;
+		shape * sub_shape2 = object->sub_shape2;
 
-			// hit testing with first sphere
-			bool hit_with_first = false;
+		// hit testing with first sphere
+		bool hit_with_first = false;
 
-			float radius_for_first = sub_shape1->radius;
-			glm::vec3 c_for_first = sub_shape1->position;
-			glm::vec3 d = s - e;
-			float t_For_first = 0;
+		float radius_for_first = sub_shape1->radius;
+		glm::vec3 c_for_first = sub_shape1->position;
+		glm::vec3 d = s - e;
+		float t_For_first = 0;
 
-			float determine = glm::pow(dot(d, (e - c_for_first)), 2) - dot(d, d) * (dot((e - c_for_first), (e - c_for_first)) - radius_for_first * radius_for_first);
+		float determine = glm::pow(dot(d, (e - c_for_first)), 2) - dot(d, d) * (dot((e - c_for_first), (e - c_for_first)) - radius_for_first * radius_for_first);
 
-			if (determine >= 0) // there is intersetion 
-			{
-				float rooted_determine = glm::sqrt(determine);
-				t_For_first = (-1 * dot(d, (e - c_for_first)) - rooted_determine) / dot(d, d);
+		if (determine >= 0) // there is intersetion 
+		{
+			float rooted_determine = glm::sqrt(determine);
+			t_For_first = (-1 * dot(d, (e - c_for_first)) - rooted_determine) / dot(d, d);
 
-				if (t_For_first > 0.001 && t_For_first < finalT)
-				{
-					hit_with_first = true;
-				}
+			if (t_For_first > 0.001 && t_For_first < finalT)
+			{
+				hit_with_first = true;
 			}
+		}
 
-			// hit testing with second sphere
-			bool hit_with_second = false;
+		// hit testing with second sphere
+		bool hit_with_second = false;
 
-			float radius_for_second = sub_shape2->radius;
-			glm::vec3 c_for_second = sub_shape2->position;
-			d = s - e;
-			float t_For_second = 0;
+		float radius_for_second = sub_shape2->radius;
+		glm::vec3 c_for_second = sub_shape2->position;
+		d = s - e;
+		float t_For_second = 0;
 
-			float determine_for_second = glm::pow(dot(d, (e - c_for_second)), 2) - dot(d, d) * (dot((e - c_for_second), (e - c_for_second)) - radius_for_second * radius_for_second);
-			if (determine_for_second >= 0) // there is intersetion 
-			{
-				float rooted_determine = glm::sqrt(determine_for_second);
-				t_For_second = (-1 * dot(d, (e - c_for_second)) - rooted_determine) / dot(d, d);
+		float determine_for_second = glm::pow(dot(d, (e - c_for_second)), 2) - dot(d, d) * (dot((e - c_for_second), (e - c_for_second)) - radius_for_second * radius_for_second);
+		if (determine_for_second >= 0) // there is intersetion 
+		{
+			float rooted_determine = glm::sqrt(determine_for_second);
+			t_For_second = (-1 * dot(d, (e - c_for_second)) - rooted_determine) / dot(d, d);
 
-				if (t_For_second > 0.001 && t_For_second < finalT)
-				{
-					hit_with_second = true;
-				}
+			if (t_For_second > 0.001 && t_For_second < finalT)
+			{
+				hit_with_second = true;
 			}
+		}
 
-			if (hit_with_first && hit_with_second)
-			{
-				finalT = glm::min(t_For_first, t_For_second);
-				intersection = e + finalT * d;
-				material_ambient = (sub_shape1->material_ambient + sub_shape2->material_ambient) / 2.0f;
-				material_diffuse = (sub_shape1->material_diffuse + sub_shape2->material_diffuse) / 2.0f;
-				material_specular = (sub_shape1->material_specular + sub_shape2->material_specular) / 2.0f;
-				material_roughness = (sub_shape1->material_roughness + sub_shape2->material_roughness) / 2.0f;
-				material_shininess = (sub_shape1->material_shininess + sub_shape2->material_shininess) / 2.0f;
-				material_reflective = (sub_shape1->material_reflective + sub_shape2->material_reflective) / 2.0f;
-				material_transmissive = (sub_shape1->material_transmissive + sub_shape2->material_transmissive) / 2.0f;
-				material_refraction = (sub_shape1->material_refraction + sub_shape2->material_refraction) / 2.0f;
-				type = 4;
-				center = c_for_first;
-				N = normalize(e + t_For_first * d - c_for_first);
-				radiusParamter = radius_for_first;
+		if ( hit_with_first && hit_with_second )
+		{
+			finalT = glm::min(t_For_first, t_For_second);
+			intersection = e + finalT * d;
+			hit_material = object->mat; // average of both spheres
+			type = 4;
+			center = c_for_first;
+			N = normalize(e + t_For_first * d - c_for_first);
+			radiusParamter = radius_for_first;
+		
+			isHit = true;
+		}
+	}
+	else if (object->type == "union")
+	{
+		shape * sub_shape1 = object->sub_shape1;
+		shape * sub_shape2 = object->sub_shape2;
 
-				isHit = true;
-			}
-			else if (hit_with_first && !hit_with_second)
-			{
-				finalT = t_For_first;
-				intersection = e + t_For_first * d;
-				material_ambient = sub_shape1->material_ambient;
-				material_diffuse = sub_shape1->material_diffuse;
-				material_specular = sub_shape1->material_specular;
-				material_roughness = sub_shape1->material_roughness;
-				material_shininess = sub_shape1->material_shininess;
-				material_reflective = sub_shape1->material_reflective;
-				material_transmissive = sub_shape1->material_transmissive;
-				material_refraction = sub_shape1->material_refraction;
-				type = 4;
-				center = c_for_first;
-				N = normalize(e + t_For_first * d - c_for_first);
-				radiusParamter = radius_for_first;
+		// hit testing with first sphere
+		bool hit_with_first = false;
 
-				isHit = true;
-			}
-			else if (!hit_with_first && hit_with_second)
+		float radius_for_first = sub_shape1->radius;
+		glm::vec3 c_for_first = sub_shape1->position;
+		glm::vec3 d = s - e;
+		float t_For_first = 0;
+
+		float determine = glm::pow(dot(d, (e - c_for_first)), 2) - dot(d, d) * (dot((e - c_for_first), (e - c_for_first)) - radius_for_first * radius_for_first);
+
+		if (determine >= 0) // there is intersetion 
+		{
+			float rooted_determine = glm::sqrt(determine);
+			t_For_first = (-1 * dot(d, (e - c_for_first)) - rooted_determine) / dot(d, d);
+
+			if (t_For_first > 0.001 && t_For_first < finalT)
 			{
-				finalT = t_For_second;
-				intersection = e + t_For_second * d;
-				material_ambient = sub_shape2->material_ambient;
-				material_diffuse = sub_shape2->material_diffuse;
-				material_specular = sub_shape2->material_specular;
-				material_roughness = sub_shape2->material_roughness;
-				material_shininess = sub_shape2->material_shininess;
-				material_reflective = sub_shape2->material_reflective;
-				material_transmissive = sub_shape2->material_transmissive;
-				material_refraction = sub_shape2->material_refraction;
-				type = 4;
-				center = c_for_second;
-				N = normalize(e + t_For_second * d - c_for_second);
-				radiusParamter = radius_for_second;
+				hit_with_first = true;
+			}
+		}
 
-				isHit = true;
+		// hit testing with second sphere
+		bool hit_with_second = false;
+
+		float radius_for_second = sub_shape2->radius;
+		glm::vec3 c_for_second = sub_shape2->position;
+		d = s - e;
+		float t_For_second = 0;
+
+		float determine_for_second = glm::pow(dot(d, (e - c_for_second)), 2) - dot(d, d) * (dot((e - c_for_second), (e - c_for_second)) - radius_for_second * radius_for_second);
+		if (determine_for_second >= 0) // there is intersetion 
+		{
+			float rooted_determine = glm::sqrt(determine_for_second);
+			t_For_second = (-1 * dot(d, (e - c_for_second)) - rooted_determine) / dot(d, d);
+
+			if (t_For_second > 0.001 && t_For_second < finalT)
+			{
+				hit_with_second = true;
 			}
 		}
-		else if (objects_to_for_hit_testing.at(i)->type == "difference")
+
+		if (hit_with_first && hit_with_second)
+		{
+			finalT = glm::min(t_For_first, t_For_second);
+			intersection = e + finalT * d;
+			hit_material = object->mat; // average of both spheres
+			type = 4;
+			center = c_for_first;
+			N = normalize(e + t_For_first * d - c_for_first);
+			radiusParamter = radius_for_first;
+
+			isHit = true;
+		}
+		else if (hit_with_first && !hit_with_second)
 		{
-			shape * sub_shape1 = objects_to_for_hit_testing.at(i)->sub_shape1;
-			shape * sub_shape2 = objects_to_for_hit_testing.at(i)->sub_shape2;
+			finalT = t_For_first;
+			intersection = e + t_For_first * d;
+			hit_material = sub_shape1->mat;
+			type = 4;
+			center = c_for_first;
+			N = normalize(e + t_For_first * d - c_for_first);
+			radiusParamter = radius_for_first;
+
+			isHit = true;
+		}
+		else if (!hit_with_first && hit_with_second)
+		{
+			finalT = t_For_second;
+			intersection = e + t_For_second * d;
+			hit_material = sub_shape2->mat;
+			type = 4;
+			center = c_for_second;
+			N = normalize(e + t_For_second * d - c_for_second);
+			radiusParamter = radius_for_second;
+
+			isHit = true;
+		}
+	}
+	else if (object->type == "difference")
+	{
+		shape * sub_shape1 = object->sub_shape1;
+		shape * sub_shape2 = object->sub_shape2;
 
-			// hit testing with first sphere
-			bool hit_with_first = false;
+		// hit testing with first sphere
+		bool hit_with_first = false;
 
-			float radius_for_first = sub_shape1->radius;
-			glm::vec3 c_for_first = sub_shape1->position;
-			glm::vec3 d = s - e;
-			float t_For_first = 0;
+		float radius_for_first = sub_shape1->radius;
+		glm::vec3 c_for_first = sub_shape1->position;
+		glm::vec3 d = s - e;
+		float t_For_first = 0;
 
-			float determine = glm::pow(dot(d, (e - c_for_first)), 2) - dot(d, d) * (dot((e - c_for_first), (e - c_for_first)) - radius_for_first * radius_for_first);
+		float determine = glm::pow(dot(d, (e - c_for_first)), 2) - dot(d, d) * (dot((e - c_for_first), (e - c_for_first)) - radius_for_first * radius_for_first);
 
-			if (determine >= 0) // there is intersetion 
-			{
-				float rooted_determine = glm::sqrt(determine);
-				t_For_first = (-1 * dot(d, (e - c_for_first)) - rooted_determine) / dot(d, d);
+		if (determine >= 0) // there is intersetion 
+		{
+			float rooted_determine = glm::sqrt(determine);
+			t_For_first = (-1 * dot(d, (e - c_for_first)) - rooted_determine) / dot(d, d);
 
-				if (t_For_first > 0.001 && t_For_first < finalT)
-				{
-					hit_with_first = true;
-				}
+			if (t_For_first > 0.001 && t_For_first < finalT)
+			{
+				hit_with_first = true;
 			}
+		}
 
-			// hit testing with second sphere
-			bool hit_with_second = false;
+		// hit testing with second sphere
+		bool hit_with_second = false;
 
-			float radius_for_second = sub_shape2->radius;
-			glm::vec3 c_for_second = sub_shape2->position;
-			d = s - e;
-			float t_For_second = 0;
+		float radius_for_second = sub_shape2->radius;
+		glm::vec3 c_for_second = sub_shape2->position;
+		d = s - e;
+		float t_For_second = 0;
 
-			float determine_for_second = glm::pow(dot(d, (e - c_for_second)), 2) - dot(d, d) * (dot((e - c_for_second), (e - c_for_second)) - radius_for_second * radius_for_second);
-			if (determine_for_second >= 0) // there is intersetion 
-			{
-				float rooted_determine = glm::sqrt(determine_for_second);
-				t_For_second = (-1 * dot(d, (e - c_for_second)) - rooted_determine) / dot(d, d);
+		float determine_for_second = glm::pow(dot(d, (e - c_for_second)), 2) - dot(d, d) * (dot((e - c_for_second), (e - c_for_second)) - radius_for_second * radius_for_second);
+		if (determine_for_second >= 0) // there is intersetion 
+		{
+			float rooted_determine = glm::sqrt(determine_for_second);
+			t_For_second = (-1 * dot(d, (e - c_for_second)) - rooted_determine) / dot(d, d);
 
-				if (t_For_second > 0.001 && t_For_second < finalT)
-				{
-					hit_with_second = true;
-				}
+			if (t_For_second > 0.001 && t_For_second < finalT)
+			{
+				hit_with_second = true;
 			}
+		}
 
-			if (hit_with_first && !hit_with_second)
-			{
-				finalT = t_For_first;
-				intersection = e + t_For_first * d;
-				material_ambient = sub_shape1->material_ambient;
-				material_diffuse = sub_shape1->material_diffuse;
-				material_specular = sub_shape1->material_specular;
-				material_roughness = sub_shape1->material_roughness;
-				material_shininess = sub_shape1->material_shininess;
-				material_reflective = sub_shape1->material_reflective;
-				material_transmissive = sub_shape1->material_transmissive;
-				material_refraction = sub_shape1->material_refraction;
-				type = 4;
-				center = c_for_first;
-				N = normalize(e + t_For_first * d - c_for_first);
-				radiusParamter = radius_for_first;
+		if (hit_with_first && !hit_with_second)
+		{
+			finalT = t_For_first;
+			intersection = e + t_For_first * d;
+			hit_material = sub_shape1->mat;
+			type = 4;
+			center = c_for_first;
+			N = normalize(e + t_For_first * d - c_for_first);
+			radiusParamter = radius_for_first;
+
+			isHit = true;
+		}
+	}
+}
 
-				isHit = true;
-			}
+bool hitTesting(const point3 &e, const point3 &s, Material * &hit_material,
+				glm::vec3 &intersection, glm::vec3 &N, glm::vec3 &center, int &type, float &radiusParamter, std::vector<shape *> objects_to_for_hit_testing,
+				shape ** hit_shape)
+{
+	bool isHit = false;
+	float finalT = 10000.0f;
+
+	for (int i = 0; i < objects_to_for_hit_testing.size(); i++)
+	{
+		// every closer hit lowers finalT, which tells which shape was hit last
+		float lastT = finalT;
+
+		hitTestingShape(objects_to_for_hit_testing.at(i), e, s, finalT, isHit, hit_material, intersection, N, center, type, radiusParamter);
+
+		if (finalT != lastT && hit_shape != NULL)
+		{
+			*hit_shape = objects_to_for_hit_testing.at(i);
 		}
 	}//for
 	return isHit;
 }
 
-void getColor(colour3 &colour,
-			  glm::vec3 &material_ambient, glm::vec3 &material_diffuse, glm::vec3 &material_specular,
-			  float &material_shininess, glm::vec3 &material_reflective, glm::vec3 &material_transmissive, float &material_refraction, float &material_roughness,
-			  const glm::vec3 &intersection, glm::vec3 &N, glm::vec3 &V)
+// the nearest hit along the ray, from the BVH or from the candidates the octree collects
+bool closestHit(const point3 &e, const point3 &s, Material * &hit_material,
+				glm::vec3 &intersection, glm::vec3 &N, glm::vec3 &center, int &type, float &radiusParamter, shape ** hit_shape)
+{
+	render_statistics &statistics = thread_statistics();
+	statistics.rays++;
+
+	if (current_scene->bvh.ready)
+	{
+		bool isHit = false;
+		float finalT = 10000.0f;
+		bvhClosestHit(e, s, finalT, isHit, hit_material, intersection, N, center, type, radiusParamter, hit_shape);
+
+		// planes are unbounded, they are tested after the shapes like the octree does
+		for (int i = 0; i < current_scene->listOfPlanes.size(); i++)
+		{
+			statistics.hit_shape_tests++;
+			float lastT = finalT;
+			hitTestingShape(current_scene->listOfPlanes.at(i), e, s, finalT, isHit, hit_material, intersection, N, center, type, radiusParamter);
+
+			if (finalT != lastT && hit_shape != NULL)
+			{
+				*hit_shape = current_scene->listOfPlanes.at(i);
+			}
+		}
+
+		// paged triangles are in neither structure, the resident pages along the ray are tested after them
+		if (out_of_core)
+		{
+			pagedClosestHit(e, s, finalT, isHit, hit_material, intersection, N, center, type, radiusParamter, hit_shape);
+		}
+		return isHit;
+	}
+
+	std::vector<shape *> objects_to_for_hit_testing;
+	ray_box_intersection(e, s, current_scene->ocTree_root, objects_to_for_hit_testing, false);
+	if (out_of_core)
+	{
+		addPagedShapes(e, s, objects_to_for_hit_testing);
+	}
+	statistics.hit_shape_tests += objects_to_for_hit_testing.size();
+	return hitTesting(e, s, hit_material, intersection, N, center, type, radiusParamter, objects_to_for_hit_testing, hit_shape);
+}
+
+// Oren-Nayar diffuse and Blinn-Phong specular from a single light. The material variant decides at
+// compile time whether the Oren-Nayar terms (acos, sin, tan) and the specular pow() are evaluated at all.
+template <bool ROUGH, bool SPECULAR>
+inline void shadeLight(const Material &m, const glm::vec3 &L, const glm::vec3 &light_colour,
+					   const glm::vec3 &N, const glm::vec3 &V, float theta_r, const glm::vec3 &u,
+					   glm::vec3 &colour_diffuse, glm::vec3 &colour_specular)
+{
+	float NdotL = dot(L, N);
+
+	if (ROUGH)
+	{
+		float theta_i = glm::acos(NdotL);
+		float alpha = glm::max(theta_i, theta_r);
+		float beta = glm::min(theta_i, theta_r);
+		glm::vec3 v = normalize(L - N * glm::clamp(dot(N, L), 0.0f, 1.0f));
+
+		colour_diffuse += m.diffuse * glm::max(dot(N, L), 0.0f) * (m.oren_nayar_A + (m.oren_nayar_B * glm::max(0.0f, dot(u, v)) * glm::sin(alpha) * glm::tan(beta))) * light_colour;
+	}
+	else // roughness 0 is plain Lambert: A is 1 and B is 0
+	{
+		colour_diffuse += m.diffuse * glm::max(dot(N, L), 0.0f) * light_colour;
+	}
+
+	if (SPECULAR && NdotL >= 0.0)
+	{
+		glm::vec3 H = normalize(L + V);
+		colour_specular += light_colour * m.specular * glm::pow(glm::max(dot(N, H), 0.0f), m.shininess);
+	}
+}
+
+template <bool ROUGH, bool SPECULAR>
+void shade(colour3 &colour, const Material &m, const glm::vec3 &intersection, const glm::vec3 &N, const glm::vec3 &V,
+	const std::vector<int> * spot_lights)
 {
-	// OrenCNayar reflectance diffuse model
-	float power_of_material_roughness = material_roughness * material_roughness;
-	float A = 1 - 0.5 * (power_of_material_roughness / (power_of_material_roughness + 0.33));
-	float B = 0.45 * (power_of_material_roughness / (power_of_material_roughness + 0.09));
-	float theta_r = acos(dot(V, N));
-	glm::vec3 u = normalize(V - N * glm::clamp(dot(N, V), 0.0f, 1.0f));
+	const Scene &lights = *current_scene;
+	float theta_r = 0;
+	glm::vec3 u = glm::vec3(0, 0, 0);
+
+	if (ROUGH)
+	{
+		theta_r = glm::acos(dot(V, N));
+		u = normalize(V - N * glm::clamp(dot(N, V), 0.0f, 1.0f));
+	}
 
 	// point
 	glm::vec3 colour_diffuse_point = glm::vec3(0, 0, 0);
 	glm::vec3 colour_specular_point = glm::vec3(0, 0, 0);
 
-	for (int i = 0; i < light_point_position.size(); i++)
-	{
-		bool is_shadowed_by_point_light = shadowTesting(intersection, light_point_position.at(i), 1);
+	// the samples of the area lights are among the point lights, their shadows are found a light at a time
+	std::vector<char> &area_shadowed = area_light_shadowed;
+	int area = 0;
+	int area_first = 0;
+	int area_end = 0;
 
-		if (!is_shadowed_by_point_light)
+	for (int i = 0; i < lights.light_point_position.size(); i++)
+	{
+		if (area < lights.light_area_first.size() && i == lights.light_area_first.at(area))
 		{
-			glm::vec3 LforPoint = normalize(light_point_position.at(i) - intersection);
-			glm::vec3 HforPoint = normalize(LforPoint + V);
-
-			// OrenCNayar reflectance diffuse model
-			float theta_i = acos(dot(LforPoint, N));
-			float alpha = glm::max(theta_i, theta_r);
-			float beta = glm::min(theta_i, theta_r);
-			glm::vec3 v = normalize(LforPoint - N * glm::clamp(dot(N, LforPoint), 0.0f, 1.0f));
+			areaLightShadows(intersection, area, area_shadowed);
+			area_first = i;
+			area_end = i + area_shadowed.size();
+			area++;
+		}
 
-			colour_diffuse_point += material_diffuse * glm::max(dot(N, LforPoint), 0.0f) * (A + (B * glm::max(0.0f, dot(u, v)) * sin(alpha) * tan(beta))) * light_point_color.at(i);
+		bool is_shadowed_by_point_light = i < area_end ? area_shadowed.at(i - area_first) != 0
+			: shadowTesting(intersection, lights.light_point_position.at(i), 1, i);
 
-			if (dot(LforPoint, N) < 0.0)
-			{
-			}
-			else
-			{
-				colour_specular_point += light_point_color.at(i) * material_specular * pow(glm::max(dot(N, HforPoint), 0.0f), material_shininess);
-			}
+		if (!is_shadowed_by_point_light)
+		{
+			glm::vec3 LforPoint = normalize(lights.light_point_position.at(i) - intersection);
+			shadeLight<ROUGH, SPECULAR>(m, LforPoint, lights.light_point_color.at(i), N, V, theta_r, u, colour_diffuse_point, colour_specular_point);
 		}
 	}
 
@@ -1111,30 +1373,14 @@ void getColor(colour3 &colour,
 	glm::vec3 colour_diffuse_directional = glm::vec3(0, 0, 0);
 	glm::vec3 colour_specular_directional = glm::vec3(0, 0, 0);
 
-	for (int i = 0; i < light_directional_direction.size(); i++)
+	for (int i = 0; i < lights.light_directional_direction.size(); i++)
 	{
-		bool is_shadowed_by_directional_light = shadowTesting(intersection, intersection - light_directional_direction.at(i), 2);
+		bool is_shadowed_by_directional_light = shadowTesting(intersection, intersection - lights.light_directional_direction.at(i), 2, lights.light_point_position.size() + i);
 
 		if (!is_shadowed_by_directional_light)
 		{
-			glm::vec3 LforDirectional = -normalize(light_directional_direction.at(i));
-			glm::vec3 HforDirectional = normalize(LforDirectional + V);
-
-			// OrenCNayar reflectance diffuse model
-			float theta_i = acos(dot(LforDirectional, N));
-			float alpha = glm::max(theta_i, theta_r);
-			float beta = glm::min(theta_i, theta_r);
-			glm::vec3 v = normalize(LforDirectional - N * glm::clamp(dot(N, LforDirectional), 0.0f, 1.0f));
-
-			colour_diffuse_directional += material_diffuse * glm::max(dot(N, LforDirectional), 0.0f) * (A + (B * glm::max(0.0f, dot(u, v)) * sin(alpha) * tan(beta))) * light_directional_color.at(i);
-			
-			if (dot(LforDirectional, N) < 0.0)
-			{
-			}
-			else
-			{
-				colour_specular_directional += light_directional_color.at(i) * material_specular * pow(glm::max(dot(N, HforDirectional), 0.0f), material_shininess);
-			}
+			glm::vec3 LforDirectional = -normalize(lights.light_directional_direction.at(i));
+			shadeLight<ROUGH, SPECULAR>(m, LforDirectional, lights.light_directional_color.at(i), N, V, theta_r, u, colour_diffuse_directional, colour_specular_directional);
 		}
 	}
 
@@ -1142,78 +1388,213 @@ void getColor(colour3 &colour,
 	glm::vec3 colour_diffuse_spot = glm::vec3(0, 0, 0);
 	glm::vec3 colour_specular_spot = glm::vec3(0, 0, 0);
 
-	for (int i = 0; i < light_spot_direction.size(); i++)
+	int spot_count = spot_lights != NULL ? spot_lights->size() : lights.light_spot_direction.size();
+	for (int k = 0; k < spot_count; k++)
 	{
-		float angle = acos(dot(light_spot_direction.at(i), intersection - light_spot_position.at(i)) / (length(light_spot_direction.at(i)) * length(intersection - light_spot_position.at(i))));
-		if (angle <= glm::radians( light_spot_cutoff.at(i) ) )
+		int i = spot_lights != NULL ? spot_lights->at(k) : k;
+
+		// inside the cone when the angle to its axis is at most the cutoff, compared as cosines
+		glm::vec3 from_light = intersection - lights.light_spot_position.at(i);
+		if (dot(lights.light_spot_axis.at(i), from_light) >= lights.light_spot_cos_cutoff.at(i) * length(from_light))
 		{
-			bool is_shadowed_by_spot_light = shadowTesting(intersection, light_spot_position.at(i), 3);
+			bool is_shadowed_by_spot_light = shadowTesting(intersection, lights.light_spot_position.at(i), 3, lights.light_point_position.size() + lights.light_directional_direction.size() + i);
 
 			if (!is_shadowed_by_spot_light)
 			{
-				glm::vec3 LforSpot = -normalize(light_spot_direction.at(i));
-				glm::vec3 HforDirectional = normalize(LforSpot + V);
-
-				// OrenCNayar reflectance diffuse model
-				float theta_i = acos(dot(LforSpot, N));
-				float alpha = glm::max(theta_i, theta_r);
-				float beta = glm::min(theta_i, theta_r);
-				glm::vec3 v = normalize(LforSpot - N * glm::clamp(dot(N, LforSpot), 0.0f, 1.0f));
-
-				colour_diffuse_spot += material_diffuse * glm::max(dot(N, LforSpot), 0.0f) * (A + (B * glm::max(0.0f, dot(u, v)) * sin(alpha) * tan(beta))) * light_spot_color.at(i);
-				
-				if (dot(LforSpot, N) < 0.0)
-				{
-				}
-				else
-				{
-					colour_specular_spot += light_spot_color.at(i) * material_specular * pow(glm::max(dot(N, HforDirectional), 0.0f), material_shininess);
-				}
+				glm::vec3 LforSpot = -lights.light_spot_axis.at(i);
+				shadeLight<ROUGH, SPECULAR>(m, LforSpot, lights.light_spot_color.at(i), N, V, theta_r, u, colour_diffuse_spot, colour_specular_spot);
 			}
 		}
 	}
 
-	glm::vec3 colour_ambient = light_ambient_color * material_ambient;
+	glm::vec3 colour_ambient = lights.light_ambient_color * m.ambient;
 	glm::vec3 colour_diffuse = colour_diffuse_directional + colour_diffuse_point + colour_diffuse_spot;
 	glm::vec3 colour_specular = colour_specular_directional + colour_specular_point + colour_specular_spot;
 
 	colour = colour + colour_ambient + colour_diffuse + colour_specular;
 }
 
-void mirrorReflection(point3 &e, point3 &s, colour3 &colour, int depth,
-					  glm::vec3 &material_ambient, glm::vec3 &material_diffuse, glm::vec3 &material_specular,
-				      float &material_shininess, glm::vec3 &material_reflective, glm::vec3 &material_transmissive, float &material_refraction, float &material_roughness,
-					  glm::vec3 &N, glm::vec3 lastPoint)
+void getColor(colour3 &colour, const Material &m, const glm::vec3 &intersection, const glm::vec3 &N, const glm::vec3 &V,
+	const std::vector<int> * spot_lights)
+{
+	m.shade(colour, m, intersection, N, V, spot_lights);
+}
+
+void compileMaterial(Material * m)
+{
+	// Oren-Nayar coefficients only depend on the roughness
+	float power_of_material_roughness = m->roughness * m->roughness;
+	m->oren_nayar_A = 1 - 0.5 * (power_of_material_roughness / (power_of_material_roughness + 0.33));
+	m->oren_nayar_B = 0.45 * (power_of_material_roughness / (power_of_material_roughness + 0.09));
+
+	m->flags = 0;
+	if (m->roughness != 0.0f)
+	{
+		m->flags |= MATERIAL_ROUGH;
+	}
+	if (m->specular.x != 0.0f || m->specular.y != 0.0f || m->specular.z != 0.0f)
+	{
+		m->flags |= MATERIAL_SPECULAR;
+	}
+	if (m->reflective.x != 0.0f || m->reflective.y != 0.0f || m->reflective.z != 0.0f)
+	{
+		m->flags |= MATERIAL_REFLECTIVE;
+	}
+	if (m->transmissive.x != 0.0f || m->transmissive.y != 0.0f || m->transmissive.z != 0.0f)
+	{
+		m->flags |= MATERIAL_TRANSMISSIVE;
+	}
+
+	switch (m->flags & (MATERIAL_ROUGH | MATERIAL_SPECULAR))
+	{
+	case 0:
+		m->shade = shade<false, false>;
+		break;
+	case MATERIAL_SPECULAR:
+		m->shade = shade<false, true>;
+		break;
+	case MATERIAL_ROUGH:
+		m->shade = shade<true, false>;
+		break;
+	default:
+		m->shade = shade<true, true>;
+		break;
+	}
+	m->shade_batch = batchShadingFor(m->flags);
+}
+
+Material * loadMaterial(json &object_material)
+{
+	Material * m = new Material;
+	setMaterial(m, object_material);
+
+	m->id = current_scene->listOfMaterials.size();
+	current_scene->listOfMaterials.push_back(m);
+	return m;
+}
+
+// fills m from the json, keeping its id so shapes and the g-buffer still refer to it
+void setMaterial(Material * m, json &object_material)
+{
+	if (object_material.find("ambient") != object_material.end())
+	{
+		std::vector<float> material_ambient_array = object_material["ambient"];
+		m->ambient = vector_to_vec3(material_ambient_array);
+	}
+	else
+	{
+		m->ambient = glm::vec3(0, 0, 0);
+	}
+
+	if (object_material.find("diffuse") != object_material.end())
+	{
+		std::vector<float> material_diffuse_array = object_material["diffuse"];
+		m->diffuse = vector_to_vec3(material_diffuse_array);
+	}
+	else
+	{
+		m->diffuse = glm::vec3(0, 0, 0);
+	}
+
+	if (object_material.find("specular") != object_material.end())
+	{
+		std::vector<float> material_specular_array = object_material["specular"];
+		m->specular = vector_to_vec3(material_specular_array);
+		m->shininess = object_material["shininess"];
+	}
+	else
+	{
+		m->specular = glm::vec3(0, 0, 0);
+		m->shininess = 0;
+	}
+
+	if (object_material.find("reflective") != object_material.end())
+	{
+		std::vector<float> material_reflective_array = object_material["reflective"];
+		m->reflective = vector_to_vec3(material_reflective_array);
+	}
+	else
+	{
+		m->reflective = glm::vec3(0, 0, 0);
+	}
+
+	if (object_material.find("transmissive") != object_material.end())
+	{
+		std::vector<float> material_transmissive_array = object_material["transmissive"];
+		m->transmissive = vector_to_vec3(material_transmissive_array);
+	}
+	else
+	{
+		m->transmissive = glm::vec3(0, 0, 0);
+	}
+
+	if (object_material.find("refraction") != object_material.end())
+	{
+		m->refraction = object_material["refraction"];
+	}
+	else
+	{
+		m->refraction = refractionOfAir;
+	}
+
+	if (object_material.find("roughness") != object_material.end())
+	{
+		m->roughness = object_material["roughness"];
+	}
+	else
+	{
+		m->roughness = 0;
+	}
+
+	compileMaterial(m);
+}
+
+// csg objects show the average of their two spheres where both are hit
+Material * averageMaterial(const Material * a, const Material * b)
 {
-	glm::vec3 material_ambient_ForHitPoint = glm::vec3(0, 0, 0);
-	glm::vec3 material_diffuse_ForHitPoint = glm::vec3(0, 0, 0);
-	glm::vec3 material_specular_ForHitPoint = glm::vec3(0, 0, 0);
-	float material_shininess_ForHitPoint = 0;
-	float material_roughness_ForHitPoint = 0;
-	glm::vec3 material_reflective_ForHitPoint = glm::vec3(0, 0, 0);
-	glm::vec3 material_transmissive_ForHitPoint = glm::vec3(0, 0, 0);
-	float material_refraction_ForHitPoint = refractionOfAir;
+	Material * m = new Material;
+	setAverageMaterial(m, a, b);
+
+	m->id = current_scene->listOfMaterials.size();
+	current_scene->listOfMaterials.push_back(m);
+	return m;
+}
+
+void setAverageMaterial(Material * m, const Material * a, const Material * b)
+{
+	m->ambient = (a->ambient + b->ambient) / 2.0f;
+	m->diffuse = (a->diffuse + b->diffuse) / 2.0f;
+	m->specular = (a->specular + b->specular) / 2.0f;
+	m->roughness = (a->roughness + b->roughness) / 2.0f;
+	m->shininess = (a->shininess + b->shininess) / 2.0f;
+	m->reflective = (a->reflective + b->reflective) / 2.0f;
+	m->transmissive = (a->transmissive + b->transmissive) / 2.0f;
+	m->refraction = (a->refraction + b->refraction) / 2.0f;
+
+	compileMaterial(m);
+}
+
+void mirrorReflection(const point3 &e, const point3 &s, colour3 &colour, int depth,
+					  const Material &m, const glm::vec3 &material_reflective,
+					  const glm::vec3 &N, glm::vec3 lastPoint)
+{
+	Material * material_ForHitPoint = NULL;
 	glm::vec3 intersection_ForHitPoint = glm::vec3(0, 0, 0);
 	glm::vec3 N_ForHitPoint = glm::vec3(0, 0, 0);
 	glm::vec3 c = glm::vec3(0, 0, 0);
 	int type = -1;
 	float radius = -1;
 
-	std::vector<shape *> objects_to_for_hit_testing_five;
-	ray_box_intersection(e, s, ocTree_root, objects_to_for_hit_testing_five, false);
-	bool isHit = hitTesting(e, s,
-						    material_ambient_ForHitPoint, material_diffuse_ForHitPoint, material_specular_ForHitPoint,
-						    material_shininess_ForHitPoint, material_reflective_ForHitPoint, material_transmissive_ForHitPoint, material_refraction_ForHitPoint, material_roughness_ForHitPoint,
-						    intersection_ForHitPoint, N_ForHitPoint, c, type, radius, objects_to_for_hit_testing_five);
+	bool isHit = closestHit(e, s, material_ForHitPoint,
+						    intersection_ForHitPoint, N_ForHitPoint, c, type, radius);
 
 	glm::vec3 V_ForHitPoint = normalize(e - intersection_ForHitPoint);
 	glm::vec3 RforMirror_ForHitPoint = normalize(2 * glm::max(dot(N_ForHitPoint, V_ForHitPoint), 0.0f) * N_ForHitPoint - V_ForHitPoint);
 
-	if ( depth > 0 && isHit && (material_reflective_ForHitPoint.x != 0.0f || material_reflective_ForHitPoint.y != 0.0f || material_reflective_ForHitPoint.z != 0.0f) )
+	if ( depth > 0 && isHit && (material_ForHitPoint->flags & MATERIAL_REFLECTIVE) )
 	{
 		mirrorReflection(intersection_ForHitPoint, RforMirror_ForHitPoint + intersection_ForHitPoint, colour, depth - 1,
-						 material_ambient_ForHitPoint, material_diffuse_ForHitPoint, material_specular_ForHitPoint,
-						 material_shininess_ForHitPoint, material_reflective_ForHitPoint, material_transmissive_ForHitPoint, material_refraction_ForHitPoint, material_roughness_ForHitPoint,
+						 *material_ForHitPoint, material_ForHitPoint->reflective,
 						 N_ForHitPoint, e);
 	}
 
@@ -1223,16 +1604,13 @@ void mirrorReflection(point3 &e, point3 &s, colour3 &colour, int depth,
 	if (isHit)
 	{
 		glm::vec3 colourForHitPoint = colour;
-		getColor(colourForHitPoint,
-			material_ambient_ForHitPoint, material_diffuse_ForHitPoint, material_specular_ForHitPoint,
-			material_shininess_ForHitPoint, material_reflective_ForHitPoint, material_transmissive_ForHitPoint, material_refraction_ForHitPoint, material_roughness_ForHitPoint,
-			intersection_ForHitPoint, N_ForHitPoint, V_ForHitPoint);
+		getColor(colourForHitPoint, *material_ForHitPoint, intersection_ForHitPoint, N_ForHitPoint, V_ForHitPoint);
 
 		glm::vec3 LforMirror = normalize(intersection_ForHitPoint - e);
 		glm::vec3 HforMirror = normalize(LforMirror + normalize(lastPoint - e));
 
-		colour_diffuse_Mirror = material_reflective * colourForHitPoint * material_diffuse * glm::max(dot(N, LforMirror), 0.0f);
-		colour_specular_Mirror = material_reflective * colourForHitPoint * material_specular * pow(glm::max(dot(N, HforMirror), 0.0f), material_shininess);
+		colour_diffuse_Mirror = material_reflective * colourForHitPoint * m.diffuse * glm::max(dot(N, LforMirror), 0.0f);
+		colour_specular_Mirror = material_reflective * colourForHitPoint * m.specular * glm::pow(glm::max(dot(N, HforMirror), 0.0f), m.shininess);
 
 		if (dot(LforMirror, N) < 0.0)
 		{
@@ -1241,698 +1619,645 @@ void mirrorReflection(point3 &e, point3 &s, colour3 &colour, int depth,
 	}
 
 	glm::vec3 colourForThis = glm::vec3(0, 0, 0);
-	getColor(colourForThis,
-			material_ambient, material_diffuse, material_specular,
-			material_shininess, material_reflective, material_transmissive, material_refraction, material_roughness,
-			e, N, normalize(lastPoint - e) );
+	getColor(colourForThis, m, e, N, normalize(lastPoint - e));
 
 	colour = colourForThis + colour_diffuse_Mirror + colour_specular_Mirror;
 }
 
 void getBoundingAndShapeList ()
 {
-	bounding.push_back(0); // left
-	bounding.push_back(0); // right
-	bounding.push_back(0); // down
-	bounding.push_back(0); // up
-	bounding.push_back(0); // back
-	bounding.push_back(-10000); // front
+	trace_scope scope("getBoundingAndShapeList");
+	loadShapes();
+	buildAccelerationStructures();
+}
+
+// turns the objects of the scene into shapes and planes and finds the bounding box around them
+void loadShapes()
+{
+	trace_scope scope("load shapes");
 
-	json &objects = scene["objects"];
+	current_scene->bounding.push_back(0); // left
+	current_scene->bounding.push_back(0); // right
+	current_scene->bounding.push_back(0); // down
+	current_scene->bounding.push_back(0); // up
+	current_scene->bounding.push_back(0); // back
+	current_scene->bounding.push_back(-10000); // front
+
+	json &objects = current_scene->scene["objects"];
 
 	for (json::iterator it = objects.begin(); it != objects.end(); ++it)
 	{
 		json &object = *it;
 
-		float this_left = 0;
-		float this_right = 0;
-		float this_down = 0;
-		float this_up = 0;
-		float this_back = 0;
-		float this_front = 0;
-
-		json &material = object["material"];
-
-		bool isTransformation = false;
-		float rotation;
-		int axisOfrotation;
-		float scale_x;
-		float scale_y;
-		float scale_z;
-		float translation_x;
-		float translation_y;
-		float translation_z;
-
-		if (object.find("transformation") != object.end())
-		{
-			isTransformation = true;
-			json &transformation = object["transformation"];
-
-			rotation = transformation["rotation"];
-			axisOfrotation = transformation["axisOfrotation"];
-
-			std::vector<float> scale = transformation["scale"];
-			scale_x = scale.at(0);
-			scale_y = scale.at(1);
-			scale_z = scale.at(2);
-
-			std::vector<float> translation = transformation["translation"];
-			translation_x = translation.at(0);
-			translation_y = translation.at(1);
-			translation_z = translation.at(2);
-		}
-
-		shape * newShape = new shape;
-		bool isNewShape = true;
-
-		if (object["type"] == "sphere")
-		{
-			std::vector<float> pos = object["position"];
-			float radius = object["radius"];
-
-			this_left = pos[0] - radius;
-			this_right = pos[0] + radius;
-			this_down = pos[1] - radius;
-			this_up = pos[1] + radius;
-			this_back = pos[2] - radius;
-			this_front = pos[2] + radius;
-
-			newShape->type = "sphere";
-			newShape->position.x = pos[0];
-			newShape->position.y = pos[1];
-			newShape->position.z = pos[2];
-			newShape->radius = radius;
-			newShape->half_height = -1;
-
-			newShape->bounding.push_back(newShape->position.x - radius);
-			newShape->bounding.push_back(newShape->position.x + radius);
-			newShape->bounding.push_back(newShape->position.y - radius);
-			newShape->bounding.push_back(newShape->position.y + radius);
-			newShape->bounding.push_back(newShape->position.z - radius);
-			newShape->bounding.push_back(newShape->position.z + radius);
-		}// if
-		else if (object["type"] == "plane")
-		{
-			isNewShape = false;
-			shape * newPlane = new shape;
-			std::vector<float> pos = object["position"];
-			std::vector<float> normal = object["normal"];
-
-			newPlane->type = "plane";
-			newPlane->position.x = pos[0];
-			newPlane->position.y = pos[1];
-			newPlane->position.z = pos[2];
-			newPlane->normal.x = normal[0];
-			newPlane->normal.y = normal[1];
-			newPlane->normal.z = normal[2];
-
-			if (material.find("ambient") != material.end())
-			{
-				std::vector<float> material_ambient_array = material["ambient"];
-				newPlane->material_ambient = vector_to_vec3(material_ambient_array);
-			}
-			else
-			{
-				newPlane->material_ambient = glm::vec3(0, 0, 0);
-			}
-
-			if (material.find("diffuse") != material.end())
-			{
-				std::vector<float> material_diffuse_array = material["diffuse"];
-				newPlane->material_diffuse = vector_to_vec3(material_diffuse_array);
-			}
-			else
-			{
-				newPlane->material_diffuse = glm::vec3(0, 0, 0);
-			}
-
-			if (material.find("specular") != material.end())
-			{
-				std::vector<float> material_specular_array = material["specular"];
-				newPlane->material_specular = vector_to_vec3(material_specular_array);
-				newPlane->material_shininess = material["shininess"];
-			}
-			else
-			{
-				newPlane->material_specular = glm::vec3(0, 0, 0);
-				newPlane->material_shininess = 0;
-			}
-
-			if (material.find("reflective") != material.end())
-			{
-				std::vector<float> material_reflective_array = material["reflective"];
-				newPlane->material_reflective = vector_to_vec3(material_reflective_array);
-			}
-			else
-			{
-				newPlane->material_reflective = glm::vec3(0, 0, 0);
-			}
-
-			if (material.find("transmissive") != material.end())
-			{
-				std::vector<float> material_transmissive_array = material["transmissive"];
-				newPlane->material_transmissive = vector_to_vec3(material_transmissive_array);
-			}
-			else
-			{
-				newPlane->material_transmissive = glm::vec3(0, 0, 0);
-			}
+		int first_shape = current_scene->listOfShapes.size();
+		int first_plane = current_scene->listOfPlanes.size();
 
-			if (material.find("refraction") != material.end())
-			{
-				newPlane->material_refraction = material["refraction"];
-			}
-			else
-			{
-				newPlane->material_refraction = refractionOfAir;
-			}
-
-			if (material.find("roughness") != material.end())
-			{
-				newPlane->material_roughness = material["roughness"];
-			}
-			else
-			{
-				newPlane->material_roughness = 0;
-			}
+		scene_object loaded;
+		loadObject(object, loaded);
+		current_scene->listOfShapes.insert(current_scene->listOfShapes.end(), loaded.shapes.begin(), loaded.shapes.end());
+		current_scene->listOfPlanes.insert(current_scene->listOfPlanes.end(), loaded.planes.begin(), loaded.planes.end());
 
-			listOfPlanes.push_back(newPlane);
-		}//else if
-		else if (object["type"] == "mesh")
+		if (loaded.bounding.size() != 0)
 		{
-			isNewShape = false;
-			json &triangles = object["triangles"];
-			glm::vec4 bary_center;
-			int number = 0;
-			float sum_of_x = 0;
-			float sum_of_y = 0;
-			float sum_of_z = 0;
-
-			for (json::iterator it2 = triangles.begin(); it2 != triangles.end(); ++it2)
-			{
-				json &triangle = *it2;
-
-				std::vector<float> vertex0 = triangle[0];
-				std::vector<float> vertex1 = triangle[1];
-				std::vector<float> vertex2 = triangle[2];
-
-				sum_of_x += vertex0.at(0) + vertex1.at(0) + vertex2.at(0);
-				sum_of_y += vertex0.at(1) + vertex1.at(1) + vertex2.at(1);
-				sum_of_z += vertex0.at(2) + vertex1.at(2) + vertex2.at(2);
-				number += 3;
-			}
-
-			bary_center.x = sum_of_x / number;
-			bary_center.y = sum_of_y / number; 
-			bary_center.z = sum_of_z / number;
-			bary_center.w = 0.0f;
-			std::cout << bary_center.x << " " << bary_center.y << " " << bary_center.z << std::endl;
-
-			for (json::iterator it2 = triangles.begin(); it2 != triangles.end(); ++it2)
-			{
-				json &triangle = *it2;
-				shape * newShape2 = new shape;
-				newShape2->type = "triangle";
-
-				std::vector<float> vertex0 = triangle[0];
-				newShape2->vertex0 = glm::vec4(vector_to_vec3(vertex0), 0.0f);
+			current_scene->bounding.at(0) = glm::min(current_scene->bounding.at(0), loaded.bounding.at(0));
+			current_scene->bounding.at(1) = glm::max(current_scene->bounding.at(1), loaded.bounding.at(1));
+			current_scene->bounding.at(2) = glm::min(current_scene->bounding.at(2), loaded.bounding.at(2));
+			current_scene->bounding.at(3) = glm::max(current_scene->bounding.at(3), loaded.bounding.at(3));
+			current_scene->bounding.at(4) = glm::min(current_scene->bounding.at(4), loaded.bounding.at(4));
+			current_scene->bounding.at(5) = glm::max(current_scene->bounding.at(5), loaded.bounding.at(5));
+		}
 
-				std::vector<float> vertex1 = triangle[1];
-				newShape2->vertex1 = glm::vec4(vector_to_vec3(vertex1), 0.0f);
+		if (object.find("keyframes") != object.end())
+		{
+			registerAnimatedObject(object, first_shape, first_plane);
+		}
+		current_scene->listOfObjects.push_back(loaded);
+	}//for
 
-				std::vector<float> vertex2 = triangle[2];
-				newShape2->vertex2 = glm::vec4(vector_to_vec3(vertex2), 0.0f);
+	std::cout << "Bounding: " << current_scene->bounding.at(0) << " " << current_scene->bounding.at(1) << " " << current_scene->bounding.at(2) << " " << current_scene->bounding.at(3) << " " << current_scene->bounding.at(4) << " " << current_scene->bounding.at(5) << std::endl;
+}
 
-				// transformation
-				if (isTransformation)
-				{
-					glm::vec3 axis(0.0f, 0.0f, 0.0f);
+void deleteObject(scene_object &object)
+{
+	for (int i = 0; i < object.shapes.size(); i++)
+	{
+		shape * s = object.shapes.at(i);
+		if (s->type == "intersection" || s->type == "union" || s->type == "difference")
+		{
+			delete s->sub_shape1;
+			delete s->sub_shape2;
+		}
+		delete s;
+	}
+	for (int i = 0; i < object.planes.size(); i++)
+	{
+		delete object.planes.at(i);
+	}
+	for (int i = 0; i < object.materials.size(); i++)
+	{
+		delete object.materials.at(i);
+	}
+	object.shapes.clear();
+	object.planes.clear();
+	object.materials.clear();
+}
 
-					if (axisOfrotation == 1)
-					{
-						axis.x = 1.0f;
-					}
-					else if (axisOfrotation == 2)
-					{
-						axis.y = 1.0f;
-					}
-					else
-					{
-						axis.z = 1.0f;
-					}
+// everything loadShapes() and buildOcTree() made, so that they can run again
+void clearShapes()
+{
+	current_scene->compact.ready = false;
+	current_scene->bvh.ready = false;
+	if (current_scene->ocTree_root != NULL)
+	{
+		deleteOcTree(current_scene->ocTree_root);
+	}
+	current_scene->ocTree_root = NULL;
 
-					newShape2->vertex0 = newShape2->vertex0 - bary_center;
-					newShape2->vertex1 = newShape2->vertex1 - bary_center;
-					newShape2->vertex2 = newShape2->vertex2 - bary_center;
+	for (int i = 0; i < current_scene->listOfObjects.size(); i++)
+	{
+		deleteObject(current_scene->listOfObjects.at(i));
+	}
+	current_scene->listOfObjects.clear();
+	current_scene->listOfShapes.clear();
+	current_scene->listOfPlanes.clear();
+	current_scene->listOfMaterials.clear();
+	current_scene->bounding.clear();
+}
 
-					newShape2->vertex0 = glm::scale(glm::mat4(), glm::vec3(scale_x, scale_y, scale_z)) * glm::rotate(glm::mat4(), glm::radians(rotation), axis) * newShape2->vertex0;
-					newShape2->vertex0 = newShape2->vertex0 + bary_center + glm::vec4(translation_x, translation_y, translation_z, 0.0);;
+// the shapes, planes and materials of one entry of the "objects" of the scene file
+void loadObject(json &object, scene_object &loaded)
+{
+	int first_material = current_scene->listOfMaterials.size();
+
+	float this_left = 0;
+	float this_right = 0;
+	float this_down = 0;
+	float this_up = 0;
+	float this_back = 0;
+	float this_front = 0;
+
+	// read without adding a "material" to objects that have none, the json stays as it was in the file
+	json material = object.find("material") != object.end() ? object["material"] : json::object();
+
+	bool isTransformation = false;
+	float rotation;
+	int axisOfrotation;
+	float scale_x;
+	float scale_y;
+	float scale_z;
+	float translation_x;
+	float translation_y;
+	float translation_z;
+
+	if (object.find("transformation") != object.end())
+	{
+		isTransformation = true;
+		json &transformation = object["transformation"];
 
-					newShape2->vertex1 = glm::scale(glm::mat4(), glm::vec3(scale_x, scale_y, scale_z)) * glm::rotate(glm::mat4(), glm::radians(rotation), axis) * newShape2->vertex1;
-					newShape2->vertex1 = newShape2->vertex1 + bary_center + glm::vec4(translation_x, translation_y, translation_z, 0.0);;
+		rotation = transformation["rotation"];
+		axisOfrotation = transformation["axisOfrotation"];
 
-					newShape2->vertex2 = glm::scale(glm::mat4(), glm::vec3(scale_x, scale_y, scale_z)) * glm::rotate(glm::mat4(), glm::radians(rotation), axis) * newShape2->vertex2;
-					newShape2->vertex2 = newShape2->vertex2 + bary_center + glm::vec4(translation_x, translation_y, translation_z, 0.0);
-				}
+		std::vector<float> scale = transformation["scale"];
+		scale_x = scale.at(0);
+		scale_y = scale.at(1);
+		scale_z = scale.at(2);
 
-				float triangle_left = glm::min(glm::min(newShape2->vertex0.x, newShape2->vertex1.x), newShape2->vertex2.x);
-				float triangle_right = glm::max(glm::max(newShape2->vertex0.x, newShape2->vertex1.x), newShape2->vertex2.x);
+		std::vector<float> translation = transformation["translation"];
+		translation_x = translation.at(0);
+		translation_y = translation.at(1);
+		translation_z = translation.at(2);
+	}
 
-				float triangle_down = glm::min(glm::min(newShape2->vertex0.y, newShape2->vertex1.y), newShape2->vertex2.y);
-				float triangle_up = glm::max(glm::max(newShape2->vertex0.y, newShape2->vertex1.y), newShape2->vertex2.y);
+	shape * newShape = new shape;
+	bool isNewShape = true;
 
-				float triangle_back = glm::min(glm::min(newShape2->vertex0.z, newShape2->vertex1.z), newShape2->vertex2.z);
-				float triangle_front = glm::max(glm::max(newShape2->vertex0.z, newShape2->vertex1.z), newShape2->vertex2.z);
+	if (object["type"] == "sphere")
+	{
+		std::vector<float> pos = object["position"];
+		float radius = object["radius"];
+
+		this_left = pos[0] - radius;
+		this_right = pos[0] + radius;
+		this_down = pos[1] - radius;
+		this_up = pos[1] + radius;
+		this_back = pos[2] - radius;
+		this_front = pos[2] + radius;
+
+		newShape->type = "sphere";
+		newShape->position.x = pos[0];
+		newShape->position.y = pos[1];
+		newShape->position.z = pos[2];
+		newShape->radius = radius;
+		newShape->half_height = -1;
+
+		newShape->bounding.push_back(newShape->position.x - radius);
+		newShape->bounding.push_back(newShape->position.x + radius);
+		newShape->bounding.push_back(newShape->position.y - radius);
+		newShape->bounding.push_back(newShape->position.y + radius);
+		newShape->bounding.push_back(newShape->position.z - radius);
+		newShape->bounding.push_back(newShape->position.z + radius);
+	}// if
+	else if (object["type"] == "plane")
+	{
+		isNewShape = false;
+		shape * newPlane = new shape;
+		std::vector<float> pos = object["position"];
+		std::vector<float> normal = object["normal"];
+
+		newPlane->type = "plane";
+		newPlane->position.x = pos[0];
+		newPlane->position.y = pos[1];
+		newPlane->position.z = pos[2];
+		newPlane->normal.x = normal[0];
+		newPlane->normal.y = normal[1];
+		newPlane->normal.z = normal[2];
+
+		newPlane->mat = loadMaterial(material);
+
+		loaded.planes.push_back(newPlane);
+	}//else if
+	else if (object["type"] == "mesh")
+	{
+		isNewShape = false;
+		json &triangles = object["triangles"];
+		Material * mesh_material = loadMaterial(material);
+		glm::vec4 bary_center(0.0f, 0.0f, 0.0f, 0.0f);
+		int number = 0;
+		float sum_of_x = 0;
+		float sum_of_y = 0;
+		float sum_of_z = 0;
+
+		for (json::iterator it2 = triangles.begin(); it2 != triangles.end(); ++it2)
+		{
+			json &triangle = *it2;
 
-				if (triangle_left < this_left)
-				{
-					this_left = triangle_left;
-				}
-				if (triangle_right > this_right)
-				{
-					this_right = triangle_right;
-				}
-				if (triangle_down < this_down)
-				{
-					this_down = triangle_down;
-				}
-				if (triangle_up > this_up)
-				{
-					this_up = triangle_up;
-				}
-				if (triangle_back < this_back)
-				{
-					this_back = triangle_back;
-				}
-				if (triangle_front > this_front)
-				{
-					this_front = triangle_front;
-				}
+			std::vector<float> vertex0 = triangle[0];
+			std::vector<float> vertex1 = triangle[1];
+			std::vector<float> vertex2 = triangle[2];
 
-				newShape2->bounding.push_back(triangle_left);
-				newShape2->bounding.push_back(triangle_right);
-				newShape2->bounding.push_back(triangle_down);
-				newShape2->bounding.push_back(triangle_up);
-				newShape2->bounding.push_back(triangle_back);
-				newShape2->bounding.push_back(triangle_front);
+			sum_of_x += vertex0.at(0) + vertex1.at(0) + vertex2.at(0);
+			sum_of_y += vertex0.at(1) + vertex1.at(1) + vertex2.at(1);
+			sum_of_z += vertex0.at(2) + vertex1.at(2) + vertex2.at(2);
+			number += 3;
+		}
 
-				if (material.find("ambient") != material.end())
-				{
-					std::vector<float> material_ambient_array = material["ambient"];
-					newShape2->material_ambient = vector_to_vec3(material_ambient_array);
-				}
-				else
-				{
-					newShape2->material_ambient = glm::vec3(0, 0, 0);
-				}
+		// a mesh whose triangles were paged out has none left here
+		if (number != 0)
+		{
+			bary_center.x = sum_of_x / number;
+			bary_center.y = sum_of_y / number;
+			bary_center.z = sum_of_z / number;
+		}
 
-				if (material.find("diffuse") != material.end())
-				{
-					std::vector<float> material_diffuse_array = material["diffuse"];
-					newShape2->material_diffuse = vector_to_vec3(material_diffuse_array);
-				}
-				else
-				{
-					newShape2->material_diffuse = glm::vec3(0, 0, 0);
-				}
+		for (json::iterator it2 = triangles.begin(); it2 != triangles.end(); ++it2)
+		{
+			json &triangle = *it2;
+			shape * newShape2 = new shape;
+			newShape2->type = "triangle";
 
-				if (material.find("specular") != material.end())
-				{
-					std::vector<float> material_specular_array = material["specular"];
-					newShape2->material_specular = vector_to_vec3(material_specular_array);
-					newShape2->material_shininess = material["shininess"];
-				}
-				else
-				{
-					newShape2->material_specular = glm::vec3(0, 0, 0);
-					newShape2->material_shininess = 0;
-				}
+			std::vector<float> vertex0 = triangle[0];
+			newShape2->vertex0 = glm::vec4(vector_to_vec3(vertex0), 0.0f);
 
-				if (material.find("reflective") != material.end())
-				{
-					std::vector<float> material_reflective_array = material["reflective"];
-					newShape2->material_reflective = vector_to_vec3(material_reflective_array);
-				}
-				else
-				{
-					newShape2->material_reflective = glm::vec3(0, 0, 0);
-				}
+			std::vector<float> vertex1 = triangle[1];
+			newShape2->vertex1 = glm::vec4(vector_to_vec3(vertex1), 0.0f);
 
-				if (material.find("transmissive") != material.end())
-				{
-					std::vector<float> material_transmissive_array = material["transmissive"];
-					newShape2->material_transmissive = vector_to_vec3(material_transmissive_array);
-				}
-				else
-				{
-					newShape2->material_transmissive = glm::vec3(0, 0, 0);
-				}
+			std::vector<float> vertex2 = triangle[2];
+			newShape2->vertex2 = glm::vec4(vector_to_vec3(vertex2), 0.0f);
 
-				if (material.find("refraction") != material.end())
-				{
-					newShape2->material_refraction = material["refraction"];
-				}
-				else
+			// transformation
+			if (isTransformation)
+			{
+				glm::vec3 axis(0.0f, 0.0f, 0.0f);
+
+				if (axisOfrotation == 1)
 				{
-					newShape2->material_refraction = refractionOfAir;
+					axis.x = 1.0f;
 				}
-
-				if (material.find("roughness") != material.end())
+				else if (axisOfrotation == 2)
 				{
-					newShape2->material_roughness = material["roughness"];
+					axis.y = 1.0f;
 				}
 				else
 				{
-					newShape2->material_roughness = 0;
+					axis.z = 1.0f;
 				}
 
-				listOfShapes.push_back(newShape2);
-			}
-		}
-		else if (object["type"] == "intersection" || object["type"] == "union" || object["type"] == "difference")
-		{
-			isNewShape = false;
+				newShape2->vertex0 = newShape2->vertex0 - bary_center;
+				newShape2->vertex1 = newShape2->vertex1 - bary_center;
+				newShape2->vertex2 = newShape2->vertex2 - bary_center;
 
-			json & sub_objects = object["objects"];
+				newShape2->vertex0 = glm::scale(glm::mat4(), glm::vec3(scale_x, scale_y, scale_z)) * glm::rotate(glm::mat4(), glm::radians(rotation), axis) * newShape2->vertex0;
+				newShape2->vertex0 = newShape2->vertex0 + bary_center + glm::vec4(translation_x, translation_y, translation_z, 0.0);;
 
-			json & sub_object1 = sub_objects[0];
-			json & sub_object2 = sub_objects[1];
+				newShape2->vertex1 = glm::scale(glm::mat4(), glm::vec3(scale_x, scale_y, scale_z)) * glm::rotate(glm::mat4(), glm::radians(rotation), axis) * newShape2->vertex1;
+				newShape2->vertex1 = newShape2->vertex1 + bary_center + glm::vec4(translation_x, translation_y, translation_z, 0.0);;
 
-			shape * sub_shape1 = new shape;
-			shape * sub_shape2 = new shape;
+				newShape2->vertex2 = glm::scale(glm::mat4(), glm::vec3(scale_x, scale_y, scale_z)) * glm::rotate(glm::mat4(), glm::radians(rotation), axis) * newShape2->vertex2;
+				newShape2->vertex2 = newShape2->vertex2 + bary_center + glm::vec4(translation_x, translation_y, translation_z, 0.0);
+			}
 
-			// sub_shape1
-			std::vector<float> pos = sub_object1["position"];
-			sub_shape1->radius = sub_object1["radius"];
-			sub_shape1->position.x = pos.at(0);
-			sub_shape1->position.y = pos.at(1);
-			sub_shape1->position.z = pos.at(2);
+			float triangle_left = glm::min(glm::min(newShape2->vertex0.x, newShape2->vertex1.x), newShape2->vertex2.x);
+			float triangle_right = glm::max(glm::max(newShape2->vertex0.x, newShape2->vertex1.x), newShape2->vertex2.x);
 
-			json &material_for_sub_shape1 = sub_object1["material"];
+			float triangle_down = glm::min(glm::min(newShape2->vertex0.y, newShape2->vertex1.y), newShape2->vertex2.y);
+			float triangle_up = glm::max(glm::max(newShape2->vertex0.y, newShape2->vertex1.y), newShape2->vertex2.y);
 
-			if (material_for_sub_shape1.find("ambient") != material_for_sub_shape1.end())
-			{
-				std::vector<float> material_ambient_array = material_for_sub_shape1["ambient"];
-				sub_shape1->material_ambient = vector_to_vec3(material_ambient_array);
-			}
-			else
-			{
-				sub_shape1->material_ambient = glm::vec3(0, 0, 0);
-			}
+			float triangle_back = glm::min(glm::min(newShape2->vertex0.z, newShape2->vertex1.z), newShape2->vertex2.z);
+			float triangle_front = glm::max(glm::max(newShape2->vertex0.z, newShape2->vertex1.z), newShape2->vertex2.z);
 
-			if (material_for_sub_shape1.find("diffuse") != material_for_sub_shape1.end())
+			if (triangle_left < this_left)
 			{
-				std::vector<float> material_diffuse_array = material_for_sub_shape1["diffuse"];
-				sub_shape1->material_diffuse = vector_to_vec3(material_diffuse_array);
+				this_left = triangle_left;
 			}
-			else
+			if (triangle_right > this_right)
 			{
-				sub_shape1->material_diffuse = glm::vec3(0, 0, 0);
+				this_right = triangle_right;
 			}
-
-			if (material_for_sub_shape1.find("specular") != material_for_sub_shape1.end())
+			if (triangle_down < this_down)
 			{
-				std::vector<float> material_specular_array = material_for_sub_shape1["specular"];
-				sub_shape1->material_specular = vector_to_vec3(material_specular_array);
-				sub_shape1->material_shininess = material_for_sub_shape1["shininess"];
+				this_down = triangle_down;
 			}
-			else
+			if (triangle_up > this_up)
 			{
-				sub_shape1->material_specular = glm::vec3(0, 0, 0);
-				sub_shape1->material_shininess = 0;
+				this_up = triangle_up;
 			}
-
-			if (material_for_sub_shape1.find("reflective") != material_for_sub_shape1.end())
+			if (triangle_back < this_back)
 			{
-				std::vector<float> material_reflective_array = material_for_sub_shape1["reflective"];
-				sub_shape1->material_reflective = vector_to_vec3(material_reflective_array);
+				this_back = triangle_back;
 			}
-			else
+			if (triangle_front > this_front)
 			{
-				sub_shape1->material_reflective = glm::vec3(0, 0, 0);
+				this_front = triangle_front;
 			}
 
-			if (material_for_sub_shape1.find("transmissive") != material_for_sub_shape1.end())
-			{
-				std::vector<float> material_transmissive_array = material_for_sub_shape1["transmissive"];
-				sub_shape1->material_transmissive = vector_to_vec3(material_transmissive_array);
-			}
-			else
-			{
-				sub_shape1->material_transmissive = glm::vec3(0, 0, 0);
-			}
+			newShape2->bounding.push_back(triangle_left);
+			newShape2->bounding.push_back(triangle_right);
+			newShape2->bounding.push_back(triangle_down);
+			newShape2->bounding.push_back(triangle_up);
+			newShape2->bounding.push_back(triangle_back);
+			newShape2->bounding.push_back(triangle_front);
 
-			if (material_for_sub_shape1.find("refraction") != material_for_sub_shape1.end())
-			{
-				sub_shape1->material_refraction = material_for_sub_shape1["refraction"];
-			}
-			else
-			{
-				sub_shape1->material_refraction = refractionOfAir;
-			}
+			newShape2->mat = mesh_material;
 
-			if (material_for_sub_shape1.find("roughness") != material_for_sub_shape1.end())
-			{
-				sub_shape1->material_roughness = material_for_sub_shape1["roughness"];
-			}
-			else
-			{
-				sub_shape1->material_roughness = 0;
-			}
+			loaded.shapes.push_back(newShape2);
+		}
+	}
+	else if (object["type"] == "intersection" || object["type"] == "union" || object["type"] == "difference")
+	{
+		isNewShape = false;
 
-			// sub_shape2
-			std::vector<float> pos_sub_shape2 = sub_object2["position"];
-			sub_shape2->radius = sub_object2["radius"];
-			sub_shape2->position.x = pos_sub_shape2.at(0);
-			sub_shape2->position.y = pos_sub_shape2.at(1);
-			sub_shape2->position.z = pos_sub_shape2.at(2);
+		json & sub_objects = object["objects"];
 
-			json &material_for_sub_shape2 = sub_object2["material"];
+		json & sub_object1 = sub_objects[0];
+		json & sub_object2 = sub_objects[1];
 
-			if (material_for_sub_shape2.find("ambient") != material_for_sub_shape2.end())
-			{
-				std::vector<float> material_ambient_array = material_for_sub_shape2["ambient"];
-				sub_shape2->material_ambient = vector_to_vec3(material_ambient_array);
-			}
-			else
-			{
-				sub_shape2->material_ambient = glm::vec3(0, 0, 0);
-			}
+		shape * sub_shape1 = new shape;
+		shape * sub_shape2 = new shape;
 
-			if (material_for_sub_shape2.find("diffuse") != material_for_sub_shape2.end())
-			{
-				std::vector<float> material_diffuse_array = material_for_sub_shape2["diffuse"];
-				sub_shape2->material_diffuse = vector_to_vec3(material_diffuse_array);
-			}
-			else
-			{
-				sub_shape2->material_diffuse = glm::vec3(0, 0, 0);
-			}
+		// sub_shape1
+		std::vector<float> pos = sub_object1["position"];
+		sub_shape1->radius = sub_object1["radius"];
+		sub_shape1->position.x = pos.at(0);
+		sub_shape1->position.y = pos.at(1);
+		sub_shape1->position.z = pos.at(2);
 
-			if (material_for_sub_shape2.find("specular") != material_for_sub_shape2.end())
-			{
-				std::vector<float> material_specular_array = material_for_sub_shape2["specular"];
-				sub_shape2->material_specular = vector_to_vec3(material_specular_array);
-				sub_shape2->material_shininess = material_for_sub_shape2["shininess"];
-			}
-			else
-			{
-				sub_shape2->material_specular = glm::vec3(0, 0, 0);
-				sub_shape2->material_shininess = 0;
-			}
+		json &material_for_sub_shape1 = sub_object1["material"];
 
-			if (material_for_sub_shape2.find("reflective") != material_for_sub_shape2.end())
-			{
-				std::vector<float> material_reflective_array = material_for_sub_shape2["reflective"];
-				sub_shape2->material_reflective = vector_to_vec3(material_reflective_array);
-			}
-			else
-			{
-				sub_shape2->material_reflective = glm::vec3(0, 0, 0);
-			}
+		sub_shape1->mat = loadMaterial(material_for_sub_shape1);
 
-			if (material_for_sub_shape2.find("transmissive") != material_for_sub_shape2.end())
-			{
-				std::vector<float> material_transmissive_array = material_for_sub_shape2["transmissive"];
-				sub_shape2->material_transmissive = vector_to_vec3(material_transmissive_array);
-			}
-			else
-			{
-				sub_shape2->material_transmissive = glm::vec3(0, 0, 0);
-			}
+		// sub_shape2
+		std::vector<float> pos_sub_shape2 = sub_object2["position"];
+		sub_shape2->radius = sub_object2["radius"];
+		sub_shape2->position.x = pos_sub_shape2.at(0);
+		sub_shape2->position.y = pos_sub_shape2.at(1);
+		sub_shape2->position.z = pos_sub_shape2.at(2);
 
-			if (material_for_sub_shape2.find("refraction") != material_for_sub_shape2.end())
-			{
-				sub_shape2->material_refraction = material_for_sub_shape2["refraction"];
-			}
-			else
-			{
-				sub_shape2->material_refraction = refractionOfAir;
-			}
+		json &material_for_sub_shape2 = sub_object2["material"];
 
-			if (material_for_sub_shape2.find("roughness") != material_for_sub_shape2.end())
-			{
-				sub_shape2->material_roughness = material_for_sub_shape2["roughness"];
-			}
-			else
-			{
-				sub_shape2->material_roughness = 0;
-			}
-			shape * new_shape2 = new shape;
+		sub_shape2->mat = loadMaterial(material_for_sub_shape2);
+		shape * new_shape2 = new shape;
 
-			if (object["type"] == "intersection")
-			{
-				new_shape2->type = "intersection";
-			}
-			else if(object["type"] == "union")
-			{
-				new_shape2->type = "union";
-			}
-			else if (object["type"] == "difference")
-			{
-				new_shape2->type = "difference";
-			}
-			new_shape2->sub_shape1 = sub_shape1;
-			new_shape2->sub_shape2 = sub_shape2;
+		if (object["type"] == "intersection")
+		{
+			new_shape2->type = "intersection";
+		}
+		else if(object["type"] == "union")
+		{
+			new_shape2->type = "union";
+		}
+		else if (object["type"] == "difference")
+		{
+			new_shape2->type = "difference";
+		}
+		new_shape2->sub_shape1 = sub_shape1;
+		new_shape2->sub_shape2 = sub_shape2;
+		new_shape2->mat = averageMaterial(sub_shape1->mat, sub_shape2->mat);
+
+		this_left = glm::min(sub_shape1->position.x - sub_shape1->radius, sub_shape2->position.x - sub_shape2->radius);
+		this_right = glm::max(sub_shape1->position.x + sub_shape1->radius, sub_shape2->position.x + sub_shape2->radius);
+		this_down = glm::min(sub_shape1->position.y - sub_shape1->radius, sub_shape2->position.y - sub_shape2->radius);
+		this_up = glm::max(sub_shape1->position.y + sub_shape1->radius, sub_shape2->position.y + sub_shape2->radius);
+		this_back = glm::min(sub_shape1->position.z - sub_shape1->radius, sub_shape2->position.z - sub_shape2->radius);
+		this_front = glm::max(sub_shape1->position.z + sub_shape1->radius, sub_shape2->position.z + sub_shape2->radius);
+
+		new_shape2->bounding.push_back(this_left);
+		new_shape2->bounding.push_back(this_right);
+		new_shape2->bounding.push_back(this_down);
+		new_shape2->bounding.push_back(this_up);
+		new_shape2->bounding.push_back(this_back);
+		new_shape2->bounding.push_back(this_front);
+
+		loaded.shapes.push_back(new_shape2);
+	}//else if
+
+	if (isNewShape)
+	{
+		newShape->mat = loadMaterial(material);
 
-			this_left = glm::min(sub_shape1->position.x - sub_shape1->radius, sub_shape2->position.x - sub_shape2->radius);
-			this_right = glm::max(sub_shape1->position.x + sub_shape1->radius, sub_shape2->position.x + sub_shape2->radius);
-			this_down = glm::min(sub_shape1->position.y - sub_shape1->radius, sub_shape2->position.y - sub_shape2->radius);
-			this_up = glm::max(sub_shape1->position.y + sub_shape1->radius, sub_shape2->position.y + sub_shape2->radius);
-			this_back = glm::min(sub_shape1->position.z - sub_shape1->radius, sub_shape2->position.z - sub_shape2->radius);
-			this_front = glm::max(sub_shape1->position.z + sub_shape1->radius, sub_shape2->position.z + sub_shape2->radius);
+		loaded.shapes.push_back(newShape);
+	}
+	else
+	{
+		delete newShape;
+	}
 
-			new_shape2->bounding.push_back(this_left);
-			new_shape2->bounding.push_back(this_right);
-			new_shape2->bounding.push_back(this_down);
-			new_shape2->bounding.push_back(this_up);
-			new_shape2->bounding.push_back(this_back);
-			new_shape2->bounding.push_back(this_front);
+	if (object["type"] == "sphere" || object["type"] == "mesh" || object["type"] == "intersection" || object["type"] == "union" || object["type"] == "difference")
+	{
+		loaded.bounding.push_back(this_left);
+		loaded.bounding.push_back(this_right);
+		loaded.bounding.push_back(this_down);
+		loaded.bounding.push_back(this_up);
+		loaded.bounding.push_back(this_back);
+		loaded.bounding.push_back(this_front);
+	}
+	loaded.materials.assign(current_scene->listOfMaterials.begin() + first_material, current_scene->listOfMaterials.end());
+}
 
-			listOfShapes.push_back(new_shape2);
-		}//else if
+void buildAccelerationStructures()
+{
+	trace_scope scope("build acceleration structures");
 
-		if (isNewShape)
-		{
-			if (material.find("ambient") != material.end())
-			{
-				std::vector<float> material_ambient_array = material["ambient"];
-				newShape->material_ambient = vector_to_vec3(material_ambient_array);
-			}
-			else
-			{
-				newShape->material_ambient = glm::vec3(0, 0, 0);
-			}
+	buildOcTree();
+	buildCompactOctree();
+	buildBVH();
+}
 
-			if (material.find("diffuse") != material.end())
-			{
-				std::vector<float> material_diffuse_array = material["diffuse"];
-				newShape->material_diffuse = vector_to_vec3(material_diffuse_array);
-			}
-			else
-			{
-				newShape->material_diffuse = glm::vec3(0, 0, 0);
-			}
+// a new Node tree over the shapes inside the bounding box of the scene
+void buildOcTree()
+{
+	trace_scope scope("build octree");
 
-			if (material.find("specular") != material.end())
-			{
-				std::vector<float> material_specular_array = material["specular"];
-				newShape->material_specular = vector_to_vec3(material_specular_array);
-				newShape->material_shininess = material["shininess"];
-			}
-			else
-			{
-				newShape->material_specular = glm::vec3(0, 0, 0);
-				newShape->material_shininess = 0;
-			}
+	current_scene->ocTree_root = new Node;
+	current_scene->ocTree_root->bounding = current_scene->bounding;
+	current_scene->ocTree_root->shapes_contained = current_scene->listOfShapes;
 
-			if (material.find("reflective") != material.end())
-			{
-				std::vector<float> material_reflective_array = material["reflective"];
-				newShape->material_reflective = vector_to_vec3(material_reflective_array);
-			}
-			else
-			{
-				newShape->material_reflective = glm::vec3(0, 0, 0);
-			}
+	partition(current_scene->ocTree_root, current_scene->listOfShapes, current_scene->bounding);
+}
 
-			if (material.find("transmissive") != material.end())
-			{
-				std::vector<float> material_transmissive_array = material["transmissive"];
-				newShape->material_transmissive = vector_to_vec3(material_transmissive_array);
-			}
-			else
-			{
-				newShape->material_transmissive = glm::vec3(0, 0, 0);
-			}
+void deleteOcTree(Node * node)
+{
+	for (int i = 0; i < node->children.size(); i++)
+	{
+		deleteOcTree(node->children.at(i));
+	}
+	delete node;
+}
 
-			if (material.find("refraction") != material.end())
-			{
-				newShape->material_refraction = material["refraction"];
-			}
-			else
-			{
-				newShape->material_refraction = refractionOfAir;
-			}
+// Puts a shape into the leaf whose box is nearest to it, refitOcTree() then grows the boxes on the way
+// to cover it. Like refitting, this is only good for a few shapes before the octree has to be built again.
+void insertIntoOcTree(Node * node, shape * object)
+{
+	if (node->children.size() == 0)
+	{
+		node->shapes_contained.push_back(object);
+		return;
+	}
 
-			if (material.find("roughness") != material.end())
-			{
-				newShape->material_roughness = material["roughness"];
-			}
-			else
-			{
-				newShape->material_roughness = 0;
-			}
+	const std::vector<float> &box = object->bounding;
+	glm::vec3 centre(box.at(0) + box.at(1), box.at(2) + box.at(3), box.at(4) + box.at(5));
 
-			listOfShapes.push_back(newShape);
+	Node * nearest = node->children.at(0);
+	float nearest_distance = -1;
+
+	for (int i = 0; i < node->children.size(); i++)
+	{
+		const std::vector<float> &child = node->children.at(i)->bounding;
+		glm::vec3 child_centre(child.at(0) + child.at(1), child.at(2) + child.at(3), child.at(4) + child.at(5));
+		float distance = glm::length(child_centre - centre);
+
+		if (nearest_distance < 0 || distance < nearest_distance)
+		{
+			nearest = node->children.at(i);
+			nearest_distance = distance;
 		}
+	}
+	insertIntoOcTree(nearest, object);
+}
+
+// takes the shapes out of every node that has them, removed has to be sorted
+void removeFromOcTree(Node * node, const std::vector<shape *> &removed)
+{
+	std::vector<shape *> &shapes = node->shapes_contained;
+	shapes.erase(std::remove_if(shapes.begin(), shapes.end(),
+		[&removed](shape * object) { return std::binary_search(removed.begin(), removed.end(), object); }), shapes.end());
+
+	for (int i = 0; i < node->children.size(); i++)
+	{
+		removeFromOcTree(node->children.at(i), removed);
+	}
+}
+
+void rebuildOcTree()
+{
+	trace_scope scope("rebuild octree");
+
+	// the flattened copy points into the old tree until it is built again
+	current_scene->compact.ready = false;
+	deleteOcTree(current_scene->ocTree_root);
+
+	current_scene->bounding.clear();
+	current_scene->bounding.push_back(0); // left
+	current_scene->bounding.push_back(0); // right
+	current_scene->bounding.push_back(0); // down
+	current_scene->bounding.push_back(0); // up
+	current_scene->bounding.push_back(0); // back
+	current_scene->bounding.push_back(-10000); // front
+
+	for (int i = 0; i < current_scene->listOfShapes.size(); i++)
+	{
+		std::vector<float> &this_bounding = current_scene->listOfShapes.at(i)->bounding;
+
+		current_scene->bounding.at(0) = glm::min(current_scene->bounding.at(0), this_bounding.at(0));
+		current_scene->bounding.at(1) = glm::max(current_scene->bounding.at(1), this_bounding.at(1));
+		current_scene->bounding.at(2) = glm::min(current_scene->bounding.at(2), this_bounding.at(2));
+		current_scene->bounding.at(3) = glm::max(current_scene->bounding.at(3), this_bounding.at(3));
+		current_scene->bounding.at(4) = glm::min(current_scene->bounding.at(4), this_bounding.at(4));
+		current_scene->bounding.at(5) = glm::max(current_scene->bounding.at(5), this_bounding.at(5));
+	}
+
+	current_scene->ocTree_root = new Node;
+	current_scene->ocTree_root->bounding = current_scene->bounding;
+	current_scene->ocTree_root->shapes_contained = current_scene->listOfShapes;
 
-		if (object["type"] == "sphere" || object["type"] == "mesh" || object["type"] == "intersection" || object["type"] == "union" || object["type"] == "difference")
+	partition(current_scene->ocTree_root, current_scene->listOfShapes, current_scene->bounding);
+}
+
+// Shrink or grow every box to exactly fit what is below it, leaves first. The node keeps its shapes
+// and children, so this is only valid while the shapes stay in the leaves they were partitioned into.
+void refitOcTree(Node * node)
+{
+	std::vector<float> box;
+
+	if (node->children.size() != 0)
+	{
+		for (int i = 0; i < node->children.size(); i++)
 		{
-			if (this_left < bounding.at(0))
-			{
-				bounding.at(0) = this_left;
-			}
-			if (this_right > bounding.at(1))
-			{
-				bounding.at(1) = this_right;
-			}
+			refitOcTree(node->children.at(i));
+		}
+		box = node->children.at(0)->bounding;
 
-			if (this_down < bounding.at(2))
-			{
-				bounding.at(2) = this_down;
-			}
-			if (this_up > bounding.at(3))
-			{
-				bounding.at(3) = this_up;
-			}
+		for (int i = 1; i < node->children.size(); i++)
+		{
+			std::vector<float> &child = node->children.at(i)->bounding;
+			box.at(0) = glm::min(box.at(0), child.at(0));
+			box.at(1) = glm::max(box.at(1), child.at(1));
+			box.at(2) = glm::min(box.at(2), child.at(2));
+			box.at(3) = glm::max(box.at(3), child.at(3));
+			box.at(4) = glm::min(box.at(4), child.at(4));
+			box.at(5) = glm::max(box.at(5), child.at(5));
+		}
+	}
+	else if (node->shapes_contained.size() != 0)
+	{
+		box = node->shapes_contained.at(0)->bounding;
 
-			if (this_back < bounding.at(4))
-			{
-				bounding.at(4) = this_back;
-			}
-			if (this_front > bounding.at(5))
-			{
-				bounding.at(5) = this_front;
-			}
+		for (int i = 1; i < node->shapes_contained.size(); i++)
+		{
+			std::vector<float> &other = node->shapes_contained.at(i)->bounding;
+			box.at(0) = glm::min(box.at(0), other.at(0));
+			box.at(1) = glm::max(box.at(1), other.at(1));
+			box.at(2) = glm::min(box.at(2), other.at(2));
+			box.at(3) = glm::max(box.at(3), other.at(3));
+			box.at(4) = glm::min(box.at(4), other.at(4));
+			box.at(5) = glm::max(box.at(5), other.at(5));
 		}
-	}//for
+	}
+	else
+	{
+		return;
+	}
+	node->bounding = box;
+}
+
+float surfaceArea(const std::vector<float> &box)
+{
+	float x = box.at(1) - box.at(0);
+	float y = box.at(3) - box.at(2);
+	float z = box.at(5) - box.at(4);
+	return 2 * (x * y + y * z + z * x);
+}
+
+float octreeCostOfNode(Node * node, float area_of_root)
+{
+	float probability = area_of_root > 0 ? surfaceArea(node->bounding) / area_of_root : 1;
+
+	if (node->children.size() == 0)
+	{
+		return probability * node->shapes_contained.size();
+	}
+
+	float cost = probability;
+	for (int i = 0; i < node->children.size(); i++)
+	{
+		cost += octreeCostOfNode(node->children.at(i), area_of_root);
+	}
+	return cost;
+}
+
+// surface area heuristic: expected number of box and shape tests for a random ray through the root
+float octreeCost(Node * node)
+{
+	return octreeCostOfNode(node, surfaceArea(node->bounding));
+}
+
+void reportOcTreeNode(Node * node, int depth, acceleration_report &report, std::set<shape *> &referenced)
+{
+	report.depth = glm::max(report.depth, depth);
+
+	if (node->children.size() == 0)
+	{
+		report.leaves++;
+		report.references += node->shapes_contained.size();
+		report.histogram.at(occupancyBucket(node->shapes_contained.size()))++;
+		referenced.insert(node->shapes_contained.begin(), node->shapes_contained.end());
+		return;
+	}
 
-	std::cout << "Bounding: " << bounding.at(0) << " " << bounding.at(1) << " " << bounding.at(2) << " " << bounding.at(3) << " " << bounding.at(4) << " " << bounding.at(5) << std::endl;
+	report.inner_nodes++;
+	for (int i = 0; i < node->children.size(); i++)
+	{
+		reportOcTreeNode(node->children.at(i), depth + 1, report, referenced);
+	}
+}
 
-	ocTree_root = new Node;
-	ocTree_root->bounding = bounding;
-	ocTree_root->shapes_contained = listOfShapes;
+void reportOcTree(acceleration_report &report)
+{
+	report = acceleration_report();
+	report.name = "Octree";
 
-	partition(ocTree_root, listOfShapes, bounding);
+	std::set<shape *> referenced;
+	reportOcTreeNode(current_scene->ocTree_root, 0, report, referenced);
+	report.shapes = referenced.size();
+	report.cost = octreeCost(current_scene->ocTree_root);
 }
 
-void partition( Node * parent, std::vector<shape *> listOfShapes, std::vector<float> bounding )
+void partition( Node * parent, std::vector<shape *> listOfShapes, std::vector<float> bounding, int depth )
 {
-	if ( listOfShapes.size() > 1 
-		&& bounding.at(1) - bounding.at(0) > 0.2 
-		&& bounding.at(3) - bounding.at(2) > 0.2
-		&& bounding.at(5) - bounding.at(4) > 0.2
+	if ( (int)listOfShapes.size() > current_scene->octree_max_leaf_size
+		&& depth < current_scene->octree_max_depth
+		&& bounding.at(1) - bounding.at(0) > current_scene->octree_min_extent
+		&& bounding.at(3) - bounding.at(2) > current_scene->octree_min_extent
+		&& bounding.at(5) - bounding.at(4) > current_scene->octree_min_extent
 	   )
 	{
 		std::vector<float> sub_bounding1;
@@ -2022,7 +2347,11 @@ void partition( Node * parent, std::vector<shape *> listOfShapes, std::vector<fl
 		if( node_sub_bounding1->shapes_contained.size() != 0 )
 		{
 			parent->children.push_back(node_sub_bounding1);
-			partition(node_sub_bounding1, node_sub_bounding1->shapes_contained, node_sub_bounding1->bounding);
+			partition(node_sub_bounding1, node_sub_bounding1->shapes_contained, node_sub_bounding1->bounding, depth + 1);
+		}
+		else
+		{
+			delete node_sub_bounding1;
 		}
 
 		//sub_bounding2
@@ -2048,7 +2377,11 @@ void partition( Node * parent, std::vector<shape *> listOfShapes, std::vector<fl
 		if (node_sub_bounding2->shapes_contained.size() != 0)
 		{
 			parent->children.push_back(node_sub_bounding2);
-			partition(node_sub_bounding2, node_sub_bounding2->shapes_contained, node_sub_bounding2->bounding);
+			partition(node_sub_bounding2, node_sub_bounding2->shapes_contained, node_sub_bounding2->bounding, depth + 1);
+		}
+		else
+		{
+			delete node_sub_bounding2;
 		}
 
 		//sub_bounding3
@@ -2074,7 +2407,11 @@ void partition( Node * parent, std::vector<shape *> listOfShapes, std::vector<fl
 		if (node_sub_bounding3->shapes_contained.size() != 0)
 		{
 			parent->children.push_back(node_sub_bounding3);
-			partition(node_sub_bounding3, node_sub_bounding3->shapes_contained, node_sub_bounding3->bounding);
+			partition(node_sub_bounding3, node_sub_bounding3->shapes_contained, node_sub_bounding3->bounding, depth + 1);
+		}
+		else
+		{
+			delete node_sub_bounding3;
 		}
 
 		//sub_bounding4
@@ -2100,7 +2437,11 @@ void partition( Node * parent, std::vector<shape *> listOfShapes, std::vector<fl
 		if (node_sub_bounding4->shapes_contained.size() != 0)
 		{
 			parent->children.push_back(node_sub_bounding4);
-			partition(node_sub_bounding4, node_sub_bounding4->shapes_contained, node_sub_bounding4->bounding);
+			partition(node_sub_bounding4, node_sub_bounding4->shapes_contained, node_sub_bounding4->bounding, depth + 1);
+		}
+		else
+		{
+			delete node_sub_bounding4;
 		}
 
 		//sub_bounding5
@@ -2126,7 +2467,11 @@ void partition( Node * parent, std::vector<shape *> listOfShapes, std::vector<fl
 		if (node_sub_bounding5->shapes_contained.size() != 0)
 		{
 			parent->children.push_back(node_sub_bounding5);
-			partition(node_sub_bounding5, node_sub_bounding5->shapes_contained, node_sub_bounding5->bounding);
+			partition(node_sub_bounding5, node_sub_bounding5->shapes_contained, node_sub_bounding5->bounding, depth + 1);
+		}
+		else
+		{
+			delete node_sub_bounding5;
 		}
 
 		//sub_bounding6
@@ -2152,7 +2497,11 @@ void partition( Node * parent, std::vector<shape *> listOfShapes, std::vector<fl
 		if (node_sub_bounding6->shapes_contained.size() != 0)
 		{
 			parent->children.push_back(node_sub_bounding6);
-			partition(node_sub_bounding6, node_sub_bounding6->shapes_contained, node_sub_bounding6->bounding);
+			partition(node_sub_bounding6, node_sub_bounding6->shapes_contained, node_sub_bounding6->bounding, depth + 1);
+		}
+		else
+		{
+			delete node_sub_bounding6;
 		}
 
 		//sub_bounding7
@@ -2178,7 +2527,11 @@ void partition( Node * parent, std::vector<shape *> listOfShapes, std::vector<fl
 		if (node_sub_bounding7->shapes_contained.size() != 0)
 		{
 			parent->children.push_back(node_sub_bounding7);
-			partition(node_sub_bounding7, node_sub_bounding7->shapes_contained, node_sub_bounding7->bounding);
+			partition(node_sub_bounding7, node_sub_bounding7->shapes_contained, node_sub_bounding7->bounding, depth + 1);
+		}
+		else
+		{
+			delete node_sub_bounding7;
 		}
 
 		//sub_bounding8
@@ -2204,13 +2557,24 @@ void partition( Node * parent, std::vector<shape *> listOfShapes, std::vector<fl
 		if (node_sub_bounding8->shapes_contained.size() != 0)
 		{
 			parent->children.push_back(node_sub_bounding8);
-			partition(node_sub_bounding8, node_sub_bounding8->shapes_contained, node_sub_bounding8->bounding);
+			partition(node_sub_bounding8, node_sub_bounding8->shapes_contained, node_sub_bounding8->bounding, depth + 1);
+		}
+		else
+		{
+			delete node_sub_bounding8;
 		}
 	}
 }
 
-void ray_box_intersection(glm::vec3 &e, glm::vec3 &s, Node * node, std::vector<shape *> &objects_to_for_hit_testing, bool pick)
+void ray_box_intersection(const glm::vec3 &e, const glm::vec3 &s, Node * node, std::vector<shape *> &objects_to_for_hit_testing, bool pick)
 {
+	// whole-tree queries go through the flattened copy, picking still prints the Node boxes
+	if (node == current_scene->ocTree_root && current_scene->compact.ready && !pick)
+	{
+		compactRayBoxIntersection(e, s, objects_to_for_hit_testing);
+		return;
+	}
+
 	float txmin, txmax;
 	float tymin, tymax;
 	float tzmin, tzmax;
@@ -2306,9 +2670,9 @@ void ray_box_intersection(glm::vec3 &e, glm::vec3 &s, Node * node, std::vector<s
 					objects_to_for_hit_testing.push_back(node->shapes_contained.at(i));
 				}
 			}
-			for (int i = 0; i < listOfPlanes.size(); i++)
+			for (int i = 0; i < current_scene->listOfPlanes.size(); i++)
 			{
-				objects_to_for_hit_testing.push_back(listOfPlanes.at(i));
+				objects_to_for_hit_testing.push_back(current_scene->listOfPlanes.at(i));
 			}
 			if (pick)
 			{
@@ -2331,9 +2695,9 @@ void ray_box_intersection(glm::vec3 &e, glm::vec3 &s, Node * node, std::vector<s
 	}
 	else
 	{
-		for (int i = 0; i < listOfPlanes.size(); i++)
+		for (int i = 0; i < current_scene->listOfPlanes.size(); i++)
 		{
-			objects_to_for_hit_testing.push_back(listOfPlanes.at(i));
+			objects_to_for_hit_testing.push_back(current_scene->listOfPlanes.at(i));
 		}
 	}
 }
\ No newline at end of file
@@ -10,6 +10,43 @@
 #include "json.hpp"
 using json = nlohmann::json;
 
+// feature flags of a compiled material, used to pick the shading variant
+#define MATERIAL_ROUGH 1
+#define MATERIAL_SPECULAR 2
+#define MATERIAL_REFLECTIVE 4
+#define MATERIAL_TRANSMISSIVE 8
+
+struct Material;
+
+// spot_lights, when given, are the only spot lights that can reach the point (see light_culling.h)
+typedef void (*shade_function)(glm::vec3 &colour, const Material &m, const glm::vec3 &intersection, const glm::vec3 &N, const glm::vec3 &V,
+	const std::vector<int> * spot_lights);
+
+// shades every hit of the batch at once, see batch_shading.h
+struct shading_batch;
+typedef void (*shade_batch_function)(shading_batch &batch, const std::vector<int> * spot_lights);
+
+// A material as read from the scene file, compiled at load time: the Oren-Nayar
+// coefficients are precomputed and shade and shade_batch point at the variants for its flags.
+struct Material
+{
+	int id;
+	glm::vec3 ambient;
+	glm::vec3 diffuse;
+	glm::vec3 specular;
+	float shininess;
+	float roughness;
+	glm::vec3 reflective;
+	glm::vec3 transmissive;
+	float refraction;
+
+	float oren_nayar_A;
+	float oren_nayar_B;
+	int flags;
+	shade_function shade;
+	shade_batch_function shade_batch;
+};
+
 struct shape
 {
 	std::string type;
@@ -17,14 +54,7 @@ struct shape
 	glm::vec3 normal;
 	float radius;
 	float half_height;
-	glm::vec3 material_ambient;
-	glm::vec3 material_diffuse;
-	glm::vec3 material_specular;
-	float material_shininess;
-	float material_roughness;
-	glm::vec3 material_reflective;
-	glm::vec3 material_transmissive;
-	float material_refraction;
+	Material * mat;
 	std::vector<float> bounding;
 	glm::vec4 vertex0;
 	glm::vec4 vertex1;
@@ -40,36 +70,94 @@ struct Node
 	std::vector<shape *> shapes_contained;
 };
 
+// what one entry of the "objects" of the scene file was loaded as
+struct scene_object
+{
+	std::vector<shape *> shapes;
+	std::vector<shape *> planes;
+	std::vector<Material *> materials; // in the order loadMaterial() made them
+	std::vector<float> bounding; // of the shapes, empty when there are none
+};
+
 typedef glm::vec3 point3;
 typedef glm::vec3 colour3;
 
-extern double fov;
-extern colour3 background_colour;
-extern Node * ocTree_root;
+extern const char *PATH; // where the scenes are
+extern int area_light_probes;
 
 void choose_scene(char const *fn);
+void use_scene(json loaded, const std::string &file);
+void loadCamera(json &camera);
+void clearLights();
+void loadLights(json &lights);
+
+struct gbuffer_sample;
+
+// sample, when given, receives the first hit for deferred shading
+bool trace(point3 &e, point3 &s, colour3 &colour, gbuffer_sample * sample = NULL);
+
+// what a primary ray hit first, trace() is findPrimaryHit() followed by shadePrimaryHit()
+struct primary_hit
+{
+	bool hit;
+	Material * material;
+	glm::vec3 intersection;
+	glm::vec3 N;
+	glm::vec3 V;
+	glm::vec3 center;
+	int type;
+	float radius;
+	shape * primitive;
+};
+
+// moves e and s along when the eye is not at the origin, as trace() does
+bool findPrimaryHit(point3 &e, point3 &s, primary_hit &hit);
+void shadePrimaryHit(const point3 &e, const primary_hit &hit, colour3 &colour, const std::vector<int> * spot_lights = NULL);
 
-bool trace(point3 &e, point3 &s, colour3 &colour);
+bool shadowTestingShape(shape * object, const point3 &e, const point3 &s, int type);
+bool shadowTesting(const point3 &e, const point3 &s, int type, int light);
+void areaLightShadows(const glm::vec3 &intersection, int area, std::vector<char> &shadowed);
+void invalidateOccluderCache();
+bool segmentHitsBox(const glm::vec3 &a, const glm::vec3 &b, const std::vector<float> &box);
+bool boxBlocksLight(const std::vector<float> &box, const glm::vec3 &point);
 
-bool shadowTesting(const point3 &e, const point3 &s, int type);
+void mirrorReflection(const point3 &e, const point3 &s, colour3 &colour, int depth,
+	const Material &m, const glm::vec3 &material_reflective,
+	const glm::vec3 &N, glm::vec3 lastPoint);
 
-void mirrorReflection(point3 &e, point3 &s, colour3 &colour, int depth,
-	glm::vec3 &material_ambient, glm::vec3 &material_diffuse, glm::vec3 &material_specular,
-	float &material_shininess, glm::vec3 &material_reflective, glm::vec3 &material_transmissive, float &material_refraction, float &material_roughness,
-	glm::vec3 &N, glm::vec3 lastPoint);
+void hitTestingShape(shape * object, const point3 &e, const point3 &s, float &finalT, bool &isHit, Material * &hit_material,
+	glm::vec3 &intersection, glm::vec3 &N, glm::vec3 &center, int &type, float &radius);
+bool hitTesting(const point3 &e, const point3 &s, Material * &hit_material,
+	glm::vec3 &intersection, glm::vec3 &N, glm::vec3 &center, int &type, float &radius, std::vector<shape *> objects_to_for_hit_testing,
+	shape ** hit_shape = NULL);
+bool closestHit(const point3 &e, const point3 &s, Material * &hit_material,
+	glm::vec3 &intersection, glm::vec3 &N, glm::vec3 &center, int &type, float &radius, shape ** hit_shape = NULL);
 
-bool hitTesting(const point3 &e, const point3 &s,
-	glm::vec3 &material_ambient, glm::vec3 &material_diffuse, glm::vec3 &material_specular,
-	float &material_shininess, glm::vec3 &material_reflective, glm::vec3 &material_transmissive, float &material_refraction, float &material_roughness,
-	glm::vec3 &intersection, glm::vec3 &N, glm::vec3 &center, int &type, float &radius, std::vector<shape *> objects_to_for_hit_testing);
+void getColor(colour3 &colour, const Material &m, const glm::vec3 &intersection, const glm::vec3 &N, const glm::vec3 &V,
+	const std::vector<int> * spot_lights = NULL);
 
-void getColor(colour3 &colour,
-	glm::vec3 &material_ambient, glm::vec3 &material_diffuse, glm::vec3 &material_specular,
-	float &material_shininess, glm::vec3 &material_reflective, glm::vec3 &material_transmissive, float &material_refraction, float &material_roughness,
-	const glm::vec3 &intersection, glm::vec3 &N, glm::vec3 &V);
+void compileMaterial(Material * m);
+Material * loadMaterial(json &object_material);
+Material * averageMaterial(const Material * a, const Material * b);
+void setMaterial(Material * m, json &object_material);
+void setAverageMaterial(Material * m, const Material * a, const Material * b);
 
 void getBoundingAndShapeList();
-void partition(Node * parent, std::vector<shape *> listOfShapes, std::vector<float> bounding);
-void ray_box_intersection(glm::vec3 &e, glm::vec3 &s, Node * node, std::vector<shape *> &objects_to_for_hit_testing, bool pick);
+void loadShapes();
+void loadObject(json &object, scene_object &loaded);
+void deleteObject(scene_object &object);
+void clearShapes();
+void buildAccelerationStructures();
+void buildOcTree();
+void partition(Node * parent, std::vector<shape *> listOfShapes, std::vector<float> bounding, int depth = 0);
+void deleteOcTree(Node * node);
+void rebuildOcTree();
+void refitOcTree(Node * node);
+void insertIntoOcTree(Node * node, shape * object);
+void removeFromOcTree(Node * node, const std::vector<shape *> &removed);
+struct acceleration_report;
+float octreeCost(Node * node);
+void reportOcTree(acceleration_report &report);
+void ray_box_intersection(const glm::vec3 &e, const glm::vec3 &s, Node * node, std::vector<shape *> &objects_to_for_hit_testing, bool pick);
 
 #endif
@@ -0,0 +1,166 @@
+#include "region.h"
+#include "render.h"
+#include "trace.h"
+#include "scene.h"
+#include "light_culling.h"
+#include <cstdio>
+#include <thread>
+#include <atomic>
+
+void split_into_tiles(const pixel_rect &rect, std::vector<pixel_rect> &tiles)
+{
+	tiles.clear();
+	for (int y = rect.y; y < rect.y + rect.height; y += RENDER_TILE_SIZE)
+	{
+		for (int x = rect.x; x < rect.x + rect.width; x += RENDER_TILE_SIZE)
+		{
+			pixel_rect t;
+			t.x = x;
+			t.y = y;
+			t.width = glm::min(RENDER_TILE_SIZE, rect.x + rect.width - x);
+			t.height = glm::min(RENDER_TILE_SIZE, rect.y + rect.height - y);
+			tiles.push_back(t);
+		}
+	}
+}
+
+// what the threads of render_tiles share
+struct tile_pool
+{
+	Scene * scene;
+	int count;
+	std::atomic<int> next;
+	void (*render_tile)(void *job, int index);
+	void *job;
+};
+
+void tile_pool_thread(tile_pool *pool)
+{
+	scene_scope bind(pool->scene);
+	trace_thread_name("render");
+
+	for (int index = pool->next++; index < pool->count; index = pool->next++)
+	{
+		pool->render_tile(pool->job, index);
+	}
+}
+
+void render_tiles(Scene * scene, int count, void (*render_tile)(void *job, int index), void *job)
+{
+	tile_pool pool;
+	pool.scene = scene;
+	pool.count = count;
+	pool.next = 0;
+	pool.render_tile = render_tile;
+	pool.job = job;
+
+	// a single tile is not worth a thread
+	int thread_count = glm::min(glm::max((int)std::thread::hardware_concurrency(), 1), count);
+	if (thread_count <= 1)
+	{
+		scene_scope bind(scene);
+		for (int index = 0; index < count; index++)
+		{
+			render_tile(job, index);
+		}
+		return;
+	}
+
+	std::vector<std::thread> threads;
+	for (int n = 0; n < thread_count; n++)
+	{
+		threads.push_back(std::thread(tile_pool_thread, &pool));
+	}
+
+	for (int n = 0; n < threads.size(); n++)
+	{
+		threads.at(n).join();
+	}
+}
+
+void render_rect(const pixel_rect &rect, int image_width, int image_height, int samples, colour3 *pixels, int stride)
+{
+	render_rect_culled(NULL, rect, image_width, image_height, samples, NULL, pixels, stride);
+}
+
+// what the render threads share
+struct region_render
+{
+	int width, height;
+	int samples;
+	const std::vector<char> *wanted;
+	std::vector<pixel_rect> tiles;
+	std::vector<colour3> *image;
+};
+
+void render_region_tile(void *job, int index)
+{
+	region_render *render = (region_render *)job;
+	trace_scope scope("render tile");
+	const pixel_rect &t = render->tiles.at(index);
+	render_rect_culled(NULL, t, render->width, render->height, render->samples, render->wanted,
+		&render->image->at(t.y * render->width + t.x), render->width);
+}
+
+int render_rects(const std::vector<pixel_rect> &rects, int image_width, int image_height, int samples, std::vector<colour3> &image)
+{
+	// a flag per pixel rather than the rects themselves, so that overlaps are only rendered once
+	std::vector<char> wanted(image_width * image_height, 0);
+	int count = 0;
+
+	for (int r = 0; r < rects.size(); r++)
+	{
+		const pixel_rect &rect = rects.at(r);
+		int left = glm::max(rect.x, 0);
+		int bottom = glm::max(rect.y, 0);
+		int right = glm::min(rect.x + rect.width, image_width);
+		int top = glm::min(rect.y + rect.height, image_height);
+
+		for (int y = bottom; y < top; y++)
+		{
+			for (int x = left; x < right; x++)
+			{
+				count += wanted.at(y * image_width + x) == 0;
+				wanted.at(y * image_width + x) = 1;
+			}
+		}
+	}
+
+	// the tiles of the frame that have any of them, so small rects spread over the threads as well as large ones
+	region_render render;
+	render.width = image_width;
+	render.height = image_height;
+	render.samples = samples;
+	render.wanted = &wanted;
+	render.image = &image;
+
+	pixel_rect frame = { 0, 0, image_width, image_height };
+	std::vector<pixel_rect> tiles;
+	split_into_tiles(frame, tiles);
+
+	for (int n = 0; n < tiles.size(); n++)
+	{
+		const pixel_rect &t = tiles.at(n);
+		bool any = false;
+		for (int j = t.y; j < t.y + t.height && !any; j++)
+		{
+			for (int i = t.x; i < t.x + t.width && !any; i++)
+			{
+				any = wanted.at(j * image_width + i) != 0;
+			}
+		}
+		if (any)
+		{
+			render.tiles.push_back(t);
+		}
+	}
+
+	render_tiles(current_scene, render.tiles.size(), render_region_tile, &render);
+	return count;
+}
+
+bool parse_rect(const char *text, pixel_rect &rect)
+{
+	char end;
+	return sscanf(text, "%d,%d,%d,%d%c", &rect.x, &rect.y, &rect.width, &rect.height, &end) == 4 && rect.width > 0 && rect.height > 0;
+}
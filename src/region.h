@@ -0,0 +1,38 @@
+#ifndef region_h
+#define region_h
+#include "raytracer.h"
+
+struct Scene;
+
+// pixels from (x, y), bottom row first like the rest of the images
+struct pixel_rect
+{
+	int x, y;
+	int width, height;
+};
+
+// the size of the tiles every render hands out to its threads, or to its workers
+const int RENDER_TILE_SIZE = 32;
+
+// rect cut into tiles of RENDER_TILE_SIZE, row by row from the bottom, those at its right and top cut short
+void split_into_tiles(const pixel_rect &rect, std::vector<pixel_rect> &tiles);
+
+// Calls render_tile(job, index) for every index below count on all cores, each thread with scene
+// bound and taking the next index as soon as it is done with one; returns when all are done.
+void render_tiles(Scene * scene, int count, void (*render_tile)(void *job, int index), void *job);
+
+// Renders rect of an image_width x image_height frame, with the camera of the whole frame, into
+// pixels, where the pixel (x, y) of the frame goes to pixels[(y - rect.y) * stride + x - rect.x].
+// The buffer belongs to the caller and has to hold rect.height rows of stride pixels. Samples
+// are the same as a full render with as many takes, so the pixels fit into one seamlessly.
+void render_rect(const pixel_rect &rect, int image_width, int image_height, int samples, colour3 *pixels, int stride);
+
+// Renders the pixels inside any of rects into image, which holds the whole image_width x
+// image_height frame, on all cores; the other pixels are left as they are. Rects are clipped
+// to the frame and pixels where they overlap are only rendered once. Returns the pixel count.
+int render_rects(const std::vector<pixel_rect> &rects, int image_width, int image_height, int samples, std::vector<colour3> &image);
+
+// "x,y,width,height", false when that is not what text holds
+bool parse_rect(const char *text, pixel_rect &rect);
+
+#endif
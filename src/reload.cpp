@@ -0,0 +1,456 @@
+#include "reload.h"
+#include "animation.h"
+#include "gbuffer.h"
+#include "render.h"
+#include "trace.h"
+#include "scene.h"
+#include <algorithm>
+#include <chrono>
+#include <map>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// the inotify instance watching the directory of the scene file
+int scene_watch = -1;
+
+#ifdef __linux__
+
+// editors write the file in place or write a new one and rename it over, the directory sees both
+bool watch_scene_file()
+{
+	if (current_scene->scene_file.empty())
+	{
+		return false;
+	}
+
+	size_t slash = current_scene->scene_file.find_last_of('/');
+	std::string directory = slash == std::string::npos ? "." : current_scene->scene_file.substr(0, slash);
+
+	scene_watch = inotify_init1(IN_NONBLOCK);
+	if (scene_watch < 0 || inotify_add_watch(scene_watch, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		std::cout << "Unable to watch " << directory << " for changes" << std::endl;
+		return false;
+	}
+
+	std::cout << "Watching " << current_scene->scene_file << " for changes" << std::endl;
+	return true;
+}
+
+bool scene_file_changed()
+{
+	if (scene_watch < 0)
+	{
+		return false;
+	}
+
+	std::string name = current_scene->scene_file.substr(current_scene->scene_file.find_last_of('/') + 1);
+	bool changed = false;
+
+	alignas(inotify_event) char events[4096];
+	ssize_t length;
+
+	while ((length = read(scene_watch, events, sizeof(events))) > 0)
+	{
+		for (char *next = events; next < events + length; )
+		{
+			inotify_event *event = (inotify_event *)next;
+			if (event->len != 0 && name == event->name)
+			{
+				changed = true;
+			}
+			next += sizeof(inotify_event) + event->len;
+		}
+	}
+	return changed;
+}
+
+#else
+
+bool watch_scene_file()
+{
+	std::cout << "Watching the scene file needs inotify, press r to load the changes instead" << std::endl;
+	return false;
+}
+
+bool scene_file_changed()
+{
+	return false;
+}
+
+#endif
+
+// the object without its materials, objects that only differ in those keep their shapes
+json withoutMaterials(json object)
+{
+	object.erase("material");
+
+	if (object.find("objects") != object.end())
+	{
+		json &sub_objects = object["objects"];
+		for (json::iterator it = sub_objects.begin(); it != sub_objects.end(); ++it)
+		{
+			it->erase("material");
+		}
+	}
+	return object;
+}
+
+bool isCsg(const json &object)
+{
+	return object["type"] == "intersection" || object["type"] == "union" || object["type"] == "difference";
+}
+
+// gives the materials of a loaded object the values of the same object in the file, in the order
+// loadObject() made them: one, or for a csg object both spheres' and their average
+void setObjectMaterials(scene_object &loaded, json &object)
+{
+	json none = json::object();
+
+	if (isCsg(object))
+	{
+		json &sub_objects = object["objects"];
+		for (int i = 0; i < 2; i++)
+		{
+			json &sub_object = sub_objects[i];
+			setMaterial(loaded.materials.at(i), sub_object.find("material") != sub_object.end() ? sub_object["material"] : none);
+		}
+		setAverageMaterial(loaded.materials.at(2), loaded.materials.at(0), loaded.materials.at(1));
+	}
+	else
+	{
+		setMaterial(loaded.materials.at(0), object.find("material") != object.end() ? object["material"] : none);
+	}
+}
+
+void reloadAllShapes()
+{
+	for (int i = 0; i < current_scene->listOfAnimatedObjects.size(); i++)
+	{
+		delete current_scene->listOfAnimatedObjects.at(i);
+	}
+	current_scene->listOfAnimatedObjects.clear();
+	current_scene->cost_after_build = -1;
+
+	clearShapes();
+	getBoundingAndShapeList();
+}
+
+bool reload_scene(scene_changes &changes)
+{
+	trace_scope scope("reload scene");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	changes = scene_changes();
+
+	std::fstream in(current_scene->scene_file);
+	if (!in.is_open())
+	{
+		std::cout << "Unable to open scene file " << current_scene->scene_file << std::endl;
+		return false;
+	}
+
+	// an editor may still be halfway through writing it, the next write brings the rest
+	json edited;
+	try
+	{
+		in >> edited;
+	}
+	catch (json::exception &error)
+	{
+		std::cout << "Unable to read " << current_scene->scene_file << ", keeping the loaded scene: " << error.what() << std::endl;
+		return false;
+	}
+
+	if (edited["camera"] != current_scene->scene["camera"])
+	{
+		changes.camera = true;
+		loadCamera(edited["camera"]);
+	}
+
+	if (edited["lights"] != current_scene->scene["lights"])
+	{
+		changes.lights = true;
+		clearLights();
+		loadLights(edited["lights"]);
+	}
+
+	json &old_objects = current_scene->scene["objects"];
+	json &new_objects = edited["objects"];
+
+	// the keyframes hold on to the shapes they move, those scenes start over
+	bool keyframes = current_scene->listOfAnimatedObjects.size() != 0;
+	for (json::iterator it = new_objects.begin(); it != new_objects.end(); ++it)
+	{
+		keyframes = keyframes || it->find("keyframes") != it->end();
+	}
+
+	if (keyframes && old_objects != new_objects)
+	{
+		current_scene->scene = std::move(edited);
+		reloadAllShapes();
+		invalidateOccluderCache();
+
+		changes.all = true;
+		std::cout << "Reloaded all objects of " << current_scene->scene_file << " in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+		return true;
+	}
+
+	int old_count = old_objects.size();
+	int new_count = new_objects.size();
+	std::vector<int> new_match(new_count, -1);
+	std::vector<bool> old_matched(old_count, false);
+
+	// identical objects first, wherever they are in the file now
+	std::multimap<std::string, int> unchanged;
+	for (int i = 0; i < old_count; i++)
+	{
+		unchanged.insert(std::make_pair(old_objects[i].dump(), i));
+	}
+	for (int j = 0; j < new_count; j++)
+	{
+		std::string text = new_objects[j].dump();
+		std::multimap<std::string, int>::iterator it = unchanged.lower_bound(text);
+
+		if (it != unchanged.end() && it->first == text)
+		{
+			new_match.at(j) = it->second;
+			old_matched.at(it->second) = true;
+			unchanged.erase(it);
+		}
+	}
+
+	std::vector<int> old_left;
+	std::vector<int> new_left;
+	for (int i = 0; i < old_count; i++)
+	{
+		if (!old_matched.at(i))
+		{
+			old_left.push_back(i);
+		}
+	}
+	for (int j = 0; j < new_count; j++)
+	{
+		if (new_match.at(j) < 0)
+		{
+			new_left.push_back(j);
+		}
+	}
+
+	std::vector<scene_object> objects(new_count);
+	std::vector<bool> loaded(new_count, false);
+	std::vector<scene_object> removed;
+	std::vector<Material *> edited_materials;
+	std::vector<std::pair<int, int> > moved; // removed object and the object of the file that replaces it
+
+	for (int j = 0; j < new_count; j++)
+	{
+		if (new_match.at(j) >= 0)
+		{
+			objects.at(j) = current_scene->listOfObjects.at(new_match.at(j));
+			loaded.at(j) = true;
+		}
+	}
+
+	// what is left was edited in place when it kept its type, or else removed and added
+	for (int k = 0; k < old_left.size(); k++)
+	{
+		int i = old_left.at(k);
+		int j = k < new_left.size() ? new_left.at(k) : -1;
+
+		if (j >= 0 && old_objects[i]["type"] == new_objects[j]["type"] && withoutMaterials(old_objects[i]) == withoutMaterials(new_objects[j]))
+		{
+			objects.at(j) = current_scene->listOfObjects.at(i);
+			loaded.at(j) = true;
+			setObjectMaterials(objects.at(j), new_objects[j]);
+			edited_materials.insert(edited_materials.end(), objects.at(j).materials.begin(), objects.at(j).materials.end());
+			changes.edited++;
+			continue;
+		}
+
+		if (j >= 0 && old_objects[i]["type"] == new_objects[j]["type"])
+		{
+			changes.moved++;
+			moved.push_back(std::make_pair((int)removed.size(), j));
+		}
+		else
+		{
+			changes.removed++;
+			changes.added += j >= 0;
+		}
+		removed.push_back(current_scene->listOfObjects.at(i));
+	}
+	changes.added += glm::max((int)new_left.size() - (int)old_left.size(), 0);
+
+	// a moved object that brings as many shapes of the same types keeps their places in the BVH
+	std::vector<shape *> old_shapes;
+	std::vector<shape *> new_shapes;
+	bool shapes_changed = changes.added != 0 || changes.removed != 0;
+
+	bool geometry = removed.size() != 0;
+	for (int j = 0; j < new_count; j++)
+	{
+		geometry = geometry || !loaded.at(j);
+	}
+
+	if (geometry)
+	{
+		// the baseline the refitted octree is judged against, from before the first change
+		if (current_scene->cost_after_build < 0)
+		{
+			refitOcTree(current_scene->ocTree_root);
+			current_scene->cost_after_build = octreeCost(current_scene->ocTree_root);
+		}
+
+		std::vector<shape *> removed_shapes;
+		for (int i = 0; i < removed.size(); i++)
+		{
+			removed_shapes.insert(removed_shapes.end(), removed.at(i).shapes.begin(), removed.at(i).shapes.end());
+			changes.planes = changes.planes || removed.at(i).planes.size() != 0;
+			if (removed.at(i).bounding.size() != 0)
+			{
+				changes.boxes.push_back(removed.at(i).bounding);
+			}
+		}
+		std::sort(removed_shapes.begin(), removed_shapes.end());
+		removeFromOcTree(current_scene->ocTree_root, removed_shapes);
+
+		for (int j = 0; j < new_count; j++)
+		{
+			if (!loaded.at(j))
+			{
+				loadObject(new_objects[j], objects.at(j));
+				for (int k = 0; k < objects.at(j).shapes.size(); k++)
+				{
+					insertIntoOcTree(current_scene->ocTree_root, objects.at(j).shapes.at(k));
+				}
+				changes.planes = changes.planes || objects.at(j).planes.size() != 0;
+				if (objects.at(j).bounding.size() != 0)
+				{
+					changes.boxes.push_back(objects.at(j).bounding);
+				}
+			}
+		}
+
+		for (int k = 0; k < moved.size() && !shapes_changed; k++)
+		{
+			const std::vector<shape *> &before = removed.at(moved.at(k).first).shapes;
+			const std::vector<shape *> &after = objects.at(moved.at(k).second).shapes;
+			shapes_changed = before.size() != after.size();
+
+			for (int m = 0; m < before.size() && !shapes_changed; m++)
+			{
+				shapes_changed = before.at(m)->type != after.at(m)->type;
+			}
+			old_shapes.insert(old_shapes.end(), before.begin(), before.end());
+			new_shapes.insert(new_shapes.end(), after.begin(), after.end());
+		}
+	}
+
+	// the lists follow the order of the file again, which is what material ids are
+	current_scene->listOfShapes.clear();
+	current_scene->listOfPlanes.clear();
+	std::vector<int> renumbered(current_scene->listOfMaterials.size(), 0);
+	current_scene->listOfMaterials.clear();
+
+	for (int j = 0; j < new_count; j++)
+	{
+		scene_object &object = objects.at(j);
+		current_scene->listOfShapes.insert(current_scene->listOfShapes.end(), object.shapes.begin(), object.shapes.end());
+		current_scene->listOfPlanes.insert(current_scene->listOfPlanes.end(), object.planes.begin(), object.planes.end());
+
+		for (int k = 0; k < object.materials.size(); k++)
+		{
+			Material * m = object.materials.at(k);
+			renumbered.at(m->id) = current_scene->listOfMaterials.size();
+			m->id = current_scene->listOfMaterials.size();
+			current_scene->listOfMaterials.push_back(m);
+		}
+	}
+	current_scene->listOfObjects = objects;
+
+	// the g-buffer refers to materials by id; pixels on removed objects are traced again anyway
+	for (int i = 0; i < gbuffer.size(); i++)
+	{
+		if (gbuffer.at(i).hit)
+		{
+			gbuffer.at(i).material = renumbered.at(gbuffer.at(i).material);
+		}
+	}
+	for (int i = 0; i < edited_materials.size(); i++)
+	{
+		changes.materials.push_back(edited_materials.at(i)->id);
+	}
+
+	if (geometry)
+	{
+		current_scene->ocTree_root->shapes_contained = current_scene->listOfShapes;
+
+		// only moved shapes are refitted, added or removed ones need a BVH of their own
+		if (!shapes_changed)
+		{
+			replaceBVHShapes(old_shapes, new_shapes);
+		}
+		updateAccelerationStructures(shapes_changed);
+
+		for (int i = 0; i < removed.size(); i++)
+		{
+			deleteObject(removed.at(i));
+		}
+	}
+
+	// the occluders may be gone, and the light slots may belong to other lights
+	if (geometry || changes.lights)
+	{
+		invalidateOccluderCache();
+	}
+	current_scene->scene = std::move(edited);
+
+	std::cout << "Reloaded " << current_scene->scene_file << ": " << changes.edited << " objects with new materials, " << changes.moved << " moved, "
+		<< changes.added << " added, " << changes.removed << " removed" << (changes.lights ? ", new lights" : "") << (changes.camera ? ", new camera" : "")
+		<< " in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+	return true;
+}
+
+void changed_pixels(const scene_changes &changes, std::vector<char> &changed)
+{
+	trace_scope scope("find changed pixels");
+
+	changed.assign(gbuffer_width * gbuffer_height, 0);
+	bool everything = changes.all || changes.camera || changes.lights || changes.planes;
+
+	std::vector<char> edited(current_scene->listOfMaterials.size(), 0);
+	for (int i = 0; i < changes.materials.size(); i++)
+	{
+		edited.at(changes.materials.at(i)) = 1;
+	}
+
+	for (int y = 0; y < gbuffer_height; y++)
+	{
+		for (int x = 0; x < gbuffer_width; x++)
+		{
+			gbuffer_sample * sample = gbuffer_at(x, y);
+			char &flag = changed.at(y * gbuffer_width + x);
+
+			// the secondary rays of reflective and transmissive pixels can see any of it
+			if (everything || (sample->hit && (sample->needs_trace || edited.at(sample->material))))
+			{
+				flag = 1;
+				continue;
+			}
+
+			point3 e(0.0f, 0.0f, 0.0f);
+			point3 s = image_plane_point(x, y, gbuffer_width, gbuffer_height);
+			point3 end = sample->hit ? sample->position : e + 10000.0f * (s - e);
+
+			for (int i = 0; i < changes.boxes.size() && !flag; i++)
+			{
+				const std::vector<float> &box = changes.boxes.at(i);
+				flag = segmentHitsBox(e, end, box) || (sample->hit && boxBlocksLight(box, sample->position));
+			}
+		}
+	}
+}
@@ -0,0 +1,40 @@
+#ifndef reload_h
+#define reload_h
+#include "raytracer.h"
+
+// What reload_scene() found different in the scene file. Objects are matched by their text
+// first, wherever they moved to in the file, and what is left is paired up in the order of
+// the file while the types agree; the rest was added or removed.
+struct scene_changes
+{
+	bool all; // the shapes were loaded again from scratch
+	bool camera;
+	bool lights;
+	bool planes; // planes are unbounded, they can change every pixel
+	std::vector<int> materials; // ids of the materials that were given new values
+	std::vector<std::vector<float> > boxes; // around every object that was taken out or put in
+	int edited; // objects with only new materials
+	int moved; // objects with new geometry, taken out and put in again
+	int added;
+	int removed;
+};
+
+// starts watching the directory of scene_file, false where there is no inotify
+bool watch_scene_file();
+
+// true when the scene file was written since the last call, never waits
+bool scene_file_changed();
+
+// Reads the scene file again and takes over what changed. Materials are set in place and the
+// shapes of the objects that moved, were added or removed are taken out of and put into the
+// leaves of the octree nearest them. The BVH is refitted when objects only moved and built again
+// when shapes were added or removed. Scenes with keyframes are loaded again from scratch.
+// false, with the loaded scene as it was, when the file cannot be read.
+bool reload_scene(scene_changes &changes);
+
+// a flag per pixel of the last render that the changes could make look different,
+// found from its g-buffer: the primary ray and the shadow rays of every pixel are
+// tested against the boxes, and the pixels on changed materials are taken as well
+void changed_pixels(const scene_changes &changes, std::vector<char> &changed);
+
+#endif
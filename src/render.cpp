@@ -0,0 +1,216 @@
+#include "render.h"
+#include "trace.h"
+#include "region.h"
+#include "scene.h"
+#include <cmath>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// same camera as the viewer: eye at the origin looking down -z through a plane at distance 1
+point3 image_plane_point(float x, float y, int width, int height)
+{
+	return image_plane_point(x, y, width, height, current_scene->fov);
+}
+
+// the same with a field of view of its own, in degrees
+point3 image_plane_point(float x, float y, int width, int height, double field)
+{
+	float d = 1;
+	float aspect_ratio = (float)width / height;
+	float h = d * (float)tan((M_PI * field) / 180.0 / 2.0);
+	float w = h * aspect_ratio;
+
+	float top = h;
+	float bottom = -h;
+	float left = -w;
+	float right = w;
+
+	float u = left + (right - left) * (x + 0.5f) / width;
+	float v = bottom + (top - bottom) * (y + 0.5f) / height;
+
+	return point3(u, v, -d);
+}
+
+// A hash of pixel, sample and dimension instead of a generator that carries state, so a sample
+// gets the same numbers whichever thread takes it and in whatever order, and a resumed render
+// takes the very same samples. Dimension tells apart the numbers one sample needs.
+unsigned int pixel_random_bits(int x, int y, int sample, int dimension)
+{
+	unsigned int h = (unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u ^ (unsigned int)sample * 83492791u
+		^ (unsigned int)dimension * 2654435761u;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h;
+}
+
+float pixel_random(int x, int y, int sample, int dimension)
+{
+	return (pixel_random_bits(x, y, sample, dimension) >> 8) * (1.0f / 16777216.0f);
+}
+
+// the first sample goes through the pixel centre like a plain render, the others are spread over the pixel
+glm::vec2 sample_offset(int x, int y, int sample)
+{
+	if (sample == 0)
+	{
+		return glm::vec2(0.0f, 0.0f);
+	}
+
+	unsigned int h = pixel_random_bits(x, y, sample, 0);
+	return glm::vec2((h & 0xffff) / 65536.0f - 0.5f, (h >> 16) / 65536.0f - 0.5f);
+}
+
+// pixels are stored bottom row first, the way the viewer draws them
+void render_image(int width, int height, std::vector<colour3> &pixels)
+{
+	pixels.assign(width * height, colour3(0, 0, 0));
+
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			point3 e(0.0f, 0.0f, 0.0f);
+			point3 s = image_plane_point(x, y, width, height);
+
+			if (!trace(e, s, pixels.at(y * width + x)))
+			{
+				pixels.at(y * width + x) = current_scene->background_colour;
+			}
+		}
+	}
+}
+
+// renders the width x height pixels from (x, y) of a full image of image_width x image_height
+void render_tile(int x, int y, int width, int height, int image_width, int image_height, int samples, std::vector<colour3> &pixels)
+{
+	pixels.assign(width * height, colour3(0, 0, 0));
+
+	pixel_rect rect = { x, y, width, height };
+	render_rect(rect, image_width, image_height, samples, pixels.data(), width);
+}
+
+// the same samples in the same order as render_with_checkpoints, on this thread alone
+void render_reference(int width, int height, int samples, std::vector<colour3> &pixels)
+{
+	pixels.assign(width * height, colour3(0, 0, 0));
+
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			colour3 sum(0, 0, 0);
+
+			for (int sample = 0; sample < samples; sample++)
+			{
+				glm::vec2 offset = sample_offset(x, y, sample);
+				point3 e(0.0f, 0.0f, 0.0f);
+				point3 s = image_plane_point(x + offset.x, y + offset.y, width, height);
+				colour3 colour(0, 0, 0);
+
+				if (!trace(e, s, colour))
+				{
+					colour = current_scene->background_colour;
+				}
+				sum += colour;
+			}
+			pixels.at(y * width + x) = sum / (float)samples;
+		}
+	}
+}
+
+// top row first, the way a ppm stores them
+void ppm_bytes(int width, int height, const std::vector<colour3> &pixels, std::vector<unsigned char> &rgb)
+{
+	rgb.clear();
+	rgb.reserve(width * height * 3);
+
+	for (int y = height - 1; y >= 0; y--)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			colour3 c = glm::clamp(pixels.at(y * width + x), 0.0f, 1.0f);
+			rgb.push_back((unsigned char)(c.r * 255.0f + 0.5f));
+			rgb.push_back((unsigned char)(c.g * 255.0f + 0.5f));
+			rgb.push_back((unsigned char)(c.b * 255.0f + 0.5f));
+		}
+	}
+}
+
+// the other way round, back to bottom row first
+void ppm_pixels(int width, int height, const std::vector<unsigned char> &rgb, std::vector<colour3> &pixels)
+{
+	pixels.resize(width * height);
+
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			const unsigned char *c = &rgb.at(((height - 1 - y) * width + x) * 3);
+			pixels.at(y * width + x) = colour3(c[0], c[1], c[2]) / 255.0f;
+		}
+	}
+}
+
+bool write_ppm(const std::string &fn, int width, int height, const std::vector<colour3> &pixels)
+{
+	std::ofstream out(fn.c_str(), std::ios::binary);
+	if (!out.is_open())
+	{
+		std::cout << "Unable to write image " << fn << std::endl;
+		return false;
+	}
+
+	trace_scope scope("write image");
+	std::vector<unsigned char> rgb;
+	ppm_bytes(width, height, pixels, rgb);
+
+	out << "P6\n" << width << " " << height << "\n255\n";
+	out.write((const char *)rgb.data(), rgb.size());
+	out.flush();
+
+	// a full disk only shows here, and the caller must not take the image as written
+	if (!out.good())
+	{
+		std::cout << "Unable to write image " << fn << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// only reads what write_ppm writes
+bool read_ppm(const std::string &fn, int &width, int &height, std::vector<unsigned char> &rgb)
+{
+	std::ifstream in(fn.c_str(), std::ios::binary);
+	std::string magic;
+	int max_value = 0;
+
+	if (!(in >> magic >> width >> height >> max_value) || magic != "P6" || max_value != 255 || width <= 0 || height <= 0)
+	{
+		return false;
+	}
+	in.get();
+
+	rgb.resize(width * height * 3);
+	in.read((char *)rgb.data(), rgb.size());
+	return in.gcount() == rgb.size();
+}
+
+void file_stamp(const std::string &fn, long long &size, long long &time)
+{
+	struct stat info;
+	if (stat(fn.c_str(), &info) != 0)
+	{
+		size = 0;
+		time = 0;
+		return;
+	}
+	size = info.st_size;
+	time = info.st_mtime;
+}
@@ -0,0 +1,25 @@
+#ifndef render_h
+#define render_h
+#include "raytracer.h"
+
+point3 image_plane_point(float x, float y, int width, int height);
+point3 image_plane_point(float x, float y, int width, int height, double field);
+
+// counter-based random numbers, the same for a pixel and sample on every run and thread
+unsigned int pixel_random_bits(int x, int y, int sample, int dimension);
+float pixel_random(int x, int y, int sample, int dimension); // in [0, 1)
+glm::vec2 sample_offset(int x, int y, int sample);
+
+void render_image(int width, int height, std::vector<colour3> &pixels);
+void render_reference(int width, int height, int samples, std::vector<colour3> &pixels);
+void render_tile(int x, int y, int width, int height, int image_width, int image_height, int samples, std::vector<colour3> &pixels);
+
+void ppm_bytes(int width, int height, const std::vector<colour3> &pixels, std::vector<unsigned char> &rgb);
+void ppm_pixels(int width, int height, const std::vector<unsigned char> &rgb, std::vector<colour3> &pixels);
+bool write_ppm(const std::string &fn, int width, int height, const std::vector<colour3> &pixels);
+bool read_ppm(const std::string &fn, int &width, int &height, std::vector<unsigned char> &rgb);
+
+// size and modification time of a file, to tell when it has changed; zero when it cannot be read
+void file_stamp(const std::string &fn, long long &size, long long &time);
+
+#endif
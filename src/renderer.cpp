@@ -0,0 +1,125 @@
+#include "renderer.h"
+#include "animation.h"
+#include "trace.h"
+
+Scene * create_scene()
+{
+	return new Scene();
+}
+
+bool load_scene(Scene * scene, const std::string &file, std::string &error)
+{
+	scene_scope bind(scene);
+	clearScene();
+
+	std::ifstream in(file.c_str());
+	if (!in.is_open())
+	{
+		error = "unable to open scene file " + file;
+		return false;
+	}
+
+	try
+	{
+		json loaded;
+		in >> loaded;
+		use_scene(std::move(loaded), file);
+		loadShapes();
+	}
+	catch (std::exception &exception)
+	{
+		clearScene();
+		error = "unable to load " + file + ": " + exception.what();
+		return false;
+	}
+	return true;
+}
+
+void build_scene(Scene * scene)
+{
+	scene_scope bind(scene);
+
+	if (scene->ocTree_root != NULL)
+	{
+		deleteOcTree(scene->ocTree_root);
+		scene->ocTree_root = NULL;
+	}
+	scene->cost_after_build = -1;
+	buildAccelerationStructures();
+}
+
+void destroy_scene(Scene * scene)
+{
+	{
+		scene_scope bind(scene);
+		clearScene();
+	}
+	delete scene;
+}
+
+void scene_cameras(Scene * scene, std::vector<view_camera> &cameras)
+{
+	scene_scope bind(scene);
+	load_views(cameras);
+}
+
+view_camera scene_camera(Scene * scene)
+{
+	std::vector<view_camera> cameras;
+	scene_cameras(scene, cameras);
+	return cameras.at(0);
+}
+
+void set_scene_frame(Scene * scene, float frame)
+{
+	scene_scope bind(scene);
+	setAnimationFrame(frame);
+}
+
+// what the render threads share
+struct renderer_job
+{
+	const view_camera *camera;
+	int width, height;
+	int samples;
+	colour3 *buffer;
+	int stride;
+	pixel_rect region;
+	std::vector<pixel_rect> tiles;
+};
+
+void render_renderer_tile(void *job, int index)
+{
+	renderer_job *render = (renderer_job *)job;
+	trace_scope scope("render tile");
+	const pixel_rect &t = render->tiles.at(index);
+	colour3 *pixels = render->buffer + (t.y - render->region.y) * render->stride + t.x - render->region.x;
+	render_view_rect(*render->camera, t, render->width, render->height, render->samples, pixels, render->stride);
+}
+
+void render(Scene * scene, const view_camera &camera, const pixel_rect &region, int image_width, int image_height,
+	int samples, colour3 *buffer, int stride)
+{
+	renderer_job job;
+	job.camera = &camera;
+	job.width = image_width;
+	job.height = image_height;
+	job.samples = glm::max(samples, 1);
+	job.buffer = buffer;
+	job.stride = stride;
+	job.region = region;
+
+	// only the part of region inside the frame is rendered, the rest of buffer is left as it is
+	pixel_rect inside;
+	inside.x = glm::max(region.x, 0);
+	inside.y = glm::max(region.y, 0);
+	inside.width = glm::min(region.x + region.width, image_width) - inside.x;
+	inside.height = glm::min(region.y + region.height, image_height) - inside.y;
+	if (inside.width <= 0 || inside.height <= 0)
+	{
+		return;
+	}
+
+	split_into_tiles(inside, job.tiles);
+	render_tiles(scene, job.tiles.size(), render_renderer_tile, &job);
+}
@@ -0,0 +1,43 @@
+#ifndef renderer_h
+#define renderer_h
+#include "scene.h"
+#include "views.h"
+
+// The tracer for programs that embed it, built into libraytracer.a by make library. A
+// program loads and builds as many scenes as it likes and renders any of them from any
+// thread, several at once if it wants; every render runs on all cores and only reads its
+// scene. A scene must not be rendered while it is loaded, built or destroyed.
+//
+//   Scene * scene = create_scene();
+//   std::string error;
+//   if (load_scene(scene, "scenes/c.json", error))
+//   {
+//       build_scene(scene);
+//       render(scene, scene_camera(scene), region, width, height, 1, pixels, width);
+//   }
+//   destroy_scene(scene);
+
+Scene * create_scene();
+
+// reads file into scene and makes its shapes, false with error set when it cannot be read
+bool load_scene(Scene * scene, const std::string &file, std::string &error);
+
+// the acceleration structures, needed once after loading and after every animation frame
+void build_scene(Scene * scene);
+
+void destroy_scene(Scene * scene);
+
+// the cameras of the scene file, its "cameras" or the single one of "camera"
+void scene_cameras(Scene * scene, std::vector<view_camera> &cameras);
+view_camera scene_camera(Scene * scene);
+
+// poses an animated scene at frame, after build_scene(); its acceleration structures follow
+void set_scene_frame(Scene * scene, float frame);
+
+// Renders region of an image_width x image_height frame of scene, seen from camera, into
+// buffer, laid out as render_rect() does. Samples are those of the command line renders.
+// The part of region outside the frame is not rendered, and its pixels in buffer stay as they are.
+void render(Scene * scene, const view_camera &camera, const pixel_rect &region, int image_width, int image_height,
+	int samples, colour3 *buffer, int stride);
+
+#endif
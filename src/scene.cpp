@@ -0,0 +1,51 @@
+#include "scene.h"
+
+Scene main_scene;
+thread_local Scene * current_scene = &main_scene;
+
+Scene::Scene()
+	: fov(60), eye(0.0f, 0.0f, 0.0f), background_colour(0, 0, 0), light_ambient_color(0, 0, 0), ocTree_root(NULL),
+	rebuild_threshold(1.5f), cost_after_build(-1),
+	octree_max_leaf_size(1), octree_max_depth(64), octree_min_extent(0.2f),
+	bvh_max_leaf_size(4), bvh_max_sphere_leaf_size(8) // one packet
+{
+}
+
+void clearScene()
+{
+	for (int i = 0; i < current_scene->listOfAnimatedObjects.size(); i++)
+	{
+		delete current_scene->listOfAnimatedObjects.at(i);
+	}
+	current_scene->listOfAnimatedObjects.clear();
+
+	clearShapes();
+	clearLights();
+
+	// a new one drops what is left, the storage of the flattened structures included
+	*current_scene = Scene();
+
+	// the cached occluders may belong to the scene that was here
+	invalidateOccluderCache();
+}
+
+size_t sceneBytes()
+{
+	size_t bytes = current_scene->ocTree_root != NULL ? pointerOctreeBytes(current_scene->ocTree_root) : 0;
+
+	for (int i = 0; i < current_scene->listOfShapes.size(); i++)
+	{
+		shape * s = current_scene->listOfShapes.at(i);
+		bytes += sizeof(shape) + s->bounding.capacity() * sizeof(float);
+		if (s->type == "intersection" || s->type == "union" || s->type == "difference")
+		{
+			bytes += 2 * sizeof(shape);
+		}
+	}
+	bytes += current_scene->listOfPlanes.size() * sizeof(shape) + current_scene->listOfMaterials.size() * sizeof(Material);
+	bytes += (current_scene->light_point_position.size() + current_scene->light_spot_position.size()) * 4 * sizeof(glm::vec3);
+
+	// the parsed file, its text is a fair measure of what the json holds
+	bytes += current_scene->scene.dump().size();
+	return bytes + compactOctreeBytes() + bvhBytes();
+}
@@ -0,0 +1,82 @@
+#ifndef scene_h
+#define scene_h
+#include "raytracer.h"
+#include "animation.h"
+#include "compact_octree.h"
+#include "bvh.h"
+
+// Everything that belongs to one loaded scene: what was read from its file, the shapes,
+// materials and lights made from it and the acceleration structures built over them.
+// The tracer works on current_scene, which every thread has of its own; it starts out as
+// the one scene the viewer and the command line modes load into, and a render of another
+// scene points its threads there for as long as it runs. Several scenes can so be in
+// memory and render at the same time.
+struct Scene
+{
+	json scene;
+	std::string scene_file; // empty for a generated scene
+	double fov;
+	glm::vec3 eye; // primary hits are moved along to it when it is not at the origin
+	colour3 background_colour;
+
+	glm::vec3 light_ambient_color;
+	std::vector<glm::vec3> light_directional_color;
+	std::vector<glm::vec3> light_directional_direction;
+	std::vector<glm::vec3> light_point_color;
+	std::vector<glm::vec3> light_point_position;
+	std::vector<glm::vec3> light_spot_color;
+	std::vector<glm::vec3> light_spot_position;
+	std::vector<glm::vec3> light_spot_direction;
+	std::vector<float> light_spot_cutoff; // in degrees
+	std::vector<glm::vec3> light_spot_axis; // the direction, normalized
+	std::vector<float> light_spot_cos_cutoff; // a point is lit when the cosine of its angle to the axis is at least this
+
+	// area lights are grids of point lights, columns along x and rows along z, these are where they start
+	std::vector<int> light_area_first;
+	std::vector<int> light_area_columns;
+	std::vector<int> light_area_rows;
+
+	std::vector<float> bounding; // around all of the shapes
+	std::vector<shape *> listOfShapes;
+	std::vector<shape *> listOfPlanes;
+	std::vector<Material *> listOfMaterials;
+	std::vector<scene_object> listOfObjects; // one per entry of scene["objects"]
+
+	Node * ocTree_root;
+	compact_octree_state compact;
+	bvh_state bvh;
+
+	std::vector<animated_object *> listOfAnimatedObjects;
+	float rebuild_threshold; // the octree and the BVH are refitted every frame and only rebuilt once their cost has grown past this factor
+	float cost_after_build; // of the refitted octree when it was last built, -1 before that
+
+	// when partition() stops splitting
+	int octree_max_leaf_size;
+	int octree_max_depth;
+	float octree_min_extent;
+
+	// BVH nodes with more shapes than this (more spheres, when they are all spheres) are always
+	// split, smaller ones only when the surface area heuristic says it pays
+	int bvh_max_leaf_size;
+	int bvh_max_sphere_leaf_size;
+
+	Scene();
+};
+
+extern Scene main_scene;
+extern thread_local Scene * current_scene;
+
+// makes scene the current one of this thread until the end of the block
+struct scene_scope
+{
+	Scene * previous;
+
+	scene_scope(Scene * scene) : previous(current_scene) { current_scene = scene; }
+	~scene_scope() { current_scene = previous; }
+};
+
+// frees everything the current scene holds, leaving it as a new one
+void clearScene();
+size_t sceneBytes(); // the shapes, materials, lights and acceleration structures of the current scene, roughly
+
+#endif
@@ -0,0 +1,412 @@
+#include "service.h"
+#include "scene.h"
+#include "region.h"
+#include "render.h"
+#include "statistics.h"
+#include "offline.h"
+#include "trace.h"
+#include <list>
+#include <cstdio>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+// A scene that stays loaded and built between jobs. A job makes it the current scene of
+// the service thread and of its render threads for as long as it runs.
+struct resident_scene
+{
+	std::string file;
+	time_t modified;
+	Scene scene;
+	size_t bytes;
+	double load_ms;
+	double build_ms;
+	bool posed; // a job moved the animated objects to frame, they are no longer as the file has them
+	float frame;
+
+	resident_scene() : modified(0), bytes(0), load_ms(0), build_ms(0), posed(false), frame(0) {}
+};
+
+// the largest width and height of a job, a bigger image is refused rather than allocated
+const int JOB_MAX_SIZE = 8192;
+
+// most recently used first
+std::list<resident_scene> resident_scenes;
+
+void free_resident(std::list<resident_scene>::iterator it)
+{
+	{
+		scene_scope bind(&it->scene);
+		clearScene();
+	}
+	resident_scenes.erase(it);
+}
+
+void free_resident_scenes()
+{
+	while (resident_scenes.size() != 0)
+	{
+		free_resident(resident_scenes.begin());
+	}
+}
+
+time_t modification_time(const std::string &file)
+{
+	struct stat status;
+	return stat(file.c_str(), &status) == 0 ? status.st_mtime : 0;
+}
+
+std::string scene_path(const std::string &name)
+{
+	if (name.size() >= 5 && name.compare(name.size() - 5, 5, ".json") == 0)
+	{
+		return name;
+	}
+	return PATH + name + ".json";
+}
+
+// the scene of the file in use, from the cache or loaded and built now; false with error set when it cannot be read
+bool load_resident(const std::string &file, resident_scene &resident, std::string &error)
+{
+	scene_scope bind(&resident.scene);
+	std::ifstream in(file.c_str());
+	if (!in.is_open())
+	{
+		error = "unable to open scene file " + file;
+		return false;
+	}
+
+	try
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		json loaded;
+		in >> loaded;
+		use_scene(std::move(loaded), file);
+		loadShapes();
+		resident.load_ms = milliseconds_since(start);
+
+		start = std::chrono::steady_clock::now();
+		buildAccelerationStructures();
+		resident.build_ms = milliseconds_since(start);
+	}
+	catch (std::exception &exception)
+	{
+		clearScene();
+		error = "unable to load " + file + ": " + exception.what();
+		return false;
+	}
+
+	resident.file = file;
+	resident.modified = modification_time(file);
+	resident.bytes = sceneBytes();
+	return true;
+}
+
+// frees the scenes used least recently until the rest fit, the one just used always stays
+void enforce_budget(size_t budget)
+{
+	size_t total = 0;
+	for (std::list<resident_scene>::iterator it = resident_scenes.begin(); it != resident_scenes.end(); ++it)
+	{
+		total += it->bytes;
+	}
+
+	while (total > budget && resident_scenes.size() > 1)
+	{
+		std::list<resident_scene>::iterator last = --resident_scenes.end();
+		std::cout << "Freeing " << last->file << " (" << last->bytes / 1024 << " KB) to stay within the cache budget" << std::endl;
+		total -= last->bytes;
+		free_resident(last);
+	}
+}
+
+// runs one job, the answer goes to out
+bool run_job(json &job, FILE *out, size_t budget)
+{
+	json answer;
+	answer["ok"] = false;
+
+	std::string name;
+	int width, height, samples;
+	std::string output;
+	bool has_frame;
+	float frame = 0;
+	try
+	{
+		name = job.value("scene", std::string());
+		width = job.value("width", 640);
+		height = job.value("height", 640);
+		samples = glm::max(job.value("samples", 1), 1);
+		output = job.value("output", std::string());
+
+		has_frame = job.find("frame") != job.end();
+		if (has_frame)
+		{
+			frame = job["frame"];
+		}
+	}
+	catch (json::exception &exception)
+	{
+		answer["error"] = std::string("unable to read the job: ") + exception.what();
+		std::string line = answer.dump() + "\n";
+		return fwrite(line.data(), 1, line.size(), out) == line.size() && fflush(out) == 0;
+	}
+
+	if (name.empty() || width <= 0 || height <= 0 || width > JOB_MAX_SIZE || height > JOB_MAX_SIZE)
+	{
+		answer["error"] = "a job needs a scene and a width and height from 1 to " + std::to_string(JOB_MAX_SIZE);
+		std::string line = answer.dump() + "\n";
+		return fwrite(line.data(), 1, line.size(), out) == line.size() && fflush(out) == 0;
+	}
+
+	trace_scope scope("job");
+	std::string file = scene_path(name);
+
+	// found again by the file, and only while it was not written since; a job without a frame
+	// wants the objects where the file has them, which a scene posed by an earlier job no longer has
+	std::list<resident_scene>::iterator it = resident_scenes.begin();
+	while (it != resident_scenes.end() && it->file != file)
+	{
+		++it;
+	}
+	bool cached = it != resident_scenes.end() && it->modified == modification_time(file) && (has_frame || !it->posed);
+	if (it != resident_scenes.end() && !cached)
+	{
+		free_resident(it);
+	}
+
+	if (cached)
+	{
+		resident_scenes.splice(resident_scenes.begin(), resident_scenes, it);
+	}
+	else
+	{
+		std::string error;
+		resident_scenes.push_front(resident_scene());
+		if (!load_resident(file, resident_scenes.front(), error))
+		{
+			resident_scenes.pop_front();
+			answer["error"] = error;
+			std::string line = answer.dump() + "\n";
+			return fwrite(line.data(), 1, line.size(), out) == line.size() && fflush(out) == 0;
+		}
+	}
+	resident_scene &resident = resident_scenes.front();
+	scene_scope bind(&resident.scene);
+
+	// the camera of the job only lasts as long as the job
+	double scene_fov = current_scene->fov;
+	colour3 scene_background = current_scene->background_colour;
+	try
+	{
+		if (job.find("camera") != job.end())
+		{
+			loadCamera(job["camera"]);
+		}
+		if (has_frame && isAnimated() && (!resident.posed || resident.frame != frame))
+		{
+			setAnimationFrame(frame);
+			resident.posed = true;
+			resident.frame = frame;
+		}
+	}
+	catch (json::exception &exception)
+	{
+		current_scene->fov = scene_fov;
+		current_scene->background_colour = scene_background;
+
+		answer["error"] = std::string("unable to read the camera or frame of the job: ") + exception.what();
+		std::string line = answer.dump() + "\n";
+		return fwrite(line.data(), 1, line.size(), out) == line.size() && fflush(out) == 0;
+	}
+
+	reset_statistics();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<colour3> image(width * height, colour3(0, 0, 0));
+	std::vector<pixel_rect> whole(1);
+	whole.at(0).x = 0;
+	whole.at(0).y = 0;
+	whole.at(0).width = width;
+	whole.at(0).height = height;
+	render_rects(whole, width, height, samples, image);
+	double render_ms = milliseconds_since(start);
+	render_statistics statistics = total_statistics();
+
+	current_scene->fov = scene_fov;
+	current_scene->background_colour = scene_background;
+
+	answer["ok"] = true;
+	answer["scene"] = file;
+	answer["cached"] = cached;
+	answer["load_ms"] = cached ? 0.0 : resident.load_ms;
+	answer["build_ms"] = cached ? 0.0 : resident.build_ms;
+	answer["render_ms"] = render_ms;
+	answer["rays"] = statistics.rays + statistics.shadow_rays;
+
+	std::vector<unsigned char> ppm;
+	if (!output.empty())
+	{
+		if (!write_ppm(output, width, height, image))
+		{
+			answer["ok"] = false;
+			answer["error"] = "unable to write " + output;
+		}
+		answer["output"] = output;
+	}
+	else
+	{
+		std::vector<unsigned char> rgb;
+		ppm_bytes(width, height, image, rgb);
+		std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+		ppm.assign(header.begin(), header.end());
+		ppm.insert(ppm.end(), rgb.begin(), rgb.end());
+		answer["bytes"] = ppm.size();
+	}
+
+	enforce_budget(budget);
+	answer["resident_scenes"] = resident_scenes.size();
+
+	std::cout << "Job on " << file << (cached ? " (cached)" : "") << ": " << width << "x" << height << ", " << samples
+		<< " samples, rendered in " << render_ms << " ms" << std::endl;
+
+	std::string line = answer.dump() + "\n";
+	bool written = fwrite(line.data(), 1, line.size(), out) == line.size();
+	if (ppm.size() != 0)
+	{
+		written = written && fwrite(ppm.data(), 1, ppm.size(), out) == ppm.size();
+	}
+	return fflush(out) == 0 && written;
+}
+
+// one line without its newline, false at the end of the input
+bool read_line(FILE *in, std::string &line)
+{
+	line.clear();
+	int c;
+	while ((c = fgetc(in)) != EOF && c != '\n')
+	{
+		line.push_back((char)c);
+	}
+	return c != EOF || line.size() != 0;
+}
+
+// takes jobs from in until it ends or a job says quit, returning true for quit
+bool serve_jobs(FILE *in, FILE *out, size_t budget)
+{
+	std::string line;
+	while (read_line(in, line))
+	{
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+		{
+			continue;
+		}
+
+		json job;
+		bool quit;
+		try
+		{
+			job = json::parse(line);
+			quit = job.is_object() && job.value("quit", false);
+		}
+		catch (json::exception &exception)
+		{
+			json answer;
+			answer["ok"] = false;
+			answer["error"] = std::string("unable to read the job: ") + exception.what();
+			std::string text = answer.dump() + "\n";
+			fwrite(text.data(), 1, text.size(), out);
+			fflush(out);
+			continue;
+		}
+
+		if (quit)
+		{
+			return true;
+		}
+		if (!run_job(job, out, budget))
+		{
+			// whoever sent the job has gone
+			return false;
+		}
+	}
+	return false;
+}
+
+#ifdef _WIN32
+
+void run_service(const std::string &socket_path, size_t cache_budget)
+{
+	if (socket_path != "-")
+	{
+		std::cout << "The render service needs Unix domain sockets on Windows, use -serve - to read jobs from stdin." << std::endl;
+		return;
+	}
+
+	std::streambuf *log = std::cout.rdbuf(std::cerr.rdbuf());
+	serve_jobs(stdin, stdout, cache_budget);
+	std::cout.rdbuf(log);
+	free_resident_scenes();
+}
+
+#else
+
+void run_service(const std::string &socket_path, size_t cache_budget)
+{
+	trace_thread_name("service");
+
+	if (socket_path == "-")
+	{
+		// the answers own stdout
+		std::streambuf *log = std::cout.rdbuf(std::cerr.rdbuf());
+		serve_jobs(stdin, stdout, cache_budget);
+		std::cout.rdbuf(log);
+		free_resident_scenes();
+		return;
+	}
+
+	// a client that goes away mid-answer should not take the service with it
+	signal(SIGPIPE, SIG_IGN);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+	unlink(socket_path.c_str());
+
+	if (listener < 0 || bind(listener, (sockaddr *)&address, sizeof(address)) < 0 || listen(listener, 4) < 0)
+	{
+		std::cout << "Unable to listen on " << socket_path << std::endl;
+		return;
+	}
+	std::cout << "Render service listening on " << socket_path << ", caching up to " << cache_budget / (1024 * 1024) << " MB of scenes" << std::endl;
+
+	bool quit = false;
+	while (!quit)
+	{
+		int connection = accept(listener, NULL, NULL);
+		if (connection < 0)
+		{
+			continue;
+		}
+
+		FILE *in = fdopen(connection, "r");
+		FILE *out = fdopen(dup(connection), "w");
+		quit = serve_jobs(in, out, cache_budget);
+		fclose(out);
+		fclose(in);
+	}
+
+	close(listener);
+	unlink(socket_path.c_str());
+	free_resident_scenes();
+}
+
+#endif
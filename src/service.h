@@ -0,0 +1,25 @@
+#ifndef service_h
+#define service_h
+#include <string>
+#include <cstddef>
+
+// A render process that stays up and takes jobs, one JSON object per line:
+//
+//   { "scene": "c", "width": 640, "height": 480, "samples": 4, "camera": { "field": 45 }, "frame": 10, "output": "c.ppm" }
+//
+// The scene is a name in scenes/ or a path to a .json file. "camera" takes the same fields as
+// the camera of a scene file and replaces them for this job only; "frame" poses an animated
+// scene. Every job is answered with one line, { "ok": true, ... } with the times it took, or
+// { "ok": false, "error": ... }. Without "output" the line says how many bytes follow it and
+// the image comes after it as a PPM. { "quit": true } stops the service.
+//
+// Scenes stay loaded and built after their job, so the next job on the same scene only
+// traces. The ones used least recently are freed once all of them together take more than
+// cache_budget bytes, and a scene is loaded again when its file was written since.
+//
+// socket_path "-" reads the jobs from stdin and answers on stdout (the log goes to stderr);
+// otherwise the service listens on a Unix domain socket there and serves one connection at
+// a time.
+void run_service(const std::string &socket_path, size_t cache_budget);
+
+#endif
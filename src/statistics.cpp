@@ -0,0 +1,181 @@
+#include "statistics.h"
+#include "scene.h"
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+std::mutex statistics_mutex;
+std::vector<render_statistics *> statistics_of_threads;
+render_statistics statistics_of_finished_threads;
+
+void add_statistics(render_statistics &sum, const render_statistics &other)
+{
+	sum.rays += other.rays;
+	sum.node_visits += other.node_visits;
+	sum.box_tests += other.box_tests;
+	sum.hit_shape_tests += other.hit_shape_tests;
+	sum.shadow_rays += other.shadow_rays;
+	sum.shadow_rays_occluded += other.shadow_rays_occluded;
+	sum.shadow_shape_tests += other.shadow_shape_tests;
+	sum.shadow_node_visits += other.shadow_node_visits;
+	sum.occluder_cache_tests += other.occluder_cache_tests;
+	sum.occluder_cache_hits += other.occluder_cache_hits;
+	sum.area_light_tests += other.area_light_tests;
+	sum.area_light_penumbrae += other.area_light_penumbrae;
+	sum.spot_lights_kept += other.spot_lights_kept;
+	sum.spot_lights_culled += other.spot_lights_culled;
+	sum.shading_batches += other.shading_batches;
+	sum.batched_hits += other.batched_hits;
+}
+
+// registers the counters of a thread while it lives, and keeps its totals when it exits
+struct statistics_slot
+{
+	render_statistics counters;
+
+	statistics_slot()
+	{
+		std::lock_guard<std::mutex> lock(statistics_mutex);
+		statistics_of_threads.push_back(&counters);
+	}
+
+	~statistics_slot()
+	{
+		std::lock_guard<std::mutex> lock(statistics_mutex);
+		add_statistics(statistics_of_finished_threads, counters);
+		for (int i = 0; i < statistics_of_threads.size(); i++)
+		{
+			if (statistics_of_threads.at(i) == &counters)
+			{
+				statistics_of_threads.erase(statistics_of_threads.begin() + i);
+				break;
+			}
+		}
+	}
+};
+
+render_statistics &thread_statistics()
+{
+	static thread_local statistics_slot slot;
+	return slot.counters;
+}
+
+void reset_statistics()
+{
+	std::lock_guard<std::mutex> lock(statistics_mutex);
+	statistics_of_finished_threads = render_statistics();
+	for (int i = 0; i < statistics_of_threads.size(); i++)
+	{
+		*statistics_of_threads.at(i) = render_statistics();
+	}
+}
+
+render_statistics total_statistics()
+{
+	std::lock_guard<std::mutex> lock(statistics_mutex);
+	render_statistics sum = statistics_of_finished_threads;
+	for (int i = 0; i < statistics_of_threads.size(); i++)
+	{
+		add_statistics(sum, *statistics_of_threads.at(i));
+	}
+	return sum;
+}
+
+double percent(unsigned long long part, unsigned long long whole)
+{
+	return whole == 0 ? 0.0 : 100.0 * part / whole;
+}
+
+double per(unsigned long long count, unsigned long long rays)
+{
+	return rays == 0 ? 0.0 : (double)count / rays;
+}
+
+void print_statistics()
+{
+	render_statistics sum = total_statistics();
+
+	std::cout << "Statistics:" << std::endl;
+	std::cout << "	rays: " << sum.rays << ", per ray: " << per(sum.node_visits, sum.rays) << " node visits, "
+		<< per(sum.box_tests, sum.rays) << " box tests, " << per(sum.hit_shape_tests, sum.rays) << " shape tests" << std::endl;
+	std::cout << "	shadow rays: " << sum.shadow_rays << ", occluded: " << sum.shadow_rays_occluded
+		<< " (" << percent(sum.shadow_rays_occluded, sum.shadow_rays) << "%)" << std::endl;
+	std::cout << "	per shadow ray: " << per(sum.shadow_node_visits, sum.shadow_rays) << " node visits, "
+		<< per(sum.shadow_shape_tests, sum.shadow_rays) << " shape tests" << std::endl;
+	std::cout << "	occluder cache: " << sum.occluder_cache_hits << " hits in " << sum.occluder_cache_tests << " tests ("
+		<< percent(sum.occluder_cache_hits, sum.occluder_cache_tests) << "%), "
+		<< percent(sum.occluder_cache_hits, sum.shadow_rays_occluded) << "% of occluded shadow rays" << std::endl;
+	if (sum.area_light_tests != 0)
+	{
+		std::cout << "	area lights: " << sum.area_light_tests << " probed, " << sum.area_light_penumbrae << " in penumbra ("
+			<< percent(sum.area_light_penumbrae, sum.area_light_tests) << "%) and sampled in full" << std::endl;
+	}
+	if (sum.spot_lights_kept + sum.spot_lights_culled != 0)
+	{
+		std::cout << "	light culling: " << sum.spot_lights_culled << " of " << sum.spot_lights_kept + sum.spot_lights_culled
+			<< " spot lights at primary hits culled by their tile (" << percent(sum.spot_lights_culled, sum.spot_lights_kept + sum.spot_lights_culled) << "%)" << std::endl;
+	}
+	if (sum.shading_batches != 0)
+	{
+		std::cout << "	batched shading: " << sum.batched_hits << " hits in " << sum.shading_batches << " batches, "
+			<< per(sum.batched_hits, sum.shading_batches) << " per batch" << std::endl;
+	}
+
+	// the compact octree and the BVH of the scene the statistics were printed for, as they were last built
+	const compact_octree_state &compact = current_scene->compact;
+	if (compact.ready && current_scene->ocTree_root != NULL)
+	{
+		std::cout << "	compact octree: " << compact.node_count << " nodes, " << compact.leaves.size() << " leaves, " << compact.encoded_bytes / 1024
+			<< " KB (the Node tree takes " << pointerOctreeBytes(current_scene->ocTree_root) / 1024 << " KB)" << std::endl;
+	}
+
+	const bvh_state &bvh = current_scene->bvh;
+	if (bvh.ready && bvh.node_count != 0)
+	{
+		std::cout << "	BVH: " << bvh.node_count << " nodes, " << bvh.leaves.size() << " leaves, " << bvh.spheres.size() / 8
+			<< " sphere packets, " << bvhBytes() / 1024 << " KB, built in " << bvh.build_ms << " ms" << std::endl;
+	}
+}
+
+const int OCCUPANCY_BUCKETS = 9;
+
+acceleration_report::acceleration_report()
+{
+	name = "";
+	depth = 0;
+	inner_nodes = 0;
+	leaves = 0;
+	references = 0;
+	shapes = 0;
+	cost = 0;
+	histogram.assign(OCCUPANCY_BUCKETS, 0);
+}
+
+int occupancyBucket(int shapes)
+{
+	int bucket = 0;
+	for (int limit = 1; shapes > limit / 2 && bucket < OCCUPANCY_BUCKETS - 1; limit *= 2)
+	{
+		bucket++;
+	}
+	return bucket;
+}
+
+void print_acceleration_report(const acceleration_report &report)
+{
+	const char *labels[OCCUPANCY_BUCKETS] = { "0", "1", "2", "3-4", "5-8", "9-16", "17-32", "33-64", "65+" };
+
+	std::cout << report.name << ": depth " << report.depth << ", " << report.inner_nodes << " inner nodes, " << report.leaves << " leaves" << std::endl;
+	std::cout << "	" << report.references << " shape references to " << report.shapes << " shapes, "
+		<< report.references - report.shapes << " duplicates (" << per(report.references, report.shapes) << " per shape)" << std::endl;
+	std::cout << "	shapes per leaf: " << per(report.references, report.leaves) << " average";
+	for (int i = 0; i < OCCUPANCY_BUCKETS; i++)
+	{
+		if (report.histogram.at(i) != 0)
+		{
+			std::cout << ", " << labels[i] << ": " << report.histogram.at(i);
+		}
+	}
+	std::cout << std::endl;
+	std::cout << "	SAH cost: " << report.cost << std::endl;
+}
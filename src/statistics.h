@@ -0,0 +1,83 @@
+#ifndef statistics_h
+#define statistics_h
+#include <vector>
+#include <atomic>
+
+// A counter only its own thread adds to, which others may read or reset while it does. Relaxed
+// loads and stores keep that free of data races without the cost of an atomic increment.
+struct statistics_counter
+{
+	std::atomic<unsigned long long> value;
+
+	statistics_counter() : value(0) {}
+	statistics_counter(const statistics_counter &other) : value(other.value.load(std::memory_order_relaxed)) {}
+
+	statistics_counter &operator=(const statistics_counter &other)
+	{
+		value.store(other.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		return *this;
+	}
+
+	statistics_counter &operator=(unsigned long long n)
+	{
+		value.store(n, std::memory_order_relaxed);
+		return *this;
+	}
+
+	void operator+=(unsigned long long n) { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+	void operator++(int) { *this += 1; }
+	operator unsigned long long() const { return value.load(std::memory_order_relaxed); }
+};
+
+// Counters collected while rendering. Every thread counts into its own copy,
+// print_statistics() adds them up, also while renders of other scenes go on.
+struct render_statistics
+{
+	statistics_counter rays; // rays that looked for their closest hit
+	statistics_counter node_visits;
+	statistics_counter box_tests;
+	statistics_counter hit_shape_tests;
+	statistics_counter shadow_rays;
+	statistics_counter shadow_rays_occluded;
+	statistics_counter shadow_shape_tests;
+	statistics_counter shadow_node_visits;
+	statistics_counter occluder_cache_tests;
+	statistics_counter occluder_cache_hits;
+	statistics_counter area_light_tests; // shading points that probed an area light
+	statistics_counter area_light_penumbrae; // of those, the ones whose probes disagreed
+	statistics_counter spot_lights_kept; // spot lights shaded at primary hits after tile culling
+	statistics_counter spot_lights_culled; // and the ones culled
+	statistics_counter shading_batches; // batches of hits on one material shaded together
+	statistics_counter batched_hits; // hits shaded in them
+};
+
+// The shape of an acceleration structure. The cost is the surface area heuristic: the expected
+// number of node visits and shape tests of a ray through the root box.
+struct acceleration_report
+{
+	const char *name;
+	int depth;
+	int inner_nodes;
+	int leaves;
+	long long references; // shapes in leaves, counting a shape once for every leaf it is in
+	int shapes; // different shapes in leaves
+	float cost;
+	std::vector<int> histogram; // leaves by shape count, see occupancyBucket()
+
+	acceleration_report();
+};
+
+render_statistics &thread_statistics();
+
+void reset_statistics();
+render_statistics total_statistics();
+void print_statistics();
+
+// count / rays, 0 without rays
+double per(unsigned long long count, unsigned long long rays);
+
+// 0, 1, 2, 3-4, 5-8, ..., 65 and more
+int occupancyBucket(int shapes);
+void print_acceleration_report(const acceleration_report &report);
+
+#endif
@@ -0,0 +1,208 @@
+#include "sweep.h"
+#include "checkpoint.h"
+#include "statistics.h"
+#include "offline.h"
+#include "scene.h"
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#endif
+
+struct sweep_result
+{
+	int shapes;
+	int planes;
+	double generate_ms;
+	double load_ms;
+	double build_ms;
+	double frame_ms;
+	double peak_mb;
+	render_statistics statistics;
+};
+
+#ifdef _WIN32
+
+void run_sweep(const scene_parameters &base, const std::string &name, double from, double to, int steps,
+	int width, int height, const std::string &output)
+{
+	std::cout << "Parameter sweeps measure every scene in a process of its own and are not available on Windows." << std::endl;
+}
+
+#else
+
+// runs in the child: everything from generating the scene to its first frame
+sweep_result measure_scene(const scene_parameters &parameters, int width, int height, const std::string &journal)
+{
+	sweep_result result = {};
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	json generated = generate_scene(parameters);
+	result.generate_ms = milliseconds_since(start);
+
+	start = std::chrono::steady_clock::now();
+	use_scene(std::move(generated), "");
+	loadShapes();
+	result.load_ms = milliseconds_since(start);
+
+	start = std::chrono::steady_clock::now();
+	buildAccelerationStructures();
+	result.build_ms = milliseconds_since(start);
+
+	result.shapes = current_scene->listOfShapes.size();
+	result.planes = current_scene->listOfPlanes.size();
+
+	reset_statistics();
+	start = std::chrono::steady_clock::now();
+	std::vector<colour3> pixels;
+	render_with_checkpoints(width, height, 1, journal, false, pixels);
+	result.frame_ms = milliseconds_since(start);
+	remove(journal.c_str());
+
+	result.statistics = total_statistics();
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	result.peak_mb = usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+	result.peak_mb = usage.ru_maxrss / 1024.0;
+#endif
+	return result;
+}
+
+bool run_measurement(const scene_parameters &parameters, int width, int height, const std::string &journal, sweep_result &result)
+{
+	int fds[2];
+	if (pipe(fds) != 0)
+	{
+		perror("pipe");
+		return false;
+	}
+
+	// whatever is still buffered would be written twice
+	std::cout.flush();
+
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		perror("fork");
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+
+	if (pid == 0)
+	{
+		// the messages of loading and building would break up the table
+		int null = open("/dev/null", O_WRONLY);
+		if (null >= 0)
+		{
+			dup2(null, STDOUT_FILENO);
+		}
+		close(fds[0]);
+
+		sweep_result measured = measure_scene(parameters, width, height, journal);
+		ssize_t written = write(fds[1], &measured, sizeof(measured));
+		_exit(written == sizeof(measured) ? 0 : 1);
+	}
+
+	close(fds[1]);
+
+	// the result fits in one pipe buffer, but a read can still come back short
+	size_t received = 0;
+	while (received < sizeof(result))
+	{
+		ssize_t n = read(fds[0], (char *)&result + received, sizeof(result) - received);
+		if (n <= 0)
+		{
+			break;
+		}
+		received += n;
+	}
+	close(fds[0]);
+
+	int status = 0;
+	waitpid(pid, &status, 0);
+	return received == sizeof(result) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void run_sweep(const scene_parameters &base, const std::string &name, double from, double to, int steps,
+	int width, int height, const std::string &output)
+{
+	steps = glm::max(steps, 1);
+	bool geometric = from > 0 && to > 0;
+
+	scene_parameters check = base;
+	if (!set_scene_parameter(check, name, "1"))
+	{
+		return;
+	}
+
+	std::ofstream csv(output + ".csv");
+	csv << name << ",shapes,planes,generate_ms,load_ms,build_ms,frame_ms,peak_mb,rays,node_visits_per_ray,box_tests_per_ray,"
+		"shape_tests_per_ray,shadow_rays,shadow_node_visits_per_ray,shadow_shape_tests_per_ray" << std::endl;
+
+	std::cout << std::setw(12) << name << std::setw(9) << "shapes" << std::setw(12) << "generate ms" << std::setw(9) << "load ms"
+		<< std::setw(9) << "build ms" << std::setw(9) << "frame ms" << std::setw(9) << "peak MB" << std::setw(11) << "nodes/ray"
+		<< std::setw(11) << "shapes/ray" << std::endl;
+
+	// every parameter but size is a count, which the scene takes as a whole number
+	bool count = name != "size";
+	bool applied = false;
+	double previous = 0.0;
+
+	for (int step = 0; step < steps; step++)
+	{
+		double f = steps == 1 ? 0.0 : (double)step / (steps - 1);
+		double value = geometric ? from * pow(to / from, f) : from + (to - from) * f;
+
+		if (count)
+		{
+			// the table has to show what was rendered, and a step that rounds to the same count would only repeat a row
+			value = floor(value + 0.5);
+			if (applied && value == previous)
+			{
+				continue;
+			}
+		}
+		applied = true;
+		previous = value;
+
+		char text[64];
+		snprintf(text, sizeof(text), count ? "%.0f" : "%.6f", value);
+
+		scene_parameters parameters = base;
+		set_scene_parameter(parameters, name, text);
+
+		sweep_result result;
+		if (!run_measurement(parameters, width, height, output + ".journal", result))
+		{
+			std::cout << std::setw(12) << value << " failed" << std::endl;
+			continue;
+		}
+
+		const render_statistics &s = result.statistics;
+		std::cout << std::setw(12) << value << std::fixed << std::setprecision(1) << std::setw(9) << result.shapes
+			<< std::setw(12) << result.generate_ms << std::setw(9) << result.load_ms << std::setw(9) << result.build_ms
+			<< std::setw(9) << result.frame_ms << std::setw(9) << result.peak_mb << std::setw(11) << per(s.node_visits, s.rays)
+			<< std::setw(11) << per(s.hit_shape_tests, s.rays) << std::defaultfloat << std::setprecision(6) << std::endl;
+
+		csv << value << "," << result.shapes << "," << result.planes << "," << result.generate_ms << "," << result.load_ms << ","
+			<< result.build_ms << "," << result.frame_ms << "," << result.peak_mb << "," << s.rays << ","
+			<< per(s.node_visits, s.rays) << "," << per(s.box_tests, s.rays) << "," << per(s.hit_shape_tests, s.rays) << ","
+			<< s.shadow_rays << "," << per(s.shadow_node_visits, s.shadow_rays) << "," << per(s.shadow_shape_tests, s.shadow_rays)
+			<< std::endl;
+	}
+
+	std::cout << "Sweep written to " << output << ".csv" << std::endl;
+}
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef sweep_h
+#define sweep_h
+#include "generator.h"
+
+// Generates and renders one scene per step while the parameter called name goes from
+// `from` to `to` (in equal ratios when both are positive, in equal steps otherwise), all
+// other parameters as in base. Counts are rounded to whole numbers, and a step that rounds to
+// the count of the one before is skipped. Every scene is measured in a process of its own, so that the
+// peak memory is that of the scene alone, and the table is written to <output>.csv as well.
+void run_sweep(const scene_parameters &base, const std::string &name, double from, double to, int steps,
+	int width, int height, const std::string &output);
+
+#endif
@@ -0,0 +1,331 @@
+#include "tiles.h"
+#include "gbuffer.h"
+#include "render.h"
+#include "statistics.h"
+#include "trace.h"
+#include "scene.h"
+#include "region.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+std::vector<colour3> framebuffer;
+int framebuffer_width = 0;
+int framebuffer_height = 0;
+
+// Coarse to fine, a pass traces one pixel of every block of its size and fills the block with it:
+// 1/16, 1/4, 1/2 and then all of the pixels. The blocks nest, so the pixel a pass traces in a block
+// is already there when a coarser pass traced it, and the rest of the block never was traced.
+struct preview_pass
+{
+	int block_width, block_height;
+};
+const preview_pass PREVIEW_PASSES[] = { { 4, 4 }, { 2, 2 }, { 1, 2 }, { 1, 1 } };
+const int PREVIEW_PASS_COUNT = sizeof(PREVIEW_PASSES) / sizeof(PREVIEW_PASSES[0]);
+
+bool coarse_to_fine = true;
+
+// every tile once per pass, all tiles of a pass before any of the next one
+std::vector<tile> tiles_to_render;
+int tiles_per_pass = 0;
+int pass_count = 1;
+std::atomic<int> next_tile(0);
+std::atomic<int> tiles_done(0);
+std::atomic<int> tiles_left(0);
+std::atomic<bool> cancel_render(false);
+bool relight_tiles = false;
+
+std::vector<std::thread> render_threads;
+
+// tiles that are done but not yet shown, the display takes them from here
+std::mutex finished_mutex;
+std::vector<tile> finished_tiles;
+// signalled, with finished_mutex, when tiles_done goes up or the render is cancelled
+std::condition_variable tile_finished;
+
+void render_pixel(int x, int y, colour3 &colour)
+{
+	bool antialiasing = false;
+	point3 e(0.0f, 0.0f, 0.0f);
+	colour = colour3(0, 0, 0);
+
+	if (relight_tiles)
+	{
+		point3 s = image_plane_point(x, y, framebuffer_width, framebuffer_height);
+		if (!relight(x, y, e, s, colour))
+		{
+			colour = current_scene->background_colour;
+		}
+	}
+	else if (!antialiasing)
+	{
+		point3 s = image_plane_point(x, y, framebuffer_width, framebuffer_height);
+		if (!trace(e, s, colour, gbuffer_at(x, y)))
+		{
+			colour = current_scene->background_colour;
+		}
+	}
+	else
+	{
+		float offsets[4][2] = { { 0.25f, 0.25f }, { 0.25f, 0.75f }, { 0.75f, 0.25f }, { 0.75f, 0.75f } };
+
+		for (int i = 0; i < 4; i++)
+		{
+			colour3 sample_colour(0, 0, 0);
+			point3 sample_e = e;
+			point3 s = image_plane_point(x + offsets[i][0], y + offsets[i][1], framebuffer_width, framebuffer_height);
+			if (!trace(sample_e, s, sample_colour))
+			{
+				sample_colour = current_scene->background_colour;
+			}
+			colour += sample_colour / 4.0f;
+		}
+	}
+}
+
+// the pixels of tile t that pass traces, each filling its block
+void render_tile_pass(const tile &t, int pass)
+{
+	int block_width = 1, block_height = 1;
+	int coarser_width = 0, coarser_height = 0;
+
+	if (pass_count > 1)
+	{
+		block_width = PREVIEW_PASSES[pass].block_width;
+		block_height = PREVIEW_PASSES[pass].block_height;
+		if (pass > 0)
+		{
+			coarser_width = PREVIEW_PASSES[pass - 1].block_width;
+			coarser_height = PREVIEW_PASSES[pass - 1].block_height;
+		}
+	}
+
+	for (int y = t.y; y < t.y + t.height; y += block_height)
+	{
+		// checked per row so that a restart does not wait for a whole tile
+		if (cancel_render)
+		{
+			return;
+		}
+		for (int x = t.x; x < t.x + t.width; x += block_width)
+		{
+			colour3 &colour = framebuffer.at(y * framebuffer_width + x);
+
+			// the tiles start on multiples of every block size, so x and y are counted from the frame
+			if (coarser_width == 0 || x % coarser_width != 0 || y % coarser_height != 0)
+			{
+				render_pixel(x, y, colour);
+			}
+
+			if (block_width == 1 && block_height == 1)
+			{
+				continue;
+			}
+			for (int j = y; j < glm::min(y + block_height, t.y + t.height); j++)
+			{
+				for (int i = x; i < glm::min(x + block_width, t.x + t.width); i++)
+				{
+					framebuffer.at(j * framebuffer_width + i) = colour;
+				}
+			}
+		}
+	}
+}
+
+// the pixels of t as the display shows them
+void copy_tile_pixels(tile &t)
+{
+	t.rgba.resize(t.width * t.height * 4);
+	unsigned char *data = t.rgba.data();
+
+	for (int y = t.y; y < t.y + t.height; y++)
+	{
+		for (int x = t.x; x < t.x + t.width; x++)
+		{
+			colour3 c = glm::clamp(framebuffer.at(y * framebuffer_width + x), 0.0f, 1.0f);
+			data[0] = (unsigned char)(c.r * 255.0f + 0.5f);
+			data[1] = (unsigned char)(c.g * 255.0f + 0.5f);
+			data[2] = (unsigned char)(c.b * 255.0f + 0.5f);
+			data[3] = 255;
+			data += 4;
+		}
+	}
+}
+
+void render_thread(Scene * scene)
+{
+	scene_scope bind(scene);
+	trace_thread_name("render");
+
+	while (!cancel_render)
+	{
+		int i = next_tile++;
+		if (i >= (int)tiles_to_render.size())
+		{
+			return;
+		}
+
+		// a pass fills pixels of the one before, which has to be done with the tile first
+		int pass = i / tiles_per_pass;
+		{
+			std::unique_lock<std::mutex> lock(finished_mutex);
+			while (tiles_done < pass * tiles_per_pass && !cancel_render)
+			{
+				tile_finished.wait(lock);
+			}
+		}
+		if (cancel_render)
+		{
+			return;
+		}
+
+		trace_scope scope(pass_count > 1 ? "render tile pass" : "render tile");
+		const tile &t = tiles_to_render.at(i);
+		render_tile_pass(t, pass);
+		if (cancel_render)
+		{
+			return;
+		}
+
+		// once tiles_done counts it, the next pass of the tile can start writing its pixels
+		{
+			std::lock_guard<std::mutex> lock(finished_mutex);
+			finished_tiles.push_back(t);
+			copy_tile_pixels(finished_tiles.back());
+			tiles_done++;
+		}
+		tile_finished.notify_all();
+		tiles_left--;
+	}
+}
+
+bool tile_changed(const tile &t, const std::vector<char> &changed)
+{
+	for (int y = t.y; y < t.y + t.height; y++)
+	{
+		for (int x = t.x; x < t.x + t.width; x++)
+		{
+			if (changed.at(y * framebuffer_width + x))
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// traces the image on background threads, one tile at a time; any render still running is cancelled first.
+// With changed, only the tiles with one of its pixels set are traced and the rest of the framebuffer stays.
+int start_tile_render(int width, int height, bool relighting, const std::vector<char> *changed)
+{
+	stop_tile_render();
+
+	if (width != framebuffer_width || height != framebuffer_height)
+	{
+		framebuffer.assign(width * height, colour3(0, 0, 0));
+		framebuffer_width = width;
+		framebuffer_height = height;
+	}
+
+	if (!relighting)
+	{
+		resize_gbuffer(width, height);
+	}
+	relight_tiles = relighting;
+
+	pixel_rect frame = { 0, 0, width, height };
+	std::vector<pixel_rect> frame_tiles;
+	split_into_tiles(frame, frame_tiles);
+
+	std::vector<tile> tiles;
+	for (int i = 0; i < frame_tiles.size(); i++)
+	{
+		tile t;
+		t.x = frame_tiles.at(i).x;
+		t.y = frame_tiles.at(i).y;
+		t.width = frame_tiles.at(i).width;
+		t.height = frame_tiles.at(i).height;
+
+		if (changed == NULL || tile_changed(t, *changed))
+		{
+			tiles.push_back(t);
+		}
+	}
+
+	pass_count = coarse_to_fine ? PREVIEW_PASS_COUNT : 1;
+	tiles_per_pass = tiles.size();
+	tiles_to_render.clear();
+	for (int pass = 0; pass < pass_count; pass++)
+	{
+		tiles_to_render.insert(tiles_to_render.end(), tiles.begin(), tiles.end());
+	}
+
+	next_tile = 0;
+	tiles_done = 0;
+	tiles_left = tiles_to_render.size();
+	reset_statistics();
+
+	int threads = std::thread::hardware_concurrency();
+	if (threads < 1)
+	{
+		threads = 1;
+	}
+	for (int i = 0; i < threads; i++)
+	{
+		render_threads.push_back(std::thread(render_thread, current_scene));
+	}
+	return tiles_per_pass;
+}
+
+// cancels the render, tiles that were not shown yet are dropped
+void stop_tile_render()
+{
+	{
+		std::lock_guard<std::mutex> lock(finished_mutex);
+		cancel_render = true;
+	}
+	tile_finished.notify_all();
+	finish_tile_render();
+	cancel_render = false;
+
+	std::lock_guard<std::mutex> lock(finished_mutex);
+	finished_tiles.clear();
+}
+
+// waits for the render threads, finished tiles stay until they are taken
+void finish_tile_render()
+{
+	for (int i = 0; i < render_threads.size(); i++)
+	{
+		render_threads.at(i).join();
+	}
+	render_threads.clear();
+}
+
+bool tile_render_running()
+{
+	return render_threads.size() != 0;
+}
+
+bool tile_render_finished()
+{
+	return tiles_left == 0;
+}
+
+int tile_render_passes_done()
+{
+	return tiles_per_pass > 0 ? tiles_done / tiles_per_pass : pass_count;
+}
+
+int tile_render_pass_count()
+{
+	return pass_count;
+}
+
+void take_finished_tiles(std::vector<tile> &tiles)
+{
+	std::lock_guard<std::mutex> lock(finished_mutex);
+	tiles.swap(finished_tiles);
+	finished_tiles.clear();
+}
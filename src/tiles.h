@@ -0,0 +1,33 @@
+#ifndef tiles_h
+#define tiles_h
+#include "raytracer.h"
+
+// a rectangle of the framebuffer, in pixels, bottom row first like the framebuffer
+struct tile
+{
+	int x, y;
+	int width, height;
+	std::vector<unsigned char> rgba; // of a finished tile, as it was when it finished
+};
+
+// what the render threads have traced so far, bottom row first
+extern std::vector<colour3> framebuffer;
+extern int framebuffer_width, framebuffer_height;
+
+// when set, the image is traced coarse to fine: 1/16, 1/4 and 1/2 of the pixels, each filling its
+// neighbours, before the last pass traces the rest
+extern bool coarse_to_fine;
+
+// changed, when given, has a flag per pixel and only the tiles with one set are traced again; returns the number of tiles
+int start_tile_render(int width, int height, bool relighting, const std::vector<char> *changed = NULL);
+void stop_tile_render();
+void finish_tile_render();
+
+bool tile_render_running();
+bool tile_render_finished();
+int tile_render_passes_done(); // passes that every tile has been through
+int tile_render_pass_count();
+// the next pass may already be tracing a tile that is taken, so only its rgba is to be shown
+void take_finished_tiles(std::vector<tile> &tiles);
+
+#endif
@@ -0,0 +1,202 @@
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+struct trace_event
+{
+	const char *name;
+	long long start; // nanoseconds since the program started
+	long long duration;
+};
+
+// a thread that had the buffer, from its first event on
+struct trace_owner
+{
+	unsigned long long first_event;
+	int id;
+	const char *thread_name;
+};
+
+struct trace_buffer
+{
+	trace_event events[TRACE_BUFFER_EVENTS];
+	std::atomic<unsigned long long> written; // events ever written, the newest is at (written - 1) % TRACE_BUFFER_EVENTS
+	std::atomic<bool> in_use;
+	std::vector<trace_owner> owners; // oldest first, the last one has the buffer now
+};
+
+bool tracing = false;
+std::string trace_file;
+
+const std::chrono::steady_clock::time_point trace_epoch = std::chrono::steady_clock::now();
+
+// only locked when a thread takes a buffer or names itself, never while marking
+std::mutex trace_buffers_mutex;
+std::vector<trace_buffer *> trace_buffers;
+int trace_threads = 0;
+
+long long trace_now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - trace_epoch).count();
+}
+
+// gives the buffer of a thread back when the thread exits
+struct trace_slot
+{
+	trace_buffer *buffer;
+
+	trace_slot()
+	{
+		buffer = NULL;
+	}
+
+	~trace_slot()
+	{
+		if (buffer != NULL)
+		{
+			buffer->in_use = false;
+		}
+	}
+};
+
+trace_buffer *thread_trace_buffer()
+{
+	static thread_local trace_slot slot;
+
+	if (slot.buffer == NULL)
+	{
+		std::lock_guard<std::mutex> lock(trace_buffers_mutex);
+
+		for (int i = 0; i < trace_buffers.size() && slot.buffer == NULL; i++)
+		{
+			if (!trace_buffers.at(i)->in_use)
+			{
+				slot.buffer = trace_buffers.at(i);
+			}
+		}
+
+		if (slot.buffer == NULL)
+		{
+			slot.buffer = new trace_buffer;
+			slot.buffer->written = 0;
+			trace_buffers.push_back(slot.buffer);
+		}
+		slot.buffer->in_use = true;
+
+		// owners whose events have all been overwritten are forgotten
+		std::vector<trace_owner> &owners = slot.buffer->owners;
+		unsigned long long written = slot.buffer->written.load(std::memory_order_relaxed);
+		while (owners.size() > 1 && owners.at(1).first_event + TRACE_BUFFER_EVENTS <= written)
+		{
+			owners.erase(owners.begin());
+		}
+
+		trace_owner owner = { written, ++trace_threads, "thread" };
+		owners.push_back(owner);
+	}
+	return slot.buffer;
+}
+
+trace_scope::trace_scope(const char *name)
+{
+	this->name = name;
+	start = tracing ? trace_now() : -1;
+}
+
+trace_scope::~trace_scope()
+{
+	if (start < 0)
+	{
+		return;
+	}
+
+	trace_buffer *buffer = thread_trace_buffer();
+	unsigned long long written = buffer->written.load(std::memory_order_relaxed);
+
+	trace_event &event = buffer->events[written % TRACE_BUFFER_EVENTS];
+	event.name = name;
+	event.start = start;
+	event.duration = trace_now() - start;
+
+	buffer->written.store(written + 1, std::memory_order_release);
+}
+
+void trace_thread_name(const char *name)
+{
+	if (tracing)
+	{
+		trace_buffer *buffer = thread_trace_buffer();
+		std::lock_guard<std::mutex> lock(trace_buffers_mutex);
+		buffer->owners.back().thread_name = name;
+	}
+}
+
+void write_trace_at_exit()
+{
+	write_trace(trace_file);
+}
+
+void start_tracing(const std::string &fn)
+{
+	if (!tracing)
+	{
+		atexit(write_trace_at_exit);
+	}
+	tracing = true;
+	trace_file = fn;
+	trace_thread_name("main");
+}
+
+bool write_trace(const std::string &fn)
+{
+	FILE *out = fopen(fn.c_str(), "w");
+	if (out == NULL)
+	{
+		std::cout << "Unable to write trace " << fn << std::endl;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(trace_buffers_mutex);
+	fprintf(out, "{\"traceEvents\":[\n");
+
+	bool first = true;
+	size_t count = 0;
+
+	for (int i = 0; i < trace_buffers.size(); i++)
+	{
+		const trace_buffer *buffer = trace_buffers.at(i);
+		unsigned long long written = buffer->written.load(std::memory_order_acquire);
+		unsigned long long oldest = written > TRACE_BUFFER_EVENTS ? written - TRACE_BUFFER_EVENTS : 0;
+
+		for (int o = 0; o < buffer->owners.size(); o++)
+		{
+			const trace_owner &owner = buffer->owners.at(o);
+			unsigned long long end = o + 1 < buffer->owners.size() ? buffer->owners.at(o + 1).first_event : written;
+
+			fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+				first ? "" : ",\n", owner.id, owner.thread_name, owner.id);
+			first = false;
+
+			// microseconds, which is what the format counts in
+			for (unsigned long long e = std::max(owner.first_event, oldest); e < end; e++)
+			{
+				const trace_event &event = buffer->events[e % TRACE_BUFFER_EVENTS];
+				fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+					event.name, owner.id, event.start / 1000.0, event.duration / 1000.0);
+				count++;
+			}
+		}
+	}
+
+	fprintf(out, "\n]}\n");
+	fclose(out);
+
+	std::cout << "Trace of " << count << " events written to " << fn << std::endl;
+	return true;
+}
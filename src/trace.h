@@ -0,0 +1,33 @@
+#ifndef trace_h
+#define trace_h
+#include <string>
+
+// A timeline of what every thread was doing, written in the trace event format of
+// chrome://tracing and https://ui.perfetto.dev. A trace_scope marks the lifetime of a
+// block; each thread keeps its events in a ring buffer of its own, so marking takes two
+// clock reads and a store, and only the newest TRACE_BUFFER_EVENTS events of a thread
+// are kept. Buffers of threads that have finished are handed to the next new thread,
+// whose events still show under an id and name of its own.
+struct trace_scope
+{
+	const char *name; // must outlive the trace, a string literal
+	long long start;
+
+	trace_scope(const char *name);
+	~trace_scope();
+};
+
+const int TRACE_BUFFER_EVENTS = 16384;
+
+extern bool tracing;
+
+// turns tracing on and writes the events to fn when the program exits
+void start_tracing(const std::string &fn);
+
+// the name the events of this thread are shown under
+void trace_thread_name(const char *name);
+
+// while the threads are quiet, a buffer being written to can show a half-written event
+bool write_trace(const std::string &fn);
+
+#endif
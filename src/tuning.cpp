@@ -0,0 +1,215 @@
+#include "tuning.h"
+#include "raytracer.h"
+#include "render.h"
+#include "statistics.h"
+#include "compact_octree.h"
+#include "bvh.h"
+#include "offline.h"
+#include "scene.h"
+#include <cfloat>
+
+void default_acceleration_settings(acceleration_settings &settings)
+{
+	settings.octree_max_leaf_size = 1;
+	settings.octree_max_depth = 64;
+	settings.octree_min_extent = 0.2f;
+	settings.bvh_max_leaf_size = 4;
+	settings.bvh_max_sphere_leaf_size = 8;
+}
+
+void current_acceleration_settings(acceleration_settings &settings)
+{
+	settings.octree_max_leaf_size = current_scene->octree_max_leaf_size;
+	settings.octree_max_depth = current_scene->octree_max_depth;
+	settings.octree_min_extent = current_scene->octree_min_extent;
+	settings.bvh_max_leaf_size = current_scene->bvh_max_leaf_size;
+	settings.bvh_max_sphere_leaf_size = current_scene->bvh_max_sphere_leaf_size;
+}
+
+void apply_acceleration_settings(const acceleration_settings &settings)
+{
+	current_scene->octree_max_leaf_size = settings.octree_max_leaf_size;
+	current_scene->octree_max_depth = settings.octree_max_depth;
+	current_scene->octree_min_extent = settings.octree_min_extent;
+	current_scene->bvh_max_leaf_size = settings.bvh_max_leaf_size;
+	current_scene->bvh_max_sphere_leaf_size = settings.bvh_max_sphere_leaf_size;
+}
+
+std::string settings_file(const std::string &scene_file)
+{
+	std::string name = scene_file;
+	if (name.size() >= 5 && name.compare(name.size() - 5, 5, ".json") == 0)
+	{
+		name.erase(name.size() - 5);
+	}
+	return name + ".accel.json";
+}
+
+void load_acceleration_settings(const std::string &scene_file)
+{
+	acceleration_settings settings;
+	default_acceleration_settings(settings);
+
+	std::ifstream in(settings_file(scene_file).c_str());
+	if (!scene_file.empty() && in.is_open())
+	{
+		// a truncated or hand edited file, or one with a field of the wrong type, leaves the defaults
+		try
+		{
+			json tuned;
+			in >> tuned;
+
+			acceleration_settings read = settings;
+			read.octree_max_leaf_size = tuned.value("octree_max_leaf_size", read.octree_max_leaf_size);
+			read.octree_max_depth = tuned.value("octree_max_depth", read.octree_max_depth);
+			read.octree_min_extent = tuned.value("octree_min_extent", read.octree_min_extent);
+			read.bvh_max_leaf_size = tuned.value("bvh_max_leaf_size", read.bvh_max_leaf_size);
+			read.bvh_max_sphere_leaf_size = tuned.value("bvh_max_sphere_leaf_size", read.bvh_max_sphere_leaf_size);
+			settings = read;
+
+			std::cout << "Using the acceleration settings in " << settings_file(scene_file) << std::endl;
+		}
+		catch (json::exception &error)
+		{
+			std::cout << "Unable to read " << settings_file(scene_file) << ", using the default acceleration settings: " << error.what() << std::endl;
+		}
+	}
+	apply_acceleration_settings(settings);
+}
+
+void save_acceleration_settings(const std::string &scene_file, const acceleration_settings &settings)
+{
+	json tuned;
+	tuned["octree_max_leaf_size"] = settings.octree_max_leaf_size;
+	tuned["octree_max_depth"] = settings.octree_max_depth;
+	tuned["octree_min_extent"] = settings.octree_min_extent;
+	tuned["bvh_max_leaf_size"] = settings.bvh_max_leaf_size;
+	tuned["bvh_max_sphere_leaf_size"] = settings.bvh_max_sphere_leaf_size;
+
+	std::ofstream out(settings_file(scene_file).c_str());
+	out << tuned.dump(1, '\t') << std::endl;
+
+	if (!out)
+	{
+		std::cout << "Unable to write " << settings_file(scene_file) << std::endl;
+		return;
+	}
+	std::cout << "Settings written to " << settings_file(scene_file) << std::endl;
+}
+
+void print_acceleration_reports()
+{
+	acceleration_report report;
+	reportOcTree(report);
+	print_acceleration_report(report);
+
+	if (current_scene->bvh.ready)
+	{
+		reportBVH(report);
+		print_acceleration_report(report);
+	}
+}
+
+// only the structure that is tuned, the compact octree points into the Node tree and goes with it
+double rebuild_acceleration_structure()
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	if (acceleration_structure == ACCELERATION_BVH)
+	{
+		buildBVH();
+	}
+	else
+	{
+		current_scene->compact.ready = false;
+		deleteOcTree(current_scene->ocTree_root);
+		buildOcTree();
+		buildCompactOctree();
+	}
+	return milliseconds_since(start);
+}
+
+void tune_acceleration(const std::string &scene_file, int probe_size, int width, int height)
+{
+	acceleration_settings base;
+	current_acceleration_settings(base);
+
+	std::vector<acceleration_settings> candidates;
+	int leaf_sizes[] = { 1, 2, 4, 8 };
+
+	for (int i = 0; i < 4; i++)
+	{
+		if (acceleration_structure == ACCELERATION_BVH)
+		{
+			int sphere_leaf_sizes[] = { 8, 16, 32 };
+			for (int k = 0; k < 3; k++)
+			{
+				acceleration_settings candidate = base;
+				candidate.bvh_max_leaf_size = leaf_sizes[i];
+				candidate.bvh_max_sphere_leaf_size = sphere_leaf_sizes[k];
+				candidates.push_back(candidate);
+			}
+		}
+		else
+		{
+			float min_extents[] = { 0.05f, 0.2f, 0.8f };
+			for (int k = 0; k < 3; k++)
+			{
+				acceleration_settings candidate = base;
+				candidate.octree_max_leaf_size = leaf_sizes[i];
+				candidate.octree_min_extent = min_extents[k];
+				candidates.push_back(candidate);
+			}
+		}
+	}
+
+	// the probe stands for the whole frame, its render time is scaled up to it
+	double scale = (double)width * height / (probe_size * probe_size);
+	int best = -1;
+	double best_ms = DBL_MAX;
+	std::vector<colour3> pixels;
+
+	for (int i = 0; i < candidates.size(); i++)
+	{
+		apply_acceleration_settings(candidates.at(i));
+
+		std::streambuf *output = std::cout.rdbuf(NULL);
+		double build_ms = rebuild_acceleration_structure();
+
+		// the fastest of three, the first one also warms the caches
+		double render_ms = DBL_MAX;
+		for (int run = 0; run < 3; run++)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			render_image(probe_size, probe_size, pixels);
+			render_ms = glm::min(render_ms, milliseconds_since(start));
+		}
+		std::cout.rdbuf(output);
+
+		double frame_ms = build_ms + render_ms * scale;
+		if (acceleration_structure == ACCELERATION_BVH)
+		{
+			std::cout << "BVH leaves of " << candidates.at(i).bvh_max_leaf_size << " shapes or " << candidates.at(i).bvh_max_sphere_leaf_size << " spheres";
+		}
+		else
+		{
+			std::cout << "Octree leaves of " << candidates.at(i).octree_max_leaf_size << " shapes, " << candidates.at(i).octree_min_extent << " wide";
+		}
+		std::cout << ": build " << build_ms << " ms, probe " << render_ms << " ms, frame about " << frame_ms << " ms" << std::endl;
+
+		if (frame_ms < best_ms)
+		{
+			best = i;
+			best_ms = frame_ms;
+		}
+	}
+
+	apply_acceleration_settings(candidates.at(best));
+	std::streambuf *output = std::cout.rdbuf(NULL);
+	rebuild_acceleration_structure();
+	std::cout.rdbuf(output);
+
+	std::cout << "Fastest:" << std::endl;
+	print_acceleration_reports();
+	save_acceleration_settings(scene_file, candidates.at(best));
+}
@@ -0,0 +1,31 @@
+#ifndef tuning_h
+#define tuning_h
+#include <string>
+
+// The parameters the octree and the BVH are built with. They can be tuned per scene and are
+// then kept next to it, scenes/<name>.accel.json for scenes/<name>.json, and used whenever
+// the scene is loaded.
+struct acceleration_settings
+{
+	int octree_max_leaf_size;
+	int octree_max_depth;
+	float octree_min_extent;
+	int bvh_max_leaf_size;
+	int bvh_max_sphere_leaf_size;
+};
+
+void default_acceleration_settings(acceleration_settings &settings);
+void apply_acceleration_settings(const acceleration_settings &settings);
+
+// the tuned settings of the scene in scene_file, or the defaults when it has none
+void load_acceleration_settings(const std::string &scene_file);
+
+// depth, nodes, leaf occupancy, duplicates and SAH cost of the octree and the BVH as built
+void print_acceleration_reports();
+
+// Builds the acceleration structure in use with every candidate setting, renders a
+// probe_size x probe_size image with each, and keeps the one that gives the fastest
+// width x height frame, build included. The choice is written next to the scene.
+void tune_acceleration(const std::string &scene_file, int probe_size, int width, int height);
+
+#endif
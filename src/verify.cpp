@@ -0,0 +1,255 @@
+#include "verify.h"
+#include "raytracer.h"
+#include "render.h"
+#include "checkpoint.h"
+#include "compact_octree.h"
+#include "bvh.h"
+#include "offline.h"
+#include "scene.h"
+#include "batch_shading.h"
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+// how many levels of colour batched shading may be off by, see batch_shading.h
+const int BATCHED_SHADING_LEVELS = 1;
+
+struct render_path
+{
+	const char *name;
+	bool compact_octree;
+	bool bvh;
+};
+
+struct image_difference
+{
+	int pixels_over; // pixels with a channel further from the reference than the tolerance
+	long long max_distance; // in ULPs for floats, in levels for bytes
+	double psnr;
+};
+
+// floats as integers that grow with the float, so that neighbouring floats are one apart
+long long ordered_bits(float f)
+{
+	int i;
+	memcpy(&i, &f, sizeof(i));
+	return i < 0 ? (long long)INT_MIN - i : i;
+}
+
+long long ulp_distance(float a, float b)
+{
+	if (a != a || b != b)
+	{
+		return (a != a && b != b) ? 0 : LLONG_MAX;
+	}
+	return glm::abs(ordered_bits(a) - ordered_bits(b));
+}
+
+double psnr_of(double squared_error, long long channels)
+{
+	return squared_error == 0 ? INFINITY : 10.0 * log10(channels / squared_error);
+}
+
+// black where the pixels are the same, blue within the tolerance, red beyond it, brighter the further off
+image_difference compare_images(const std::vector<colour3> &reference, const std::vector<colour3> &pixels, int max_ulp,
+	std::vector<colour3> &diff)
+{
+	image_difference difference = { 0, 0, 0 };
+	double squared_error = 0;
+	diff.assign(pixels.size(), colour3(0, 0, 0));
+
+	for (int i = 0; i < pixels.size(); i++)
+	{
+		long long distance = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			distance = glm::max(distance, ulp_distance(reference.at(i)[c], pixels.at(i)[c]));
+
+			double error = glm::clamp(reference.at(i)[c], 0.0f, 1.0f) - glm::clamp(pixels.at(i)[c], 0.0f, 1.0f);
+			squared_error += error * error;
+		}
+		difference.max_distance = glm::max(difference.max_distance, distance);
+
+		if (distance > max_ulp)
+		{
+			difference.pixels_over++;
+			diff.at(i) = colour3(glm::min(0.25f + (float)log2((double)distance) / 32.0f, 1.0f), 0, 0);
+		}
+		else if (distance > 0)
+		{
+			diff.at(i) = colour3(0, 0, 0.5f);
+		}
+	}
+
+	difference.psnr = psnr_of(squared_error, (long long)pixels.size() * 3);
+	return difference;
+}
+
+image_difference compare_bytes(const std::vector<unsigned char> &reference, const std::vector<unsigned char> &rgb)
+{
+	image_difference difference = { 0, 0, 0 };
+	double squared_error = 0;
+
+	for (int i = 0; i < rgb.size(); i += 3)
+	{
+		long long distance = 0;
+		for (int c = i; c < i + 3; c++)
+		{
+			double error = (reference.at(c) - rgb.at(c)) / 255.0;
+			squared_error += error * error;
+			distance = glm::max(distance, (long long)glm::abs(reference.at(c) - rgb.at(c)));
+		}
+		difference.max_distance = glm::max(difference.max_distance, distance);
+		difference.pixels_over += distance > 0;
+	}
+
+	difference.psnr = psnr_of(squared_error, rgb.size());
+	return difference;
+}
+
+bool matches(const image_difference &difference, double min_psnr)
+{
+	return difference.pixels_over == 0 || (min_psnr > 0 && difference.psnr >= min_psnr);
+}
+
+bool verify_render(const std::string &scene_name, int width, int height, int samples, int max_ulp, double min_psnr,
+	const std::string &output, bool update_golden)
+{
+	bool built_compact_octree = current_scene->compact.ready;
+	bool built_bvh = current_scene->bvh.ready;
+	bool passed = true;
+
+	std::cout << "Verifying " << scene_name << " at " << width << "x" << height << ", " << samples << " samples per pixel" << std::endl;
+
+	current_scene->compact.ready = false;
+	current_scene->bvh.ready = false;
+	int probes = area_light_probes;
+	area_light_probes = 0;
+
+	// the paths are compared bit for bit, the approximations of batched shading with the last of them after that
+	bool batched = batched_shading;
+	batched_shading = false;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<colour3> reference;
+	render_reference(width, height, samples, reference);
+	std::cout << "	reference: " << milliseconds_since(start) << " ms" << std::endl;
+	area_light_probes = probes;
+
+	render_path paths[] = { { "octree", true, false }, { "bvh", true, true } };
+	std::string journal = output + "_verify.journal";
+	std::vector<colour3> pixels;
+	const char *last_path = "reference";
+
+	for (int p = 0; p < 2; p++)
+	{
+		if ((paths[p].compact_octree && !built_compact_octree) || (paths[p].bvh && !built_bvh))
+		{
+			std::cout << "	" << paths[p].name << ": not built, skipped" << std::endl;
+			continue;
+		}
+		current_scene->compact.ready = paths[p].compact_octree;
+		current_scene->bvh.ready = paths[p].bvh;
+
+		start = std::chrono::steady_clock::now();
+		render_with_checkpoints(width, height, samples, journal, false, pixels);
+		double render_ms = milliseconds_since(start);
+		last_path = paths[p].name;
+
+		std::vector<colour3> diff;
+		image_difference difference = compare_images(reference, pixels, max_ulp, diff);
+		write_ppm(output + "_" + paths[p].name + "_diff.ppm", width, height, diff);
+
+		bool match = matches(difference, min_psnr);
+		passed = passed && match;
+
+		std::cout << "	" << paths[p].name << ": " << render_ms << " ms, " << difference.pixels_over << " pixels over "
+			<< max_ulp << " ULP, at most " << difference.max_distance << " ULP, PSNR " << difference.psnr << " dB, "
+			<< (match ? "matches" : "DIFFERS") << std::endl;
+	}
+
+	std::vector<colour3> exact = pixels;
+	if (batched && pixels.size() != 0)
+	{
+		batched_shading = true;
+		start = std::chrono::steady_clock::now();
+		render_with_checkpoints(width, height, samples, journal, false, pixels);
+		double render_ms = milliseconds_since(start);
+		const char *exact_path = last_path;
+		last_path = "batched shading";
+
+		// against the same path shading hit by hit, so that only the batching is measured
+		std::vector<unsigned char> exact_rgb;
+		std::vector<unsigned char> rgb;
+		ppm_bytes(width, height, exact, exact_rgb);
+		ppm_bytes(width, height, pixels, rgb);
+		image_difference difference = compare_bytes(exact_rgb, rgb);
+
+		bool match = difference.max_distance <= BATCHED_SHADING_LEVELS;
+		passed = passed && match;
+
+		std::cout << "	" << last_path << ": " << render_ms << " ms, " << difference.pixels_over << " pixels differ from "
+			<< exact_path << ", by at most " << difference.max_distance << " levels, PSNR " << difference.psnr << " dB, " << (match ? "matches" : "DIFFERS") << std::endl;
+	}
+
+	// the tiles go to the threads in a different order every time, the pixels must not notice
+	if (pixels.size() != 0)
+	{
+		std::vector<colour3> again;
+		render_with_checkpoints(width, height, samples, journal, false, again);
+		bool identical = memcmp(pixels.data(), again.data(), pixels.size() * sizeof(colour3)) == 0;
+		passed = passed && identical;
+
+		std::cout << "	" << last_path << " again: " << (identical ? "bitwise identical" : "DIFFERS") << std::endl;
+	}
+	else
+	{
+		exact = reference;
+	}
+	remove(journal.c_str());
+	pixels = exact;
+
+	current_scene->compact.ready = built_compact_octree;
+	current_scene->bvh.ready = built_bvh;
+	batched_shading = batched;
+
+	std::string golden = PATH + std::string("golden/") + scene_name + ".ppm";
+	if (update_golden)
+	{
+		if (write_ppm(golden, width, height, reference))
+		{
+			std::cout << "	reference written to " << golden << std::endl;
+		}
+	}
+	else
+	{
+		int golden_width, golden_height;
+		std::vector<unsigned char> golden_rgb;
+		std::vector<unsigned char> rgb;
+
+		if (!read_ppm(golden, golden_width, golden_height, golden_rgb))
+		{
+			std::cout << "	no golden image at " << golden << std::endl;
+		}
+		else if (golden_width != width || golden_height != height)
+		{
+			std::cout << "	" << golden << " is " << golden_width << "x" << golden_height << ", render with -size "
+				<< golden_width << " " << golden_height << " to compare with it" << std::endl;
+		}
+		else
+		{
+			ppm_bytes(width, height, pixels, rgb);
+			image_difference difference = compare_bytes(golden_rgb, rgb);
+
+			bool match = matches(difference, min_psnr);
+			passed = passed && match;
+
+			std::cout << "	" << golden << ": " << difference.pixels_over << " pixels differ, by at most " << difference.max_distance
+				<< " levels, PSNR " << difference.psnr << " dB, " << (match ? "matches" : "DIFFERS") << std::endl;
+		}
+	}
+
+	std::cout << (passed ? "Verification passed" : "Verification FAILED") << std::endl;
+	return passed;
+}
@@ -0,0 +1,21 @@
+#ifndef verify_h
+#define verify_h
+#include <string>
+
+// Renders the loaded scene with the reference path (the octree Node tree, tested shape by
+// shape on one thread, with a shadow ray to every sample of an area light) and with every
+// optimised path that was built (the compact octree and the BVH, on all cores), and compares
+// each with the reference pixel by pixel. A pixel matches when none of its channels is more
+// than max_ulp floats away from the reference; a path matches when all pixels do, or when
+// its PSNR is at least min_psnr (0 turns that off). The last path is rendered twice to
+// check that threads do not change a single bit. A diff image is written to
+// <output>_<path>_diff.ppm for every path. These paths shade every hit on its own; the last
+// one is then rendered with batched shading, which must be within one level of colour of the
+// reference (see batch_shading.h), and that is the render that is repeated.
+//
+// The fastest path is also compared with scenes/golden/<scene>.ppm when that has the same
+// size; update_golden writes the reference render there instead.
+bool verify_render(const std::string &scene_name, int width, int height, int samples, int max_ulp, double min_psnr,
+	const std::string &output, bool update_golden);
+
+#endif
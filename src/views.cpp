@@ -0,0 +1,158 @@
+#include "views.h"
+#include "render.h"
+#include "trace.h"
+#include "light_culling.h"
+#include "scene.h"
+#include <cmath>
+
+glm::vec3 json_vec3(json &value)
+{
+	std::vector<float> v = value;
+	return glm::vec3(v.at(0), v.at(1), v.at(2));
+}
+
+void load_views(std::vector<view_camera> &views)
+{
+	views.clear();
+
+	view_camera single;
+	single.name = "view";
+	single.field = current_scene->fov;
+	single.position = glm::vec3(0.0f, 0.0f, 0.0f);
+	single.right = glm::vec3(1.0f, 0.0f, 0.0f);
+	single.up = glm::vec3(0.0f, 1.0f, 0.0f);
+	single.back = glm::vec3(0.0f, 0.0f, 1.0f);
+
+	if (current_scene->scene.find("cameras") == current_scene->scene.end())
+	{
+		views.push_back(single);
+		return;
+	}
+
+	json &cameras = current_scene->scene["cameras"];
+	for (json::iterator it = cameras.begin(); it != cameras.end(); ++it)
+	{
+		json &camera = *it;
+		view_camera view = single;
+
+		view.name = camera.value("name", "view" + std::to_string(views.size()));
+		view.field = camera.value("field", current_scene->fov);
+
+		if (camera.find("position") != camera.end())
+		{
+			view.position = json_vec3(camera["position"]);
+		}
+
+		glm::vec3 look_at = view.position - view.back;
+		glm::vec3 up = view.up;
+		if (camera.find("lookAt") != camera.end())
+		{
+			look_at = json_vec3(camera["lookAt"]);
+		}
+		if (camera.find("up") != camera.end())
+		{
+			up = json_vec3(camera["up"]);
+		}
+
+		// the camera looks down its -z, so back points from what it looks at to the camera;
+		// without a direction, or with up along it, there is no image plane and every ray would be NaN
+		glm::vec3 back = view.position - look_at;
+		if (glm::length(back) < 1e-6f)
+		{
+			std::cout << "Ignoring camera " << view.name << ", it looks at its own position" << std::endl;
+			continue;
+		}
+		glm::vec3 right = glm::cross(up, back);
+		if (glm::length(right) <= 1e-6f * glm::length(up) * glm::length(back))
+		{
+			std::cout << "Ignoring camera " << view.name << ", its up is parallel to the direction it looks in" << std::endl;
+			continue;
+		}
+		view.back = glm::normalize(back);
+		view.right = glm::normalize(right);
+		view.up = glm::cross(view.back, view.right);
+		views.push_back(view);
+
+		std::cout << "Camera " << view.name << " at " << glm::to_string(view.position) << " looking at " << glm::to_string(look_at)
+			<< ", field " << view.field << std::endl;
+	}
+
+	if (views.size() == 0)
+	{
+		std::cout << "No usable camera in \"cameras\", using the one of \"camera\"" << std::endl;
+		views.push_back(single);
+	}
+}
+
+void render_view_rect(const view_camera &view, const pixel_rect &rect, int image_width, int image_height, int samples,
+	colour3 *pixels, int stride)
+{
+	render_rect_culled(&view, rect, image_width, image_height, samples, NULL, pixels, stride);
+}
+
+// what the render threads share
+struct view_render
+{
+	const std::vector<view_camera> *views;
+	int width, height;
+	int samples;
+	std::vector<pixel_rect> tiles; // of one view, every view has the same
+	std::vector<std::vector<colour3> > *images;
+};
+
+void render_view_tile(void *job, int index)
+{
+	view_render *render = (view_render *)job;
+	trace_scope scope("render tile");
+	int view = index / render->tiles.size();
+	const pixel_rect &t = render->tiles.at(index % render->tiles.size());
+	render_view_rect(render->views->at(view), t, render->width, render->height, render->samples,
+		&render->images->at(view).at(t.y * render->width + t.x), render->width);
+}
+
+void render_views(const std::vector<view_camera> &views, int width, int height, int samples,
+	std::vector<std::vector<colour3> > &images)
+{
+	images.assign(views.size(), std::vector<colour3>(width * height, colour3(0, 0, 0)));
+
+	view_render render;
+	render.views = &views;
+	render.width = width;
+	render.height = height;
+	render.samples = samples;
+	render.images = &images;
+
+	pixel_rect frame = { 0, 0, width, height };
+	split_into_tiles(frame, render.tiles);
+
+	// the tiles of all views in one run, view by view, so the threads move on to the next view together
+	render_tiles(current_scene, views.size() * render.tiles.size(), render_view_tile, &render);
+}
+
+void contact_sheet(const std::vector<std::vector<colour3> > &images, int width, int height,
+	int &sheet_width, int &sheet_height, std::vector<colour3> &sheet)
+{
+	const int gap = 4;
+	int count = images.size();
+	int columns = glm::max((int)ceil(sqrt((double)count)), 1);
+	int rows = glm::max((count + columns - 1) / columns, 1);
+
+	sheet_width = columns * width + (columns - 1) * gap;
+	sheet_height = rows * height + (rows - 1) * gap;
+	sheet.assign(sheet_width * sheet_height, current_scene->background_colour);
+
+	// the first image at the top left, the rows of the sheet are stored bottom first like the images
+	for (int i = 0; i < count; i++)
+	{
+		int left = (i % columns) * (width + gap);
+		int bottom = (rows - 1 - i / columns) * (height + gap);
+
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				sheet.at((bottom + y) * sheet_width + left + x) = images.at(i).at(y * width + x);
+			}
+		}
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef views_h
+#define views_h
+#include "raytracer.h"
+#include "region.h"
+
+// One of the "cameras" of a scene file:
+//
+//   { "name": "left", "field": 60, "position": [-0.03, 0, 0], "lookAt": [0, 0, -1], "up": [0, 1, 0] }
+//
+// All fields are optional. The field of view defaults to that of the scene's "camera", the
+// position to the origin and the camera looks down -z with y up, like the single camera.
+struct view_camera
+{
+	std::string name;
+	double field;
+	glm::vec3 position;
+	glm::vec3 right, up, back; // the camera's x, y and z in the scene
+};
+
+// the cameras of the loaded scene, or just the one of "camera" when it has no "cameras"; a camera
+// that looks at its own position or whose up is parallel to where it looks is left out with a message
+void load_views(std::vector<view_camera> &views);
+
+// renders rect of view at image_width x image_height into pixels, laid out as render_rect() does
+void render_view_rect(const view_camera &view, const pixel_rect &rect, int image_width, int image_height, int samples,
+	colour3 *pixels, int stride);
+
+// Renders every view at width x height on all cores, one image per view into images. The
+// tiles of all views are handed out from one list, so views share the threads as well as the
+// scene, its acceleration structures and its materials.
+void render_views(const std::vector<view_camera> &views, int width, int height, int samples,
+	std::vector<std::vector<colour3> > &images);
+
+// the images side by side in rows, as near to square as they go, with the background between
+void contact_sheet(const std::vector<std::vector<colour3> > &images, int width, int height,
+	int &sheet_width, int &sheet_height, std::vector<colour3> &sheet);
+
+#endif